@@ -0,0 +1,59 @@
+#include "AbletonLinkTimebase.h"
+#include "MidiTime.h"
+#include <ableton/Link.hpp>
+#include <chrono>
+
+AbletonLinkTimebase::AbletonLinkTimebase(double bpm)
+    : m_link(new ableton::Link(bpm))
+{
+    m_link->enableStartStopSync(true);
+    m_link->enable(true);
+}
+
+AbletonLinkTimebase::~AbletonLinkTimebase() {
+    m_link->enable(false);
+}
+
+qint64 AbletonLinkTimebase::hostOffsetNs() const {
+    // Both clocks are monotonic; measured each time, so their rates
+    // never have to agree for long
+    const qint64 hostNs = m_link->clock().micros().count() * 1000;
+    return MidiTime::nowNanoseconds() - hostNs;
+}
+
+LinkTimeline AbletonLinkTimebase::capture() const {
+    // The audio-thread capture: lock-free, for the one timing thread
+    const ableton::Link::SessionState state = m_link->captureAudioSessionState();
+    const std::chrono::microseconds hostNow = m_link->clock().micros();
+    const qint64 nowNs = MidiTime::nowNanoseconds();
+    
+    LinkTimeline timeline;
+    timeline.bpm = state.tempo();
+    timeline.referenceBeat = state.beatAtTime(hostNow, QUANTUM);
+    timeline.referenceNs = nowNs;
+    timeline.playing = state.isPlaying();
+    timeline.peers = static_cast<int>(m_link->numPeers());
+    return timeline;
+}
+
+void AbletonLinkTimebase::commitTempo(double bpm, qint64 atNs) {
+    const std::chrono::microseconds hostAt((atNs - hostOffsetNs()) / 1000);
+    ableton::Link::SessionState state = m_link->captureAppSessionState();
+    state.setTempo(bpm, hostAt);
+    m_link->commitAppSessionState(state);
+}
+
+void AbletonLinkTimebase::commitStart(double beat, qint64 atNs) {
+    const std::chrono::microseconds hostAt((atNs - hostOffsetNs()) / 1000);
+    ableton::Link::SessionState state = m_link->captureAppSessionState();
+    state.forceBeatAtTime(beat, hostAt, QUANTUM);
+    state.setIsPlaying(true, hostAt);
+    m_link->commitAppSessionState(state);
+}
+
+void AbletonLinkTimebase::commitStop(qint64 atNs) {
+    const std::chrono::microseconds hostAt((atNs - hostOffsetNs()) / 1000);
+    ableton::Link::SessionState state = m_link->captureAppSessionState();
+    state.setIsPlaying(false, hostAt);
+    m_link->commitAppSessionState(state);
+}
@@ -0,0 +1,34 @@
+#ifndef ABLETONLINKTIMEBASE_H
+#define ABLETONLINKTIMEBASE_H
+
+#include <memory>
+#include "LinkTimebase.h"
+
+namespace ableton {
+class Link;
+}
+
+// LinkTimebase on an Ableton Link session (built with
+// MIDIMASTER2_ENABLE_LINK). Link's host clock is mapped onto MidiTime
+// at every capture and commit, so timelines are in the same nanoseconds
+// as MIDI arrival timestamps and clock generator deadlines. Peers are
+// joined from construction; start/stop sync is on.
+class AbletonLinkTimebase : public LinkTimebase {
+public:
+    explicit AbletonLinkTimebase(double bpm = 120.0);
+    ~AbletonLinkTimebase();
+
+    LinkTimeline capture() const override;
+    void commitTempo(double bpm, qint64 atNs) override;
+    // Forces the beat on every peer (publishing means this app leads)
+    void commitStart(double beat, qint64 atNs) override;
+    void commitStop(qint64 atNs) override;
+
+private:
+    // MidiTime nanoseconds minus Link host time
+    qint64 hostOffsetNs() const;
+
+    std::unique_ptr<ableton::Link> m_link;
+};
+
+#endif // ABLETONLINKTIMEBASE_H
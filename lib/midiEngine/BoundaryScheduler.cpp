@@ -0,0 +1,286 @@
+#include "BoundaryScheduler.h"
+#include "RealtimeScheduling.h"
+
+BoundaryScheduler::BoundaryScheduler(QObject *parent)
+    : QThread(parent)
+    , m_clock(SystemClockSource::instance())
+    , m_latenessHistogram(nullptr)
+    , m_armed(false)
+    , m_armToken(0)
+    , m_fireAtNs(0)
+    , m_boundaryTimeNs(0)
+    , m_generation(0)
+    , m_firesInProgress(0)
+    , m_stopRequested(false)
+    , m_firedCount(0)
+    , m_rescheduledCount(0)
+    , m_cancelledCount(0)
+    , m_maxLateNs(0)
+    , m_maxEarlyNs(0)
+{
+    setObjectName("BoundaryScheduler");
+    for (std::atomic<quint64> &count : m_histogram) {
+        count.store(0);
+    }
+}
+
+BoundaryScheduler::~BoundaryScheduler() {
+    stopScheduler();
+}
+
+void BoundaryScheduler::setFireCallback(FireCallback callback) {
+    m_fireCallback = std::move(callback);
+}
+
+void BoundaryScheduler::setClockSource(const ClockSource *clock) {
+    m_clock = clock ? clock : SystemClockSource::instance();
+}
+
+void BoundaryScheduler::setLatenessHistogram(LatencyHistogram *histogram) {
+    m_latenessHistogram = histogram;
+}
+
+void BoundaryScheduler::startScheduler() {
+    stopScheduler();
+    m_stopRequested.store(false, std::memory_order_release);
+    start(QThread::TimeCriticalPriority);
+}
+
+void BoundaryScheduler::stopScheduler() {
+    if (!isRunning()) {
+        return;
+    }
+    m_stopRequested.store(true, std::memory_order_release);
+    wake();
+    wait();
+}
+
+quint32 BoundaryScheduler::arm(qint64 fireAtNs, qint64 boundaryTimeNs) {
+    quint32 token;
+    {
+        std::lock_guard<WriterLock> guard(m_pendingLock);
+        m_armed = true;
+        m_fireAtNs = fireAtNs;
+        m_boundaryTimeNs = boundaryTimeNs;
+        token = ++m_armToken;
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+    wake();
+    return token;
+}
+
+bool BoundaryScheduler::reschedule(quint32 token, qint64 fireAtNs, qint64 boundaryTimeNs) {
+    {
+        std::lock_guard<WriterLock> guard(m_pendingLock);
+        if (!m_armed || m_armToken != token) {
+            return false;
+        }
+        m_fireAtNs = fireAtNs;
+        m_boundaryTimeNs = boundaryTimeNs;
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+    m_rescheduledCount.fetch_add(1, std::memory_order_relaxed);
+    wake();
+    return true;
+}
+
+bool BoundaryScheduler::fireNow(quint32 token) {
+    qint64 fireAtNs;
+    qint64 boundaryTimeNs;
+    {
+        std::lock_guard<WriterLock> guard(m_pendingLock);
+        if (!m_armed || m_armToken != token) {
+            return false;
+        }
+        m_armed = false;
+        fireAtNs = m_fireAtNs;
+        boundaryTimeNs = m_boundaryTimeNs;
+        m_firesInProgress.fetch_add(1, std::memory_order_acq_rel);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+    wake();
+    fire(fireAtNs, boundaryTimeNs);
+    return true;
+}
+
+bool BoundaryScheduler::cancel() {
+    bool wasArmed;
+    {
+        std::lock_guard<WriterLock> guard(m_pendingLock);
+        wasArmed = m_armed;
+        m_armed = false;
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+    if (wasArmed) {
+        m_cancelledCount.fetch_add(1, std::memory_order_relaxed);
+        wake();
+    }
+    // A fire claimed before the lock was taken is past the point of
+    // cancelling: let its callback finish (it only queues the note)
+    while (m_firesInProgress.load(std::memory_order_acquire) > 0) {
+        QThread::yieldCurrentThread();
+    }
+    return wasArmed;
+}
+
+qint64 BoundaryScheduler::pendingDeadline() const {
+    std::lock_guard<WriterLock> guard(m_pendingLock);
+    return m_armed ? m_fireAtNs : 0;
+}
+
+bool BoundaryScheduler::fireDue() {
+    qint64 fireAtNs;
+    qint64 boundaryTimeNs;
+    {
+        std::lock_guard<WriterLock> guard(m_pendingLock);
+        if (!m_armed || m_fireAtNs > m_clock->nowNanoseconds()) {
+            return false;
+        }
+        m_armed = false;
+        fireAtNs = m_fireAtNs;
+        boundaryTimeNs = m_boundaryTimeNs;
+        m_firesInProgress.fetch_add(1, std::memory_order_acq_rel);
+        m_generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+    wake();
+    fire(fireAtNs, boundaryTimeNs);
+    return true;
+}
+
+void BoundaryScheduler::wake() {
+    // Taking the mutex orders this against the sleeper's predicate check,
+    // so a change made just before it starts waiting is never missed
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_sleepCondition.notify_all();
+}
+
+BoundaryScheduler::Stats BoundaryScheduler::stats() const {
+    Stats stats;
+    stats.fired = m_firedCount.load(std::memory_order_relaxed);
+    stats.rescheduled = m_rescheduledCount.load(std::memory_order_relaxed);
+    stats.cancelled = m_cancelledCount.load(std::memory_order_relaxed);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        stats.histogram[i] = m_histogram[i].load(std::memory_order_relaxed);
+    }
+    stats.maxLateNs = m_maxLateNs.load(std::memory_order_relaxed);
+    stats.maxEarlyNs = m_maxEarlyNs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void BoundaryScheduler::resetStats() {
+    m_firedCount.store(0);
+    m_rescheduledCount.store(0);
+    m_cancelledCount.store(0);
+    for (std::atomic<quint64> &count : m_histogram) {
+        count.store(0);
+    }
+    m_maxLateNs.store(0);
+    m_maxEarlyNs.store(0);
+}
+
+int BoundaryScheduler::bucketFor(qint64 errorNs) {
+    static const qint64 edges[HISTOGRAM_BUCKETS - 1] = {
+        -1000000, -100000, -10000, 10000, 100000, 1000000, 5000000
+    };
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && errorNs >= edges[bucket]) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+const char *BoundaryScheduler::bucketLabel(int bucket) {
+    static const char *labels[HISTOGRAM_BUCKETS] = {
+        "< -1ms", "-1ms..-100us", "-100..-10us", "+-10us",
+        "10..100us", "100us..1ms", "1..5ms", "> 5ms"
+    };
+    return bucket >= 0 && bucket < HISTOGRAM_BUCKETS ? labels[bucket] : "";
+}
+
+void BoundaryScheduler::run() {
+    RealtimeScheduling::applyToCurrentThread(RealtimeThreadRole::Boundary);
+    while (!m_stopRequested.load(std::memory_order_acquire)) {
+        bool armed;
+        qint64 fireAtNs;
+        quint32 generation;
+        {
+            std::lock_guard<WriterLock> guard(m_pendingLock);
+            armed = m_armed;
+            fireAtNs = m_fireAtNs;
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+
+        auto changed = [this, generation]() {
+            return m_stopRequested.load(std::memory_order_acquire) ||
+                   m_generation.load(std::memory_order_acquire) != generation;
+        };
+
+        // Nothing pending: sleep until armed
+        if (!armed) {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_sleepCondition.wait(lock, changed);
+            continue;
+        }
+
+        // Coarse part: sleep until the spin window (re-read on any change)
+        const qint64 wakeNs = fireAtNs - SPIN_WINDOW_NS;
+        if (wakeNs > m_clock->nowNanoseconds()) {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            if (m_sleepCondition.wait_until(lock, MidiTime::fromNanoseconds(wakeNs), changed)) {
+                continue;
+            }
+        }
+
+        // Fine part: spin for the last few hundred microseconds
+        bool superseded = false;
+        while (m_clock->nowNanoseconds() < fireAtNs) {
+            if (changed()) {
+                superseded = true;
+                break;
+            }
+            MidiTime::cpuRelax();
+        }
+        if (superseded) {
+            continue;
+        }
+
+        // Claim the fire unless it was moved, cancelled or fired meanwhile
+        qint64 boundaryTimeNs = 0;
+        bool claimed = false;
+        {
+            std::lock_guard<WriterLock> guard(m_pendingLock);
+            if (m_armed && m_generation.load(std::memory_order_acquire) == generation) {
+                m_armed = false;
+                boundaryTimeNs = m_boundaryTimeNs;
+                m_firesInProgress.fetch_add(1, std::memory_order_acq_rel);
+                claimed = true;
+            }
+        }
+        if (claimed) {
+            fire(fireAtNs, boundaryTimeNs);
+        }
+    }
+}
+
+void BoundaryScheduler::fire(qint64 fireAtNs, qint64 boundaryTimeNs) {
+    // Whoever claimed the fire (exactly one caller) records it
+    const qint64 errorNs = m_clock->nowNanoseconds() - fireAtNs;
+    if (m_fireCallback) {
+        m_fireCallback(boundaryTimeNs);
+    }
+
+    m_firedCount.fetch_add(1, std::memory_order_relaxed);
+    m_histogram[bucketFor(errorNs)].fetch_add(1, std::memory_order_relaxed);
+    m_firesInProgress.fetch_sub(1, std::memory_order_acq_rel);
+    if (m_latenessHistogram) {
+        m_latenessHistogram->record(errorNs);
+    }
+    if (errorNs > m_maxLateNs.load(std::memory_order_relaxed)) {
+        m_maxLateNs.store(errorNs, std::memory_order_relaxed);
+    }
+    if (errorNs < m_maxEarlyNs.load(std::memory_order_relaxed)) {
+        m_maxEarlyNs.store(errorNs, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef BOUNDARYSCHEDULER_H
+#define BOUNDARYSCHEDULER_H
+
+#include <QThread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include "ClockSource.h"
+#include "LatencyHistogram.h"
+#include "MidiTime.h"
+#include "SeqLock.h"
+
+// Fires the next downbeat at a computed timestamp instead of on a clock
+// SyncController decides a boundary a few ticks ahead and arms the
+// scheduler with "boundary minus output advance"; later clocks refine the
+// deadline as the tempo tracker updates. The thread sleeps until shortly
+// before the deadline and spins the rest, so the Note On leaves with
+// sub-millisecond precision between clocks rather than on the tick grid.
+// How late (or early) each fire was is kept as a histogram.
+class BoundaryScheduler : public QThread {
+    Q_OBJECT
+
+public:
+    // Called on the scheduler thread when the deadline is reached
+    using FireCallback = std::function<void(qint64 boundaryTimeNs)>;
+
+    // Signed fire error buckets: < -1ms, -1ms..-100us, -100..-10us,
+    // +-10us, 10..100us, 100us..1ms, 1..5ms, > 5ms
+    static const int HISTOGRAM_BUCKETS = 8;
+    static constexpr int ON_TIME_BUCKET = 3; // +-10us
+
+    struct Stats {
+        quint64 fired;
+        quint64 rescheduled; // Deadline refined by a later clock
+        quint64 cancelled;
+        quint64 histogram[HISTOGRAM_BUCKETS];
+        qint64 maxLateNs;
+        qint64 maxEarlyNs;
+    };
+
+    explicit BoundaryScheduler(QObject *parent = nullptr);
+    ~BoundaryScheduler();
+
+    void setFireCallback(FireCallback callback);
+    // Time base for deadlines (nullptr = system clock). Set while stopped.
+    // The thread only follows the system clock: with any other source,
+    // leave it stopped and call fireDue() whenever time has advanced.
+    void setClockSource(const ClockSource *clock);
+    // Also record how late each fire was here (early fires count as 0);
+    // owned by the caller. Set while stopped.
+    void setLatenessHistogram(LatencyHistogram *histogram);
+
+    void startScheduler();
+    void stopScheduler();
+
+    // Any thread. Replaces whatever was pending; returns a token for
+    // reschedule(). A deadline already in the past fires immediately.
+    quint32 arm(qint64 fireAtNs, qint64 boundaryTimeNs);
+    // Moves the pending fire; false if it already fired or was replaced
+    bool reschedule(quint32 token, qint64 fireAtNs, qint64 boundaryTimeNs);
+    // Fires on the calling thread if still pending (the boundary has been
+    // reached without the scheduler getting to it); false if already fired
+    bool fireNow(quint32 token);
+    // Drops the pending fire and waits for one already running to finish,
+    // so nothing is emitted after it returns; true if a fire was pending.
+    // Not from the fire callback.
+    bool cancel();
+    
+    // Deadline of the pending fire, 0 if none
+    qint64 pendingDeadline() const;
+    // Fires on the calling thread if the clock source has reached the
+    // pending deadline; false if nothing was due
+    bool fireDue();
+
+    Stats stats() const;
+    void resetStats();
+
+    static const char *bucketLabel(int bucket);
+
+protected:
+    void run() override;
+
+private:
+    static int bucketFor(qint64 errorNs);
+    void fire(qint64 fireAtNs, qint64 boundaryTimeNs);
+    void wake();
+
+    static const qint64 SPIN_WINDOW_NS = 300000; // Busy-wait the last 300us
+
+    FireCallback m_fireCallback;
+    const ClockSource *m_clock;
+    LatencyHistogram *m_latenessHistogram;
+
+    // Pending fire; m_generation changes on every arm/reschedule/cancel
+    // (wakes the thread), m_armToken only on arm (identifies the fire)
+    mutable WriterLock m_pendingLock;
+    bool m_armed;
+    quint32 m_armToken;
+    qint64 m_fireAtNs;
+    qint64 m_boundaryTimeNs;
+    std::atomic<quint32> m_generation;
+    std::atomic<int> m_firesInProgress; // Claimed, callback not yet returned
+
+    std::atomic<bool> m_stopRequested;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCondition;
+
+    std::atomic<quint64> m_firedCount;
+    std::atomic<quint64> m_rescheduledCount;
+    std::atomic<quint64> m_cancelledCount;
+    std::atomic<quint64> m_histogram[HISTOGRAM_BUCKETS];
+    std::atomic<qint64> m_maxLateNs;
+    std::atomic<qint64> m_maxEarlyNs;
+};
+
+#endif // BOUNDARYSCHEDULER_H
@@ -0,0 +1,519 @@
+#include "ClockArbiter.h"
+#include <QtMath>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+const double DEFAULT_PERIOD_NS = 60.0e9 / 120.0 / 24.0; // 120 BPM until a source is tracked
+const int IDLE_WAIT_MS = 100;                           // Nothing pending: look again this often
+
+void clearSource(std::unique_ptr<TempoEstimator> &tracker, ClockArbiter::SourceHealth &health) {
+    tracker->reset();
+    health.state = ClockArbiter::SourceState::Idle;
+    health.active = false;
+    health.clocks = 0;
+    health.mergedClocks = 0;
+    health.lateClocks = 0;
+    health.timeouts = 0;
+    health.bpm = 0.0;
+    health.jitterNs = 0.0;
+    health.phaseOffsetNs = 0.0;
+    health.lastClockNs = 0;
+}
+
+} // namespace
+
+void ClockArbiter::InputSink::midiStart(qint64 timestamp) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        arbiter->transport(source, Transport::Start, timestamp);
+    }
+    arbiter->deliverPosted();
+}
+
+void ClockArbiter::InputSink::midiStop(qint64 timestamp) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        arbiter->transport(source, Transport::Stop, timestamp);
+    }
+    arbiter->deliverPosted();
+}
+
+void ClockArbiter::InputSink::midiContinue(qint64 timestamp) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        arbiter->transport(source, Transport::Continue, timestamp);
+    }
+    arbiter->deliverPosted();
+}
+
+void ClockArbiter::InputSink::midiClock(qint64 timestamp) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        arbiter->clock(source, timestamp);
+    }
+    arbiter->deliverPosted();
+}
+
+void ClockArbiter::InputSink::midiSongPositionPointer(int positionBeats, double positionQuarterNotes) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        if (arbiter->follows(source)) {
+            arbiter->post({Delivery::SongPosition, 0, positionBeats, positionQuarterNotes, 0});
+        }
+    }
+    arbiter->deliverPosted();
+}
+
+void ClockArbiter::InputSink::midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) {
+    {
+        std::lock_guard<std::mutex> guard(arbiter->m_mutex);
+        if (arbiter->follows(source)) {
+            arbiter->post({Delivery::QuarterFrame, data, 0, 0.0, timestamp});
+        }
+    }
+    arbiter->deliverPosted();
+}
+
+ClockArbiter::ClockArbiter(QObject *parent)
+    : QThread(parent)
+    , m_sink(nullptr)
+    , m_clock(SystemClockSource::instance())
+    , m_timeoutPeriods(DEFAULT_TIMEOUT_PERIODS)
+    , m_active(NO_SOURCE)
+    , m_running(false)
+    , m_hasMergedTick(false)
+    , m_converging(false)
+    , m_mergedTickNs(0)
+    , m_mergedPeriodNs(DEFAULT_PERIOD_NS)
+    , m_holdoverAnchorNs(0)
+    , m_holdoverTicks(0)
+    , m_failovers(0)
+    , m_failbacks(0)
+    , m_holdoverClocks(0)
+    , m_publishedActive(NO_SOURCE)
+    , m_delivering(false)
+    , m_stopRequested(false)
+{
+    setObjectName("ClockArbiter");
+    for (int i = 0; i < MAX_SOURCES; ++i) {
+        m_inputs[i].arbiter = this;
+        m_inputs[i].source = i;
+        m_sources[i].tracker.reset(new KalmanTempoEstimator());
+        clearSource(m_sources[i].tracker, m_sources[i].health);
+        m_sources[i].periodNs = 0.0;
+        m_sources[i].consecutiveClocks = 0;
+    }
+}
+
+ClockArbiter::~ClockArbiter() {
+    stopArbiter();
+}
+
+void ClockArbiter::setSink(MidiTransportSink *sink) {
+    m_sink.store(sink, std::memory_order_release);
+}
+
+void ClockArbiter::setClockSource(const ClockSource *clock) {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_clock = clock ? clock : SystemClockSource::instance();
+}
+
+void ClockArbiter::setTimeoutPeriods(double periods) {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    // Under two periods a single lost clock would already count as a failure
+    m_timeoutPeriods = qMax(2.0, periods);
+}
+
+double ClockArbiter::timeoutPeriods() const {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_timeoutPeriods;
+}
+
+void ClockArbiter::startArbiter() {
+    if (isRunning()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopRequested = false;
+    }
+    start(QThread::TimeCriticalPriority);
+}
+
+void ClockArbiter::stopArbiter() {
+    if (!isRunning()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopRequested = true;
+    }
+    m_sleepCondition.notify_all();
+    wait();
+}
+
+MidiTransportSink *ClockArbiter::sourceSink(int source) {
+    return source >= 0 && source < MAX_SOURCES ? &m_inputs[source] : nullptr;
+}
+
+void ClockArbiter::resetSource(int source) {
+    if (source < 0 || source >= MAX_SOURCES) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(m_mutex);
+    Source &gone = m_sources[source];
+    clearSource(gone.tracker, gone.health);
+    gone.periodNs = 0.0;
+    gone.consecutiveClocks = 0;
+    if (m_active == source) {
+        const qint64 now = nowNs();
+        int next = m_hasMergedTick ? INTERNAL_SOURCE : NO_SOURCE;
+        for (int i = 0; i < MAX_SOURCES; ++i) {
+            if (m_sources[i].health.state == SourceState::Live && !isSilent(m_sources[i], now)) {
+                next = i;
+                break;
+            }
+        }
+        m_active = next;
+        m_converging = m_hasMergedTick;
+        m_publishedActive.store(m_active, std::memory_order_relaxed);
+    }
+}
+
+qint64 ClockArbiter::pendingDeadline() const {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return pendingDeadlineLocked();
+}
+
+bool ClockArbiter::fireDue() {
+    bool fired = false;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        fired = fireDueLocked(nowNs());
+    }
+    deliverPosted();
+    return fired;
+}
+
+int ClockArbiter::activeSource() const {
+    return m_publishedActive.load(std::memory_order_relaxed);
+}
+
+ClockArbiter::SourceHealth ClockArbiter::sourceHealth(int source) const {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (source < 0 || source >= MAX_SOURCES) {
+        SourceHealth none = {};
+        return none;
+    }
+    SourceHealth health = m_sources[source].health;
+    health.active = m_active == source;
+    return health;
+}
+
+ClockArbiter::Stats ClockArbiter::stats() const {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    Stats stats;
+    stats.activeSource = m_active;
+    stats.failovers = m_failovers;
+    stats.failbacks = m_failbacks;
+    stats.holdoverClocks = m_holdoverClocks;
+    stats.droppedDeliveries = m_posted.overflowCount();
+    return stats;
+}
+
+qint64 ClockArbiter::nowNs() const {
+    return m_clock->nowNanoseconds();
+}
+
+void ClockArbiter::post(Delivery::Kind kind, qint64 timestamp) {
+    post({kind, 0, 0, 0.0, timestamp});
+}
+
+void ClockArbiter::post(const Delivery &delivery) {
+    if (m_sink.load(std::memory_order_acquire)) {
+        m_posted.push(delivery);
+    }
+}
+
+void ClockArbiter::deliverPosted() {
+    // The flag is taken and given back with read-modify-writes, so a call
+    // posted while another thread was delivering is seen by the recheck
+    while (!m_posted.isEmpty()) {
+        if (m_delivering.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        Delivery delivery;
+        while (m_posted.pop(delivery)) {
+            MidiTransportSink *sink = m_sink.load(std::memory_order_acquire);
+            if (!sink) {
+                continue;
+            }
+            switch (delivery.kind) {
+            case Delivery::Start:
+                sink->midiStart(delivery.timestamp);
+                break;
+            case Delivery::Stop:
+                sink->midiStop(delivery.timestamp);
+                break;
+            case Delivery::Continue:
+                sink->midiContinue(delivery.timestamp);
+                break;
+            case Delivery::Clock:
+                sink->midiClock(delivery.timestamp);
+                break;
+            case Delivery::SongPosition:
+                sink->midiSongPositionPointer(delivery.positionBeats, delivery.positionQuarterNotes);
+                break;
+            case Delivery::QuarterFrame:
+                sink->midiTimeCodeQuarterFrame(delivery.data, delivery.timestamp);
+                break;
+            }
+        }
+        m_delivering.exchange(false, std::memory_order_acq_rel);
+    }
+}
+
+bool ClockArbiter::isSilent(const Source &source, qint64 nowNs) const {
+    if (source.health.lastClockNs == 0) {
+        return true;
+    }
+    const double periodNs = source.periodNs > 0.0 ? source.periodNs : m_mergedPeriodNs;
+    return nowNs - source.health.lastClockNs > m_timeoutPeriods * periodNs;
+}
+
+void ClockArbiter::clock(int source, qint64 timestamp) {
+    const qint64 arrivalNs = timestamp > 0 ? timestamp : nowNs();
+
+    // Ticks the holdover owed before this clock go first
+    fireDueLocked(arrivalNs);
+
+    Source &input = m_sources[source];
+    if (isSilent(input, arrivalNs)) {
+        input.consecutiveClocks = 0;
+    }
+    const qint64 intervalNs = input.health.lastClockNs > 0 ? arrivalNs - input.health.lastClockNs : 0;
+    const TempoEstimate tempo = input.tracker->update(arrivalNs);
+    if (tempo.valid) {
+        input.periodNs = tempo.periodNs;
+        input.health.bpm = tempo.bpm;
+        input.health.jitterNs = tempo.jitterNs;
+    } else if (intervalNs >= TempoEstimator::MIN_PERIOD_NS && intervalNs <= TempoEstimator::MAX_PERIOD_NS) {
+        input.periodNs = intervalNs;
+    }
+    input.health.lastClockNs = arrivalNs;
+    ++input.health.clocks;
+    ++input.consecutiveClocks;
+    if (input.health.state == SourceState::Idle ||
+        (input.health.state == SourceState::TimedOut && input.consecutiveClocks >= RECOVERY_CLOCKS)) {
+        input.health.state = SourceState::Live;
+    }
+
+    selectActive(source);
+    if (m_active != source) {
+        return;
+    }
+
+    // While converging, the tracker's filtered tick is the phase to slew
+    // onto; otherwise the arrival goes downstream as it came
+    const qint64 measuredNs = m_converging && tempo.valid ? tempo.tickTimeNs : arrivalNs;
+    if (!m_hasMergedTick) {
+        if (input.periodNs > 0.0) {
+            m_mergedPeriodNs = input.periodNs;
+        }
+        ++input.health.mergedClocks;
+        mergeTick(measuredNs);
+        return;
+    }
+
+    const double periodNs = m_mergedPeriodNs;
+    const qint64 predictedNs = m_mergedTickNs + std::llround(periodNs);
+    const double offsetNs = static_cast<double>(measuredNs - predictedNs);
+    input.health.phaseOffsetNs = offsetNs;
+
+    // Closer to the tick already merged than to the next one: the
+    // holdover filled this one in
+    if (offsetNs < -0.5 * periodNs) {
+        ++input.health.lateClocks;
+        return;
+    }
+
+    qint64 tickNs = measuredNs;
+    if (m_converging) {
+        const double maxStepNs = MAX_PHASE_STEP * periodNs;
+        tickNs = predictedNs + std::llround(qBound(-maxStepNs, offsetNs, maxStepNs));
+        if (input.periodNs > 0.0) {
+            const double maxPeriodStepNs = MAX_PERIOD_STEP * periodNs;
+            m_mergedPeriodNs += qBound(-maxPeriodStepNs, input.periodNs - periodNs, maxPeriodStepNs);
+        }
+        if (qAbs(offsetNs) <= maxStepNs && qAbs(input.periodNs - m_mergedPeriodNs) <= MAX_PERIOD_STEP * periodNs) {
+            m_converging = false;
+        }
+    } else if (input.periodNs > 0.0) {
+        m_mergedPeriodNs = input.periodNs;
+    }
+    ++input.health.mergedClocks;
+    mergeTick(tickNs);
+}
+
+void ClockArbiter::selectActive(int source) {
+    const Source &input = m_sources[source];
+    if (m_active == source || input.health.state != SourceState::Live) {
+        return;
+    }
+
+    if (m_active < 0) {
+        // Nothing followed (start-up or holdover): the first live source
+        m_active = source;
+    } else if (source < m_active && input.consecutiveClocks >= RECOVERY_CLOCKS) {
+        // A higher-priority source has been clocking steadily again
+        m_active = source;
+        ++m_failbacks;
+    } else {
+        return;
+    }
+    m_converging = m_hasMergedTick;
+    m_publishedActive.store(m_active, std::memory_order_relaxed);
+}
+
+bool ClockArbiter::follows(int source) {
+    if (m_active == source) {
+        return true;
+    }
+    if (m_active < 0) {
+        // A transport from any input while none is followed: that input
+        // is the one playing now
+        m_active = source;
+        m_converging = m_hasMergedTick;
+        m_publishedActive.store(m_active, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ClockArbiter::transport(int source, Transport message, qint64 timestamp) {
+    // Every source's own clock restarts with its transport
+    if (message != Transport::Stop) {
+        m_sources[source].tracker->reset();
+    }
+    if (!follows(source)) {
+        return;
+    }
+
+    if (message == Transport::Stop) {
+        m_running = false;
+        post(Delivery::Stop, timestamp);
+        return;
+    }
+
+    // The merged grid restarts at the first clock after Start/Continue
+    m_running = true;
+    m_hasMergedTick = false;
+    m_converging = false;
+    post(message == Transport::Start ? Delivery::Start : Delivery::Continue, timestamp);
+    m_sleepCondition.notify_all();
+}
+
+void ClockArbiter::mergeTick(qint64 tickNs) {
+    m_mergedTickNs = tickNs;
+    m_holdoverAnchorNs = tickNs;
+    m_holdoverTicks = 0;
+    m_hasMergedTick = true;
+    post(Delivery::Clock, tickNs);
+}
+
+qint64 ClockArbiter::pendingDeadlineLocked() const {
+    qint64 deadline = 0;
+    const Source *active = m_active >= 0 ? &m_sources[m_active] : nullptr;
+    if (active && active->health.state == SourceState::Live) {
+        const Source &input = *active;
+        const double periodNs = input.periodNs > 0.0 ? input.periodNs : m_mergedPeriodNs;
+        deadline = input.health.lastClockNs + std::llround(m_timeoutPeriods * periodNs) + 1;
+    }
+    if (m_running && m_hasMergedTick) {
+        const qint64 holdoverNs = m_holdoverAnchorNs +
+            std::llround((m_holdoverTicks + 1 + HOLDOVER_GRACE) * m_mergedPeriodNs);
+        deadline = deadline > 0 ? qMin(deadline, holdoverNs) : holdoverNs;
+    }
+    return deadline;
+}
+
+bool ClockArbiter::fireDueLocked(qint64 nowNs) {
+    bool fired = false;
+
+    // Sources gone silent; the active one hands over to the next healthy
+    // source, or to the holdover grid
+    for (int i = 0; i < MAX_SOURCES; ++i) {
+        Source &input = m_sources[i];
+        if (input.health.state != SourceState::Live || !isSilent(input, nowNs)) {
+            continue;
+        }
+        input.health.state = SourceState::TimedOut;
+        ++input.health.timeouts;
+        input.consecutiveClocks = 0;
+        fired = true;
+        if (i == m_active) {
+            int next = INTERNAL_SOURCE;
+            for (int j = 0; j < MAX_SOURCES; ++j) {
+                if (m_sources[j].health.state == SourceState::Live && !isSilent(m_sources[j], nowNs)) {
+                    next = j;
+                    break;
+                }
+            }
+            m_active = next;
+            m_converging = m_hasMergedTick;
+            ++m_failovers;
+            m_publishedActive.store(m_active, std::memory_order_relaxed);
+        }
+    }
+
+    // Holdover: a tick half a period overdue is filled in on the merged
+    // grid, so downstream keeps its count and tempo
+    if (m_running && m_hasMergedTick) {
+        const double periodNs = m_mergedPeriodNs;
+        const qint64 firstDueNs = m_holdoverAnchorNs + std::llround((m_holdoverTicks + 1 + HOLDOVER_GRACE) * periodNs);
+        if (nowNs - firstDueNs > MAX_HOLDOVER_BURST * periodNs) {
+            // Far behind (a stall, or virtual time jumped): no burst of
+            // catch-up clocks, restart the grid one tick back from now
+            m_holdoverAnchorNs = nowNs - std::llround(periodNs);
+            m_holdoverTicks = 0;
+        }
+        for (;;) {
+            const qint64 dueNs = m_holdoverAnchorNs + std::llround((m_holdoverTicks + 1 + HOLDOVER_GRACE) * periodNs);
+            if (nowNs < dueNs) {
+                break;
+            }
+            ++m_holdoverTicks;
+            m_mergedTickNs = m_holdoverAnchorNs + std::llround(m_holdoverTicks * periodNs);
+            m_converging = true;
+            ++m_holdoverClocks;
+            fired = true;
+            post(Delivery::Clock, m_mergedTickNs);
+        }
+    }
+    return fired;
+}
+
+void ClockArbiter::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto stopping = [this]() { return m_stopRequested; };
+    while (!m_stopRequested) {
+        // Deadlines only move later while waiting (each clock pushes them
+        // on), so clocks don't wake the thread; it wakes at the old
+        // deadline, finds nothing due and sleeps again
+        const qint64 deadline = pendingDeadlineLocked();
+        if (deadline > 0) {
+            m_sleepCondition.wait_until(lock, MidiTime::fromNanoseconds(deadline), stopping);
+        } else {
+            m_sleepCondition.wait_for(lock, std::chrono::milliseconds(IDLE_WAIT_MS), stopping);
+        }
+        if (m_stopRequested) {
+            break;
+        }
+        fireDueLocked(nowNs());
+        lock.unlock();
+        deliverPosted();
+        lock.lock();
+    }
+}
@@ -0,0 +1,190 @@
+#ifndef CLOCKARBITER_H
+#define CLOCKARBITER_H
+
+#include <QThread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "ClockSource.h"
+#include "MidiEventQueue.h"
+#include "MidiTransportSink.h"
+#include "TempoEstimator.h"
+
+// Merges the clock of several redundant inputs into one stream
+// Each source (0 = the primary input, then the backups in priority order)
+// keeps its own tempo tracker and health. The downstream sink hears the
+// active source only: the highest-priority one that is clocking. When
+// the active source misses a tick, the arbiter's thread fills it in on
+// the merged grid (holdover); when it has been silent for the timeout
+// (timeoutPeriods expected periods), the next healthy source takes over
+// at its next tick, or the holdover grid simply carries on as the
+// internal master. A source that recovers takes back over after
+// RECOVERY_CLOCKS clean clocks. At every change of source the merged
+// grid slews onto the new phase a step of at most MAX_PHASE_STEP periods
+// per tick, so downstream sees neither a gap nor a tempo jump.
+// Transport (Start/Stop/Continue, SPP, MTC) follows the active source.
+// Decisions are made under a mutex, but downstream calls are not: they
+// are posted to a ring in decision order and delivered after it is
+// released, so an input never waits behind the sink or another thread's
+// holdover work.
+class ClockArbiter : public QThread {
+    Q_OBJECT
+
+public:
+    static const int MAX_SOURCES = 4;
+    static const int INTERNAL_SOURCE = -1; // Holdover grid, no input followed
+    static const int NO_SOURCE = -2;       // Nothing heard yet
+    static constexpr double DEFAULT_TIMEOUT_PERIODS = 3.0;
+    static const int RECOVERY_CLOCKS = 24;             // One quarter note
+    static constexpr double HOLDOVER_GRACE = 0.5;      // Periods past due before filling in
+    static constexpr double MAX_PHASE_STEP = 0.05;     // Periods per tick while converging
+    static constexpr double MAX_PERIOD_STEP = 0.01;    // Relative period change per tick while converging
+
+    enum class SourceState {
+        Idle,    // Never clocked (or reset)
+        Live,    // Clocking
+        TimedOut // Went silent; Live again after RECOVERY_CLOCKS
+    };
+
+    struct SourceHealth {
+        SourceState state;
+        bool active;
+        quint64 clocks;
+        quint64 mergedClocks;  // Clocks passed downstream
+        quint64 lateClocks;    // Clocks for a tick the holdover already filled
+        quint64 timeouts;
+        double bpm;            // This source's own tracker (0 until locked)
+        double jitterNs;
+        double phaseOffsetNs;  // Last clock vs the merged grid (positive = late)
+        qint64 lastClockNs;    // 0 = never
+    };
+
+    struct Stats {
+        int activeSource;      // Source index, INTERNAL_SOURCE or NO_SOURCE
+        quint64 failovers;     // Away from a timed-out source
+        quint64 failbacks;     // Back to a higher-priority source
+        quint64 holdoverClocks;
+        quint64 droppedDeliveries; // Downstream calls lost to a full ring
+    };
+
+    explicit ClockArbiter(QObject *parent = nullptr);
+    ~ClockArbiter();
+
+    // Downstream (not owned; nullptr = nothing is passed on)
+    void setSink(MidiTransportSink *sink);
+    // Time base (nullptr = system clock). Set while stopped. As with the
+    // boundary scheduler, the thread only follows the system clock: with
+    // any other source, leave it stopped and call fireDue().
+    void setClockSource(const ClockSource *clock);
+    void setTimeoutPeriods(double periods);
+    double timeoutPeriods() const;
+
+    // The holdover thread
+    void startArbiter();
+    void stopArbiter();
+
+    // What an input delivers into: the transport calls of one source,
+    // tagged with its index (valid for the arbiter's lifetime). Calls for
+    // different sources may come from different threads.
+    MidiTransportSink *sourceSink(int source);
+
+    // Forget a source (its port closed); a different source takes over
+    // if it was active
+    void resetSource(int source);
+
+    // Next holdover (or timeout) deadline, 0 if none
+    qint64 pendingDeadline() const;
+    // Fills in due ticks and times out silent sources on the calling
+    // thread; false if nothing was due
+    bool fireDue();
+
+    int activeSource() const;
+    SourceHealth sourceHealth(int source) const;
+    Stats stats() const;
+
+protected:
+    void run() override;
+
+private:
+    class InputSink : public MidiTransportSink {
+    public:
+        void midiStart(qint64 timestamp) override;
+        void midiStop(qint64 timestamp) override;
+        void midiContinue(qint64 timestamp) override;
+        void midiClock(qint64 timestamp) override;
+        void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) override;
+        void midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) override;
+
+        ClockArbiter *arbiter;
+        int source;
+    };
+
+    struct Source {
+        std::unique_ptr<TempoEstimator> tracker;
+        SourceHealth health;
+        double periodNs;       // Tracked, or the last interval before it locks
+        int consecutiveClocks; // Since it last went silent
+    };
+
+    enum class Transport { Start, Stop, Continue };
+
+    // One downstream call, posted under m_mutex
+    struct Delivery {
+        enum Kind : quint8 { Start, Stop, Continue, Clock, SongPosition, QuarterFrame };
+
+        Kind kind;
+        quint8 data;               // QuarterFrame
+        int positionBeats;         // SongPosition
+        double positionQuarterNotes;
+        qint64 timestamp;
+    };
+
+    // All private members below run with m_mutex held
+    void clock(int source, qint64 timestamp);
+    void transport(int source, Transport message, qint64 timestamp);
+    bool follows(int source);
+    void selectActive(int source);
+    bool isSilent(const Source &source, qint64 nowNs) const;
+    bool fireDueLocked(qint64 nowNs);
+    qint64 pendingDeadlineLocked() const;
+    void mergeTick(qint64 tickNs);
+    qint64 nowNs() const;
+    void post(Delivery::Kind kind, qint64 timestamp);
+    void post(const Delivery &delivery);
+    // With m_mutex released: hands the posted calls downstream, unless
+    // another thread already is (it takes these along)
+    void deliverPosted();
+
+    static const int MAX_HOLDOVER_BURST = 4; // Further behind: re-anchor, no burst
+
+    std::atomic<MidiTransportSink *> m_sink;
+    const ClockSource *m_clock;
+    double m_timeoutPeriods;
+    InputSink m_inputs[MAX_SOURCES];
+    Source m_sources[MAX_SOURCES];
+
+    // Merged stream
+    int m_active;
+    bool m_running;         // Following a started transport
+    bool m_hasMergedTick;
+    bool m_converging;      // Slewing onto a new source's phase
+    qint64 m_mergedTickNs;
+    double m_mergedPeriodNs;
+    qint64 m_holdoverAnchorNs; // Holdover ticks: anchor + n * period
+    int m_holdoverTicks;       // Since the last real clock was merged
+    quint64 m_failovers;
+    quint64 m_failbacks;
+    quint64 m_holdoverClocks;
+    std::atomic<int> m_publishedActive;
+
+    // Guards everything above. The ring has one producer at a time (who
+    // holds the mutex) and one consumer at a time (who holds m_delivering).
+    mutable std::mutex m_mutex;
+    SpscRingBuffer<Delivery, 256> m_posted;
+    std::atomic<bool> m_delivering;
+    std::condition_variable m_sleepCondition;
+    bool m_stopRequested;
+};
+
+#endif // CLOCKARBITER_H
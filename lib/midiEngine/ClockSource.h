@@ -0,0 +1,58 @@
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include "MidiTime.h"
+
+// Where the timing code reads "now" from
+// Production code uses the monotonic steady clock. Tests install a
+// VirtualClockSource and move time themselves, so timing behaviour can be
+// checked at exact timestamps and far faster than real time.
+class ClockSource {
+public:
+    virtual ~ClockSource() {}
+
+    // MidiTime nanoseconds; any thread
+    virtual qint64 nowNanoseconds() const = 0;
+};
+
+// The steady clock shared with MidiEngine's arrival timestamps
+class SystemClockSource : public ClockSource {
+public:
+    qint64 nowNanoseconds() const override {
+        return MidiTime::nowNanoseconds();
+    }
+
+    static const SystemClockSource *instance() {
+        static const SystemClockSource source;
+        return &source;
+    }
+};
+
+// Time that only moves when told to
+// Start it well above zero: a zero timestamp means "now" to SyncController.
+class VirtualClockSource : public ClockSource {
+public:
+    explicit VirtualClockSource(qint64 startNs = 1000000000LL)
+        : m_nowNs(startNs)
+    {
+    }
+
+    qint64 nowNanoseconds() const override {
+        return m_nowNs.load(std::memory_order_acquire);
+    }
+
+    void setNanoseconds(qint64 nowNs) {
+        m_nowNs.store(nowNs, std::memory_order_release);
+    }
+
+    void advance(qint64 deltaNs) {
+        m_nowNs.fetch_add(deltaNs, std::memory_order_acq_rel);
+    }
+
+private:
+    std::atomic<qint64> m_nowNs;
+};
+
+#endif // CLOCKSOURCE_H
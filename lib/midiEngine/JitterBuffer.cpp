@@ -0,0 +1,125 @@
+#include "JitterBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+JitterBuffer::JitterBuffer() {
+    reset();
+}
+
+void JitterBuffer::reset() {
+    m_head = 0;
+    m_count = 0;
+    m_transitCount = 0;
+    m_transitNext = 0;
+    m_hasDelay = false;
+    m_delayNs = 0;
+    m_baseNs = 0;
+    m_hasSequence = false;
+    m_highestSequence = 0;
+    m_received = 0;
+    m_stats = Stats();
+}
+
+bool JitterBuffer::packetArrived(quint16 sequence, qint64 senderNs, qint64 arrivalNs) {
+    if (!m_hasSequence) {
+        m_hasSequence = true;
+        m_highestSequence = sequence;
+        m_received = 1;
+    } else {
+        const int ahead = static_cast<qint16>(static_cast<quint16>(sequence - m_highestSequence));
+        if (ahead > 0) {
+            // Gaps count as lost until (unless) they turn up
+            m_stats.lost += ahead - 1;
+            m_received = ahead < 64 ? (m_received << ahead) | 1 : 1;
+            m_highestSequence = sequence;
+        } else {
+            const int behind = -ahead;
+            if (behind < 64) {
+                const quint64 bit = quint64(1) << behind;
+                if (m_received & bit) {
+                    ++m_stats.duplicates;
+                    return false;
+                }
+                m_received |= bit;
+                if (m_stats.lost > 0) {
+                    --m_stats.lost;
+                }
+            }
+            ++m_stats.reordered;
+        }
+    }
+
+    ++m_stats.packets;
+    updateDelay(arrivalNs - senderNs);
+    return true;
+}
+
+void JitterBuffer::updateDelay(qint64 transitNs) {
+    m_transits[m_transitNext] = transitNs;
+    m_transitNext = (m_transitNext + 1) % WINDOW;
+    m_transitCount = std::min(m_transitCount + 1, WINDOW);
+
+    m_baseNs = *std::min_element(m_transits, m_transits + m_transitCount);
+
+    // Spread above the fastest transit at the quantile
+    qint64 spread[WINDOW];
+    for (int i = 0; i < m_transitCount; ++i) {
+        spread[i] = m_transits[i] - m_baseNs;
+    }
+    const int rank = std::min(m_transitCount - 1,
+                              static_cast<int>(std::ceil(JITTER_QUANTILE * m_transitCount)) - 1);
+    std::nth_element(spread, spread + rank, spread + m_transitCount);
+    m_stats.jitterNs = spread[rank];
+
+    const qint64 depth = qBound(MIN_DEPTH_NS, m_stats.jitterNs + DEPTH_MARGIN_NS, MAX_DEPTH_NS);
+    const qint64 target = m_baseNs + depth;
+    if (!m_hasDelay || target > m_delayNs) {
+        m_delayNs = target;
+        m_hasDelay = true;
+    } else {
+        m_delayNs -= (m_delayNs - target) / SHRINK_DIVISOR;
+    }
+    m_stats.depthNs = m_delayNs - m_baseNs;
+    m_stats.maxDepthNs = std::max(m_stats.maxDepthNs, m_stats.depthNs);
+}
+
+bool JitterBuffer::push(const quint8 *bytes, int size, qint64 senderNs, qint64 arrivalNs) {
+    if (size <= 0 || size > 3) {
+        return false;
+    }
+    if (m_count == CAPACITY) {
+        ++m_stats.overflows;
+        return false;
+    }
+
+    Event event;
+    event.playoutNs = senderNs + m_delayNs;
+    if (event.playoutNs < arrivalNs) {
+        ++m_stats.lateEvents;
+        event.playoutNs = arrivalNs;
+    }
+    std::memcpy(event.bytes, bytes, size);
+    event.size = static_cast<quint8>(size);
+
+    // Walk back past later events (equal times keep arrival order)
+    int position = m_count;
+    while (position > 0 && m_events[(m_head + position - 1) % CAPACITY].playoutNs > event.playoutNs) {
+        m_events[(m_head + position) % CAPACITY] = m_events[(m_head + position - 1) % CAPACITY];
+        --position;
+    }
+    m_events[(m_head + position) % CAPACITY] = event;
+    ++m_count;
+    ++m_stats.events;
+    return true;
+}
+
+qint64 JitterBuffer::nextPlayoutNs() const {
+    return m_count > 0 ? m_events[m_head].playoutNs : 0;
+}
+
+JitterBuffer::Stats JitterBuffer::stats() const {
+    Stats stats = m_stats;
+    stats.buffered = m_count;
+    return stats;
+}
@@ -0,0 +1,106 @@
+#ifndef JITTERBUFFER_H
+#define JITTERBUFFER_H
+
+#include <QtGlobal>
+
+// Adaptive playout buffer for MIDI that carries sender timestamps
+// (RTP-MIDI): events are released at their sender time plus a playout
+// delay, so the intervals the sender played come out again whatever the
+// network did to the packets in between. The delay is the fastest
+// transit over the last WINDOW packets plus a depth sized from the
+// measured jitter (the JITTER_QUANTILE of the transit spread, plus
+// DEPTH_MARGIN_NS). It grows at once when the jitter does and shrinks
+// slowly (by 1/SHRINK_DIVISOR of the excess per packet), so a sustained
+// change shifts the timeline gradually instead of as a step. Events are
+// reordered by playout time; one whose packet arrives after its playout
+// time is late: released at once, at its arrival time.
+// Sender times may be on any nanosecond base (only differences matter),
+// so no clock synchronisation with the sender is needed. Single-threaded:
+// one thread receives and releases.
+class JitterBuffer {
+public:
+    static constexpr int CAPACITY = 256;             // Events held at once
+    static constexpr int WINDOW = 128;               // Packets the depth is sized from
+    static constexpr double JITTER_QUANTILE = 0.98;
+    static constexpr qint64 DEPTH_MARGIN_NS = 1000000;   // 1 ms
+    static constexpr qint64 MIN_DEPTH_NS = 1000000;      // 1 ms
+    static constexpr qint64 MAX_DEPTH_NS = 100000000;    // 100 ms
+    static constexpr int SHRINK_DIVISOR = 64;
+
+    struct Stats {
+        quint64 packets;
+        quint64 events;
+        quint64 lateEvents;  // Released at arrival, past their playout time
+        quint64 reordered;   // Packets older than one already received
+        quint64 lost;        // Sequence gaps never filled
+        quint64 duplicates;  // Dropped
+        quint64 overflows;   // Dropped, buffer full
+        qint64 depthNs;      // Current playout delay above the fastest transit
+        qint64 jitterNs;     // Measured transit spread (JITTER_QUANTILE)
+        qint64 maxDepthNs;   // Deepest since reset
+        int buffered;        // Events waiting now
+    };
+
+    JitterBuffer();
+
+    void reset();
+
+    // A packet came in: its RTP sequence number and the sender time of
+    // its first event. false = duplicate (skip its events).
+    bool packetArrived(quint16 sequence, qint64 senderNs, qint64 arrivalNs);
+    // One event of the packet last accepted (1..3 bytes)
+    bool push(const quint8 *bytes, int size, qint64 senderNs, qint64 arrivalNs);
+
+    // Playout time of the next event, 0 if empty
+    qint64 nextPlayoutNs() const;
+
+    // Releases every event due by nowNs, in playout order:
+    // deliver(const quint8 *bytes, int size, qint64 playoutNs)
+    template <typename Deliver>
+    int releaseDue(qint64 nowNs, Deliver &&deliver) {
+        int released = 0;
+        while (m_count > 0 && m_events[m_head].playoutNs <= nowNs) {
+            const Event &event = m_events[m_head];
+            deliver(event.bytes, static_cast<int>(event.size), event.playoutNs);
+            m_head = (m_head + 1) % CAPACITY;
+            --m_count;
+            ++released;
+        }
+        return released;
+    }
+
+    qint64 playoutDelayNs() const { return m_delayNs; }
+    Stats stats() const;
+
+private:
+    struct Event {
+        qint64 playoutNs;
+        quint8 bytes[3];
+        quint8 size;
+    };
+
+    void updateDelay(qint64 transitNs);
+
+    // Sorted ring of pending events (insertion from the back: packets
+    // mostly arrive in order)
+    Event m_events[CAPACITY];
+    int m_head;
+    int m_count;
+
+    // Transit samples (arrival - sender) of the last WINDOW packets
+    qint64 m_transits[WINDOW];
+    int m_transitCount;
+    int m_transitNext;
+    bool m_hasDelay;
+    qint64 m_delayNs;  // Playout = sender time + this
+    qint64 m_baseNs;   // Fastest transit in the window
+
+    // Sequence tracking: m_received bit n = highest - n was seen
+    bool m_hasSequence;
+    quint16 m_highestSequence;
+    quint64 m_received;
+
+    Stats m_stats;
+};
+
+#endif // JITTERBUFFER_H
@@ -0,0 +1,82 @@
+#include "LatencyHistogram.h"
+#include <limits>
+
+LatencyHistogram::LatencyHistogram()
+    : m_totalCount(0)
+    , m_sumNs(0)
+    , m_minNs(std::numeric_limits<qint64>::max())
+    , m_maxNs(0)
+{
+    for (std::atomic<quint64> &count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (std::atomic<quint64> &count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_totalCount.store(0, std::memory_order_relaxed);
+    m_sumNs.store(0, std::memory_order_relaxed);
+    m_minNs.store(std::numeric_limits<qint64>::max(), std::memory_order_relaxed);
+    m_maxNs.store(0, std::memory_order_relaxed);
+}
+
+qint64 LatencyHistogram::bucketLowerBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    const int subBucket = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return static_cast<qint64>(SUB_BUCKETS + subBucket) << shift;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+    return bucketLowerBound(bucket) + (static_cast<qint64>(1) << shift) - 1;
+}
+
+qint64 LatencyHistogram::valueAtPercentile(double percentile) const {
+    // Walk a consistent total: sum the buckets rather than trusting
+    // m_totalCount, which writers update separately
+    quint64 total = 0;
+    for (const std::atomic<quint64> &count : m_counts) {
+        total += count.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    percentile = qBound(0.0, percentile, 100.0);
+    quint64 wanted = static_cast<quint64>(percentile / 100.0 * total + 0.5);
+    if (wanted == 0) {
+        wanted = 1;
+    }
+
+    quint64 seen = 0;
+    for (int bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += m_counts[bucket].load(std::memory_order_relaxed);
+        if (seen >= wanted) {
+            // Never report beyond the largest value actually recorded
+            return qMin(bucketUpperBound(bucket), m_maxNs.load(std::memory_order_relaxed));
+        }
+    }
+    return m_maxNs.load(std::memory_order_relaxed);
+}
+
+LatencySummary LatencyHistogram::summary() const {
+    LatencySummary summary;
+    summary.count = count();
+    summary.minNs = summary.count > 0 ? m_minNs.load(std::memory_order_relaxed) : 0;
+    summary.maxNs = m_maxNs.load(std::memory_order_relaxed);
+    summary.meanNs = summary.count > 0
+        ? static_cast<double>(m_sumNs.load(std::memory_order_relaxed)) / summary.count : 0.0;
+    summary.p50Ns = valueAtPercentile(50.0);
+    summary.p90Ns = valueAtPercentile(90.0);
+    summary.p99Ns = valueAtPercentile(99.0);
+    summary.p999Ns = valueAtPercentile(99.9);
+    return summary;
+}
@@ -0,0 +1,92 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <QtAlgorithms>
+#include <atomic>
+
+// Percentiles and extremes of one histogram, in nanoseconds
+struct LatencySummary {
+    quint64 count;
+    qint64 minNs;
+    qint64 maxNs;
+    double meanNs;
+    qint64 p50Ns;
+    qint64 p90Ns;
+    qint64 p99Ns;
+    qint64 p999Ns;
+};
+
+// Lock-free log-linear histogram of nanosecond durations (HdrHistogram
+// layout): values below 32 ns are counted exactly; above that every power
+// of two is split into 32 linear sub-buckets, about 3% relative precision
+// up to ~18 minutes. record() is a few relaxed atomic adds, safe from any
+// number of threads and never allocating, so probes can sit on the timing
+// path. Readers see approximately consistent counts while writers run.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_EXPONENT = 40; // Highest power of two tracked
+    static const int BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    // Negative durations count as zero
+    void record(qint64 ns) {
+        if (ns < 0) {
+            ns = 0;
+        }
+        m_counts[bucketFor(static_cast<quint64>(ns))].fetch_add(1, std::memory_order_relaxed);
+        m_totalCount.fetch_add(1, std::memory_order_relaxed);
+        m_sumNs.fetch_add(static_cast<quint64>(ns), std::memory_order_relaxed);
+
+        qint64 current = m_maxNs.load(std::memory_order_relaxed);
+        while (ns > current && !m_maxNs.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+        }
+        current = m_minNs.load(std::memory_order_relaxed);
+        while (ns < current && !m_minNs.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    quint64 count() const { return m_totalCount.load(std::memory_order_relaxed); }
+
+    LatencySummary summary() const;
+    // Highest value equivalent to the given percentile (0-100)
+    qint64 valueAtPercentile(double percentile) const;
+
+    // Not synchronised with concurrent record() calls: a sample recorded
+    // during the reset may be partly kept
+    void reset();
+
+    // Bucket layout, for exporters
+    static int bucketFor(quint64 ns) {
+        if (ns < static_cast<quint64>(SUB_BUCKETS)) {
+            return static_cast<int>(ns);
+        }
+        const int exponent = 63 - static_cast<int>(qCountLeadingZeroBits(ns));
+        if (exponent > MAX_EXPONENT) {
+            return BUCKETS - 1;
+        }
+        const int shift = exponent - SUB_BUCKET_BITS;
+        const int subBucket = static_cast<int>(ns >> shift) - SUB_BUCKETS;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + subBucket;
+    }
+    static qint64 bucketLowerBound(int bucket);
+    static qint64 bucketUpperBound(int bucket);
+    quint64 bucketCount(int bucket) const {
+        return m_counts[bucket].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<quint64> m_counts[BUCKETS];
+    std::atomic<quint64> m_totalCount;
+    std::atomic<quint64> m_sumNs;
+    std::atomic<qint64> m_minNs;
+    std::atomic<qint64> m_maxNs;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,113 @@
+#ifndef LINKTIMEBASE_H
+#define LINKTIMEBASE_H
+
+#include <QtGlobal>
+#include <cmath>
+#include <mutex>
+#include "SeqLock.h"
+
+// Build flag: 1 when AbletonLinkTimebase is compiled in (CMake
+// MIDIMASTER2_ENABLE_LINK)
+#ifndef MIDIMASTER2_LINK
+#define MIDIMASTER2_LINK 0
+#endif
+
+// One capture of a Link session's timeline: beats as a linear function
+// of MidiTime nanoseconds at the session tempo, valid until the tempo or
+// phase next changes (so capture again for every decision)
+struct LinkTimeline {
+    double bpm;
+    double referenceBeat; // Beat at referenceNs
+    qint64 referenceNs;
+    bool playing;         // Session start/stop state
+    int peers;
+
+    double beatAtTime(qint64 timeNs) const {
+        return referenceBeat + static_cast<double>(timeNs - referenceNs) * bpm / 60.0e9;
+    }
+
+    qint64 timeAtBeat(double beat) const {
+        return referenceNs + std::llround((beat - referenceBeat) * 60.0e9 / bpm);
+    }
+
+    // Position within the quantum, 0 <= phase < quantum
+    double phaseAtTime(qint64 timeNs, double quantum) const {
+        const double phase = std::fmod(beatAtTime(timeNs), quantum);
+        return phase < 0.0 ? phase + quantum : phase;
+    }
+};
+
+// How SyncController uses a LinkTimebase
+enum class LinkMode {
+    Off,
+    Follow, // Tempo and phase from the session (incoming MIDI transport ignored)
+    Publish // The session gets this controller's tempo and transport
+};
+
+// A shared tempo/phase session SyncController can follow or publish to
+// (Ableton Link; AbletonLinkTimebase). Beats are quarter notes and the
+// quantum is one bar, so a downbeat is wherever the phase wraps to 0.
+class LinkTimebase {
+public:
+    static constexpr double QUANTUM = 4.0;
+
+    virtual ~LinkTimebase() {}
+
+    // Current timeline; real-time safe, but only from one timing thread
+    // at a time (the clock generator's while SyncController follows)
+    virtual LinkTimeline capture() const = 0;
+
+    // Publishing (not from the timing thread): tempo from atNs on, with
+    // the beat continuous there
+    virtual void commitTempo(double bpm, qint64 atNs) = 0;
+    // Publishing: the session plays from beat at atNs
+    virtual void commitStart(double beat, qint64 atNs) = 0;
+    virtual void commitStop(qint64 atNs) = 0;
+};
+
+// Session held in memory: no network, moved only by commits
+// Lets SyncController's Link paths run on virtual time in tests, and
+// stands in for a session of one.
+class LocalLinkTimebase : public LinkTimebase {
+public:
+    explicit LocalLinkTimebase(double bpm = 120.0, qint64 referenceNs = 0)
+        : m_timeline(LinkTimeline{bpm, 0.0, referenceNs, false, 0})
+    {
+    }
+
+    LinkTimeline capture() const override {
+        return m_timeline.load();
+    }
+
+    void commitTempo(double bpm, qint64 atNs) override {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        LinkTimeline timeline = m_timeline.load();
+        timeline.referenceBeat = timeline.beatAtTime(atNs);
+        timeline.referenceNs = atNs;
+        timeline.bpm = bpm;
+        m_timeline.store(timeline);
+    }
+
+    void commitStart(double beat, qint64 atNs) override {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        LinkTimeline timeline = m_timeline.load();
+        timeline.referenceBeat = beat;
+        timeline.referenceNs = atNs;
+        timeline.playing = true;
+        m_timeline.store(timeline);
+    }
+
+    void commitStop(qint64 atNs) override {
+        Q_UNUSED(atNs);
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        LinkTimeline timeline = m_timeline.load();
+        timeline.playing = false;
+        m_timeline.store(timeline);
+    }
+
+private:
+    SeqLock<LinkTimeline> m_timeline;
+    WriterLock m_writeLock;
+};
+
+#endif // LINKTIMEBASE_H
@@ -0,0 +1,340 @@
+#include "MidiCapture.h"
+#include "MidiTime.h"
+#include <QDateTime>
+#include <QFile>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+const char CAPTURE_MAGIC[8] = {'M', 'M', '2', 'C', 'A', 'P', 'T', 0};
+
+size_t mappingSize(quint64 records) {
+    return sizeof(MidiCaptureHeader) + records * sizeof(MidiCaptureRecord);
+}
+
+} // namespace
+
+MidiCaptureRecorder::MidiCaptureRecorder(QObject *parent)
+    : QThread(parent)
+    , m_capturing(false)
+    , m_fd(-1)
+    , m_header(nullptr)
+    , m_capacityRecords(0)
+    , m_count(0)
+    , m_writeFailures(0)
+    , m_publishedCount(0)
+    , m_stopRequested(false)
+{
+}
+
+MidiCaptureRecorder::~MidiCaptureRecorder() {
+    stopCapture();
+}
+
+bool MidiCaptureRecorder::startCapture(const QString &path) {
+    stopCapture();
+
+    m_fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+        return false;
+    }
+    m_capacityRecords = 0;
+    m_count = 0;
+    m_writeFailures.store(0);
+    m_publishedCount.store(0);
+    if (!grow()) {
+        closeFile();
+        return false;
+    }
+
+    std::memcpy(m_header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    m_header->version = MidiCaptureHeader::VERSION;
+    m_header->recordSize = sizeof(MidiCaptureRecord);
+    m_header->startNs = MidiTime::nowNanoseconds();
+    m_header->startUtcMs = QDateTime::currentMSecsSinceEpoch();
+    m_header->recordCount = 0;
+    m_header->dropped = 0;
+    std::memset(m_header->reserved, 0, sizeof(m_header->reserved));
+
+    // Whatever was still queued from an earlier capture isn't this one's
+    MidiCaptureRecord stale;
+    while (m_ring.pop(stale)) {
+    }
+    m_path = path;
+    m_stopRequested = false;
+    start(QThread::LowPriority);
+    m_capturing.store(true, std::memory_order_release);
+    return true;
+}
+
+void MidiCaptureRecorder::stopCapture() {
+    if (!isRunning()) {
+        return;
+    }
+    m_capturing.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_wakeCondition.notify_all();
+    wait();
+    closeFile();
+}
+
+MidiCaptureRecorder::Stats MidiCaptureRecorder::stats() const {
+    Stats stats;
+    stats.records = m_publishedCount.load(std::memory_order_relaxed);
+    stats.dropped = m_ring.overflowCount() + m_writeFailures.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void MidiCaptureRecorder::push(const MidiCaptureRecord &record) {
+    if (m_capturing.load(std::memory_order_acquire)) {
+        m_ring.push(record);
+    }
+}
+
+void MidiCaptureRecorder::recordInput(const MidiMessage &message, int source) {
+    MidiCaptureRecord record = {};
+    record.timestampNs = message.timestamp;
+    record.kind = MidiCaptureRecord::Input;
+    record.source = static_cast<quint8>(source);
+    record.size = message.size;
+    std::memcpy(record.bytes, message.bytes, std::min<int>(message.size, sizeof(message.bytes)));
+    push(record);
+}
+
+void MidiCaptureRecorder::recordInput(const SysExMessage &message, int source) {
+    MidiCaptureRecord record = {};
+    record.timestampNs = message.timestamp;
+    record.kind = MidiCaptureRecord::SysExInput;
+    record.source = static_cast<quint8>(source);
+    const quint32 length = static_cast<quint32>(message.size);
+    std::memcpy(record.bytes, &length, sizeof(length));
+    push(record);
+}
+
+void MidiCaptureRecorder::recordOutput(const unsigned char *data, size_t size, qint64 sentNs) {
+    MidiCaptureRecord record = {};
+    record.timestampNs = sentNs;
+    record.kind = MidiCaptureRecord::Output;
+    record.size = static_cast<quint8>(std::min<size_t>(size, sizeof(record.bytes)));
+    std::memcpy(record.bytes, data, record.size);
+    push(record);
+}
+
+void MidiCaptureRecorder::recordBatch(const MidiOutputBatch &batch, qint64 presentationTimeNs) {
+    if (!m_capturing.load(std::memory_order_acquire)) {
+        return;
+    }
+    const qint64 timestampNs = presentationTimeNs > 0 ? presentationTimeNs : MidiTime::nowNanoseconds();
+    for (int i = 0; i < batch.count(); ++i) {
+        const MidiOutputBatch::Message &message = batch.at(i);
+        if (message.dropped) {
+            continue;
+        }
+        MidiCaptureRecord record = {};
+        record.timestampNs = timestampNs;
+        record.kind = presentationTimeNs > 0 ? MidiCaptureRecord::ScheduledOutput : MidiCaptureRecord::Output;
+        record.size = message.size;
+        std::memcpy(record.bytes, message.bytes, message.size);
+        m_ring.push(record);
+    }
+}
+
+void MidiCaptureRecorder::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopRequested) {
+        m_wakeCondition.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+    lock.unlock();
+    drain();
+}
+
+void MidiCaptureRecorder::drain() {
+    MidiCaptureRecord record;
+    while (m_ring.pop(record)) {
+        if (!m_header || (m_count == m_capacityRecords && !grow())) {
+            // Disk full or out of address space: lost, but counted
+            m_writeFailures.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        reinterpret_cast<MidiCaptureRecord *>(m_header + 1)[m_count++] = record;
+    }
+    if (m_header) {
+        m_header->recordCount = m_count;
+        m_header->dropped = stats().dropped;
+    }
+    m_publishedCount.store(m_count, std::memory_order_relaxed);
+}
+
+bool MidiCaptureRecorder::grow() {
+    const quint64 capacity = m_capacityRecords + GROWTH_RECORDS;
+    if (::ftruncate(m_fd, static_cast<off_t>(mappingSize(capacity))) != 0) {
+        return false;
+    }
+    void *mapping = ::mmap(nullptr, mappingSize(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    if (m_header) {
+        ::munmap(m_header, mappingSize(m_capacityRecords));
+    }
+    m_header = static_cast<MidiCaptureHeader *>(mapping);
+    m_capacityRecords = capacity;
+    return true;
+}
+
+void MidiCaptureRecorder::closeFile() {
+    if (m_header) {
+        m_header->recordCount = m_count;
+        m_header->dropped = stats().dropped;
+        ::msync(m_header, mappingSize(m_capacityRecords), MS_SYNC);
+        ::munmap(m_header, mappingSize(m_capacityRecords));
+        m_header = nullptr;
+    }
+    if (m_fd >= 0) {
+        // Trim the unused growth (if that fails, the header's count still
+        // bounds what a reader takes)
+        const bool trimmed = ::ftruncate(m_fd, static_cast<off_t>(mappingSize(m_count))) == 0;
+        Q_UNUSED(trimmed);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_capacityRecords = 0;
+}
+
+MidiCaptureFile::MidiCaptureFile()
+    : m_mapping(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_records(nullptr)
+    , m_count(0)
+{
+}
+
+MidiCaptureFile::~MidiCaptureFile() {
+    if (m_mapping) {
+        ::munmap(m_mapping, m_size);
+    }
+}
+
+std::unique_ptr<MidiCaptureFile> MidiCaptureFile::open(const QString &path, QString *error) {
+    auto fail = [error, &path](const QString &message) {
+        if (error) {
+            *error = path + ": " + message;
+        }
+        return std::unique_ptr<MidiCaptureFile>();
+    };
+
+    const int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0) {
+        return fail("cannot open");
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(MidiCaptureHeader)) {
+        ::close(fd);
+        return fail("not a capture file");
+    }
+    const size_t size = static_cast<size_t>(status.st_size);
+    void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return fail("cannot map");
+    }
+
+    std::unique_ptr<MidiCaptureFile> file(new MidiCaptureFile());
+    file->m_mapping = mapping;
+    file->m_size = size;
+    file->m_header = static_cast<const MidiCaptureHeader *>(mapping);
+    if (std::memcmp(file->m_header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        file->m_header->version != MidiCaptureHeader::VERSION ||
+        file->m_header->recordSize != sizeof(MidiCaptureRecord)) {
+        return fail("not a capture file (or another version)");
+    }
+    file->m_records = reinterpret_cast<const MidiCaptureRecord *>(file->m_header + 1);
+    file->m_count = std::min<quint64>(file->m_header->recordCount,
+                                      (size - sizeof(MidiCaptureHeader)) / sizeof(MidiCaptureRecord));
+    return file;
+}
+
+MidiCaptureReplayer::MidiCaptureReplayer(QObject *parent)
+    : QThread(parent)
+    , m_speed(1.0)
+    , m_source(0)
+    , m_stopRequested(false)
+    , m_replayed(0)
+{
+}
+
+MidiCaptureReplayer::~MidiCaptureReplayer() {
+    stopReplay();
+}
+
+void MidiCaptureReplayer::setDeliverCallback(DeliverCallback callback) {
+    m_deliver = std::move(callback);
+}
+
+void MidiCaptureReplayer::startReplay(std::unique_ptr<MidiCaptureFile> capture, double speed, int source) {
+    stopReplay();
+    m_capture = std::move(capture);
+    m_speed = qBound(MIN_SPEED, speed, MAX_SPEED);
+    m_source = source;
+    m_replayed.store(0);
+    m_stopRequested.store(false);
+    start(QThread::TimeCriticalPriority);
+}
+
+void MidiCaptureReplayer::stopReplay() {
+    if (isRunning()) {
+        m_stopRequested.store(true);
+        wait();
+    }
+}
+
+void MidiCaptureReplayer::run() {
+    if (!m_capture || !m_deliver) {
+        return;
+    }
+    const qint64 beginNs = MidiTime::nowNanoseconds();
+    qint64 firstNs = 0;
+    bool started = false;
+    for (quint64 i = 0; i < m_capture->count() && !m_stopRequested.load(); ++i) {
+        const MidiCaptureRecord &record = m_capture->at(i);
+        if (record.kind != MidiCaptureRecord::Input || record.source != m_source ||
+            record.size == 0 || record.size > 3) {
+            continue;
+        }
+        if (!started) {
+            firstNs = record.timestampNs;
+            started = true;
+        }
+
+        // Sleep most of the way, spin the rest (as a driver thread would
+        // deliver it: on time, not a scheduler quantum late)
+        const qint64 dueNs = beginNs + std::llround((record.timestampNs - firstNs) / m_speed);
+        while (MidiTime::nowNanoseconds() < dueNs && !m_stopRequested.load()) {
+            if (dueNs - MidiTime::nowNanoseconds() > 200000) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            } else {
+                MidiTime::cpuRelax();
+            }
+        }
+        if (m_stopRequested.load()) {
+            break;
+        }
+        m_deliver(record.bytes, record.size, dueNs);
+        m_replayed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
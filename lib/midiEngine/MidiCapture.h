@@ -0,0 +1,237 @@
+#ifndef MIDICAPTURE_H
+#define MIDICAPTURE_H
+
+#include <QThread>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "MidiOutputBatch.h"
+#include "MidiStreamParser.h"
+#include "SysExBufferPool.h"
+
+// Capture file layout: a MidiCaptureHeader, then MidiCaptureRecords in
+// the order they were captured (native byte order). recordCount is
+// updated after every flush, so a file left by a crash reads back up to
+// the last flush.
+struct MidiCaptureRecord {
+    enum Kind : quint8 {
+        Input = 0,          // Arrival time
+        Output = 1,         // Send time
+        ScheduledOutput = 2,// Presentation time (each port sends it early by its offset)
+        SysExInput = 3      // Arrival time; size 0, bytes[0..3] = length (payload not kept)
+    };
+
+    qint64 timestampNs; // MidiTime nanoseconds
+    quint8 kind;
+    quint8 source;      // Input: ClockArbiter source (0 = the input, then backups)
+    quint8 size;
+    quint8 bytes[5];
+};
+static_assert(sizeof(MidiCaptureRecord) == 16, "MidiCaptureRecord is a file format");
+
+struct MidiCaptureHeader {
+    static const quint32 VERSION = 1;
+
+    char magic[8];      // "MM2CAPT"
+    quint32 version;
+    quint32 recordSize;
+    qint64 startNs;     // MidiTime when the capture began
+    qint64 startUtcMs;  // Wall clock then
+    quint64 recordCount;
+    quint64 dropped;    // Ring full, or the file could not grow
+    quint8 reserved[16];
+};
+static_assert(sizeof(MidiCaptureHeader) == 64, "MidiCaptureHeader is a file format");
+
+// Bounded multi-producer, single-consumer ring (per-cell sequence
+// numbers): producers on any thread claim a cell with one CAS and never
+// block or allocate; a full ring drops the new element and counts it
+template <typename T, int Capacity>
+class MpscRingBuffer {
+    static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0,
+                  "MpscRingBuffer capacity must be a power of two");
+
+public:
+    MpscRingBuffer()
+        : m_head(0)
+        , m_tail(0)
+        , m_overflowCount(0)
+    {
+        for (int i = 0; i < Capacity; ++i) {
+            m_cells[i].sequence.store(static_cast<quint32>(i), std::memory_order_relaxed);
+        }
+    }
+
+    MpscRingBuffer(const MpscRingBuffer &) = delete;
+    MpscRingBuffer &operator=(const MpscRingBuffer &) = delete;
+
+    // Producer side (any thread)
+    bool push(const T &item) {
+        quint32 position = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = m_cells[position & MASK];
+            const qint32 lag = static_cast<qint32>(cell.sequence.load(std::memory_order_acquire) - position);
+            if (lag == 0) {
+                if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = item;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                position = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer side
+    bool pop(T &item) {
+        Cell &cell = m_cells[m_tail & MASK];
+        if (static_cast<qint32>(cell.sequence.load(std::memory_order_acquire) - (m_tail + 1)) < 0) {
+            return false;
+        }
+        item = cell.value;
+        cell.sequence.store(m_tail + Capacity, std::memory_order_release);
+        ++m_tail;
+        return true;
+    }
+
+    quint64 overflowCount() const { return m_overflowCount.load(std::memory_order_relaxed); }
+
+private:
+    static const quint32 MASK = Capacity - 1;
+
+    struct Cell {
+        std::atomic<quint32> sequence;
+        T value;
+    };
+
+    Cell m_cells[Capacity];
+    alignas(64) std::atomic<quint32> m_head;
+    alignas(64) quint32 m_tail;
+    std::atomic<quint64> m_overflowCount;
+};
+
+// Always-on recorder of the engine's MIDI traffic
+// The record calls are real-time safe from any thread (they only write
+// into the ring, and do nothing while stopped); the recorder's own
+// thread drains the ring every FLUSH_INTERVAL_MS into the memory-mapped
+// capture file, growing it GROWTH_RECORDS at a time.
+class MidiCaptureRecorder : public QThread {
+    Q_OBJECT
+
+public:
+    static const int RING_CAPACITY = 16384;
+    static const int FLUSH_INTERVAL_MS = 20;
+    static const int GROWTH_RECORDS = 65536; // 1 MB
+
+    struct Stats {
+        quint64 records;
+        quint64 dropped;  // Ring full, or the file could not grow
+    };
+
+    explicit MidiCaptureRecorder(QObject *parent = nullptr);
+    ~MidiCaptureRecorder();
+
+    // Creates (truncates) the file; false if it cannot be created or mapped
+    bool startCapture(const QString &path);
+    void stopCapture();
+    bool isCapturing() const { return m_capturing.load(std::memory_order_acquire); }
+    QString path() const { return m_path; }
+    Stats stats() const;
+
+    void recordInput(const MidiMessage &message, int source);
+    void recordInput(const SysExMessage &message, int source);
+    void recordOutput(const unsigned char *data, size_t size, qint64 sentNs);
+    // Live messages of a batch; presentationTimeNs 0 = sent now
+    void recordBatch(const MidiOutputBatch &batch, qint64 presentationTimeNs);
+
+protected:
+    void run() override;
+
+private:
+    void push(const MidiCaptureRecord &record);
+    void drain();
+    bool grow();
+    void closeFile();
+
+    MpscRingBuffer<MidiCaptureRecord, RING_CAPACITY> m_ring;
+    std::atomic<bool> m_capturing;
+    QString m_path;
+
+    // Writer thread (and start/stop while it is not running)
+    int m_fd;
+    MidiCaptureHeader *m_header;  // Start of the mapping
+    quint64 m_capacityRecords;
+    quint64 m_count;
+    std::atomic<quint64> m_writeFailures;
+    std::atomic<quint64> m_publishedCount;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    bool m_stopRequested;
+};
+
+// A capture file mapped read-only
+class MidiCaptureFile {
+public:
+    ~MidiCaptureFile();
+
+    // nullptr with a message if it isn't a readable capture
+    static std::unique_ptr<MidiCaptureFile> open(const QString &path, QString *error);
+
+    const MidiCaptureHeader &header() const { return *m_header; }
+    quint64 count() const { return m_count; }
+    const MidiCaptureRecord &at(quint64 index) const { return m_records[index]; }
+
+private:
+    MidiCaptureFile();
+
+    void *m_mapping;
+    size_t m_size;
+    const MidiCaptureHeader *m_header;
+    const MidiCaptureRecord *m_records;
+    quint64 m_count;
+};
+
+// Plays a capture's input records of one source back on its own thread,
+// each at its original offset from the first divided by the speed, with
+// that replay time as its timestamp. SysEx records are skipped (their
+// payload is not captured).
+class MidiCaptureReplayer : public QThread {
+    Q_OBJECT
+
+public:
+    static constexpr double MIN_SPEED = 0.01;
+    static constexpr double MAX_SPEED = 64.0;
+
+    using DeliverCallback = std::function<void(const quint8 *bytes, int size, qint64 timestampNs)>;
+
+    explicit MidiCaptureReplayer(QObject *parent = nullptr);
+    ~MidiCaptureReplayer();
+
+    // Set while stopped
+    void setDeliverCallback(DeliverCallback callback);
+
+    void startReplay(std::unique_ptr<MidiCaptureFile> capture, double speed, int source = 0);
+    void stopReplay();
+    quint64 replayed() const { return m_replayed.load(std::memory_order_relaxed); }
+
+protected:
+    void run() override;
+
+private:
+    DeliverCallback m_deliver;
+    std::unique_ptr<MidiCaptureFile> m_capture;
+    double m_speed;
+    int m_source;
+    std::atomic<bool> m_stopRequested;
+    std::atomic<quint64> m_replayed;
+};
+
+#endif // MIDICAPTURE_H
@@ -0,0 +1,210 @@
+#include "MidiClockGenerator.h"
+#include "RealtimeScheduling.h"
+#include <cmath>
+
+ClockSchedule::ClockSchedule()
+    : m_anchorNs(0)
+    , m_periodNs(periodNsForBPM(120.0))
+    , m_tickIndex(0)
+{
+}
+
+double ClockSchedule::periodNsForBPM(double bpm) {
+    // MIDI Clock: 24 ticks per quarter note
+    return 60.0e9 / bpm / 24.0;
+}
+
+void ClockSchedule::start(qint64 anchorNs, double bpm) {
+    m_anchorNs = anchorNs;
+    m_periodNs = periodNsForBPM(bpm);
+    // First tick one period after the anchor (matches the old QTimer behaviour)
+    m_tickIndex = 1;
+}
+
+void ClockSchedule::setBPM(double bpm) {
+    // Next pending deadline becomes the new anchor: no phase jump
+    m_anchorNs = nextDeadline();
+    m_periodNs = periodNsForBPM(bpm);
+    m_tickIndex = 0;
+}
+
+void ClockSchedule::reanchor(qint64 anchorNs) {
+    m_anchorNs = anchorNs;
+    m_tickIndex = 0;
+}
+
+qint64 ClockSchedule::nextDeadline() const {
+    return m_anchorNs + static_cast<qint64>(std::llround(static_cast<double>(m_tickIndex) * m_periodNs));
+}
+
+void ClockSchedule::advance() {
+    ++m_tickIndex;
+}
+
+MidiClockGenerator::MidiClockGenerator(QObject *parent)
+    : QThread(parent)
+    , m_auxPeriodNs(0.0)
+    , m_lookaheadTicks(0)
+    , m_bpm(120.0)
+    , m_bpmGeneration(0)
+    , m_stopRequested(false)
+    , m_resyncCount(0)
+{
+    setObjectName("MidiClockGenerator");
+}
+
+MidiClockGenerator::~MidiClockGenerator() {
+    stopClock();
+}
+
+void MidiClockGenerator::setTickCallback(TickCallback callback) {
+    m_tickCallback = std::move(callback);
+}
+
+void MidiClockGenerator::setAuxSchedule(double periodNs, TickCallback callback) {
+    m_auxPeriodNs = periodNs > 0.0 ? periodNs : 0.0;
+    m_auxCallback = std::move(callback);
+}
+
+void MidiClockGenerator::setDeadlineCallback(DeadlineCallback callback) {
+    m_deadlineCallback = std::move(callback);
+}
+
+void MidiClockGenerator::setLookaheadTicks(int ticks) {
+    m_lookaheadTicks = qBound(0, ticks, MAX_LOOKAHEAD_TICKS);
+}
+
+void MidiClockGenerator::setBPM(double bpm) {
+    if (bpm < 20.0 || bpm > 300.0) {
+        return;
+    }
+    m_bpm.store(bpm, std::memory_order_relaxed);
+    m_bpmGeneration.fetch_add(1, std::memory_order_release);
+}
+
+double MidiClockGenerator::bpm() const {
+    return m_bpm.load(std::memory_order_relaxed);
+}
+
+void MidiClockGenerator::startClock() {
+    stopClock();
+    m_stopRequested.store(false, std::memory_order_release);
+    start(QThread::TimeCriticalPriority);
+}
+
+void MidiClockGenerator::stopClock() {
+    if (!isRunning()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stopRequested.store(true, std::memory_order_release);
+    }
+    m_sleepCondition.notify_all();
+    wait();
+}
+
+quint64 MidiClockGenerator::resyncCount() const {
+    return m_resyncCount.load(std::memory_order_relaxed);
+}
+
+bool MidiClockGenerator::sleepUntil(qint64 wakeNs) {
+    // Interruptible by stopClock
+    if (wakeNs > MidiTime::nowNanoseconds()) {
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleepCondition.wait_until(lock, MidiTime::fromNanoseconds(wakeNs), [this]() {
+            return m_stopRequested.load(std::memory_order_acquire);
+        });
+    }
+    return !m_stopRequested.load(std::memory_order_acquire);
+}
+
+bool MidiClockGenerator::waitForEvent(qint64 deadlineNs, qint64 lookaheadNs) {
+    if (lookaheadNs <= 0) {
+        return waitUntil(deadlineNs);
+    }
+    // Inside the window: call it now. Otherwise sleep until the window
+    // covers half a lookahead past it, so one wakeup calls that many events
+    if (deadlineNs - lookaheadNs <= MidiTime::nowNanoseconds()) {
+        return !m_stopRequested.load(std::memory_order_acquire);
+    }
+    return sleepUntil(deadlineNs - lookaheadNs / 2);
+}
+
+bool MidiClockGenerator::waitUntil(qint64 deadlineNs) {
+    // Coarse part: sleep until the spin window
+    if (!sleepUntil(deadlineNs - SPIN_WINDOW_NS)) {
+        return false;
+    }
+    
+    // Fine part: spin for the last few hundred microseconds
+    while (MidiTime::nowNanoseconds() < deadlineNs) {
+        if (m_stopRequested.load(std::memory_order_acquire)) {
+            return false;
+        }
+        MidiTime::cpuRelax();
+    }
+    return !m_stopRequested.load(std::memory_order_acquire);
+}
+
+void MidiClockGenerator::run() {
+    RealtimeScheduling::applyToCurrentThread(RealtimeThreadRole::Clock);
+    ClockSchedule schedule;
+    quint32 generation = m_bpmGeneration.load(std::memory_order_acquire);
+    const qint64 startNs = MidiTime::nowNanoseconds();
+    schedule.start(startNs, m_bpm.load(std::memory_order_relaxed));
+    
+    // Aux events from the start itself, on their own absolute grid
+    const bool auxEnabled = m_auxPeriodNs > 0.0 && m_auxCallback;
+    qint64 auxAnchorNs = startNs;
+    qint64 auxIndex = 0;
+    qint64 previousDeadline = 0;
+    
+    while (!m_stopRequested.load(std::memory_order_acquire)) {
+        // Pick up tempo changes at tick granularity
+        quint32 currentGeneration = m_bpmGeneration.load(std::memory_order_acquire);
+        if (currentGeneration != generation) {
+            generation = currentGeneration;
+            schedule.setBPM(m_bpm.load(std::memory_order_relaxed));
+        }
+        
+        qint64 deadline = m_deadlineCallback ? m_deadlineCallback(previousDeadline) : schedule.nextDeadline();
+        const qint64 lookaheadNs = static_cast<qint64>(m_lookaheadTicks * schedule.periodNs());
+        if (auxEnabled) {
+            qint64 auxDeadline = auxAnchorNs + std::llround(auxIndex * m_auxPeriodNs);
+            if (auxDeadline < deadline) {
+                if (!waitForEvent(auxDeadline, lookaheadNs)) {
+                    break;
+                }
+                if (MidiTime::nowNanoseconds() - auxDeadline > static_cast<qint64>(MAX_LATE_TICKS * m_auxPeriodNs)) {
+                    m_resyncCount.fetch_add(1, std::memory_order_relaxed);
+                    auxDeadline = MidiTime::nowNanoseconds();
+                    auxAnchorNs = auxDeadline;
+                    auxIndex = 0;
+                }
+                m_auxCallback(auxDeadline);
+                ++auxIndex;
+                continue;
+            }
+        }
+        
+        if (!waitForEvent(deadline, lookaheadNs)) {
+            break;
+        }
+        
+        // If we fell far behind, don't fire a burst of catch-up clocks
+        // (downstream gear would see a tempo spike); restart the grid here
+        qint64 lateness = MidiTime::nowNanoseconds() - deadline;
+        if (lateness > static_cast<qint64>(MAX_LATE_TICKS * schedule.periodNs())) {
+            m_resyncCount.fetch_add(1, std::memory_order_relaxed);
+            deadline = MidiTime::nowNanoseconds();
+            schedule.reanchor(deadline);
+        }
+        
+        if (m_tickCallback) {
+            m_tickCallback(deadline);
+        }
+        schedule.advance();
+        previousDeadline = deadline;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef MIDICLOCKGENERATOR_H
+#define MIDICLOCKGENERATOR_H
+
+#include <QThread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include "MidiTime.h"
+
+// Absolute-deadline schedule for MIDI clock ticks
+// Deadlines are computed as anchor + tickIndex * period in floating point,
+// so the fractional part of the period is never truncated and rounding
+// error never accumulates. A tempo change re-anchors at the next pending
+// deadline, which keeps the phase continuous across the change.
+class ClockSchedule {
+public:
+    ClockSchedule();
+
+    void start(qint64 anchorNs, double bpm);
+    void setBPM(double bpm);
+    void reanchor(qint64 anchorNs);
+
+    qint64 nextDeadline() const;
+    void advance();
+
+    double periodNs() const { return m_periodNs; }
+    qint64 ticksSinceAnchor() const { return m_tickIndex; }
+
+    static double periodNsForBPM(double bpm);
+
+private:
+    qint64 m_anchorNs;
+    double m_periodNs;
+    qint64 m_tickIndex;
+};
+
+// Dedicated thread that generates master MIDI clock ticks
+// Each tick sleeps until shortly before its deadline, then spins for the
+// last few hundred microseconds, so ticks land within microseconds of the
+// ideal grid instead of on QTimer's millisecond (and coarse) grid.
+class MidiClockGenerator : public QThread {
+    Q_OBJECT
+
+public:
+    // Called on the generator thread with the tick's scheduled deadline
+    using TickCallback = std::function<void(qint64 deadlineNs)>;
+    // Called on the generator thread for each tick's deadline, given the
+    // previous tick's (0 before the first)
+    using DeadlineCallback = std::function<qint64(qint64 previousDeadlineNs)>;
+
+    explicit MidiClockGenerator(QObject *parent = nullptr);
+    ~MidiClockGenerator();
+
+    void setTickCallback(TickCallback callback);
+    
+    // A second, fixed-rate event stream (MTC quarter frames) on the same
+    // thread and deadline loop, independent of the tempo and starting with
+    // the clock. periodNs 0 turns it off. Set while stopped.
+    void setAuxSchedule(double periodNs, TickCallback callback);
+    
+    // Ticks on an external timeline (a Link session) instead of the BPM
+    // grid; nullptr restores the grid. Set while stopped.
+    void setDeadlineCallback(DeadlineCallback callback);
+
+    // Lookahead: every tick (and aux event) is called this many clock
+    // periods before its deadline, in bursts, with the thread sleeping
+    // (no spin) between them: about two wakeups per lookahead window
+    // instead of one spin per tick. For outputs that schedule their
+    // sends at the deadline; 0 (the default) calls each at its deadline.
+    // Set while stopped.
+    void setLookaheadTicks(int ticks);
+    int lookaheadTicks() const { return m_lookaheadTicks; }
+
+    // Thread-safe; takes effect from the next tick
+    void setBPM(double bpm);
+    double bpm() const;
+
+    void startClock();
+    void stopClock();
+
+    // Number of times the schedule had to be re-anchored because the
+    // thread fell several ticks behind (system stall, suspend)
+    quint64 resyncCount() const;
+
+protected:
+    void run() override;
+
+private:
+    // Returns false if a stop was requested while waiting
+    bool waitUntil(qint64 deadlineNs);
+    bool sleepUntil(qint64 wakeNs);
+    // Waits for the moment an event due at deadlineNs is to be called
+    bool waitForEvent(qint64 deadlineNs, qint64 lookaheadNs);
+
+    static const qint64 SPIN_WINDOW_NS = 300000; // 300us busy-wait before each deadline
+    static const int MAX_LATE_TICKS = 4;            // re-anchor instead of bursting
+    static constexpr int MAX_LOOKAHEAD_TICKS = 96;  // Four beats
+
+    TickCallback m_tickCallback;
+    TickCallback m_auxCallback;
+    DeadlineCallback m_deadlineCallback;
+    double m_auxPeriodNs;
+    int m_lookaheadTicks;
+    std::atomic<double> m_bpm;
+    std::atomic<quint32> m_bpmGeneration;
+    std::atomic<bool> m_stopRequested;
+    std::atomic<quint64> m_resyncCount;
+
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCondition;
+};
+
+#endif // MIDICLOCKGENERATOR_H
@@ -1,28 +1,69 @@
 #include "MidiEngine.h"
+#include "RealtimeScheduling.h"
+#include "TimestampedOutputBackend.h"
 #include <QCoreApplication>
 #include <QDebug>
 #include <QMutexLocker>
 #include <QMetaObject>
-#include <QQueue>
+#include <QSettings>
 #include <QTimer>
 #include <QThread>
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 MidiEngine::MidiEngine(QObject *parent)
     : QObject(parent)
     , m_currentOutputPortIndex(-1)
+    , m_outputBackend(nullptr)
+    , m_coalescingPolicy(CoalescingPolicy::None)
+    , m_outputSendersInFlight(0)
+    , m_timestampedOutput(false)
+    , m_maxOutputLatencyOffsetMs(MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS)
+    , m_calibrationTimer(nullptr)
+    , m_calibrationSamplesWanted(0)
+    , m_calibrationPingsSent(0)
+    , m_calibrationPingSentAt(0)
+    , m_calibrationEchoAt(0)
+    , m_flushCount(0)
+    , m_sentMessageCount(0)
+    , m_coalescedCount(0)
+    , m_inputReceivedCount(0)
     , m_currentInputPortIndex(-1)
-    , m_expectingSPPData(false)
-    , m_sppLSB(0)
-    , m_sppMSB(0)
+    , m_clockArbiter(new ClockArbiter())
+    , m_clockFailover(false)
+    , m_portScanner(nullptr)
+    , m_portsCached(false)
+    , m_sysExPool(new SysExBufferPool())
+    , m_sysExSink(nullptr)
+    , m_transportSink(nullptr)
     , m_messageProcessorTimer(nullptr)
+    , m_processingMode(ProcessingMode::MainThreadTimer)
 {
+    for (std::atomic<quint64> &count : m_flushSizeCounts) {
+        count.store(0);
+    }
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        slot.store(nullptr);
+    }
+    for (std::atomic<double> &offset : m_zoneMaxOutputLatencyOffsetMs) {
+        offset.store(-1.0);
+    }
+    m_inputParser.setSysExPool(m_sysExPool.get());
+    m_rawParser.setSysExPool(m_sysExPool.get());
+    m_umpDecoder.setSysExPool(m_sysExPool.get());
+    m_callbackSysEx.setPool(m_sysExPool.get());
+    
     // Create timer to process queued MIDI messages on main thread
     m_messageProcessorTimer = new QTimer(this);
     m_messageProcessorTimer->setInterval(1); // Process every 1ms for low latency
     m_messageProcessorTimer->setSingleShot(false);
     connect(m_messageProcessorTimer, &QTimer::timeout, this, &MidiEngine::processQueuedMessages);
     
+    m_calibrationTimer = new QTimer(this);
+    m_calibrationTimer->setInterval(150); // Longer than any sane loopback
+    connect(m_calibrationTimer, &QTimer::timeout, this, &MidiEngine::onCalibrationTimer);
+    
     // Note: RTMidi initialization is deferred to initialize() method
     // to ensure UI is ready to receive error signals
 }
@@ -32,172 +73,440 @@ MidiEngine::~MidiEngine() {
 }
 
 bool MidiEngine::initialize() {
-    try {
-        // Initialize RTMidi output (same approach as input - RTMidi correctly detects IAC Driver)
-        if (!m_rtMidiOut) {
-            try {
-                m_rtMidiOut = std::make_unique<RtMidiOut>();
-            } catch (const RtMidiError &rtmidiError) {
-                return false;
-            } catch (...) {
-                return false;
-            }
-        }
-        
+    // The clients used for opening the input and checking cached indexes;
+    // enumeration itself runs on the port scanner's thread
+    if (!m_rtMidiOut) {
         try {
-            unsigned int portCount = m_rtMidiOut->getPortCount();
-            
-            // Add all MIDI ports including Network MIDI
-            m_availableOutputPorts.clear();
-            for (unsigned int i = 0; i < portCount; ++i) {
-                try {
-                    std::string portNameStr = m_rtMidiOut->getPortName(i);
-                    QString portName = QString::fromStdString(portNameStr);
-                    
-                    m_availableOutputPorts.append(portName);
-                } catch (const RtMidiError &rtmidiError) {
-                    // Ignore errors getting individual port names
-                }
-            }
-            
-            // Emit signal so UI can populate the output combo box
-            emit outputPortsRefreshed();
+            m_rtMidiOut = std::make_unique<RtMidiOut>();
         } catch (const RtMidiError &rtmidiError) {
-            emit outputPortsRefreshed(); // Still emit signal with empty list
-        }
-        
-        // Initialize RTMidi input (get available ports)
-        if (!m_rtMidiIn) {
-            try {
-                m_rtMidiIn = std::make_unique<RtMidiIn>();
-            } catch (const RtMidiError &rtmidiError) {
-                emit inputPortsRefreshed();
-                return true; // Output is more critical, continue initialization
-            } catch (...) {
-                emit inputPortsRefreshed();
-                return true; // Output is more critical, continue initialization
-            }
+            return false;
+        } catch (...) {
+            return false;
         }
-        
-        // CRITICAL: Check if a port is already open (possibly from a previous session)
-        // If it's open but not in our filtered list (e.g., Network MIDI), close it
-        if (m_rtMidiIn->isPortOpen()) {
-            // Close any open port - we'll only open valid ports from the filtered list
-            try {
-                m_rtMidiIn->cancelCallback();
-                m_rtMidiIn->closePort();
-                m_currentInputPortIndex = -1;
-                m_currentInputPortName.clear();
-            } catch (const RtMidiError &rtmidiError) {
-                // Ignore errors during cleanup
-            }
+    }
+    
+    if (!m_rtMidiIn) {
+        try {
+            m_rtMidiIn = std::make_unique<RtMidiIn>();
+        } catch (const RtMidiError &rtmidiError) {
+            // Output is more critical, continue initialization
+        } catch (...) {
+            // Output is more critical, continue initialization
         }
-        
+    }
+    
+    // CRITICAL: Check if a port is already open (possibly from a previous session)
+    if (m_rtMidiIn && m_rtMidiIn->isPortOpen()) {
         try {
-            unsigned int portCount = m_rtMidiIn->getPortCount();
-            
-            // Add all MIDI input ports including Network MIDI
-            m_availableInputPorts.clear();
-            for (unsigned int i = 0; i < portCount; ++i) {
-                try {
-                    std::string portNameStr = m_rtMidiIn->getPortName(i);
-                    QString portName = QString::fromStdString(portNameStr);
-                    
-                    m_availableInputPorts.append(portName);
-                } catch (const RtMidiError &rtmidiError) {
-                    // Ignore errors getting individual port names
-                }
-            }
-            
-            // Don't open port yet - wait for user selection
+            m_rtMidiIn->cancelCallback();
+            m_rtMidiIn->closePort();
             m_currentInputPortIndex = -1;
             m_currentInputPortName.clear();
-            
-            // Emit signal so UI can populate the combo box
-            emit inputPortsRefreshed();
         } catch (const RtMidiError &rtmidiError) {
-            // Still emit signal with empty list so UI knows to show empty state
-            emit inputPortsRefreshed();
-            return true; // Output is more critical
+            // Ignore errors during cleanup
         }
-        
-        return true;
-    } catch (const std::exception& e) {
-        return false;
     }
+    
+    // Last session's ports right away (the UI can select and open them
+    // now), then the real list once the first scan is in
+    setPortSnapshot(loadCachedPorts());
+    
+    if (!m_portScanner) {
+        m_portScanner = new MidiPortScanner(this);
+        connect(m_portScanner, &MidiPortScanner::portsScanned, this, &MidiEngine::setPortSnapshot,
+                Qt::QueuedConnection);
+    }
+    m_portScanner->startScanning();
+    
+    return true;
 }
 
 void MidiEngine::shutdown() {
-    // Close RTMidi input
-    if (m_rtMidiIn && m_rtMidiIn->isPortOpen()) {
-        try {
-            m_rtMidiIn->closePort();
-        } catch (const RtMidiError &rtmidiError) {
-            // Ignore errors during shutdown
+    if (m_portScanner) {
+        m_portScanner->stopScanning();
+    }
+    closeInputs();
+    
+    if (m_calibrationTimer && m_calibrationTimer->isActive()) {
+        m_calibrationTimer->stop();
+        m_calibrationPingSentAt.store(0);
+    }
+    m_capture.stopCapture();
+    
+    // Close all outputs (each port flushes its queue first)
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        if (slot.load()) {
+            removeOutputSlot(slot);
+        }
+    }
+    m_deviceOutputPorts.clear();
+    m_currentOutputPortIndex = -1;
+    m_currentOutputPortName.clear();
+    updateMaxOutputLatencyOffset();
+}
+
+QStringList MidiEngine::getOutputPorts() {
+    return m_outputPortTable.names();
+}
+
+QStringList MidiEngine::getInputPorts() {
+    return m_inputPortTable.names();
+}
+
+MidiPortTable MidiEngine::outputPortTable() const {
+    return m_outputPortTable;
+}
+
+MidiPortTable MidiEngine::inputPortTable() const {
+    return m_inputPortTable;
+}
+
+void MidiEngine::setPortSnapshot(const MidiPortSnapshot &snapshot) {
+    // A scan confirming the cache changes nothing but the indexes' status
+    const bool wasCached = m_portsCached;
+    m_portsCached = snapshot.cached;
+    const bool outputsChanged = snapshot.outputs != m_outputPortTable;
+    const bool inputsChanged = snapshot.inputs != m_inputPortTable;
+    if (!outputsChanged && !inputsChanged) {
+        if (wasCached && !snapshot.cached) {
+            saveCachedPorts();
+        }
+        return;
+    }
+    
+    if (outputsChanged) {
+        m_outputPortTable = snapshot.outputs;
+        // CRITICAL: Close open device outputs that disappeared
+        const QStringList previouslyOpenOutputPorts = m_deviceOutputPorts;
+        for (const QString &openPort : previouslyOpenOutputPorts) {
+            if (!m_outputPortTable.findByName(openPort)) {
+                removeOutputPort(openPort);
+            }
+        }
+        if (const MidiPortInfo *current = m_outputPortTable.findByName(m_currentOutputPortName)) {
+            m_currentOutputPortIndex = current->index;
+        }
+    }
+    
+    if (inputsChanged) {
+        m_inputPortTable = snapshot.inputs;
+        // CRITICAL: Close the input if it disappeared
+        const MidiPortInfo *current = m_inputPortTable.findByName(m_currentInputPortName);
+        if (current) {
+            m_currentInputPortIndex = current->index;
+        } else if (m_rtMidiIn && m_rtMidiIn->isPortOpen() && !m_currentInputPortName.isEmpty()) {
+            closeInputPort();
+        }
+        for (const QString &backup : backupInputs()) {
+            if (!m_inputPortTable.findByName(backup)) {
+                removeBackupInput(backup);
+            }
         }
     }
     
-    // Close RTMidi output
-    if (m_rtMidiOut && m_rtMidiOut->isPortOpen()) {
+    if (!snapshot.cached) {
+        saveCachedPorts();
+    }
+    
+    if (outputsChanged) {
+        emit outputPortsRefreshed();
+    }
+    if (inputsChanged) {
+        emit inputPortsRefreshed();
+    }
+}
+
+int MidiEngine::resolvePortIndex(const MidiPortTable &table, const QString &portName, RtMidi *client) const {
+    const MidiPortInfo *port = table.findByName(portName);
+    if (!port) {
+        return -1;
+    }
+    // A cached index may have moved since last session: one name lookup
+    // confirms it instead of waiting for the scan
+    if (m_portsCached) {
         try {
-            m_rtMidiOut->closePort();
-            m_currentOutputPortIndex = -1;
-            m_currentOutputPortName.clear();
+            if (!client || QString::fromStdString(client->getPortName(port->index)) != portName) {
+                return -1;
+            }
         } catch (const RtMidiError &rtmidiError) {
-            // Ignore errors during shutdown
+            return -1;
         }
     }
+    return port->index;
 }
 
-QStringList MidiEngine::getOutputPorts() {
-    return m_availableOutputPorts;
+MidiPortSnapshot MidiEngine::loadCachedPorts() const {
+    QSettings settings("MidiMaster2", "MidiMaster2");
+    MidiPortSnapshot snapshot;
+    snapshot.outputs = MidiPortTable::fromIdsAndNames(settings.value("portCache/outputIds").toStringList(),
+                                                      settings.value("portCache/outputNames").toStringList());
+    snapshot.inputs = MidiPortTable::fromIdsAndNames(settings.value("portCache/inputIds").toStringList(),
+                                                     settings.value("portCache/inputNames").toStringList());
+    snapshot.cached = true;
+    return snapshot;
 }
 
-QStringList MidiEngine::getInputPorts() {
-    return m_availableInputPorts;
+void MidiEngine::saveCachedPorts() const {
+    QSettings settings("MidiMaster2", "MidiMaster2");
+    settings.setValue("portCache/outputIds", m_outputPortTable.ids());
+    settings.setValue("portCache/outputNames", m_outputPortTable.names());
+    settings.setValue("portCache/inputIds", m_inputPortTable.ids());
+    settings.setValue("portCache/inputNames", m_inputPortTable.names());
 }
 
 bool MidiEngine::openOutputPort(const QString &portName) {
-    if (!m_rtMidiOut) {
+    // The primary output (the window's output selection): replaces the
+    // previous primary, leaving any additional fan-out ports open
+    if (!m_currentOutputPortName.isEmpty() && m_currentOutputPortName != portName) {
+        removeOutputPort(m_currentOutputPortName);
+        m_currentOutputPortIndex = -1;
+        m_currentOutputPortName.clear();
+    }
+    
+    if (!findOutputSlot(portName) && !addOutputPort(portName)) {
         return false;
     }
     
-    // Close previous port if open
-    if (m_rtMidiOut->isPortOpen()) {
+    const MidiPortInfo *port = m_outputPortTable.findByName(portName);
+    m_currentOutputPortIndex = port ? port->index : -1;
+    m_currentOutputPortName = portName;
+    
+    emit outputPortChanged(portName);
+    
+    return true;
+}
+
+bool MidiEngine::addOutputPort(const QString &portName, quint8 routes) {
+    if (findOutputSlot(portName)) {
+        return setOutputPortRoutes(portName, routes);
+    }
+    
+    const int portIndex = resolvePortIndex(m_outputPortTable, portName, m_rtMidiOut.get());
+    if (portIndex < 0) {
+        return false;
+    }
+    
+    std::unique_ptr<MidiOutputBackend> backend;
+    if (m_timestampedOutput) {
+        auto timestamped = std::make_unique<TimestampedOutputBackend>();
+        QString error;
+        if (timestamped->open(portName, static_cast<unsigned int>(portIndex), &error)) {
+            backend = std::move(timestamped);
+        } else {
+            qWarning() << "Timestamped output unavailable for" << portName << "-" << error;
+        }
+    }
+    if (!backend) {
         try {
-            m_rtMidiOut->closePort();
+            auto rtMidiBackend = std::make_unique<RtMidiOutputBackend>();
+            rtMidiBackend->open(static_cast<unsigned int>(portIndex));
+            backend = std::move(rtMidiBackend);
         } catch (const RtMidiError &rtmidiError) {
-            // Ignore errors
+            return false;
         }
     }
     
-    // Find the port index
-    int portIndex = -1;
-    for (int i = 0; i < m_availableOutputPorts.size(); ++i) {
-        if (m_availableOutputPorts[i] == portName) {
-            portIndex = i;
-            break;
-        }
+    if (!addOutputPort(portName, std::move(backend), routes)) {
+        return false;
     }
-    
-    if (portIndex < 0) {
+    m_deviceOutputPorts.append(portName);
+    return true;
+}
+
+bool MidiEngine::addOutputPort(const QString &name, std::unique_ptr<MidiOutputBackend> backend, quint8 routes) {
+    if (!backend || findOutputSlot(name)) {
         return false;
     }
     
-    // Open the port
-    try {
-        m_rtMidiOut->openPort(portIndex);
-        m_currentOutputPortIndex = portIndex;
-        m_currentOutputPortName = portName;
-        
-        emit outputPortChanged(portName);
-        
-        return true;
-    } catch (const RtMidiError &rtmidiError) {
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        if (!slot.load()) {
+            slot.store(new MidiOutputPort(name, std::move(backend), routes,
+                                          &histogram(LatencyStage::OutputSend)));
+            updateMaxOutputLatencyOffset();
+            return true;
+        }
+    }
+    return false; // All MAX_OUTPUT_PORTS slots in use
+}
+
+void MidiEngine::removeOutputPort(const QString &portName) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (slot) {
+        removeOutputSlot(*slot);
+        updateMaxOutputLatencyOffset();
+    }
+    m_deviceOutputPorts.removeAll(portName);
+    if (portName == m_currentOutputPortName) {
         m_currentOutputPortIndex = -1;
         m_currentOutputPortName.clear();
+    }
+}
+
+bool MidiEngine::setOutputPortRoutes(const QString &portName, quint8 routes) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (!slot) {
+        return false;
+    }
+    slot->load()->setRoutes(routes);
+    return true;
+}
+
+QStringList MidiEngine::openOutputPorts() const {
+    QStringList names;
+    for (const std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port) {
+            names.append(port->name());
+        }
+    }
+    return names;
+}
+
+QList<OutputPortStats> MidiEngine::outputPortStats() const {
+    QList<OutputPortStats> stats;
+    for (const std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port) {
+            stats.append(port->stats());
+        }
+    }
+    return stats;
+}
+
+bool MidiEngine::setOutputLatencyOffset(const QString &portName, double offsetMs) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (!slot) {
+        return false;
+    }
+    slot->load()->setLatencyOffsetMs(offsetMs);
+    updateMaxOutputLatencyOffset();
+    return true;
+}
+
+bool MidiEngine::setOutputClockRate(const QString &portName, int multiplier, int divider) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (!slot) {
+        return false;
+    }
+    slot->load()->setClockRate(multiplier, divider);
+    return true;
+}
+
+bool MidiEngine::setOutputPortZones(const QString &portName, quint8 zones) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (!slot) {
         return false;
     }
+    slot->load()->setZones(zones);
+    updateMaxOutputLatencyOffset();
+    return true;
+}
+
+double MidiEngine::outputLatencyOffset(const QString &portName) const {
+    for (const std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port && port->name() == portName) {
+            return port->latencyOffsetMs();
+        }
+    }
+    return MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS;
+}
+
+double MidiEngine::maxOutputLatencyOffsetMs(quint8 zones) const {
+    if (zones == MidiOutputZone::All) {
+        return m_maxOutputLatencyOffsetMs.load(std::memory_order_relaxed);
+    }
+    double maxOffset = -1.0;
+    for (int zone = 0; zone < MidiOutputZone::MAX_ZONES; ++zone) {
+        if (zones & MidiOutputZone::forZone(zone)) {
+            maxOffset = qMax(maxOffset, m_zoneMaxOutputLatencyOffsetMs[zone].load(std::memory_order_relaxed));
+        }
+    }
+    return maxOffset >= 0.0 ? maxOffset : MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS;
+}
+
+void MidiEngine::updateMaxOutputLatencyOffset() {
+    bool anyOpen = false;
+    double maxOffset = 0.0;
+    double zoneMaxOffset[MidiOutputZone::MAX_ZONES];
+    for (double &offset : zoneMaxOffset) {
+        offset = -1.0;
+    }
+    for (const std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port) {
+            anyOpen = true;
+            maxOffset = qMax(maxOffset, port->latencyOffsetMs());
+            for (int zone = 0; zone < MidiOutputZone::MAX_ZONES; ++zone) {
+                if (port->zones() & MidiOutputZone::forZone(zone)) {
+                    zoneMaxOffset[zone] = qMax(zoneMaxOffset[zone], port->latencyOffsetMs());
+                }
+            }
+        }
+    }
+    m_maxOutputLatencyOffsetMs.store(anyOpen ? maxOffset : MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS,
+                                     std::memory_order_relaxed);
+    for (int zone = 0; zone < MidiOutputZone::MAX_ZONES; ++zone) {
+        m_zoneMaxOutputLatencyOffsetMs[zone].store(zoneMaxOffset[zone], std::memory_order_relaxed);
+    }
+}
+
+bool MidiEngine::timestampedOutputAvailable() {
+    return TimestampedOutputBackend::isAvailable();
+}
+
+void MidiEngine::setTimestampedOutput(bool enabled) {
+    m_timestampedOutput = enabled && timestampedOutputAvailable();
+}
+
+void MidiEngine::cancelScheduledOutput(quint8 zones) {
+    if (m_outputBackend) {
+        m_outputBackend->cancelScheduled();
+        return;
+    }
+    m_outputSendersInFlight.fetch_add(1);
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port && (port->zones() & zones)) {
+            port->cancelScheduled();
+        }
+    }
+    m_outputSendersInFlight.fetch_sub(1);
+}
+
+std::atomic<MidiOutputPort *> *MidiEngine::findOutputSlot(const QString &name) {
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port && port->name() == name) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+void MidiEngine::removeOutputSlot(std::atomic<MidiOutputPort *> &slot) {
+    // Unpublish, then wait for senders that may still hold the pointer
+    // (fanOut() is a few enqueues long) before destroying the port
+    MidiOutputPort *port = slot.exchange(nullptr);
+    while (m_outputSendersInFlight.load() != 0) {
+        QThread::yieldCurrentThread();
+    }
+    delete port;
+}
+
+bool MidiEngine::fanOut(const MidiOutputBatch &batch, qint64 presentationTimeNs, bool compensate,
+                        quint8 zones) {
+    bool sent = false;
+    m_outputSendersInFlight.fetch_add(1);
+    const qint64 now = MidiTime::nowNanoseconds();
+    for (std::atomic<MidiOutputPort *> &slot : m_outputPorts) {
+        MidiOutputPort *port = slot.load();
+        if (port && (port->zones() & zones) && port->enqueue(batch, now, presentationTimeNs, compensate)) {
+            sent = true;
+        }
+    }
+    m_outputSendersInFlight.fetch_sub(1);
+    return sent;
 }
 
 bool MidiEngine::openInputPort(const QString &portName) {
@@ -205,6 +514,12 @@ bool MidiEngine::openInputPort(const QString &portName) {
         return false;
     }
     
+    // A port is either the input or a backup; a new input is a new source
+    removeBackupInput(portName);
+    closeNetworkInput();
+    stopCaptureReplay();
+    m_clockArbiter->resetSource(0);
+    
     // Close previous port if open
     if (m_rtMidiIn->isPortOpen()) {
         try {
@@ -223,15 +538,7 @@ bool MidiEngine::openInputPort(const QString &portName) {
         // Ignore errors if no callback was set
     }
     
-    // Find the port index
-    int portIndex = -1;
-    for (int i = 0; i < m_availableInputPorts.size(); ++i) {
-        if (m_availableInputPorts[i] == portName) {
-            portIndex = i;
-            break;
-        }
-    }
-    
+    const int portIndex = resolvePortIndex(m_inputPortTable, portName, m_rtMidiIn.get());
     if (portIndex < 0) {
         return false;
     }
@@ -250,13 +557,12 @@ bool MidiEngine::openInputPort(const QString &portName) {
             // Ignore errors if no callback was set - this is fine
         }
         
-        // Set callback function
+        // Set callback function (fresh timestamp chain for the new port)
+        m_arrivalClock.reset();
         m_rtMidiIn->setCallback(&MidiEngine::rtMidiCallback, this);
     
-        // Start message processor timer
-        if (m_messageProcessorTimer) {
-            m_messageProcessorTimer->start();
-        }
+        // Start message processor (timer or real-time thread)
+        startInputProcessing();
         
         m_currentInputPortIndex = portIndex;
         m_currentInputPortName = portName;
@@ -272,14 +578,8 @@ bool MidiEngine::openInputPort(const QString &portName) {
 }
 
 void MidiEngine::closeOutputPort() {
-    if (m_rtMidiOut && m_rtMidiOut->isPortOpen()) {
-        try {
-            m_rtMidiOut->closePort();
-            m_currentOutputPortIndex = -1;
-            m_currentOutputPortName.clear();
-        } catch (const RtMidiError &rtmidiError) {
-            // Ignore errors
-        }
+    if (!m_currentOutputPortName.isEmpty()) {
+        removeOutputPort(m_currentOutputPortName);
     }
 }
 
@@ -287,302 +587,944 @@ void MidiEngine::closeInputPort() {
     if (m_rtMidiIn && m_rtMidiIn->isPortOpen()) {
         try {
             // Stop message processor
-            if (m_messageProcessorTimer) {
-                m_messageProcessorTimer->stop();
-            }
-            
-            // Clear any queued messages
-            {
-                QMutexLocker locker(&m_messageQueueMutex);
-                m_messageQueue.clear();
-            }
+            stopInputProcessing();
             
+            // Detach the producer before clearing so the ring has a single writer
             m_rtMidiIn->cancelCallback();
+            clearInputQueue();
+            m_inputParser.reset();
+            m_callbackSysEx.abort();
+            
             m_rtMidiIn->closePort();
             m_currentInputPortIndex = -1;
             m_currentInputPortName.clear();
         } catch (const RtMidiError &rtmidiError) {
             // Ignore errors
         }
+        // A backup takes over at once instead of after the timeout
+        m_clockArbiter->resetSource(0);
+        if (anyInputOpen()) {
+            startInputProcessing();
+        }
     }
 }
 
-QString MidiEngine::currentOutputPort() const {
-    return m_currentOutputPortName;
+void MidiEngine::closeInputs() {
+    stopInputProcessing();
+    if (m_rtMidiIn && m_rtMidiIn->isPortOpen()) {
+        try {
+            m_rtMidiIn->cancelCallback();
+            clearInputQueue();
+            m_inputParser.reset();
+            m_callbackSysEx.abort();
+            m_rtMidiIn->closePort();
+            m_currentInputPortIndex = -1;
+            m_currentInputPortName.clear();
+        } catch (const RtMidiError &rtmidiError) {
+            // Ignore errors
+        }
+        m_clockArbiter->resetSource(0);
+    }
+    for (std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (backup) {
+            try {
+                backup->rtMidiIn->cancelCallback();
+                backup->rtMidiIn->closePort();
+            } catch (const RtMidiError &rtmidiError) {
+                // Ignore errors
+            }
+            m_clockArbiter->resetSource(backup->source);
+            backup.reset();
+        }
+    }
+    closeNetworkInput();
+    stopCaptureReplay();
+    // Holdover ticks are delivered from its thread
+    m_clockArbiter->stopArbiter();
 }
 
-QString MidiEngine::currentInputPort() const {
-    return m_currentInputPortName;
+bool MidiEngine::openNetworkInput(quint16 controlPort, const QString &sessionName) {
+    closeNetworkInput();
+    closeInputPort();
+    stopCaptureReplay();
+    
+    // The session thread is the raw stream's only feeder while it is open
+    std::unique_ptr<RtpMidiSession> session(new RtpMidiSession());
+    session->setDeliverCallback([this](const quint8 *bytes, int size, qint64 timestampNs) {
+        handleRawMIDIBytes(bytes, size, timestampNs);
+    });
+    m_rawParser.reset();
+    if (!session->startSession(controlPort, sessionName)) {
+        return false;
+    }
+    m_networkInput = std::move(session);
+    m_clockArbiter->resetSource(0);
+    return true;
 }
 
-void MidiEngine::sendNoteOn(int channel, int note, int velocity) {
-    if (!m_rtMidiOut || !m_rtMidiOut->isPortOpen()) return;
-    try {
-        std::vector<unsigned char> message;
-        message.push_back(static_cast<unsigned char>(0x90 | (channel & 0x0F))); // Note On
-        message.push_back(static_cast<unsigned char>(note & 0x7F));
-        message.push_back(static_cast<unsigned char>(velocity & 0x7F));
-        m_rtMidiOut->sendMessage(&message);
-    } catch (const RtMidiError &rtmidiError) {
-        // Ignore errors
+void MidiEngine::closeNetworkInput() {
+    if (!m_networkInput) {
+        return;
     }
+    m_networkInput->stopSession();
+    m_networkInput.reset();
+    m_rawParser.reset();
+    // A backup takes over at once instead of after the timeout
+    m_clockArbiter->resetSource(0);
 }
 
-void MidiEngine::sendNoteOff(int channel, int note, int velocity) {
-    if (!m_rtMidiOut || !m_rtMidiOut->isPortOpen()) return;
-    try {
-        std::vector<unsigned char> message;
-        message.push_back(static_cast<unsigned char>(0x80 | (channel & 0x0F))); // Note Off
-        message.push_back(static_cast<unsigned char>(note & 0x7F));
-        message.push_back(static_cast<unsigned char>(velocity & 0x7F));
-        m_rtMidiOut->sendMessage(&message);
-    } catch (const RtMidiError &rtmidiError) {
-        // Ignore errors
-    }
+bool MidiEngine::networkInputOpen() const {
+    return m_networkInput != nullptr;
 }
 
-void MidiEngine::sendSystemMessage(int status) {
-    if (!m_rtMidiOut || !m_rtMidiOut->isPortOpen()) return;
-    try {
-        std::vector<unsigned char> message;
-        message.push_back(static_cast<unsigned char>(status & 0xFF));
-        m_rtMidiOut->sendMessage(&message);
-    } catch (const RtMidiError &rtmidiError) {
-        // Ignore errors
-    }
+bool MidiEngine::startCapture(const QString &path) {
+    return m_capture.startCapture(path);
 }
 
-void MidiEngine::sendSongPositionPointer(int position) {
-    if (!m_rtMidiOut || !m_rtMidiOut->isPortOpen()) return;
-    try {
-        // SPP is 14-bit: position in 16th notes (MIDI beats)
-        // Send as 0xF2 followed by LSB (7 bits) and MSB (7 bits)
-        quint8 lsb = static_cast<quint8>(position & 0x7F);
-        quint8 msb = static_cast<quint8>((position >> 7) & 0x7F);
-        
-        std::vector<unsigned char> message;
-        message.push_back(0xF2); // Song Position Pointer
-        message.push_back(lsb);
-        message.push_back(msb);
-        m_rtMidiOut->sendMessage(&message);
-    } catch (const RtMidiError &rtmidiError) {
-        // Ignore errors
+void MidiEngine::stopCapture() {
+    m_capture.stopCapture();
+}
+
+quint64 MidiEngine::prefaultMemory() {
+    quint64 bytes = RealtimeScheduling::prefault(this, sizeof(*this));
+    bytes += RealtimeScheduling::prefault(m_sysExPool->data(1), static_cast<std::size_t>(m_sysExPool->bufferCount())
+                                                                * m_sysExPool->bufferSize());
+    for (const std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (backup) {
+            bytes += RealtimeScheduling::prefault(backup.get(), sizeof(BackupInput));
+        }
     }
+    return bytes;
 }
 
-void MidiEngine::refreshPorts() {
-    // Refresh RTMidi output ports (same approach as input)
-    if (!m_rtMidiOut) {
-        try {
-            m_rtMidiOut = std::make_unique<RtMidiOut>();
-        } catch (const RtMidiError &rtmidiError) {
-            emit outputPortsRefreshed();
-            // Continue with input refresh
-        } catch (...) {
-            emit outputPortsRefreshed();
-            // Continue with input refresh
+bool MidiEngine::startCaptureReplay(const QString &path, double speed, QString *error) {
+    // Backups included: their input thread already consumes the queue
+    if (anyInputOpen() || m_networkInput) {
+        if (error) {
+            *error = "Close the inputs first (backups included): the replay takes their place";
         }
+        return false;
+    }
+    std::unique_ptr<MidiCaptureFile> capture = MidiCaptureFile::open(path, error);
+    if (!capture) {
+        return false;
     }
+    stopCaptureReplay();
     
-    if (m_rtMidiOut) {
-        // CRITICAL: Save the currently open port name before refreshing
-        QString previouslyOpenOutputPort = m_currentOutputPortName;
-        
-        try {
-            unsigned int portCount = m_rtMidiOut->getPortCount();
-            
-            // Add all MIDI output ports including Network MIDI
-            m_availableOutputPorts.clear();
-            for (unsigned int i = 0; i < portCount; ++i) {
-                try {
-                    std::string portNameStr = m_rtMidiOut->getPortName(i);
-                    QString portName = QString::fromStdString(portNameStr);
-                    m_availableOutputPorts.append(portName);
-                } catch (const RtMidiError &rtmidiError) {
-                    // Ignore errors getting individual port names
-                }
-            }
-            
-            // CRITICAL: Check if the previously open output port is still valid after refresh
-            if (m_rtMidiOut->isPortOpen() && !previouslyOpenOutputPort.isEmpty()) {
-                if (!m_availableOutputPorts.contains(previouslyOpenOutputPort)) {
-                    try {
-                        m_rtMidiOut->closePort();
-                        m_currentOutputPortIndex = -1;
-                        m_currentOutputPortName.clear();
-                    } catch (const RtMidiError &rtmidiError) {
-                        // Ignore errors
-                    }
-                }
-            }
-            
-            emit outputPortsRefreshed();
-        } catch (const RtMidiError &rtmidiError) {
-            // Ignore errors during refresh
+    m_replayer.reset(new MidiCaptureReplayer());
+    m_replayer->setDeliverCallback([this](const quint8 *bytes, int size, qint64 timestampNs) {
+        enqueueReplayed(bytes, size, timestampNs);
+    });
+    connect(m_replayer.get(), &QThread::finished, this, &MidiEngine::captureReplayFinished,
+            Qt::QueuedConnection);
+    clearInputQueue();
+    m_inputParser.reset();
+    m_clockArbiter->resetSource(0);
+    startInputProcessing();
+    m_replayer->startReplay(std::move(capture), speed);
+    return true;
+}
+
+void MidiEngine::stopCaptureReplay() {
+    if (!m_replayer) {
+        return;
+    }
+    m_replayer->stopReplay();
+    m_replayer.reset();
+    if (!anyInputOpen()) {
+        stopInputProcessing();
+    }
+}
+
+bool MidiEngine::isReplayingCapture() const {
+    return m_replayer && m_replayer->isRunning();
+}
+
+// Replay thread: queued like the RtMidi callback queues a message
+void MidiEngine::enqueueReplayed(const quint8 *bytes, int size, qint64 timestampNs) {
+    MidiEvent event;
+    event.sysExHandle = 0;
+    event.sysExSize = 0;
+    event.size = static_cast<quint8>(size);
+    std::memcpy(event.bytes, bytes, size);
+    event.deltatime = 0.0;
+    event.timestamp = timestampNs;
+    event.enqueuedAt = MidiTime::nowNanoseconds();
+    m_inputReceivedCount.fetch_add(1, std::memory_order_relaxed);
+    if (m_inputQueue.push(event)) {
+        m_inputWake.notify();
+    }
+}
+
+bool MidiEngine::addBackupInput(const QString &portName) {
+    if (portName == m_currentInputPortName || backupInputs().contains(portName)) {
+        return false;
+    }
+    int slot = 0;
+    while (slot < MAX_BACKUP_INPUTS && m_backupInputs[slot]) {
+        ++slot;
+    }
+    if (slot == MAX_BACKUP_INPUTS) {
+        return false;
+    }
+    
+    std::unique_ptr<BackupInput> backup(new BackupInput());
+    backup->engine = this;
+    backup->source = slot + 1;
+    backup->name = portName;
+    backup->parser.setSysExPool(m_sysExPool.get());
+    try {
+        backup->rtMidiIn = std::make_unique<RtMidiIn>();
+        const int portIndex = resolvePortIndex(m_inputPortTable, portName, backup->rtMidiIn.get());
+        if (portIndex < 0) {
+            return false;
         }
+        backup->rtMidiIn->openPort(portIndex);
+        // Timing messages only: SysEx and Active Sensing are never queued
+        backup->rtMidiIn->ignoreTypes(true, false, true);
+    } catch (const RtMidiError &rtmidiError) {
+        return false;
     }
     
-    // Refresh RTMidi input ports
-    if (!m_rtMidiIn) {
+    // The slot is read by the input processing: install it stopped
+    stopInputProcessing();
+    m_clockArbiter->resetSource(backup->source);
+    backup->rtMidiIn->setCallback(&MidiEngine::rtMidiBackupCallback, backup.get());
+    m_backupInputs[slot] = std::move(backup);
+    startInputProcessing();
+    return true;
+}
+
+void MidiEngine::removeBackupInput(const QString &portName) {
+    for (std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (!backup || backup->name != portName) {
+            continue;
+        }
+        stopInputProcessing();
         try {
-            m_rtMidiIn = std::make_unique<RtMidiIn>();
+            backup->rtMidiIn->cancelCallback();
+            backup->rtMidiIn->closePort();
         } catch (const RtMidiError &rtmidiError) {
-            emit inputPortsRefreshed();
-            return;
-        } catch (...) {
-            emit inputPortsRefreshed();
-            return;
+            // Ignore errors
+        }
+        m_clockArbiter->resetSource(backup->source);
+        backup.reset();
+        if (anyInputOpen()) {
+            startInputProcessing();
+        }
+        return;
+    }
+}
+
+QStringList MidiEngine::backupInputs() const {
+    QStringList names;
+    for (const std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (backup) {
+            names.append(backup->name);
+        }
+    }
+    return names;
+}
+
+void MidiEngine::setClockFailover(bool enabled) {
+    // Enabled again, also after closeInputs() stopped the thread
+    if (enabled) {
+        m_clockArbiter->startArbiter();
+    }
+    if (enabled == m_clockFailover.load()) {
+        return;
+    }
+    m_clockFailover.store(enabled, std::memory_order_release);
+    if (!enabled) {
+        m_clockArbiter->stopArbiter();
+    }
+}
+
+bool MidiEngine::clockFailoverEnabled() const {
+    return m_clockFailover.load(std::memory_order_acquire);
+}
+
+void MidiEngine::setClockTimeoutPeriods(double periods) {
+    m_clockArbiter->setTimeoutPeriods(periods);
+}
+
+QString MidiEngine::clockSourceName(int source) const {
+    if (source == 0) {
+        return m_networkInput ? QString("RTP-MIDI :%1").arg(m_networkInput->controlPort())
+                              : m_currentInputPortName;
+    }
+    if (source > 0 && source <= MAX_BACKUP_INPUTS && m_backupInputs[source - 1]) {
+        return m_backupInputs[source - 1]->name;
+    }
+    return QString();
+}
+
+bool MidiEngine::anyInputOpen() const {
+    if (m_rtMidiIn && m_rtMidiIn->isPortOpen()) {
+        return true;
+    }
+    for (const std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (backup) {
+            return true;
         }
     }
+    return false;
+}
+
+MidiTransportSink *MidiEngine::primaryTransportSink() const {
+    return m_clockFailover.load(std::memory_order_acquire) ? m_clockArbiter->sourceSink(0)
+                                                           : m_transportSink.load(std::memory_order_acquire);
+}
+
+QString MidiEngine::currentOutputPort() const {
+    return m_currentOutputPortName;
+}
+
+QString MidiEngine::currentInputPort() const {
+    return m_currentInputPortName;
+}
+
+void MidiEngine::setProcessingMode(ProcessingMode mode) {
+    if (mode == m_processingMode) {
+        return;
+    }
     
-    // CRITICAL: Save the currently open port name before refreshing
-    // We'll check if it's still valid after filtering
-    QString previouslyOpenPort = m_currentInputPortName;
+    bool inputActive = anyInputOpen();
+    if (inputActive) {
+        stopInputProcessing();
+    }
     
-        try {
-            unsigned int portCount = m_rtMidiIn->getPortCount();
-            
-            // Add all MIDI input ports including Network MIDI
-            m_availableInputPorts.clear();
-            for (unsigned int i = 0; i < portCount; ++i) {
-                try {
-                    std::string portNameStr = m_rtMidiIn->getPortName(i);
-                    QString portName = QString::fromStdString(portNameStr);
-                    m_availableInputPorts.append(portName);
-                } catch (const RtMidiError &rtmidiError) {
-                    // Ignore errors getting individual port names
-                }
-            }
-        
-        // CRITICAL: Check if the previously open port is still valid after refresh
-        if (m_rtMidiIn->isPortOpen() && !previouslyOpenPort.isEmpty()) {
-            if (!m_availableInputPorts.contains(previouslyOpenPort)) {
-                try {
-                    m_rtMidiIn->cancelCallback();
-                    m_rtMidiIn->closePort();
-                    m_currentInputPortIndex = -1;
-                    m_currentInputPortName.clear();
-                } catch (const RtMidiError &rtmidiError) {
-                    // Ignore errors during cleanup
-                }
-            }
+    m_processingMode = mode;
+    
+    if (inputActive) {
+        startInputProcessing();
+    }
+}
+
+MidiEngine::ProcessingMode MidiEngine::processingMode() const {
+    return m_processingMode;
+}
+
+void MidiEngine::startInputProcessing() {
+    if (m_processingMode == ProcessingMode::RealtimeThread) {
+        if (!m_inputThread) {
+            m_inputThread = std::make_unique<MidiInputThread>(this, &m_inputWake);
         }
-        
-        emit inputPortsRefreshed();
-    } catch (const RtMidiError &rtmidiError) {
-        // Still emit signal with empty list so UI knows to show empty state
-        emit inputPortsRefreshed();
+        if (!m_inputThread->isRunning()) {
+            m_inputThread->start(QThread::TimeCriticalPriority);
+        }
+    } else if (m_messageProcessorTimer) {
+        m_messageProcessorTimer->start();
+    }
+}
+
+void MidiEngine::stopInputProcessing() {
+    if (m_messageProcessorTimer) {
+        m_messageProcessorTimer->stop();
+    }
+    if (m_inputThread) {
+        m_inputThread->stop();
+    }
+}
+
+quint64 MidiEngine::inputOverflowCount() const {
+    return m_inputQueue.overflowCount();
+}
+
+const LatencyHistogram &MidiEngine::latencyHistogram(LatencyStage stage) const {
+    return m_latencyHistograms[static_cast<int>(stage)];
+}
+
+MidiEngine::InputCounters MidiEngine::inputCounters() const {
+    InputCounters counters;
+    counters.received = m_inputReceivedCount.load(std::memory_order_relaxed);
+    counters.dropped = m_inputQueue.overflowCount();
+    counters.queueHighWaterMark = m_inputQueue.highWaterMark();
+    counters.queueCapacity = MidiEventQueue::capacity();
+    return counters;
+}
+
+void MidiEngine::resetInstrumentation() {
+    for (LatencyHistogram &latency : m_latencyHistograms) {
+        latency.reset();
+    }
+    m_inputQueue.resetHighWaterMark();
+}
+
+void MidiEngine::setTransportSink(MidiTransportSink *sink) {
+    m_transportSinks.clear();
+    m_transportSinks.add(sink);
+    updateTransportSink();
+}
+
+MidiTransportSink *MidiEngine::transportSink() const {
+    return m_transportSinks.count() > 0 ? m_transportSinks.at(0) : nullptr;
+}
+
+bool MidiEngine::addTransportSink(MidiTransportSink *sink) {
+    if (!m_transportSinks.add(sink)) {
+        return false;
+    }
+    updateTransportSink();
+    return true;
+}
+
+void MidiEngine::removeTransportSink(MidiTransportSink *sink) {
+    if (m_transportSinks.remove(sink)) {
+        updateTransportSink();
+    }
+}
+
+void MidiEngine::updateTransportSink() {
+    // One sink needs no fan-out in between
+    const int count = m_transportSinks.count();
+    MidiTransportSink *sink = count > 1 ? &m_transportSinks : count == 1 ? m_transportSinks.at(0) : nullptr;
+    m_transportSink.store(sink, std::memory_order_release);
+    m_clockArbiter->setSink(sink);
+}
+
+void MidiEngine::setSysExSink(MidiSysExSink *sink) {
+    m_sysExSink.store(sink, std::memory_order_release);
+}
+
+bool MidiEngine::setSysExLimits(int maxSize, int bufferCount) {
+    // Every input feeding a parser is closed, so nothing holds a buffer
+    // or consumes the queue while the pool is swapped
+    if (anyInputOpen() || m_networkInput || m_replayer) {
+        return false;
+    }
+    clearInputQueue();
+    m_inputParser.setSysExPool(nullptr);
+    m_rawParser.setSysExPool(nullptr);
+    m_umpDecoder.setSysExPool(nullptr);
+    m_callbackSysEx.setPool(nullptr);
+    m_sysExPool.reset(new SysExBufferPool(bufferCount, maxSize));
+    m_inputParser.setSysExPool(m_sysExPool.get());
+    m_rawParser.setSysExPool(m_sysExPool.get());
+    m_umpDecoder.setSysExPool(m_sysExPool.get());
+    m_callbackSysEx.setPool(m_sysExPool.get());
+    return true;
+}
+
+SysExBufferPool::Stats MidiEngine::sysExStats() const {
+    return m_sysExPool->stats();
+}
+
+void MidiEngine::setOutputBackend(MidiOutputBackend *backend) {
+    m_outputBackend = backend;
+}
+
+void MidiEngine::sendMessage(const unsigned char *data, size_t size, quint8 zones) {
+    m_capture.recordOutput(data, size, MidiTime::nowNanoseconds());
+    if (m_outputBackend) {
+        const qint64 start = MidiTime::nowNanoseconds();
+        m_outputBackend->sendMessage(data, size);
+        histogram(LatencyStage::OutputSend).record(MidiTime::nowNanoseconds() - start);
+        countFlush(1);
+        return;
+    }
+    
+    MidiOutputBatch batch;
+    batch.append(data, size);
+    if (fanOut(batch, 0, true, zones)) {
+        countFlush(1);
+    }
+}
+
+void MidiEngine::sendBatch(MidiOutputBatch &batch, quint8 zones) {
+    if (!prepareBatch(batch)) {
+        return;
+    }
+    
+    // Each port's worker sends the batch back-to-back on its own thread
+    // (RtMidi takes exactly one message per call, it rejects concatenated
+    // short messages)
+    if (fanOut(batch, 0, true, zones)) {
+        countFlush(batch.liveCount());
+    }
+}
+
+void MidiEngine::scheduleBatch(MidiOutputBatch &batch, qint64 presentationTimeNs, quint8 zones) {
+    if (!prepareBatch(batch, presentationTimeNs)) {
+        return;
+    }
+    
+    if (fanOut(batch, presentationTimeNs, true, zones)) {
+        countFlush(batch.liveCount());
+    }
+}
+
+void MidiEngine::sendBatchAt(MidiOutputBatch &batch, qint64 sendAtNs, quint8 zones) {
+    if (!prepareBatch(batch, sendAtNs)) {
+        return;
+    }
+    
+    if (fanOut(batch, sendAtNs, false, zones)) {
+        countFlush(batch.liveCount());
+    }
+}
+
+bool MidiEngine::prepareBatch(MidiOutputBatch &batch, qint64 presentationTimeNs) {
+    // Returns true if the batch still needs to go to the fan-out ports
+    if (batch.isEmpty()) return false;
+    
+    if (m_coalescingPolicy.load(std::memory_order_relaxed) == CoalescingPolicy::DropCancellingNotePairs) {
+        int dropped = batch.coalesceNotePairs();
+        if (dropped > 0) {
+            m_coalescedCount.fetch_add(dropped, std::memory_order_relaxed);
+        }
+    }
+    m_capture.recordBatch(batch, presentationTimeNs);
+    
+    if (m_outputBackend) {
+        const qint64 start = MidiTime::nowNanoseconds();
+        if (presentationTimeNs > 0 && m_outputBackend->schedulesDelivery()) {
+            m_outputBackend->scheduleBatch(batch, presentationTimeNs);
+        } else {
+            m_outputBackend->sendBatch(batch);
+        }
+        histogram(LatencyStage::OutputSend).record(MidiTime::nowNanoseconds() - start);
+        countFlush(batch.liveCount());
+        return false;
+    }
+    return true;
+}
+
+bool MidiEngine::startLatencyCalibration(const QString &portName, int samples) {
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(portName);
+    if (isCalibrating() || !slot || samples <= 0 ||
+        !(slot->load()->routes() & MidiOutputRoute::Notes) ||
+        !m_rtMidiIn || !m_rtMidiIn->isPortOpen()) {
+        return false;
+    }
+    
+    m_calibrationPort = portName;
+    m_calibrationSamplesWanted = samples;
+    m_calibrationPingsSent = 0;
+    m_calibrationSamples.clear();
+    m_calibrationPingSentAt.store(0);
+    m_calibrationEchoAt.store(0);
+    m_calibrationTimer->start();
+    onCalibrationTimer(); // First ping right away
+    return true;
+}
+
+bool MidiEngine::isCalibrating() const {
+    return m_calibrationTimer && m_calibrationTimer->isActive();
+}
+
+void MidiEngine::onCalibrationTimer() {
+    // Collect the previous ping's echo, if it came back
+    const qint64 sentAt = m_calibrationPingSentAt.load();
+    const qint64 echoAt = m_calibrationEchoAt.load();
+    if (sentAt != 0 && echoAt != 0) {
+        m_calibrationSamples.append((echoAt - sentAt) / 1000000.0);
+    }
+    
+    // Done, or give up after twice as many pings as samples wanted
+    std::atomic<MidiOutputPort *> *slot = findOutputSlot(m_calibrationPort);
+    if (!slot || m_calibrationSamples.size() >= m_calibrationSamplesWanted ||
+        m_calibrationPingsSent >= m_calibrationSamplesWanted * 2) {
+        finishLatencyCalibration();
+        return;
+    }
+    
+    // Ping: a velocity-1 Note On on a channel nothing else uses, followed
+    // by its Note Off so a device listening to it never hangs
+    MidiOutputBatch batch;
+    batch.noteOn(CALIBRATION_CHANNEL, CALIBRATION_NOTE, 1);
+    batch.noteOff(CALIBRATION_CHANNEL, CALIBRATION_NOTE, 0);
+    m_calibrationEchoAt.store(0);
+    m_calibrationPingSentAt.store(MidiTime::nowNanoseconds());
+    m_outputSendersInFlight.fetch_add(1);
+    slot->load()->enqueue(batch, MidiTime::nowNanoseconds());
+    m_outputSendersInFlight.fetch_sub(1);
+    ++m_calibrationPingsSent;
+}
+
+void MidiEngine::finishLatencyCalibration() {
+    m_calibrationTimer->stop();
+    m_calibrationPingSentAt.store(0);
+    
+    // The round trip includes the input side too, so the offset errs on
+    // the early side; the median rejects the odd scheduling hiccup
+    const bool success = !m_calibrationSamples.isEmpty() && findOutputSlot(m_calibrationPort);
+    double latencyMs = 0.0;
+    if (success) {
+        std::sort(m_calibrationSamples.begin(), m_calibrationSamples.end());
+        latencyMs = m_calibrationSamples.at(m_calibrationSamples.size() / 2);
+        setOutputLatencyOffset(m_calibrationPort, latencyMs);
+    }
+    emit latencyCalibrationFinished(m_calibrationPort, latencyMs, success);
+}
+
+void MidiEngine::setCoalescingPolicy(CoalescingPolicy policy) {
+    m_coalescingPolicy.store(policy);
+}
+
+MidiEngine::CoalescingPolicy MidiEngine::coalescingPolicy() const {
+    return m_coalescingPolicy.load();
+}
+
+void MidiEngine::countFlush(int messages) {
+    if (messages <= 0) return;
+    m_flushCount.fetch_add(1, std::memory_order_relaxed);
+    m_sentMessageCount.fetch_add(messages, std::memory_order_relaxed);
+    m_flushSizeCounts[qMin(messages, static_cast<int>(MidiOutputBatch::MAX_MESSAGES))]
+        .fetch_add(1, std::memory_order_relaxed);
+}
+
+MidiEngine::OutputStats MidiEngine::outputStats() const {
+    OutputStats stats;
+    stats.flushes = m_flushCount.load(std::memory_order_relaxed);
+    stats.messages = m_sentMessageCount.load(std::memory_order_relaxed);
+    stats.coalesced = m_coalescedCount.load(std::memory_order_relaxed);
+    for (int i = 0; i <= MidiOutputBatch::MAX_MESSAGES; ++i) {
+        stats.flushSizeCounts[i] = m_flushSizeCounts[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void MidiEngine::resetOutputStats() {
+    m_flushCount.store(0);
+    m_sentMessageCount.store(0);
+    m_coalescedCount.store(0);
+    for (std::atomic<quint64> &count : m_flushSizeCounts) {
+        count.store(0);
+    }
+}
+
+void MidiEngine::sendNoteOn(int channel, int note, int velocity) {
+    const unsigned char message[3] = {
+        static_cast<unsigned char>(0x90 | (channel & 0x0F)), // Note On
+        static_cast<unsigned char>(note & 0x7F),
+        static_cast<unsigned char>(velocity & 0x7F)
+    };
+    sendMessage(message, sizeof(message));
+}
+
+void MidiEngine::sendNoteOff(int channel, int note, int velocity) {
+    const unsigned char message[3] = {
+        static_cast<unsigned char>(0x80 | (channel & 0x0F)), // Note Off
+        static_cast<unsigned char>(note & 0x7F),
+        static_cast<unsigned char>(velocity & 0x7F)
+    };
+    sendMessage(message, sizeof(message));
+}
+
+void MidiEngine::sendSystemMessage(int status, quint8 zones) {
+    const unsigned char message[1] = { static_cast<unsigned char>(status & 0xFF) };
+    sendMessage(message, sizeof(message), zones);
+}
+
+void MidiEngine::sendSongPositionPointer(int position) {
+    // SPP is 14-bit: position in 16th notes (MIDI beats)
+    // Send as 0xF2 followed by LSB (7 bits) and MSB (7 bits)
+    const unsigned char message[3] = {
+        0xF2, // Song Position Pointer
+        static_cast<unsigned char>(position & 0x7F),
+        static_cast<unsigned char>((position >> 7) & 0x7F)
+    };
+    sendMessage(message, sizeof(message));
+}
+
+void MidiEngine::refreshPorts() {
+    // Answered by setPortSnapshot() (and the refreshed signals) if
+    // anything changed
+    if (m_portScanner) {
+        m_portScanner->requestScan();
     }
 }
 
 // RTMidi callback function (static, called from RTMidi thread)
+// Must never allocate or block: the message is copied inline into the ring
 void MidiEngine::rtMidiCallback(double deltatime, std::vector<unsigned char> *message, void *userData) {
     MidiEngine *engine = static_cast<MidiEngine*>(userData);
-    if (engine && message && !message->empty()) {
-        // Convert to QByteArray for Qt compatibility
-        QByteArray messageData(reinterpret_cast<const char*>(message->data()), 
-                              static_cast<int>(message->size()));
-        
-        // Add to thread-safe queue
-        {
-            QMutexLocker locker(&engine->m_messageQueueMutex);
-            engine->m_messageQueue.enqueue(messageData);
+    if (!engine || !message || message->empty()) {
+        return;
+    }
+    
+    const std::size_t size = message->size();
+    const quint8 first = (*message)[0];
+    SysExAssembler &sysEx = engine->m_callbackSysEx;
+    
+    // SysEx, whole or in chunks (data bytes continuing it): copied into
+    // its pool buffer as it comes, queued once the F7 arrives. Real-Time
+    // messages in between pass; any other status cuts it short.
+    if (sysEx.active() && first >= 0x80 && first < 0xF8) {
+        sysEx.interrupt();
+    }
+    if (first == 0xF0 || (sysEx.active() && first < 0x80)) {
+        if (first == 0xF0) {
+            sysEx.begin(engine->m_arrivalClock.stamp(deltatime));
+        } else {
+            engine->m_arrivalClock.stamp(deltatime); // Keep the deltatime chain
+        }
+        if (sysEx.append(message->data(), static_cast<int>(size))) {
+            SysExMessage complete;
+            const quint16 handle = sysEx.take(&complete);
+            if (handle != 0 && !engine->queueSysEx(complete, handle, deltatime)) {
+                engine->m_sysExPool->release(handle);
+            }
+        }
+        return;
+    }
+    
+    // Anything else longer than a short message is malformed
+    if (size > static_cast<std::size_t>(MidiEvent::MAX_SIZE)) {
+        return;
+    }
+    
+    MidiEvent event;
+    event.sysExHandle = 0;
+    event.sysExSize = 0;
+    event.size = static_cast<quint8>(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        event.bytes[i] = (*message)[i];
+    }
+    event.deltatime = deltatime;
+    event.timestamp = engine->m_arrivalClock.stamp(deltatime);
+    event.enqueuedAt = MidiTime::nowNanoseconds();
+    engine->histogram(LatencyStage::DriverToCallback).record(event.enqueuedAt - event.timestamp);
+    engine->m_inputReceivedCount.fetch_add(1, std::memory_order_relaxed);
+    
+    // Full ring: event is dropped and counted by the queue
+    if (engine->m_inputQueue.push(event)) {
+        // Wakes the real-time input thread (no-op cost in timer mode)
+        engine->m_inputWake.notify();
+    }
+}
+
+// RtMidi thread: a completed SysEx goes into the ring by handle
+bool MidiEngine::queueSysEx(const SysExMessage &message, quint16 handle, double deltatime) {
+    MidiEvent event;
+    event.size = 0;
+    event.deltatime = deltatime;
+    event.timestamp = message.timestamp;
+    event.enqueuedAt = MidiTime::nowNanoseconds();
+    event.sysExHandle = handle;
+    event.sysExSize = static_cast<quint32>(message.size);
+    m_inputReceivedCount.fetch_add(1, std::memory_order_relaxed);
+    if (!m_inputQueue.push(event)) {
+        return false;
+    }
+    m_inputWake.notify();
+    return true;
+}
+
+// RTMidi callback of a backup input (its own thread and ring)
+void MidiEngine::rtMidiBackupCallback(double deltatime, std::vector<unsigned char> *message, void *userData) {
+    BackupInput *input = static_cast<BackupInput *>(userData);
+    if (!input || !message || message->empty() || message->size() > static_cast<std::size_t>(MidiEvent::MAX_SIZE)) {
+        return;
+    }
+    MidiEvent event;
+    event.sysExHandle = 0;
+    event.sysExSize = 0;
+    event.size = static_cast<quint8>(message->size());
+    for (std::size_t i = 0; i < message->size(); ++i) {
+        event.bytes[i] = (*message)[i];
+    }
+    event.deltatime = deltatime;
+    event.timestamp = input->arrivalClock.stamp(deltatime);
+    event.enqueuedAt = MidiTime::nowNanoseconds();
+    if (input->queue.push(event)) {
+        input->engine->m_inputWake.notify();
+    }
+}
+
+// Consumer side, with the producer detached: queued SysEx buffers go back
+// to the pool
+void MidiEngine::clearInputQueue() {
+    MidiEvent event;
+    while (m_inputQueue.pop(event)) {
+        if (event.sysExHandle != 0) {
+            m_sysExPool->release(event.sysExHandle);
         }
     }
-    Q_UNUSED(deltatime);
 }
 
-// Process queued MIDI messages (called on main thread via timer)
+// Process queued MIDI messages (called on main thread via timer, or on the
+// real-time input thread in ProcessingMode::RealtimeThread)
 void MidiEngine::processQueuedMessages() {
-    // Process all queued messages
-    while (true) {
-        QByteArray messageData;
-        {
-            QMutexLocker locker(&m_messageQueueMutex);
-            if (m_messageQueue.isEmpty()) {
-                break;
-            }
-            messageData = m_messageQueue.dequeue();
+    MidiEvent event;
+    LatencyHistogram &queueWait = histogram(LatencyStage::QueueWait);
+    MidiTransportSink *sink = primaryTransportSink();
+    auto dispatch = [this, sink](const auto &message) {
+        m_capture.recordInput(message, 0);
+        dispatchMessage(message, sink);
+    };
+    while (m_inputQueue.pop(event)) {
+        if (event.sysExHandle != 0) {
+            queueWait.record(MidiTime::nowNanoseconds() - event.enqueuedAt);
+            const SysExMessage message = {m_sysExPool->data(event.sysExHandle),
+                                          static_cast<int>(event.sysExSize), event.timestamp};
+            dispatch(message);
+            m_sysExPool->release(event.sysExHandle);
+            continue;
         }
+        if (event.size == 0) continue;
+        queueWait.record(MidiTime::nowNanoseconds() - event.enqueuedAt);
         
-        if (messageData.isEmpty()) continue;
-        
-        // Convert to vector for easier processing
-        std::vector<unsigned char> message(messageData.begin(), messageData.end());
-        
-        unsigned char statusByte = message[0];
-        
-        QMutexLocker locker(&m_stateMutex);
-        
-        // Handle System Realtime messages (0xF8-0xFF)
-        if (statusByte >= 0xF8 && statusByte <= 0xFF) {
-            switch (statusByte) {
-                case 0xF8: // MIDI Clock
-                    emit midiClockReceived();
-                    break;
-                    
-                case 0xFA: // Start
-                    emit midiStartReceived();
-                    break;
-                    
-                case 0xFB: // Continue
-                    emit midiContinueReceived();
-                    break;
-                    
-                case 0xFC: // Stop
-                    emit midiStopReceived();
-                    break;
-                    
-                case 0xFE: // Active Sensing
-                    // Usually ignored
-                    break;
-                    
-                case 0xFF: // System Reset
-                    emit unknownMessageReceived(statusByte);
-                    break;
-                    
-                default:
-                    emit unknownMessageReceived(statusByte);
-                    break;
-            }
-            continue; // Process next message
+        m_inputParser.parse(event.bytes, event.size, event.timestamp, dispatch);
+    }
+    
+    for (std::unique_ptr<BackupInput> &backup : m_backupInputs) {
+        if (backup) {
+            processBackupInput(*backup);
         }
-        
-        // Handle System Common messages (0xF0-0xF7)
-        if (statusByte >= 0xF0 && statusByte <= 0xF7) {
-            switch (statusByte) {
-                case 0xF2: // Song Position Pointer
-                    if (message.size() >= 3) {
-                        // SPP data: LSB (message[1]) and MSB (message[2])
-                        quint16 position = static_cast<quint16>(message[1]) | (static_cast<quint16>(message[2]) << 7);
-                        double quarterNotes = position / 4.0; // SPP is in 16th notes, 4 per quarter note
-                        emit midiSongPositionPointerReceived(position, quarterNotes);
-                    }
-                    break;
-                    
-                case 0xF0: // System Exclusive (start)
-                    // Handle sysex if needed
-                    break;
-                    
-                case 0xF1: // MIDI Time Code Quarter Frame
-                case 0xF3: // Song Select
-                case 0xF6: // Tune Request
-                case 0xF7: // System Exclusive (end)
-                    emit unknownMessageReceived(statusByte);
-                    break;
-                    
-                default:
-                    emit unknownMessageReceived(statusByte);
-                    break;
-            }
-            continue; // Process next message
+    }
+}
+
+void MidiEngine::processBackupInput(BackupInput &input) {
+    // Clock, transport, SPP and MTC into the arbiter; nothing is emitted
+    MidiTransportSink *sink = m_clockFailover.load(std::memory_order_acquire)
+        ? m_clockArbiter->sourceSink(input.source) : nullptr;
+    auto dispatch = [this, sink, &input](const MidiMessage &message) {
+        m_capture.recordInput(message, input.source);
+        if (!sink) {
+            return;
+        }
+        switch (message.status()) {
+        case 0xF8: sink->midiClock(message.timestamp); break;
+        case 0xFA: sink->midiStart(message.timestamp); break;
+        case 0xFB: sink->midiContinue(message.timestamp); break;
+        case 0xFC: sink->midiStop(message.timestamp); break;
+        case 0xF1: sink->midiTimeCodeQuarterFrame(message.bytes[1], message.timestamp); break;
+        case 0xF2: {
+            const int position = message.bytes[1] | (message.bytes[2] << 7);
+            sink->midiSongPositionPointer(position, position / 4.0);
+            break;
         }
+        default: break;
+        }
+    };
+    MidiEvent event;
+    while (input.queue.pop(event)) {
+        if (event.size > 0) {
+            input.parser.parse(event.bytes, event.size, event.timestamp, dispatch);
+        }
+    }
+}
+
+void MidiEngine::handleRawMIDIBytes(const quint8 *data, int size, qint64 timestamp) {
+    if (!data || size <= 0) {
+        return;
+    }
+    if (timestamp <= 0) {
+        timestamp = MidiTime::nowNanoseconds();
     }
+    MidiTransportSink *sink = primaryTransportSink();
+    m_rawParser.parse(data, size, timestamp, [this, sink](const auto &message) {
+        m_capture.recordInput(message, 0);
+        dispatchMessage(message, sink);
+    });
+}
+
+void MidiEngine::handleUmpWords(const quint32 *words, int wordCount, qint64 timestamp) {
+    if (!words || wordCount <= 0) {
+        return;
+    }
+    if (timestamp <= 0) {
+        timestamp = MidiTime::nowNanoseconds();
+    }
+    MidiTransportSink *sink = primaryTransportSink();
+    m_umpDecoder.decode(words, wordCount, timestamp, [this, sink](const auto &message) {
+        m_capture.recordInput(message, 0);
+        dispatchMessage(message, sink);
+    });
+    m_umpStats.store(m_umpDecoder.stats());
 }
 
 void MidiEngine::handleRawMIDIByte(quint8 byte) {
-    // This method could be used if we had access to raw MIDI bytes
-    // For now, it's a placeholder for future enhancement
-    Q_UNUSED(byte);
+    handleRawMIDIBytes(&byte, 1);
+}
+
+namespace {
+// Input handler kinds; the dispatch table holds one specialization per kind
+enum InputKind {
+    InputChannel,
+    InputSongPosition,
+    InputTimeCode,
+    InputClock,
+    InputStart,
+    InputContinue,
+    InputStop,
+    InputIgnored, // Active Sensing; SysEx never reaches dispatch
+    InputUnknown  // Song Select, Tune Request, EOX, undefined, Reset
+};
+
+constexpr int inputKindFor(int status) {
+    return status < 0xF0 ? InputChannel
+         : status == 0xF2 ? InputSongPosition
+         : status == 0xF1 ? InputTimeCode
+         : status == 0xF8 ? InputClock
+         : status == 0xFA ? InputStart
+         : status == 0xFB ? InputContinue
+         : status == 0xFC ? InputStop
+         : status == 0xFE || status == 0xF0 ? InputIgnored
+         : InputUnknown;
+}
+} // namespace
+
+template <int Kind>
+void MidiEngine::handleInput(const MidiMessage &message, MidiTransportSink *sink) {
+    if constexpr (Kind == InputClock) {
+        if (sink) sink->midiClock(message.timestamp);
+        emit midiClockReceived(message.timestamp);
+    } else if constexpr (Kind == InputStart) {
+        if (sink) sink->midiStart(message.timestamp);
+        emit midiStartReceived(message.timestamp);
+    } else if constexpr (Kind == InputContinue) {
+        if (sink) sink->midiContinue(message.timestamp);
+        emit midiContinueReceived(message.timestamp);
+    } else if constexpr (Kind == InputStop) {
+        if (sink) sink->midiStop(message.timestamp);
+        emit midiStopReceived();
+    } else if constexpr (Kind == InputSongPosition) {
+        // SPP data: LSB (bytes[1]) and MSB (bytes[2])
+        quint16 position = static_cast<quint16>(message.bytes[1]) | (static_cast<quint16>(message.bytes[2]) << 7);
+        double quarterNotes = position / 4.0; // SPP is in 16th notes, 4 per quarter note
+        if (sink) sink->midiSongPositionPointer(position, quarterNotes);
+        emit midiSongPositionPointerReceived(position, quarterNotes);
+    } else if constexpr (Kind == InputTimeCode) {
+        if (sink) sink->midiTimeCodeQuarterFrame(message.bytes[1], message.timestamp);
+    } else if constexpr (Kind == InputChannel) {
+        Q_UNUSED(sink);
+        const quint8 status = message.status();
+        // Loopback calibration echo (only while a ping is outstanding)
+        if (status == (0x90 | CALIBRATION_CHANNEL) && message.bytes[1] == CALIBRATION_NOTE &&
+            message.bytes[2] > 0 && m_calibrationPingSentAt.load(std::memory_order_acquire) != 0) {
+            qint64 expected = 0;
+            m_calibrationEchoAt.compare_exchange_strong(expected, message.timestamp);
+            return;
+        }
+        emit channelMessageReceived(status, message.bytes[1], message.size > 2 ? message.bytes[2] : 0,
+                                    message.timestamp);
+    } else if constexpr (Kind == InputUnknown) {
+        Q_UNUSED(sink);
+        emit unknownMessageReceived(message.status());
+    } else {
+        Q_UNUSED(sink);
+        Q_UNUSED(message);
+    }
+}
+
+template <std::size_t... Index>
+constexpr std::array<MidiEngine::InputHandler, sizeof...(Index)>
+MidiEngine::makeInputTable(std::index_sequence<Index...>) {
+    return {{&MidiEngine::handleInput<inputKindFor(0x80 + static_cast<int>(Index))>...}};
 }
 
+void MidiEngine::dispatchMessage(const SysExMessage &message, MidiTransportSink *transportSink) {
+    Q_UNUSED(transportSink);
+    MidiSysExSink *sink = m_sysExSink.load(std::memory_order_acquire);
+    if (sink) {
+        sink->midiSysEx(message);
+    }
+}
+
+void MidiEngine::dispatchMessage(const MidiMessage &message, MidiTransportSink *sink) {
+    static constexpr std::array<InputHandler, 128> table = makeInputTable(std::make_index_sequence<128>());
+    (this->*table[message.status() & 0x7F])(message, sink);
+}
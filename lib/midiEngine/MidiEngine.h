@@ -2,13 +2,30 @@
 #define MIDIENGINE_H
 
 #include <RtMidi.h>
+#include "ClockArbiter.h"
+#include "LatencyHistogram.h"
+#include "MidiCapture.h"
+#include "MidiEventQueue.h"
+#include "MidiInputThread.h"
+#include "MidiOutputBackend.h"
+#include "MidiOutputBatch.h"
+#include "MidiOutputPort.h"
+#include "MidiPortScanner.h"
+#include "MidiStreamParser.h"
+#include "MidiSysExSink.h"
+#include "MidiTime.h"
+#include "MidiTransportFanOut.h"
+#include "MidiTransportSink.h"
+#include "MidiUmp.h"
+#include "RtpMidiSession.h"
+#include "SeqLock.h"
 #include <QObject>
 #include <QTimer>
 #include <QDateTime>
 #include <QMutex>
 #include <QStringList>
-#include <QByteArray>
-#include <QQueue>
+#include <array>
+#include <atomic>
 #include <memory>
 #include <chrono>
 #include <vector>
@@ -17,30 +34,270 @@ class MidiEngine : public QObject {
     Q_OBJECT
 
 public:
+    // Where incoming messages are parsed and dispatched
+    enum class ProcessingMode {
+        MainThreadTimer, // Poll the input queue every 1ms on the owning (GUI) thread
+        RealtimeThread   // Dedicated high-priority thread woken on data arrival
+    };
+    
+    // What sendBatch() may drop before flushing
+    enum class CoalescingPolicy {
+        None,                   // Send every message as queued
+        DropCancellingNotePairs // Drop Off/On and On/Off pairs on the same note within one batch
+    };
+    
+    // Outbound counters (all batches and single messages since reset)
+    struct OutputStats {
+        quint64 flushes;
+        quint64 messages;
+        quint64 coalesced;
+        // flushSizeCounts[n] = number of flushes that sent n messages
+        quint64 flushSizeCounts[MidiOutputBatch::MAX_MESSAGES + 1];
+    };
+
+    // Stages of the input-to-output path probed by the engine (see also
+    // SyncController::latencyHistogram for the controller's stages)
+    enum class LatencyStage {
+        DriverToCallback, // Driver arrival timestamp to the RtMidi callback queuing it
+        QueueWait,        // Queued to dequeued by the poll timer or input thread
+        OutputSend        // Enqueue (scheduled: due time) to the backend send returning
+    };
+    static const int LATENCY_STAGE_COUNT = 3;
+    
+    // Input counters since construction (the high-water mark since the
+    // last resetInstrumentation())
+    struct InputCounters {
+        quint64 received;
+        quint64 dropped; // Queue full
+        int queueHighWaterMark;
+        int queueCapacity;
+    };
+
     explicit MidiEngine(QObject *parent = nullptr);
     ~MidiEngine();
 
     bool initialize();
     void shutdown();
 
+    // Port lists come from a background scan, refreshed on OS hot-plug
+    // notifications; until the first scan is in they are last session's
+    // (opening one checks its index first). outputPortsRefreshed and
+    // inputPortsRefreshed announce changes.
     QStringList getOutputPorts();
     QStringList getInputPorts();
+    MidiPortTable outputPortTable() const;
+    MidiPortTable inputPortTable() const;
     
+    // Primary output (replaces the previous primary; other outputs stay open)
     bool openOutputPort(const QString &portName);
     bool openInputPort(const QString &portName);
     
+    // Output fan-out: every open output receives the messages its route
+    // mask (MidiOutputRoute) selects, through its own queue and worker
+    static const int MAX_OUTPUT_PORTS = 8;
+    bool addOutputPort(const QString &portName, quint8 routes = MidiOutputRoute::All);
+    bool addOutputPort(const QString &name, std::unique_ptr<MidiOutputBackend> backend,
+                       quint8 routes = MidiOutputRoute::All);
+    void removeOutputPort(const QString &portName);
+    bool setOutputPortRoutes(const QString &portName, quint8 routes);
+    QStringList openOutputPorts() const;
+    QList<OutputPortStats> outputPortStats() const;
+    
+    // Per-output latency compensation: scheduled batches leave each port
+    // this many milliseconds before their presentation time
+    bool setOutputLatencyOffset(const QString &portName, double offsetMs);
+    double outputLatencyOffset(const QString &portName) const;
+    // Largest offset over the open outputs in the given zones (how early
+    // the sync logic must decide); MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS
+    // with none open
+    double maxOutputLatencyOffsetMs(quint8 zones = MidiOutputZone::All) const;
+    
+    // Tempo zones: each sync controller sends with its zone's bit
+    // (SyncController::setOutputZone), and a port only takes what is sent
+    // to a zone in its mask, so zones with their own tempo share the ports
+    // the engine has open (MidiOutputZone::All, the default, takes every
+    // zone's output)
+    bool setOutputPortZones(const QString &portName, quint8 zones);
+    
+    // Per-output clock divider/multiplier (MidiOutputPort::setClockRate),
+    // for devices that want the clock at another rate than the bar's
+    bool setOutputClockRate(const QString &portName, int multiplier, int divider);
+    
+    // Timestamped output: device outputs opened from now on hand their
+    // scheduled batches to the OS with the delivery time (see
+    // TimestampedOutputBackend) instead of holding them on the port's
+    // worker. Without an OS scheduler in the build, or when the port
+    // can't be opened that way, they fall back to RtMidi.
+    static bool timestampedOutputAvailable();
+    void setTimestampedOutput(bool enabled);
+    bool timestampedOutput() const { return m_timestampedOutput; }
+    // Any thread: drops what every output in the zones still holds for
+    // later, on its worker or in the OS (transport stop); later sends are
+    // unaffected
+    void cancelScheduledOutput(quint8 zones = MidiOutputZone::All);
+    
+    // Loopback calibration: route the output back into the open input
+    // (cable or IAC bus), then ping it and store the median round trip as
+    // the port's offset. Requires the port to route Notes.
+    bool startLatencyCalibration(const QString &portName, int samples = 8);
+    bool isCalibrating() const;
+    
     void closeOutputPort();
     void closeInputPort();
+    // Everything that delivers to the transport sinks: the input port,
+    // backups, the network input, a replay and the arbiter's holdover
+    // thread. Once it returns nothing is delivering (sinks can go).
+    // setClockFailover() restarts the arbiter.
+    void closeInputs();
     
     QString currentOutputPort() const;
     QString currentInputPort() const;
     
+    // Network input: instead of an input port, listen for an RTP-MIDI
+    // session on a UDP port pair (see RtpMidiSession). Its messages are
+    // de-jittered on their sender timestamps and dispatched like the
+    // input's, through the raw stream (handleRawMIDIBytes), timestamped
+    // at their reconstructed times. Opening it closes the input port and
+    // opening an input port closes it.
+    bool openNetworkInput(quint16 controlPort = RtpMidiSession::DEFAULT_PORT,
+                          const QString &sessionName = "MidiMaster2");
+    void closeNetworkInput();
+    bool networkInputOpen() const;
+    // Buffer depth, jitter, late and lost packets (nullptr while closed)
+    const RtpMidiSession *networkInput() const { return m_networkInput.get(); }
+    
+    // Clock redundancy: backup inputs carry the same clock as the primary
+    // input (a second interface, a mirrored DAW), in priority order after
+    // it. With failover on, the clock and transport of every input go
+    // through a ClockArbiter before the transport sink: downstream follows
+    // the primary, and a silent input is bridged by holdover ticks and
+    // replaced by the next backup, or by the holdover grid alone, without
+    // a gap (see ClockArbiter). Backups are only listened to for clock,
+    // transport, SPP and MTC; their other messages are dropped.
+    static constexpr int MAX_BACKUP_INPUTS = ClockArbiter::MAX_SOURCES - 1;
+    bool addBackupInput(const QString &portName);
+    void removeBackupInput(const QString &portName);
+    QStringList backupInputs() const;
+    void setClockFailover(bool enabled);
+    bool clockFailoverEnabled() const;
+    void setClockTimeoutPeriods(double periods);
+    // Per-source health: source 0 is the primary input, 1.. the backups
+    // (clockSourceName() is empty for a source with no port open)
+    const ClockArbiter &clockArbiter() const { return *m_clockArbiter; }
+    QString clockSourceName(int source) const;
+    
+    // Capture: every input message (with its source and arrival time) and
+    // every output message (with its send or presentation time) goes into
+    // a memory-mapped log; recording is real-time safe on every thread
+    // (see MidiCaptureRecorder). Off until started.
+    bool startCapture(const QString &path);
+    void stopCapture();
+    const MidiCaptureRecorder &capture() const { return m_capture; }
+    
+    // Faults in the engine's rings (input, open backups, capture) and the
+    // SysEx pool for writing, so their first use on a timing thread
+    // doesn't page fault (RealtimeProfile::prefault). Returns the bytes.
+    quint64 prefaultMemory();
+    
+    // Replay: a capture's input (source 0) goes back through the input
+    // queue, parser and dispatch as if it were arriving now, at speed
+    // times its original pace. It takes the input's place: it fails while
+    // an input port or the network input is open, and opening either
+    // stops it. captureReplayFinished follows the last message.
+    bool startCaptureReplay(const QString &path, double speed = 1.0, QString *error = nullptr);
+    void stopCaptureReplay();
+    bool isReplayingCapture() const;
+    
+    // Send one complete MIDI message (status + data bytes) without copying
+    // or allocating; all the helpers below go through here
+    // (zones: to the outputs taking any of them, see setOutputPortZones;
+    // a custom backend takes everything)
+    void sendMessage(const unsigned char *data, size_t size, quint8 zones = MidiOutputZone::All);
+    
+    // Send all messages produced by one tick with a single flush (applies
+    // the coalescing policy first)
+    void sendBatch(MidiOutputBatch &batch, quint8 zones = MidiOutputZone::All);
+    
+    // Like sendBatch(), but each output holds the batch until its latency
+    // offset before presentationTimeNs (MidiTime nanoseconds), so it
+    // arrives on time everywhere. Custom backends send it immediately,
+    // or schedule it for presentationTimeNs if they schedulesDelivery().
+    void scheduleBatch(MidiOutputBatch &batch, qint64 presentationTimeNs, quint8 zones = MidiOutputZone::All);
+    
+    // Like scheduleBatch(), but every output sends at sendAtNs itself (no
+    // latency offset): clock running ahead of its deadlines
+    void sendBatchAt(MidiOutputBatch &batch, qint64 sendAtNs, quint8 zones = MidiOutputZone::All);
+    
+    void setCoalescingPolicy(CoalescingPolicy policy);
+    CoalescingPolicy coalescingPolicy() const;
+    
+    OutputStats outputStats() const;
+    void resetOutputStats();
+    
     void sendNoteOn(int channel, int note, int velocity);
     void sendNoteOff(int channel, int note, int velocity);
-    void sendSystemMessage(int status);
+    void sendSystemMessage(int status, quint8 zones = MidiOutputZone::All);
     void sendSongPositionPointer(int position);
     
+    // Asks the port scanner for a scan now (asynchronous)
     void refreshPorts();
+    
+    // Send synchronously to a custom backend instead of the open outputs
+    // (not owned; pass nullptr to go back to the outputs)
+    void setOutputBackend(MidiOutputBackend *backend);
+    
+    // Clock and transport go straight to this sink's virtual calls, ahead
+    // of the matching signals (not owned; nullptr to detach). Set it before
+    // opening the input.
+    void setTransportSink(MidiTransportSink *sink);
+    MidiTransportSink *transportSink() const; // The first one added
+    // More sinks (tempo zones following the input): every one gets each
+    // parsed message, in the order added, from the same parse. A lone sink
+    // is called directly; two or more go through a MidiTransportFanOut.
+    // Up to MidiTransportFanOut::MAX_SINKS; add and remove before opening
+    // the input, like setTransportSink().
+    bool addTransportSink(MidiTransportSink *sink);
+    void removeTransportSink(MidiTransportSink *sink);
+    int transportSinkCount() const { return m_transportSinks.count(); }
+    
+    // Incoming SysEx is reassembled (whole or in chunks) into a fixed pool
+    // of pre-allocated buffers and handed to this sink as a view, in order
+    // with the clock (not owned; nullptr = SysEx is skipped). A SysEx
+    // larger than maxSize, or arriving while every buffer is still queued,
+    // is dropped and counted. Change the limits while no input (backup,
+    // network or replay included) is open; false otherwise.
+    void setSysExSink(MidiSysExSink *sink);
+    bool setSysExLimits(int maxSize, int bufferCount);
+    SysExBufferPool::Stats sysExStats() const;
+    
+    // In RealtimeThread mode the MIDI input signals are emitted from the
+    // input thread; prefer the transport sink for timing-critical receivers
+    void setProcessingMode(ProcessingMode mode);
+    ProcessingMode processingMode() const;
+    
+    // Number of input events dropped because the input queue was full
+    quint64 inputOverflowCount() const;
+    
+    // Raw MIDI 1.0 bytes from a transport other than RtMidi (serial,
+    // network), split anywhere: parsed with running status and dispatched
+    // like RtMidi input, on the calling thread. One stream, fed from one
+    // thread at a time (timestamp 0 = now).
+    void handleRawMIDIBytes(const quint8 *data, int size, qint64 timestamp = 0);
+    // MIDI 2.0 Universal MIDI Packet words from a UMP transport, split
+    // anywhere: decoded (UmpStreamDecoder) and dispatched the same way.
+    // Messages behind a JR Timestamp are timed by the sender's clock, so
+    // the tempo tracker sees the sender's beat instead of the transport's
+    // jitter. One stream, fed from one thread at a time (timestamp 0 =
+    // now).
+    void handleUmpWords(const quint32 *words, int wordCount, qint64 timestamp = 0);
+    // Read from any thread
+    UmpStreamDecoder::Stats umpInputStats() const { return m_umpStats.load(); }
+    
+    // Live instrumentation: recording is lock-free and allocation-free on
+    // every probed thread; read from any thread
+    const LatencyHistogram &latencyHistogram(LatencyStage stage) const;
+    InputCounters inputCounters() const;
+    void resetInstrumentation();
 
 signals:
     void outputPortChanged(const QString &portName);
@@ -48,50 +305,181 @@ signals:
     void outputPortsRefreshed();
     void inputPortsRefreshed();
     void error(const QString &message);
+    void latencyCalibrationFinished(const QString &portName, double latencyMs, bool success);
+    void captureReplayFinished();
     
     // MIDI input events
-    void midiStartReceived();
+    // Timestamps are driver arrival times in MidiTime nanoseconds
+    void midiStartReceived(qint64 timestamp);
     void midiStopReceived();
-    void midiContinueReceived();
-    void midiClockReceived();
+    void midiContinueReceived(qint64 timestamp);
+    void midiClockReceived(qint64 timestamp);
     void midiSongPositionPointerReceived(int positionBeats, double positionQuarterNotes);
+    // Note, CC, Program Change, Pressure and Pitch Bend (running status
+    // expanded; data2 is 0 for the one-data-byte messages)
+    void channelMessageReceived(int status, int data1, int data2, qint64 timestamp);
     void unknownMessageReceived(int status);
 
 private:
     // MIDI Output (using RTMidi - switched from Drumstick to fix IAC Driver detection)
+    // m_rtMidiOut only checks cached port indexes; each open output owns its own
     std::unique_ptr<RtMidiOut> m_rtMidiOut;
-    QStringList m_availableOutputPorts;
+    MidiPortTable m_outputPortTable;
     QString m_currentOutputPortName;
     int m_currentOutputPortIndex;
+    MidiOutputBackend *m_outputBackend;
+    std::atomic<CoalescingPolicy> m_coalescingPolicy;
+    
+    // Open outputs: slots are published atomically so the timing threads
+    // can fan out without locks; add/remove happen on the owning thread
+    std::atomic<MidiOutputPort *> m_outputPorts[MAX_OUTPUT_PORTS];
+    std::atomic<int> m_outputSendersInFlight;
+    QStringList m_deviceOutputPorts; // Outputs opened from m_outputPortTable
+    bool m_timestampedOutput;
+    
+    std::atomic<MidiOutputPort *> *findOutputSlot(const QString &name);
+    void removeOutputSlot(std::atomic<MidiOutputPort *> &slot);
+    bool fanOut(const MidiOutputBatch &batch, qint64 presentationTimeNs = 0, bool compensate = true,
+                quint8 zones = MidiOutputZone::All);
+    bool prepareBatch(MidiOutputBatch &batch, qint64 presentationTimeNs = 0);
+    void updateMaxOutputLatencyOffset();
+    
+    // Cached for the timing threads; recomputed whenever outputs change
+    std::atomic<double> m_maxOutputLatencyOffsetMs;
+    std::atomic<double> m_zoneMaxOutputLatencyOffsetMs[MidiOutputZone::MAX_ZONES]; // < 0 = no port in the zone
+    
+    // Loopback calibration (timer on the owning thread, echo detected by
+    // the input processing)
+    QTimer *m_calibrationTimer;
+    QString m_calibrationPort;
+    int m_calibrationSamplesWanted;
+    int m_calibrationPingsSent;
+    QList<double> m_calibrationSamples;
+    std::atomic<qint64> m_calibrationPingSentAt; // 0 = no ping outstanding
+    std::atomic<qint64> m_calibrationEchoAt;
+    
+    static const int CALIBRATION_NOTE = 0;
+    static const int CALIBRATION_CHANNEL = 15;
+    
+    void onCalibrationTimer();
+    void finishLatencyCalibration();
+    
+    // Outbound counters (written from the timing threads)
+    std::atomic<quint64> m_flushCount;
+    std::atomic<quint64> m_sentMessageCount;
+    std::atomic<quint64> m_coalescedCount;
+    std::atomic<quint64> m_flushSizeCounts[MidiOutputBatch::MAX_MESSAGES + 1];
+    
+    void countFlush(int messages);
+    
+    // Instrumentation probes (indexed by LatencyStage)
+    LatencyHistogram m_latencyHistograms[LATENCY_STAGE_COUNT];
+    std::atomic<quint64> m_inputReceivedCount; // Only written by the RtMidi callback
+    LatencyHistogram &histogram(LatencyStage stage) {
+        return m_latencyHistograms[static_cast<int>(stage)];
+    }
     
     // MIDI Input (using RTMidi for better real-time performance)
     std::unique_ptr<RtMidiIn> m_rtMidiIn;
-    QStringList m_availableInputPorts;
+    MidiPortTable m_inputPortTable;
     QString m_currentInputPortName;
     int m_currentInputPortIndex;
     
-    // SPP parsing state
-    bool m_expectingSPPData;
-    quint8 m_sppLSB;
-    quint8 m_sppMSB;
+    // Backup clock inputs: each has its own client, ring and parser (its
+    // callback thread is the ring's only producer); slots change only
+    // while input processing is stopped
+    struct BackupInput {
+        MidiEngine *engine;
+        int source; // ClockArbiter source index
+        QString name;
+        std::unique_ptr<RtMidiIn> rtMidiIn;
+        MidiEventQueue queue;
+        MidiArrivalClock arrivalClock;
+        MidiStreamParser parser;
+    };
+    std::unique_ptr<BackupInput> m_backupInputs[MAX_BACKUP_INPUTS];
+    std::unique_ptr<ClockArbiter> m_clockArbiter;
+    std::unique_ptr<RtpMidiSession> m_networkInput;
+    
+    // Capture and replay (the replayer is the input ring's producer while
+    // it runs, in place of the RtMidi callback)
+    MidiCaptureRecorder m_capture;
+    std::unique_ptr<MidiCaptureReplayer> m_replayer;
+    void enqueueReplayed(const quint8 *bytes, int size, qint64 timestampNs);
+    std::atomic<bool> m_clockFailover;
+    bool anyInputOpen() const;
+    void processBackupInput(BackupInput &input);
+    MidiTransportSink *primaryTransportSink() const;
+    static void rtMidiBackupCallback(double deltatime, std::vector<unsigned char> *message, void *userData);
+    
+    // Port enumeration (results arrive queued on the owning thread)
+    MidiPortScanner *m_portScanner;
+    bool m_portsCached; // The tables are last session's, not yet scanned
+    int resolvePortIndex(const MidiPortTable &table, const QString &portName, RtMidi *client) const;
+    MidiPortSnapshot loadCachedPorts() const;
+    void saveCachedPorts() const;
+    
+    // Input parsing: m_inputParser runs on the queue consumer,
+    // m_rawParser on whoever calls handleRawMIDIBytes(), m_umpDecoder on
+    // whoever calls handleUmpWords(). RtMidi SysEx is
+    // reassembled by m_callbackSysEx in the callback (copied chunk by
+    // chunk into the pool, no allocation) and queued by handle.
+    MidiStreamParser m_inputParser;
+    MidiStreamParser m_rawParser;
+    UmpStreamDecoder m_umpDecoder;
+    SeqLock<UmpStreamDecoder::Stats> m_umpStats; // Published after each handleUmpWords()
+    std::unique_ptr<SysExBufferPool> m_sysExPool;
+    SysExAssembler m_callbackSysEx; // Only touched by the RtMidi callback
+    std::atomic<MidiSysExSink *> m_sysExSink;
+    bool queueSysEx(const SysExMessage &message, quint16 handle, double deltatime);
+    void clearInputQueue();
+    
+    // Parsed messages go through a table indexed by status byte, each
+    // entry a handler specialized at compile time for its message kind
+    // (sink: where this input's clock and transport go)
+    using InputHandler = void (MidiEngine::*)(const MidiMessage &message, MidiTransportSink *sink);
+    void dispatchMessage(const MidiMessage &message, MidiTransportSink *sink);
+    void dispatchMessage(const SysExMessage &message, MidiTransportSink *sink);
+    template <int Kind> void handleInput(const MidiMessage &message, MidiTransportSink *sink);
+    template <std::size_t... Index>
+    static constexpr std::array<InputHandler, sizeof...(Index)> makeInputTable(std::index_sequence<Index...>);
     
     // Thread-safe state management
     mutable QMutex m_stateMutex;
     
-    // Thread-safe message queue for RTMidi callback
-    QMutex m_messageQueueMutex;
-    QQueue<QByteArray> m_messageQueue;
+    // Lock-free message queue for RTMidi callback (RtMidi thread -> processor)
+    MidiEventQueue m_inputQueue;
+    MidiArrivalClock m_arrivalClock; // Only touched by the RtMidi callback
+    std::atomic<MidiTransportSink *> m_transportSink; // What input delivers to (m_transportSinks resolved)
+    MidiTransportFanOut m_transportSinks;
+    void updateTransportSink();
     QTimer* m_messageProcessorTimer;
     
+    // Real-time input processing (ProcessingMode::RealtimeThread)
+    ProcessingMode m_processingMode;
+    MidiInputWake m_inputWake;
+    std::unique_ptr<MidiInputThread> m_inputThread;
+    
+    void startInputProcessing();
+    void stopInputProcessing();
+    
     // RTMidi callback handler (static, converts to instance method)
     static void rtMidiCallback(double deltatime, std::vector<unsigned char> *message, void *userData);
     
-private slots:
-    // Process queued MIDI messages (called on main thread via timer)
-    void processQueuedMessages();
+    friend class MidiInputThread;
+    friend class MidiEngineBench;
     
-    // Handle raw MIDI bytes for SPP parsing
+public slots:
+    // One byte of a raw stream (see handleRawMIDIBytes)
     void handleRawMIDIByte(quint8 byte);
+    // Installs a port list (the scanner's results; also how a test or a
+    // virtual transport presents ports). Closes open ports that are gone,
+    // then emits the refreshed signal of each side that changed.
+    void setPortSnapshot(const MidiPortSnapshot &snapshot);
+    
+private slots:
+    // Process queued MIDI messages (called via timer or from the input thread)
+    void processQueuedMessages();
 };
 
 #endif // MIDIENGINE_H
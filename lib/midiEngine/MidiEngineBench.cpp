@@ -0,0 +1,484 @@
+// Micro-benchmarks for the MIDI event hot path (MidiMaster2Bench target)
+// Each benchmark times single calls on the steady clock and prints
+// percentiles, so a change can be compared before and after. Outputs go
+// to a null backend: nothing leaves the process. --sustained runs the
+// real input thread under clock plus dense note/CC traffic instead, and
+// --replay runs it on a recorded capture.
+
+#include "ClockSource.h"
+#include "MidiClockGenerator.h"
+#include "MidiEngine.h"
+#include "MidiOutputBackend.h"
+#include "MidiTime.h"
+#include "MidiTransportSink.h"
+#include "SyncController.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Discards everything, counting notes so boundary ticks can be told apart
+class NullOutputBackend : public MidiOutputBackend {
+public:
+    NullOutputBackend() : messages(0), notes(0) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        Q_UNUSED(size);
+        messages.fetch_add(1, std::memory_order_relaxed);
+        if ((data[0] & 0xE0) == 0x80) { // Note On or Note Off
+            notes.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<quint64> messages;
+    std::atomic<quint64> notes;
+};
+
+// Accepts clock and transport without doing anything
+class NullTransportSink : public MidiTransportSink {
+public:
+    void midiStart(qint64) override {}
+    void midiStop(qint64) override {}
+    void midiContinue(qint64) override {}
+    void midiClock(qint64) override {}
+    void midiSongPositionPointer(int, double) override {}
+};
+
+// Per-call durations; storage is reserved up front so recording a sample
+// never allocates inside the timed region
+class Samples {
+public:
+    explicit Samples(int capacity) { m_ns.reserve(capacity); }
+
+    void add(qint64 ns) {
+        if (m_ns.size() < m_ns.capacity()) {
+            m_ns.push_back(ns);
+        }
+    }
+
+    int count() const { return static_cast<int>(m_ns.size()); }
+
+    void print(const char *name) {
+        if (m_ns.empty()) {
+            std::printf("%-34s %9s\n", name, "no samples");
+            return;
+        }
+        std::sort(m_ns.begin(), m_ns.end());
+        double sum = 0.0;
+        for (qint64 ns : m_ns) {
+            sum += static_cast<double>(ns);
+        }
+        std::printf("%-34s %9d %9.0f %9lld %9lld %9lld %9lld %9lld\n", name, count(),
+                    sum / m_ns.size(), percentile(0.50), percentile(0.90), percentile(0.99),
+                    percentile(0.999), static_cast<long long>(m_ns.back()));
+    }
+
+    static void printHeader(const char *unit) {
+        std::printf("%-34s %9s %9s %9s %9s %9s %9s %9s  (%s)\n", "benchmark", "samples", "mean",
+                    "p50", "p90", "p99", "p99.9", "max", unit);
+    }
+
+private:
+    long long percentile(double fraction) const {
+        size_t index = static_cast<size_t>(fraction * (m_ns.size() - 1) + 0.5);
+        return static_cast<long long>(m_ns[index]);
+    }
+
+    std::vector<qint64> m_ns;
+};
+
+} // namespace
+
+// Friend of MidiEngine and SyncController: drives the private entry points
+// (RtMidi callback, queue drain, boundary check) the way the driver and the
+// input thread do
+class MidiEngineBench {
+public:
+    explicit MidiEngineBench(int iterations)
+        : m_iterations(iterations)
+    {
+    }
+
+    void runMicroBenchmarks() {
+        Samples::printHeader("ns per call");
+        benchCallbackEnqueue();
+        benchQueueDrain();
+        benchClockHandling();
+        benchWholeNoteCheck();
+        benchSends();
+    }
+
+    void runSustained(int seconds, int messagesPerSecond, double bpm);
+    bool runReplay(const QString &path, double speed);
+
+private:
+    static void printSustainedReport(const NullOutputBackend &backend, SyncController &controller,
+                                     Samples &clockLatency, quint64 total, quint64 dropped,
+                                     double seconds);
+
+    static void callback(MidiEngine &engine, std::vector<unsigned char> &message) {
+        MidiEngine::rtMidiCallback(0.0, &message, &engine);
+    }
+
+    // RtMidi thread: copy into the input ring and wake the processor
+    void benchCallbackEnqueue() {
+        MidiEngine engine;
+        std::vector<unsigned char> clock = {0xF8};
+        Samples samples(m_iterations);
+        for (int i = 0; i < m_iterations; ++i) {
+            // Keep the ring from filling (untimed)
+            if (i % 512 == 0) {
+                engine.processQueuedMessages();
+            }
+            const qint64 start = MidiTime::nowNanoseconds();
+            callback(engine, clock);
+            samples.add(MidiTime::nowNanoseconds() - start);
+        }
+        samples.print("rtMidiCallback enqueue");
+    }
+
+    // Processor: pop and dispatch a burst of 64 mixed events to the sink
+    void benchQueueDrain() {
+        MidiEngine engine;
+        NullTransportSink sink;
+        engine.setTransportSink(&sink);
+        std::vector<unsigned char> clock = {0xF8};
+        std::vector<unsigned char> noteOn = {0x90, 60, 100};
+        std::vector<unsigned char> controlChange = {0xB0, 1, 64};
+        const int burst = 64;
+        const int rounds = qMax(1, m_iterations / burst);
+        Samples bursts(rounds);
+        for (int round = 0; round < rounds; ++round) {
+            for (int i = 0; i < burst; ++i) {
+                callback(engine, i % 3 == 0 ? clock : (i % 3 == 1 ? noteOn : controlChange));
+            }
+            const qint64 start = MidiTime::nowNanoseconds();
+            engine.processQueuedMessages();
+            bursts.add(MidiTime::nowNanoseconds() - start);
+        }
+        bursts.print("processQueuedMessages (64 events)");
+    }
+
+    // Incoming clock on virtual time (no threads), split by whether the
+    // tick made a boundary decision or sent note traffic
+    void benchClockHandling() {
+        MidiEngine engine;
+        NullOutputBackend backend;
+        engine.setOutputBackend(&backend);
+        VirtualClockSource clock;
+        SyncController controller(&engine);
+        controller.setClockSource(&clock);
+        controller.handleDAWStart(clock.nowNanoseconds());
+
+        const qint64 periodNs = llround(ClockSchedule::periodNsForBPM(120.0));
+        Samples plain(m_iterations);
+        Samples boundary(m_iterations / 24 + 16);
+        for (int i = 0; i < m_iterations; ++i) {
+            clock.advance(periodNs);
+            const int emittedBefore = controller.transportState().lastEmittedWholeNote;
+            const quint64 notesBefore = backend.notes.load(std::memory_order_relaxed);
+
+            const qint64 start = MidiTime::nowNanoseconds();
+            controller.handleMIDIClock(clock.nowNanoseconds());
+            const qint64 elapsed = MidiTime::nowNanoseconds() - start;
+
+            if (controller.transportState().lastEmittedWholeNote != emittedBefore ||
+                backend.notes.load(std::memory_order_relaxed) != notesBefore) {
+                boundary.add(elapsed);
+            } else {
+                plain.add(elapsed);
+            }
+        }
+        controller.stop(false);
+        plain.print("handleMIDIClock (no boundary)");
+        boundary.print("handleMIDIClock (boundary)");
+    }
+
+    // The boundary decision alone (normally inside the master tick)
+    void benchWholeNoteCheck() {
+        MidiEngine engine;
+        NullOutputBackend backend;
+        engine.setOutputBackend(&backend);
+        VirtualClockSource clock;
+        SyncController controller(&engine);
+        controller.setClockSource(&clock);
+        controller.handleDAWStart(clock.nowNanoseconds());
+
+        Samples samples(m_iterations);
+        for (int i = 1; i <= m_iterations; ++i) {
+            const MidiTime::TimePoint now = MidiTime::fromNanoseconds(clock.nowNanoseconds());
+            const qint64 start = MidiTime::nowNanoseconds();
+            controller.checkAndEmitWholeNote(i / 24.0, now);
+            samples.add(MidiTime::nowNanoseconds() - start);
+        }
+        controller.stop(false);
+        samples.print("checkAndEmitWholeNote");
+    }
+
+    // Output helpers against the null backend
+    void benchSends() {
+        MidiEngine engine;
+        NullOutputBackend backend;
+        engine.setOutputBackend(&backend);
+
+        Samples noteOn(m_iterations);
+        Samples noteOff(m_iterations);
+        Samples system(m_iterations);
+        Samples songPosition(m_iterations);
+        Samples batch(m_iterations);
+        for (int i = 0; i < m_iterations; ++i) {
+            qint64 start = MidiTime::nowNanoseconds();
+            engine.sendNoteOn(0, 60, 100);
+            noteOn.add(MidiTime::nowNanoseconds() - start);
+
+            start = MidiTime::nowNanoseconds();
+            engine.sendNoteOff(0, 60, 0);
+            noteOff.add(MidiTime::nowNanoseconds() - start);
+
+            start = MidiTime::nowNanoseconds();
+            engine.sendSystemMessage(0xF8);
+            system.add(MidiTime::nowNanoseconds() - start);
+
+            start = MidiTime::nowNanoseconds();
+            engine.sendSongPositionPointer(i & 0x3FFF);
+            songPosition.add(MidiTime::nowNanoseconds() - start);
+
+            // A boundary tick: clock, Note Off, Note On in one flush
+            MidiOutputBatch tick;
+            tick.systemMessage(0xF8);
+            tick.noteOff(0, 60, 0);
+            tick.noteOn(0, 60, 100);
+            start = MidiTime::nowNanoseconds();
+            engine.sendBatch(tick);
+            batch.add(MidiTime::nowNanoseconds() - start);
+        }
+        noteOn.print("sendNoteOn");
+        noteOff.print("sendNoteOff");
+        system.print("sendSystemMessage");
+        songPosition.print("sendSongPositionPointer");
+        batch.print("sendBatch (clock+off+on)");
+    }
+
+    int m_iterations;
+};
+
+namespace {
+
+// Forwards to the controller and records arrival-to-handled latency of
+// every clock (input thread only)
+class LatencyRecordingSink : public MidiTransportSink {
+public:
+    LatencyRecordingSink(MidiTransportSink *target, Samples *clockLatency)
+        : m_target(target), m_clockLatency(clockLatency) {}
+
+    void midiStart(qint64 timestamp) override { m_target->midiStart(timestamp); }
+    void midiStop(qint64 timestamp) override { m_target->midiStop(timestamp); }
+    void midiContinue(qint64 timestamp) override { m_target->midiContinue(timestamp); }
+    void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) override {
+        m_target->midiSongPositionPointer(positionBeats, positionQuarterNotes);
+    }
+    void midiClock(qint64 timestamp) override {
+        m_target->midiClock(timestamp);
+        m_clockLatency->add(MidiTime::nowNanoseconds() - timestamp);
+    }
+
+private:
+    MidiTransportSink *m_target;
+    Samples *m_clockLatency;
+};
+
+} // namespace
+
+void MidiEngineBench::runSustained(int seconds, int messagesPerSecond, double bpm) {
+    // Real input thread and boundary scheduler on the system clock; a
+    // producer thread stands in for the RtMidi callback thread
+    MidiEngine engine;
+    NullOutputBackend backend;
+    engine.setOutputBackend(&backend);
+    SyncController controller(&engine);
+
+    const double clocksPerSecond = bpm * 24.0 / 60.0;
+    Samples clockLatency(static_cast<int>(seconds * clocksPerSecond) + 64);
+    LatencyRecordingSink sink(&controller, &clockLatency);
+    engine.setTransportSink(&sink);
+    engine.setProcessingMode(MidiEngine::ProcessingMode::RealtimeThread);
+    engine.startInputProcessing();
+
+    std::printf("sustained: %d s, %.0f BPM clock + %d note/CC messages/s\n",
+                seconds, bpm, messagesPerSecond);
+
+    std::atomic<quint64> produced(0);
+    std::thread producer([&]() {
+        std::vector<unsigned char> start = {0xFA};
+        std::vector<unsigned char> stop = {0xFC};
+        std::vector<unsigned char> clock = {0xF8};
+        std::vector<unsigned char> noteOn = {0x90, 0, 100};
+        std::vector<unsigned char> noteOff = {0x80, 0, 0};
+        std::vector<unsigned char> controlChange = {0xB0, 1, 0};
+
+        const qint64 beginNs = MidiTime::nowNanoseconds();
+        const qint64 endNs = beginNs + seconds * 1000000000LL;
+        const double clockPeriodNs = 1.0e9 / clocksPerSecond;
+        const double messagePeriodNs = messagesPerSecond > 0 ? 1.0e9 / messagesPerSecond : 0.0;
+        qint64 clocks = 0;
+        qint64 messages = 0;
+
+        callback(engine, start);
+        produced.fetch_add(1, std::memory_order_relaxed);
+        for (;;) {
+            const qint64 nextClockNs = beginNs + llround((clocks + 1) * clockPeriodNs);
+            const qint64 nextMessageNs = messagePeriodNs > 0.0
+                ? beginNs + llround((messages + 1) * messagePeriodNs) : endNs;
+            const qint64 dueNs = qMin(nextClockNs, nextMessageNs);
+            if (dueNs >= endNs) {
+                break;
+            }
+            while (MidiTime::nowNanoseconds() < dueNs) {
+                if (dueNs - MidiTime::nowNanoseconds() > 200000) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                } else {
+                    MidiTime::cpuRelax();
+                }
+            }
+
+            if (dueNs == nextClockNs) {
+                callback(engine, clock);
+                ++clocks;
+            } else {
+                // Dense channel traffic: notes and CC sweeping across channels
+                const unsigned char channel = static_cast<unsigned char>(messages % 16);
+                const unsigned char value = static_cast<unsigned char>(messages % 128);
+                std::vector<unsigned char> &message =
+                    messages % 3 == 0 ? noteOn : (messages % 3 == 1 ? noteOff : controlChange);
+                message[0] = static_cast<unsigned char>((message[0] & 0xF0) | channel);
+                message[1] = value;
+                if (&message == &controlChange) {
+                    message[2] = value;
+                }
+                callback(engine, message);
+                ++messages;
+            }
+            produced.fetch_add(1, std::memory_order_relaxed);
+        }
+        callback(engine, stop);
+        produced.fetch_add(1, std::memory_order_relaxed);
+    });
+    producer.join();
+
+    // Let the input thread drain what is left
+    QThread::msleep(50);
+    engine.stopInputProcessing();
+    engine.setTransportSink(nullptr);
+
+    printSustainedReport(backend, controller, clockLatency, produced.load(),
+                         engine.inputOverflowCount(), seconds);
+}
+
+bool MidiEngineBench::runReplay(const QString &path, double speed) {
+    // The input thread as in runSustained, fed by the capture's replay
+    // instead of the synthetic producer
+    QString error;
+    std::unique_ptr<MidiCaptureFile> capture = MidiCaptureFile::open(path, &error);
+    if (!capture) {
+        std::fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    const quint64 records = capture->count();
+    const double capturedSeconds = records > 0
+        ? (capture->at(records - 1).timestampNs - capture->at(0).timestampNs) / 1.0e9 : 0.0;
+    capture.reset();
+
+    MidiEngine engine;
+    NullOutputBackend backend;
+    engine.setOutputBackend(&backend);
+    SyncController controller(&engine);
+    Samples clockLatency(static_cast<int>(records) + 64);
+    LatencyRecordingSink sink(&controller, &clockLatency);
+    engine.setTransportSink(&sink);
+    engine.setProcessingMode(MidiEngine::ProcessingMode::RealtimeThread);
+
+    std::printf("replay: %s, %llu records over %.1f s, at %.2fx\n", qPrintable(path),
+                static_cast<unsigned long long>(records), capturedSeconds, speed);
+    const qint64 beginNs = MidiTime::nowNanoseconds();
+    if (!engine.startCaptureReplay(path, speed, &error)) {
+        std::fprintf(stderr, "%s\n", qPrintable(error));
+        return false;
+    }
+    engine.m_replayer->wait();
+    const double seconds = qMax(1.0e-3, (MidiTime::nowNanoseconds() - beginNs) / 1.0e9);
+
+    QThread::msleep(50);
+    engine.stopInputProcessing();
+    engine.setTransportSink(nullptr);
+
+    printSustainedReport(backend, controller, clockLatency, engine.m_replayer->replayed(),
+                         engine.inputOverflowCount(), seconds);
+    return true;
+}
+
+void MidiEngineBench::printSustainedReport(const NullOutputBackend &backend, SyncController &controller,
+                                           Samples &clockLatency, quint64 total, quint64 dropped,
+                                           double seconds) {
+    std::printf("input: %llu messages, %.0f messages/s processed, %llu dropped\n",
+                static_cast<unsigned long long>(total),
+                static_cast<double>(total - dropped) / seconds,
+                static_cast<unsigned long long>(dropped));
+    std::printf("output: %llu messages to the null backend\n",
+                static_cast<unsigned long long>(backend.messages.load()));
+    Samples::printHeader("ns, driver arrival to handled");
+    clockLatency.print("clock (input thread + controller)");
+
+    BoundaryScheduler::Stats timing = controller.boundaryTimingStats();
+    std::printf("downbeats: %llu fired, max late %lld ns, max early %lld ns\n",
+                static_cast<unsigned long long>(timing.fired),
+                static_cast<long long>(timing.maxLateNs), static_cast<long long>(timing.maxEarlyNs));
+    for (int i = 0; i < BoundaryScheduler::HISTOGRAM_BUCKETS; ++i) {
+        std::printf("  %-14s %llu\n", BoundaryScheduler::bucketLabel(i),
+                    static_cast<unsigned long long>(timing.histogram[i]));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("MidiMaster2Bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the MIDI input-to-output hot path");
+    parser.addHelpOption();
+    QCommandLineOption iterationsOption("iterations", "Calls timed per micro-benchmark.", "count", "200000");
+    QCommandLineOption sustainedOption("sustained", "Run the sustained-load mode for this many seconds.", "seconds");
+    QCommandLineOption rateOption("rate", "Note/CC messages per second in sustained mode.", "count", "5000");
+    QCommandLineOption bpmOption("bpm", "Clock tempo in sustained mode.", "bpm", "120");
+    QCommandLineOption replayOption("replay", "Run the sustained mode on a recorded capture's input.", "capture");
+    QCommandLineOption speedOption("speed", "Replay speed (1 = as recorded).", "factor", "1");
+    parser.addOption(iterationsOption);
+    parser.addOption(sustainedOption);
+    parser.addOption(rateOption);
+    parser.addOption(bpmOption);
+    parser.addOption(replayOption);
+    parser.addOption(speedOption);
+    parser.process(app);
+
+    if (parser.isSet(replayOption)) {
+        MidiEngineBench bench(0);
+        if (!bench.runReplay(parser.value(replayOption), parser.value(speedOption).toDouble())) {
+            return 1;
+        }
+    } else if (parser.isSet(sustainedOption)) {
+        MidiEngineBench bench(0);
+        bench.runSustained(qMax(1, parser.value(sustainedOption).toInt()),
+                           qMax(0, parser.value(rateOption).toInt()),
+                           qBound(20.0, parser.value(bpmOption).toDouble(), 300.0));
+    } else {
+        MidiEngineBench bench(qMax(1, parser.value(iterationsOption).toInt()));
+        bench.runMicroBenchmarks();
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef MIDIEVENTQUEUE_H
+#define MIDIEVENTQUEUE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstddef>
+
+// Short MIDI message stored inline (no heap allocation)
+// Covers every channel voice, system common and system realtime message:
+// one status byte plus up to 3 data bytes. A SysEx travels as the handle
+// of the SysExBufferPool buffer it was reassembled into (size 0).
+struct MidiEvent {
+    static const int MAX_SIZE = 4;
+
+    quint8 bytes[MAX_SIZE];
+    quint8 size;
+    double deltatime;  // RtMidi deltatime (seconds since previous message)
+    qint64 timestamp;  // Arrival time, MidiTime nanoseconds
+    qint64 enqueuedAt; // When the callback queued it (queue wait probe)
+    quint16 sysExHandle; // 0 = not a SysEx
+    quint32 sysExSize;
+
+    quint8 status() const { return bytes[0]; }
+};
+
+// Wait-free single-producer/single-consumer ring buffer
+// The producer (RtMidi callback thread) only writes m_head, the consumer
+// (queue drain) only writes m_tail. Neither side ever blocks or allocates.
+// When the ring is full the new element is dropped and counted.
+template <typename T, int Capacity>
+class SpscRingBuffer {
+    static_assert(Capacity > 1 && (Capacity & (Capacity - 1)) == 0,
+                  "SpscRingBuffer capacity must be a power of two");
+
+public:
+    SpscRingBuffer()
+        : m_head(0)
+        , m_tail(0)
+        , m_overflowCount(0)
+        , m_highWaterMark(0)
+    {
+    }
+
+    SpscRingBuffer(const SpscRingBuffer &) = delete;
+    SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+    // Producer side
+    bool push(const T &item) {
+        const quint32 head = m_head.load(std::memory_order_relaxed);
+        const quint32 tail = m_tail.load(std::memory_order_acquire);
+        if (head - tail >= static_cast<quint32>(Capacity)) {
+            m_overflowCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_buffer[head & MASK] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        
+        // Deepest the queue has been (producer is the only writer)
+        const quint32 depth = head + 1 - tail;
+        if (depth > m_highWaterMark.load(std::memory_order_relaxed)) {
+            m_highWaterMark.store(depth, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T &item) {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        const quint32 head = m_head.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        item = m_buffer[tail & MASK];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: discard everything currently queued
+    void clear() {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    bool isEmpty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    int size() const {
+        return static_cast<int>(m_head.load(std::memory_order_acquire) -
+                                m_tail.load(std::memory_order_acquire));
+    }
+
+    static constexpr int capacity() { return Capacity; }
+
+    quint64 overflowCount() const {
+        return m_overflowCount.load(std::memory_order_relaxed);
+    }
+
+    int highWaterMark() const {
+        return static_cast<int>(m_highWaterMark.load(std::memory_order_relaxed));
+    }
+
+    void resetHighWaterMark() {
+        m_highWaterMark.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static const quint32 MASK = static_cast<quint32>(Capacity - 1);
+
+    // Indices are free-running; keep them on separate cache lines so the
+    // producer and consumer don't false-share
+    alignas(64) std::atomic<quint32> m_head;
+    alignas(64) std::atomic<quint32> m_tail;
+    alignas(64) std::atomic<quint64> m_overflowCount;
+    std::atomic<quint32> m_highWaterMark;
+    T m_buffer[Capacity];
+};
+
+// Input queue between the RtMidi callback and the message processor
+// Sized for several seconds of clock plus dense note/CC traffic between drains
+using MidiEventQueue = SpscRingBuffer<MidiEvent, 1024>;
+
+#endif // MIDIEVENTQUEUE_H
@@ -0,0 +1,113 @@
+#include "MidiInputThread.h"
+#include "MidiEngine.h"
+#include "RealtimeScheduling.h"
+#include <cerrno>
+#include <ctime>
+
+MidiInputWake::MidiInputWake()
+    : m_pending(false)
+{
+#ifdef __APPLE__
+    m_semaphore = dispatch_semaphore_create(0);
+#else
+    sem_init(&m_semaphore, 0, 0);
+#endif
+}
+
+MidiInputWake::~MidiInputWake() {
+#ifdef __APPLE__
+    dispatch_release(m_semaphore);
+#else
+    sem_destroy(&m_semaphore);
+#endif
+}
+
+void MidiInputWake::notify() {
+    // Only the first notification after a wait() posts the semaphore
+    if (!m_pending.exchange(true, std::memory_order_acq_rel)) {
+        post();
+    }
+}
+
+void MidiInputWake::forceNotify() {
+    m_pending.store(true, std::memory_order_release);
+    post();
+}
+
+void MidiInputWake::wait() {
+#ifdef __APPLE__
+    dispatch_semaphore_wait(m_semaphore, DISPATCH_TIME_FOREVER);
+#else
+    while (sem_wait(&m_semaphore) != 0 && errno == EINTR) {
+        // Retry if interrupted by a signal
+    }
+#endif
+    // Re-arm before the consumer drains, so anything pushed from here on
+    // triggers another wakeup instead of being missed
+    m_pending.store(false, std::memory_order_seq_cst);
+}
+
+bool MidiInputWake::waitFor(qint64 timeoutNs) {
+#ifdef __APPLE__
+    if (dispatch_semaphore_wait(m_semaphore, dispatch_time(DISPATCH_TIME_NOW, timeoutNs)) != 0) {
+        return false;
+    }
+#else
+    // sem_timedwait only takes CLOCK_REALTIME; the timeout is short and
+    // relative, so a wall-clock step at worst shortens or stretches one wait
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    qint64 nanoseconds = deadline.tv_nsec + timeoutNs;
+    deadline.tv_sec += static_cast<time_t>(nanoseconds / 1000000000);
+    deadline.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+    while (sem_timedwait(&m_semaphore, &deadline) != 0) {
+        if (errno != EINTR) {
+            return false; // Timed out
+        }
+    }
+#endif
+    m_pending.store(false, std::memory_order_seq_cst);
+    return true;
+}
+
+void MidiInputWake::post() {
+#ifdef __APPLE__
+    dispatch_semaphore_signal(m_semaphore);
+#else
+    sem_post(&m_semaphore);
+#endif
+}
+
+MidiInputThread::MidiInputThread(MidiEngine *engine, MidiInputWake *wake, QObject *parent)
+    : QThread(parent)
+    , m_engine(engine)
+    , m_wake(wake)
+    , m_stopRequested(false)
+{
+    setObjectName("MidiInputThread");
+}
+
+MidiInputThread::~MidiInputThread() {
+    stop();
+}
+
+void MidiInputThread::stop() {
+    if (!isRunning()) {
+        return;
+    }
+    m_stopRequested.store(true, std::memory_order_release);
+    m_wake->forceNotify();
+    wait();
+    m_stopRequested.store(false, std::memory_order_release);
+}
+
+void MidiInputThread::run() {
+    RealtimeScheduling::applyToCurrentThread(RealtimeThreadRole::Input);
+    while (!m_stopRequested.load(std::memory_order_acquire)) {
+        m_wake->wait();
+        if (m_stopRequested.load(std::memory_order_acquire)) {
+            break;
+        }
+        m_engine->processQueuedMessages();
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef MIDIINPUTTHREAD_H
+#define MIDIINPUTTHREAD_H
+
+#include <QThread>
+#include <QtGlobal>
+#include <atomic>
+
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+class MidiEngine;
+
+// Wake-up primitive between the RtMidi callback and the input thread
+// notify() is safe to call from the real-time callback: it never blocks,
+// and only posts the semaphore when the consumer hasn't been woken yet,
+// so a burst of messages costs one wakeup and an idle input costs none.
+class MidiInputWake {
+public:
+    MidiInputWake();
+    ~MidiInputWake();
+
+    MidiInputWake(const MidiInputWake &) = delete;
+    MidiInputWake &operator=(const MidiInputWake &) = delete;
+
+    // Producer side (RtMidi thread)
+    void notify();
+    // Unconditional post (used to unblock the consumer on shutdown)
+    void forceNotify();
+    // Consumer side: blocks until notified, then re-arms notify()
+    void wait();
+    // Same, but gives up after timeoutNs; returns false on timeout
+    bool waitFor(qint64 timeoutNs);
+
+private:
+    void post();
+
+    std::atomic<bool> m_pending;
+#ifdef __APPLE__
+    dispatch_semaphore_t m_semaphore;
+#else
+    sem_t m_semaphore;
+#endif
+};
+
+// High-priority thread that drains the engine's input queue as soon as
+// data arrives, instead of polling it from the GUI thread on a timer
+class MidiInputThread : public QThread {
+    Q_OBJECT
+
+public:
+    MidiInputThread(MidiEngine *engine, MidiInputWake *wake, QObject *parent = nullptr);
+    ~MidiInputThread();
+
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    MidiEngine *m_engine;
+    MidiInputWake *m_wake;
+    std::atomic<bool> m_stopRequested;
+};
+
+#endif // MIDIINPUTTHREAD_H
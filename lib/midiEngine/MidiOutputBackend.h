@@ -0,0 +1,46 @@
+#ifndef MIDIOUTPUTBACKEND_H
+#define MIDIOUTPUTBACKEND_H
+
+#include <cstddef>
+#include "MidiOutputBatch.h"
+
+// Destination for outgoing MIDI bytes
+// MidiEngine sends to its RtMidi output port by default; a backend set
+// with MidiEngine::setOutputBackend() receives the messages instead
+// (tests, benchmarks, virtual destinations). The send functions are
+// called on the timing threads, so implementations must not block or
+// allocate.
+class MidiOutputBackend {
+public:
+    virtual ~MidiOutputBackend() {}
+
+    virtual void sendMessage(const unsigned char *data, size_t size) = 0;
+
+    // Deliver one tick's messages; backends that can put several messages
+    // in one packet override this. Messages dropped by coalescing are
+    // skipped.
+    virtual void sendBatch(const MidiOutputBatch &batch) {
+        for (int i = 0; i < batch.count(); ++i) {
+            const MidiOutputBatch::Message &message = batch.at(i);
+            if (!message.dropped) {
+                sendMessage(message.bytes, message.size);
+            }
+        }
+    }
+
+    // Backends that hand messages to an OS scheduler with a delivery time
+    // (TimestampedOutputBackend) return true: scheduled batches are then
+    // passed on as soon as they are queued instead of being held until due
+    virtual bool schedulesDelivery() const { return false; }
+
+    // deliverAtNs: MidiTime nanoseconds (already past = now). Only called
+    // when schedulesDelivery() is true.
+    virtual void scheduleBatch(const MidiOutputBatch &batch, qint64 /*deliverAtNs*/) {
+        sendBatch(batch);
+    }
+
+    // Drops everything scheduled and not yet delivered (transport stop)
+    virtual void cancelScheduled() {}
+};
+
+#endif // MIDIOUTPUTBACKEND_H
@@ -0,0 +1,140 @@
+#ifndef MIDIOUTPUTBATCH_H
+#define MIDIOUTPUTBATCH_H
+
+#include <QtGlobal>
+#include <cstddef>
+
+// Outgoing messages produced by one tick, flushed together
+// Fixed capacity, stored inline: building a batch never allocates. A tick
+// produces at most a clock byte, a transport message and a Note Off/On
+// pair, so the capacity leaves plenty of headroom.
+class MidiOutputBatch {
+public:
+    static const int MAX_MESSAGES = 16;
+    static const int MAX_MESSAGE_SIZE = 3;
+
+    struct Message {
+        unsigned char bytes[MAX_MESSAGE_SIZE];
+        quint8 size;
+        bool dropped; // Removed by coalescing
+    };
+
+    MidiOutputBatch() : m_count(0) {}
+
+    // Returns false (and drops the message) if the batch is full
+    bool append(const unsigned char *data, size_t size) {
+        if (m_count >= MAX_MESSAGES || size == 0 || size > MAX_MESSAGE_SIZE) {
+            return false;
+        }
+        Message &message = m_messages[m_count++];
+        for (size_t i = 0; i < size; ++i) {
+            message.bytes[i] = data[i];
+        }
+        message.size = static_cast<quint8>(size);
+        message.dropped = false;
+        return true;
+    }
+
+    bool noteOn(int channel, int note, int velocity) {
+        const unsigned char message[3] = {
+            static_cast<unsigned char>(0x90 | (channel & 0x0F)),
+            static_cast<unsigned char>(note & 0x7F),
+            static_cast<unsigned char>(velocity & 0x7F)
+        };
+        return append(message, sizeof(message));
+    }
+
+    bool noteOff(int channel, int note, int velocity) {
+        const unsigned char message[3] = {
+            static_cast<unsigned char>(0x80 | (channel & 0x0F)),
+            static_cast<unsigned char>(note & 0x7F),
+            static_cast<unsigned char>(velocity & 0x7F)
+        };
+        return append(message, sizeof(message));
+    }
+
+    bool systemMessage(int status) {
+        const unsigned char message[1] = { static_cast<unsigned char>(status & 0xFF) };
+        return append(message, sizeof(message));
+    }
+
+    bool timeCodeQuarterFrame(quint8 data) {
+        const unsigned char message[2] = { 0xF1, static_cast<unsigned char>(data & 0x7F) };
+        return append(message, sizeof(message));
+    }
+
+    bool songPositionPointer(int position) {
+        const unsigned char message[3] = {
+            0xF2,
+            static_cast<unsigned char>(position & 0x7F),
+            static_cast<unsigned char>((position >> 7) & 0x7F)
+        };
+        return append(message, sizeof(message));
+    }
+
+    // Drop Note Off/Note On pairs on the same channel and note that cancel
+    // out within this batch:
+    //  - Note Off followed by Note On (re-trigger): the note is tied instead
+    //  - Note On followed by Note Off (zero-length note): nothing sounds
+    // Returns the number of messages dropped.
+    int coalesceNotePairs() {
+        int dropped = 0;
+        for (int i = 0; i < m_count; ++i) {
+            if (m_messages[i].dropped || !isNoteMessage(m_messages[i])) {
+                continue;
+            }
+            const bool firstIsOn = isNoteOn(m_messages[i]);
+            for (int j = i + 1; j < m_count; ++j) {
+                if (m_messages[j].dropped || !isNoteMessage(m_messages[j]) ||
+                    !sameNote(m_messages[i], m_messages[j])) {
+                    continue;
+                }
+                // The next message on this note decides: an opposite one
+                // cancels, a repeated one leaves both in place
+                if (isNoteOn(m_messages[j]) != firstIsOn) {
+                    m_messages[i].dropped = true;
+                    m_messages[j].dropped = true;
+                    dropped += 2;
+                }
+                break;
+            }
+        }
+        return dropped;
+    }
+
+    int count() const { return m_count; }
+    const Message &at(int index) const { return m_messages[index]; }
+    bool isEmpty() const { return m_count == 0; }
+    void clear() { m_count = 0; }
+
+    // Messages that will actually go out (not dropped by coalescing)
+    int liveCount() const {
+        int live = 0;
+        for (int i = 0; i < m_count; ++i) {
+            if (!m_messages[i].dropped) {
+                ++live;
+            }
+        }
+        return live;
+    }
+
+private:
+    static bool isNoteMessage(const Message &message) {
+        const unsigned char type = message.bytes[0] & 0xF0;
+        return message.size == 3 && (type == 0x80 || type == 0x90);
+    }
+
+    // Note On with velocity 0 is a Note Off
+    static bool isNoteOn(const Message &message) {
+        return (message.bytes[0] & 0xF0) == 0x90 && message.bytes[2] != 0;
+    }
+
+    static bool sameNote(const Message &a, const Message &b) {
+        return (a.bytes[0] & 0x0F) == (b.bytes[0] & 0x0F) && a.bytes[1] == b.bytes[1];
+    }
+
+    Message m_messages[MAX_MESSAGES];
+    int m_count;
+};
+
+#endif // MIDIOUTPUTBATCH_H
@@ -0,0 +1,356 @@
+#include "MidiOutputPort.h"
+#include "MidiTime.h"
+#include "RealtimeScheduling.h"
+#include <mutex>
+
+RtMidiOutputBackend::RtMidiOutputBackend()
+    : m_rtMidiOut(std::make_unique<RtMidiOut>())
+{
+}
+
+void RtMidiOutputBackend::open(unsigned int portIndex) {
+    m_rtMidiOut->openPort(portIndex);
+}
+
+void RtMidiOutputBackend::close() {
+    if (m_rtMidiOut->isPortOpen()) {
+        try {
+            m_rtMidiOut->closePort();
+        } catch (const RtMidiError &rtmidiError) {
+            // Ignore errors
+        }
+    }
+}
+
+bool RtMidiOutputBackend::isOpen() const {
+    return m_rtMidiOut->isPortOpen();
+}
+
+void RtMidiOutputBackend::sendMessage(const unsigned char *data, size_t size) {
+    if (!m_rtMidiOut->isPortOpen()) return;
+    try {
+        m_rtMidiOut->sendMessage(data, size);
+    } catch (const RtMidiError &rtmidiError) {
+        // Ignore errors
+    }
+}
+
+MidiOutputPort::MidiOutputPort(const QString &name, std::unique_ptr<MidiOutputBackend> backend,
+                               quint8 routes, LatencyHistogram *sendLatency)
+    : m_name(name)
+    , m_backend(std::move(backend))
+    , m_routes(routes)
+    , m_zones(MidiOutputZone::All)
+    , m_latencyOffsetNs(static_cast<qint64>(DEFAULT_LATENCY_OFFSET_MS * 1000000.0))
+    , m_clockMultiplier(1)
+    , m_clockDivider(1)
+    , m_clockPhase(0)
+    , m_lastClockDueNs(0)
+    , m_pendingHead(0)
+    , m_pendingCount(0)
+    , m_batchCount(0)
+    , m_messageCount(0)
+    , m_latencySumNs(0)
+    , m_latencyMaxNs(0)
+    , m_earlyCount(0)
+    , m_sendLatency(sendLatency)
+{
+    m_worker = std::make_unique<MidiOutputPortWorker>(this);
+    m_worker->start(QThread::TimeCriticalPriority);
+}
+
+MidiOutputPort::~MidiOutputPort() {
+    // Flushes whatever is still queued before the backend goes away
+    m_worker->stop();
+}
+
+void MidiOutputPort::setRoutes(quint8 routes) {
+    m_routes.store(routes, std::memory_order_relaxed);
+}
+
+quint8 MidiOutputPort::routes() const {
+    return m_routes.load(std::memory_order_relaxed);
+}
+
+void MidiOutputPort::setLatencyOffsetMs(double offsetMs) {
+    m_latencyOffsetNs.store(static_cast<qint64>(qMax(0.0, offsetMs) * 1000000.0), std::memory_order_relaxed);
+}
+
+double MidiOutputPort::latencyOffsetMs() const {
+    return m_latencyOffsetNs.load(std::memory_order_relaxed) / 1000000.0;
+}
+
+void MidiOutputPort::setClockRate(int multiplier, int divider) {
+    m_clockMultiplier.store(qBound(1, multiplier, MAX_CLOCK_RATE), std::memory_order_relaxed);
+    m_clockDivider.store(qBound(1, divider, MAX_CLOCK_RATE), std::memory_order_relaxed);
+}
+
+bool MidiOutputPort::enqueue(const MidiOutputBatch &batch, qint64 timestamp, qint64 presentationTimeNs,
+                             bool compensate) {
+    const quint8 routes = m_routes.load(std::memory_order_relaxed);
+    const int multiplier = m_clockMultiplier.load(std::memory_order_relaxed);
+    const int divider = m_clockDivider.load(std::memory_order_relaxed);
+    const bool rescaled = multiplier != 1 || divider != 1;
+    
+    QueuedBatch queued;
+    queued.enqueuedAt = timestamp;
+    queued.cancel = false;
+    queued.dueAt = presentationTimeNs > 0 && compensate
+        ? presentationTimeNs - m_latencyOffsetNs.load(std::memory_order_relaxed)
+        : presentationTimeNs;
+    bool clock = false;
+    bool start = false;
+    bool stop = false;
+    for (int i = 0; i < batch.count(); ++i) {
+        const MidiOutputBatch::Message &message = batch.at(i);
+        if (message.dropped || !(MidiOutputRoute::forStatus(message.bytes[0]) & routes)) {
+            continue;
+        }
+        if (rescaled) {
+            // The clock is added back below if this one passes
+            if (message.bytes[0] == 0xF8) {
+                clock = true;
+                continue;
+            }
+            start = start || message.bytes[0] == 0xFA;
+            stop = stop || message.bytes[0] == 0xFC;
+        }
+        queued.batch.append(message.bytes, message.size);
+    }
+    if (queued.batch.isEmpty() && !clock) {
+        return false;
+    }
+    
+    bool pushed = true;
+    {
+        std::lock_guard<WriterLock> guard(m_producerLock);
+        int extraClocks = 0;
+        qint64 clockDueNs = 0;
+        qint64 extraStepNs = 0;
+        if (start || stop) {
+            m_clockPhase = 0;
+            m_lastClockDueNs = 0;
+        }
+        if (stop && multiplier > 1) {
+            // Ahead of the Stop, so the extra clocks held for after the last one go
+            QueuedBatch cancel;
+            cancel.enqueuedAt = timestamp;
+            cancel.dueAt = 0;
+            cancel.cancel = true;
+            pushed = m_queue.push(cancel);
+        }
+        if (clock) {
+            if (m_clockPhase == 0) {
+                const unsigned char status = 0xF8;
+                queued.batch.append(&status, 1);
+                clockDueNs = queued.dueAt > 0 ? queued.dueAt : timestamp;
+                if (multiplier > 1 && m_lastClockDueNs > 0 && clockDueNs > m_lastClockDueNs) {
+                    extraClocks = multiplier - 1;
+                    extraStepNs = (clockDueNs - m_lastClockDueNs) / multiplier;
+                }
+                m_lastClockDueNs = clockDueNs;
+            }
+            m_clockPhase = (m_clockPhase + 1) % divider;
+        }
+        if (!queued.batch.isEmpty()) {
+            pushed = m_queue.push(queued) && pushed;
+        }
+        // Between this clock and the next, at the last interval's spacing
+        for (int i = 1; i <= extraClocks && pushed; ++i) {
+            QueuedBatch extra;
+            extra.enqueuedAt = timestamp;
+            extra.dueAt = clockDueNs + i * extraStepNs;
+            extra.cancel = false;
+            extra.batch.systemMessage(0xF8);
+            pushed = m_queue.push(extra);
+        }
+    }
+    if (pushed) {
+        m_wake.notify();
+    }
+    return pushed;
+}
+
+bool MidiOutputPort::cancelScheduled() {
+    // Through the queue, so it lands in order with the batches around it
+    QueuedBatch queued;
+    queued.enqueuedAt = MidiTime::nowNanoseconds();
+    queued.dueAt = 0;
+    queued.cancel = true;
+    bool pushed;
+    {
+        std::lock_guard<WriterLock> guard(m_producerLock);
+        pushed = m_queue.push(queued);
+    }
+    if (pushed) {
+        m_wake.notify();
+    }
+    return pushed;
+}
+
+void MidiOutputPort::drain() {
+    QueuedBatch queued;
+    while (m_queue.pop(queued)) {
+        if (queued.cancel) {
+            cancelPending();
+            continue;
+        }
+        if (queued.dueAt > 0 && m_backend->schedulesDelivery()) {
+            // The OS holds it until due (nothing for this thread to wait for)
+            m_backend->scheduleBatch(queued.batch, queued.dueAt);
+            recordSend(queued, queued.enqueuedAt);
+            continue;
+        }
+        if (queued.dueAt <= MidiTime::nowNanoseconds()) {
+            // Immediate or already due: send now
+            send(queued);
+            continue;
+        }
+        if (m_pendingCount >= MAX_PENDING) {
+            // Nowhere to hold it: whichever is due first goes early, so
+            // the port still sends in due-time order
+            m_earlyCount.fetch_add(1, std::memory_order_relaxed);
+            if (queued.dueAt <= pendingAt(0).dueAt) {
+                send(queued);
+                continue;
+            }
+            send(pendingAt(0));
+            m_pendingHead = (m_pendingHead + 1) % MAX_PENDING;
+            --m_pendingCount;
+        }
+        
+        // Keep the pending list sorted by due time (batches mostly arrive
+        // in order, so this rarely moves any)
+        int index = m_pendingCount;
+        while (index > 0 && pendingAt(index - 1).dueAt > queued.dueAt) {
+            pendingAt(index) = pendingAt(index - 1);
+            --index;
+        }
+        pendingAt(index) = queued;
+        ++m_pendingCount;
+    }
+    sendDuePending();
+}
+
+void MidiOutputPort::sendDuePending() {
+    while (m_pendingCount > 0) {
+        const qint64 remaining = pendingAt(0).dueAt - MidiTime::nowNanoseconds();
+        if (remaining > SPIN_WINDOW_NS) {
+            return;
+        }
+        while (MidiTime::nowNanoseconds() < pendingAt(0).dueAt) {
+            MidiTime::cpuRelax();
+        }
+        send(pendingAt(0));
+        m_pendingHead = (m_pendingHead + 1) % MAX_PENDING;
+        --m_pendingCount;
+    }
+}
+
+void MidiOutputPort::flushPending() {
+    for (int i = 0; i < m_pendingCount; ++i) {
+        send(pendingAt(i));
+    }
+    m_pendingCount = 0;
+}
+
+void MidiOutputPort::cancelPending() {
+    m_pendingCount = 0;
+    m_backend->cancelScheduled();
+}
+
+qint64 MidiOutputPort::nextPendingDeadline() const {
+    return m_pendingCount > 0 ? m_pending[m_pendingHead].dueAt : 0;
+}
+
+void MidiOutputPort::send(const QueuedBatch &queued) {
+    m_backend->sendBatch(queued.batch);
+    
+    // Scheduled batches are measured against their due time (how late the
+    // port actually sent), immediate ones against when they were queued
+    recordSend(queued, queued.dueAt > 0 ? qMax(queued.dueAt, queued.enqueuedAt) : queued.enqueuedAt);
+}
+
+void MidiOutputPort::recordSend(const QueuedBatch &queued, qint64 reference) {
+    const qint64 latency = qMax<qint64>(0, MidiTime::nowNanoseconds() - reference);
+    m_batchCount.fetch_add(1, std::memory_order_relaxed);
+    m_messageCount.fetch_add(queued.batch.count(), std::memory_order_relaxed);
+    m_latencySumNs.fetch_add(latency, std::memory_order_relaxed);
+    if (latency > m_latencyMaxNs.load(std::memory_order_relaxed)) {
+        m_latencyMaxNs.store(latency, std::memory_order_relaxed); // Single writer
+    }
+    if (m_sendLatency) {
+        m_sendLatency->record(latency);
+    }
+}
+
+OutputPortStats MidiOutputPort::stats() const {
+    OutputPortStats stats;
+    stats.name = m_name;
+    stats.routes = routes();
+    stats.zones = zones();
+    stats.batches = m_batchCount.load(std::memory_order_relaxed);
+    stats.messages = m_messageCount.load(std::memory_order_relaxed);
+    stats.dropped = m_queue.overflowCount();
+    stats.sentEarly = m_earlyCount.load(std::memory_order_relaxed);
+    stats.averageLatencyUs = stats.batches > 0
+        ? m_latencySumNs.load(std::memory_order_relaxed) / 1000.0 / stats.batches
+        : 0.0;
+    stats.maxLatencyUs = m_latencyMaxNs.load(std::memory_order_relaxed) / 1000.0;
+    stats.latencyOffsetMs = latencyOffsetMs();
+    stats.timestamped = m_backend->schedulesDelivery();
+    stats.clockMultiplier = clockMultiplier();
+    stats.clockDivider = clockDivider();
+    return stats;
+}
+
+void MidiOutputPort::resetStats() {
+    m_batchCount.store(0);
+    m_messageCount.store(0);
+    m_latencySumNs.store(0);
+    m_latencyMaxNs.store(0);
+    m_earlyCount.store(0);
+}
+
+MidiOutputPortWorker::MidiOutputPortWorker(MidiOutputPort *port, QObject *parent)
+    : QThread(parent)
+    , m_port(port)
+    , m_stopRequested(false)
+{
+    setObjectName("MidiOutputPortWorker");
+}
+
+MidiOutputPortWorker::~MidiOutputPortWorker() {
+    stop();
+}
+
+void MidiOutputPortWorker::stop() {
+    if (!isRunning()) {
+        return;
+    }
+    m_stopRequested.store(true, std::memory_order_release);
+    m_port->m_wake.forceNotify();
+    wait();
+    m_stopRequested.store(false, std::memory_order_release);
+}
+
+void MidiOutputPortWorker::run() {
+    RealtimeScheduling::applyToCurrentThread(RealtimeThreadRole::Output);
+    while (!m_stopRequested.load(std::memory_order_acquire)) {
+        // Sleep until new data or until shortly before the next scheduled
+        // batch is due (drain() spins the rest of the way)
+        const qint64 nextDeadline = m_port->nextPendingDeadline();
+        if (nextDeadline == 0) {
+            m_port->m_wake.wait();
+        } else {
+            const qint64 sleepNs = nextDeadline - MidiOutputPort::SPIN_WINDOW_NS - MidiTime::nowNanoseconds();
+            if (sleepNs > 0) {
+                m_port->m_wake.waitFor(sleepNs);
+            }
+        }
+        m_port->drain();
+    }
+    // Stopping: nothing may be left behind (a held Note On would hang)
+    m_port->drain();
+    m_port->flushPending();
+}
@@ -0,0 +1,225 @@
+#ifndef MIDIOUTPUTPORT_H
+#define MIDIOUTPUTPORT_H
+
+#include <QString>
+#include <QThread>
+#include <atomic>
+#include <memory>
+#include <RtMidi.h>
+#include "MidiEventQueue.h"
+#include "LatencyHistogram.h"
+#include "MidiInputThread.h"
+#include "MidiOutputBackend.h"
+#include "MidiOutputBatch.h"
+#include "SeqLock.h"
+
+// Which kinds of message an output port receives
+namespace MidiOutputRoute {
+    enum : quint8 {
+        Clock = 0x01,        // 0xF8
+        Transport = 0x02,    // Start, Continue, Stop
+        SongPosition = 0x04, // 0xF2
+        Notes = 0x08,        // Channel voice messages
+        TimeCode = 0x10,     // 0xF1 (MTC quarter frames)
+        All = 0x1F
+    };
+
+    // Route a message belongs to (anything unclassified follows Notes)
+    inline quint8 forStatus(unsigned char status) {
+        switch (status) {
+        case 0xF8: return Clock;
+        case 0xFA:
+        case 0xFB:
+        case 0xFC: return Transport;
+        case 0xF2: return SongPosition;
+        case 0xF1: return TimeCode;
+        default: return Notes;
+        }
+    }
+}
+
+// Tempo zones: independent sync controllers sharing one engine, each
+// sending to the ports whose zone mask has its bit
+namespace MidiOutputZone {
+    constexpr int MAX_ZONES = 8;
+    enum : quint8 {
+        All = 0xFF
+    };
+
+    inline quint8 forZone(int zone) { return static_cast<quint8>(1u << zone); }
+}
+
+// Backend for one RtMidi output port
+class RtMidiOutputBackend : public MidiOutputBackend {
+public:
+    RtMidiOutputBackend();
+
+    // Throws RtMidiError like RtMidiOut::openPort
+    void open(unsigned int portIndex);
+    void close();
+    bool isOpen() const;
+
+    void sendMessage(const unsigned char *data, size_t size) override;
+
+private:
+    std::unique_ptr<RtMidiOut> m_rtMidiOut;
+};
+
+// Send-latency counters for one port (enqueue on the timing thread to
+// backend send returning on the port's worker)
+struct OutputPortStats {
+    QString name;
+    quint8 routes;
+    quint8 zones;
+    quint64 batches;
+    quint64 messages;
+    quint64 dropped;              // Batches lost to a full port queue
+    quint64 sentEarly;            // Held batches sent before due: the pending list was full
+    double averageLatencyUs;      // Immediate (or OS-scheduled): since enqueue; held: since due time
+    double maxLatencyUs;
+    double latencyOffsetMs;
+    bool timestamped;             // Scheduled batches go to the OS scheduler
+    int clockMultiplier;
+    int clockDivider;
+};
+
+class MidiOutputPortWorker;
+
+// One open output in MidiEngine's fan-out set
+// enqueue() filters a batch by the port's route mask and hands it to the
+// port's own worker thread, so a slow destination (a USB interface that
+// blocks, a flaky network session) never delays the other ports or the
+// thread that produced the tick.
+//
+// Batches can carry a presentation time: the worker holds them and sends
+// at presentation time minus the port's latency offset, so each device's
+// downbeat arrives on the beat despite a different pipeline delay. A
+// backend that schedulesDelivery() gets them at once with that due time
+// instead, and the OS sends them.
+class MidiOutputPort {
+public:
+    // Advance applied to new ports (the former global emission advance)
+    static constexpr double DEFAULT_LATENCY_OFFSET_MS = 70.0;
+
+    // sendLatency (optional, not owned) also receives every send latency
+    MidiOutputPort(const QString &name, std::unique_ptr<MidiOutputBackend> backend,
+                   quint8 routes = MidiOutputRoute::All, LatencyHistogram *sendLatency = nullptr);
+    ~MidiOutputPort();
+
+    MidiOutputPort(const MidiOutputPort &) = delete;
+    MidiOutputPort &operator=(const MidiOutputPort &) = delete;
+
+    QString name() const { return m_name; }
+
+    void setRoutes(quint8 routes);
+    quint8 routes() const;
+
+    // Tempo zones whose output this port takes (a bit per zone, see
+    // MidiEngine::setOutputPortZones); all of them by default
+    void setZones(quint8 zones) { m_zones.store(zones, std::memory_order_relaxed); }
+    quint8 zones() const { return m_zones.load(std::memory_order_relaxed); }
+
+    void setLatencyOffsetMs(double offsetMs);
+    double latencyOffsetMs() const;
+
+    // Clock rate for this device: one clock in every divider passes, and
+    // each one passed is followed by multiplier - 1 more, spread evenly
+    // over the interval since the previous one passed. Start realigns the
+    // count to the bar; Stop drops extra clocks still held. 1:1 by default.
+    static constexpr int MAX_CLOCK_RATE = 8;
+    void setClockRate(int multiplier, int divider);
+    int clockMultiplier() const { return m_clockMultiplier.load(std::memory_order_relaxed); }
+    int clockDivider() const { return m_clockDivider.load(std::memory_order_relaxed); }
+
+    // Any thread; never blocks on the backend. presentationTimeNs = 0
+    // sends as soon as possible; compensate false sends at
+    // presentationTimeNs itself (no latency offset). Returns false if
+    // nothing in the batch is routed here or the queue is full.
+    bool enqueue(const MidiOutputBatch &batch, qint64 timestamp, qint64 presentationTimeNs = 0,
+                 bool compensate = true);
+    
+    // Any thread: everything scheduled before this call and not yet sent
+    // (held here or by the backend's scheduler) is dropped; batches queued
+    // after it are not affected
+    bool cancelScheduled();
+    bool schedulesDelivery() const { return m_backend->schedulesDelivery(); }
+
+    OutputPortStats stats() const;
+    void resetStats();
+
+private:
+    friend class MidiOutputPortWorker;
+
+    struct QueuedBatch {
+        MidiOutputBatch batch;
+        qint64 enqueuedAt;
+        qint64 dueAt; // 0 = immediate
+        bool cancel;  // Not a batch: drop everything scheduled so far
+    };
+
+    // Worker side
+    void drain();
+    void send(const QueuedBatch &queued);
+    void cancelPending();
+    void recordSend(const QueuedBatch &queued, qint64 reference);
+    void sendDuePending();
+    void flushPending();
+    qint64 nextPendingDeadline() const;
+    QueuedBatch &pendingAt(int index) { return m_pending[(m_pendingHead + index) % MAX_PENDING]; }
+
+    // Room for a clock lookahead (a beat of clocks plus its MTC) held here
+    // when the backend can't schedule
+    static const int MAX_PENDING = 128;
+    static const qint64 SPIN_WINDOW_NS = 200000; // busy-wait the last 200us before a due time
+
+    QString m_name;
+    std::unique_ptr<MidiOutputBackend> m_backend;
+    std::atomic<quint8> m_routes;
+    std::atomic<quint8> m_zones;
+    std::atomic<qint64> m_latencyOffsetNs;
+    std::atomic<int> m_clockMultiplier;
+    std::atomic<int> m_clockDivider;
+
+    // Several producers (clock generator, input thread, GUI) are
+    // serialized by a WriterLock (uncontended); the worker is the consumer
+    SpscRingBuffer<QueuedBatch, 256> m_queue;
+    WriterLock m_producerLock;
+    // Clock rate counting (guarded by m_producerLock)
+    int m_clockPhase;
+    qint64 m_lastClockDueNs; // Last clock passed (0 = none since Start)
+    MidiInputWake m_wake;
+    std::unique_ptr<MidiOutputPortWorker> m_worker;
+
+    // Scheduled batches waiting for their due time, a ring sorted from
+    // m_pendingHead (worker only)
+    QueuedBatch m_pending[MAX_PENDING];
+    int m_pendingHead;
+    int m_pendingCount;
+
+    std::atomic<quint64> m_batchCount;
+    std::atomic<quint64> m_messageCount;
+    std::atomic<qint64> m_latencySumNs;
+    std::atomic<qint64> m_latencyMaxNs;
+    std::atomic<quint64> m_earlyCount;
+    LatencyHistogram *m_sendLatency;
+};
+
+// Drains one port's queue, blocking only on that port's backend
+class MidiOutputPortWorker : public QThread {
+    Q_OBJECT
+
+public:
+    MidiOutputPortWorker(MidiOutputPort *port, QObject *parent = nullptr);
+    ~MidiOutputPortWorker();
+
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    MidiOutputPort *m_port;
+    std::atomic<bool> m_stopRequested;
+};
+
+#endif // MIDIOUTPUTPORT_H
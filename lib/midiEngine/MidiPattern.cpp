@@ -0,0 +1,274 @@
+#include "MidiPattern.h"
+#include <QJsonArray>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int DEFAULT_NOTE_LENGTH_TICKS = 6; // A 16th
+
+MidiPatternEvent makeEvent(int tick, int lengthTicks, quint8 status, quint8 data1, quint8 data2, quint8 size) {
+    MidiPatternEvent event;
+    event.tick = tick;
+    event.lengthTicks = lengthTicks;
+    event.bytes[0] = status;
+    event.bytes[1] = data1;
+    event.bytes[2] = data2;
+    event.size = size;
+    return event;
+}
+
+MidiOutputBatch::Message makeMessage(const quint8 *bytes, quint8 size) {
+    MidiOutputBatch::Message message;
+    message.bytes[0] = bytes[0];
+    message.bytes[1] = size > 1 ? bytes[1] : 0;
+    message.bytes[2] = size > 2 ? bytes[2] : 0;
+    message.size = size;
+    message.dropped = false;
+    return message;
+}
+
+MidiOutputBatch::Message noteOffFor(const MidiPatternEvent &event) {
+    const quint8 bytes[3] = {static_cast<quint8>(0x80 | (event.bytes[0] & 0x0F)), event.bytes[1], 0};
+    return makeMessage(bytes, 3);
+}
+
+// One message on its row; Note Offs sort first so a note retriggered on
+// the tick its previous one ends is released before it sounds again
+struct RowEntry {
+    int row;
+    int order; // 0 = Note Off, 1 = anything else
+    MidiOutputBatch::Message message;
+};
+
+// A whole number in [low, high]; fallback when absent
+int readInt(const QJsonObject &object, const char *key, int fallback, int low, int high, bool *ok) {
+    *ok = true;
+    if (!object.contains(key)) {
+        return fallback;
+    }
+    const QJsonValue value = object.value(key);
+    const double number = value.toDouble();
+    *ok = value.isDouble() && number == std::floor(number) && number >= low && number <= high;
+    return static_cast<int>(number);
+}
+
+bool isNoteOn(const MidiPatternEvent &event) {
+    return event.size == 3 && (event.bytes[0] & 0xF0) == 0x90 && event.bytes[2] != 0;
+}
+
+bool sameNote(const MidiOutputBatch::Message &a, const MidiOutputBatch::Message &b) {
+    return a.bytes[0] == b.bytes[0] && a.bytes[1] == b.bytes[1];
+}
+
+} // namespace
+
+MidiPattern::MidiPattern()
+    : lengthTicks(96)
+    , swing(0.5)
+    , swingTicks(6)
+{
+}
+
+void MidiPattern::addNote(int tick, int noteLengthTicks, int channel, int note, int velocity) {
+    events.append(makeEvent(tick, qMax(1, noteLengthTicks), static_cast<quint8>(0x90 | (channel & 0x0F)),
+                            static_cast<quint8>(note & 0x7F), static_cast<quint8>(qBound(1, velocity, 127)), 3));
+}
+
+void MidiPattern::addControlChange(int tick, int channel, int controller, int value) {
+    events.append(makeEvent(tick, 0, static_cast<quint8>(0xB0 | (channel & 0x0F)),
+                            static_cast<quint8>(controller & 0x7F), static_cast<quint8>(value & 0x7F), 3));
+}
+
+void MidiPattern::addProgramChange(int tick, int channel, int program) {
+    events.append(makeEvent(tick, 0, static_cast<quint8>(0xC0 | (channel & 0x0F)),
+                            static_cast<quint8>(program & 0x7F), 0, 2));
+}
+
+bool MidiPattern::fromJson(const QJsonObject &json, MidiPattern *pattern, QString *error) {
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+    MidiPattern result;
+    bool ok = true;
+    if (json.contains("bars")) {
+        result.lengthTicks = readInt(json, "bars", 1, 1, CompiledPattern::MAX_LENGTH_TICKS / 96, &ok) * 96;
+        if (!ok) return fail(QString("\"bars\" must be 1-%1").arg(CompiledPattern::MAX_LENGTH_TICKS / 96));
+    }
+    if (json.contains("lengthTicks")) {
+        result.lengthTicks = readInt(json, "lengthTicks", 96, 1, CompiledPattern::MAX_LENGTH_TICKS, &ok);
+        if (!ok) return fail(QString("\"lengthTicks\" must be 1-%1").arg(CompiledPattern::MAX_LENGTH_TICKS));
+    }
+    if (json.contains("swing")) {
+        result.swing = json.value("swing").toDouble();
+        if (!json.value("swing").isDouble() || result.swing < 0.5 || result.swing > 0.75) {
+            return fail("\"swing\" must be 0.5-0.75");
+        }
+    }
+    result.swingTicks = readInt(json, "swingTicks", 6, 1, 48, &ok);
+    if (!ok) return fail("\"swingTicks\" must be 1-48");
+
+    if (!json.value("events").isArray()) return fail("\"events\" must be an array of events");
+    const QJsonArray events = json.value("events").toArray();
+    for (int i = 0; i < events.size(); ++i) {
+        const QString where = QString("\"events[%1]").arg(i);
+        if (!events.at(i).isObject()) return fail(where + "\" must be an object");
+        const QJsonObject event = events.at(i).toObject();
+        const int tick = readInt(event, "tick", 0, 0, result.lengthTicks - 1, &ok);
+        if (!ok) return fail(where + QString(".tick\" must be 0-%1").arg(result.lengthTicks - 1));
+        const int every = readInt(event, "every", result.lengthTicks, 1, result.lengthTicks, &ok);
+        if (!ok) return fail(where + QString(".every\" must be 1-%1").arg(result.lengthTicks));
+        const int channel = readInt(event, "channel", 0, 0, 15, &ok);
+        if (!ok) return fail(where + ".channel\" must be 0-15");
+
+        const int kinds = (event.contains("note") ? 1 : 0) + (event.contains("cc") ? 1 : 0) +
+                          (event.contains("program") ? 1 : 0);
+        if (kinds != 1) return fail(where + "\" must have one of \"note\", \"cc\" or \"program\"");
+
+        int repeat = 0;
+        for (int at = tick; at < result.lengthTicks; at += every, ++repeat) {
+            if (event.contains("note")) {
+                const int note = readInt(event, "note", 0, 0, 127, &ok);
+                if (!ok) return fail(where + ".note\" must be 0-127");
+                const int velocity = readInt(event, "velocity", 100, 1, 127, &ok);
+                if (!ok) return fail(where + ".velocity\" must be 1-127");
+                const int length = readInt(event, "length", DEFAULT_NOTE_LENGTH_TICKS, 1, result.lengthTicks, &ok);
+                if (!ok) return fail(where + QString(".length\" must be 1-%1").arg(result.lengthTicks));
+                result.addNote(at, length, channel, note, velocity);
+            } else if (event.contains("cc")) {
+                const int controller = readInt(event, "cc", 0, 0, 127, &ok);
+                if (!ok) return fail(where + ".cc\" must be 0-127");
+                int value = 0;
+                if (event.contains("values")) {
+                    const QJsonArray values = event.value("values").toArray();
+                    const QJsonValue step = values.size() > 0 ? values.at(repeat % values.size()) : QJsonValue();
+                    value = step.isDouble() ? step.toInt() : -1;
+                    if (value < 0 || value > 127) return fail(where + ".values\" must list 0-127");
+                } else {
+                    value = readInt(event, "value", 0, 0, 127, &ok);
+                    if (!ok) return fail(where + ".value\" must be 0-127");
+                }
+                result.addControlChange(at, channel, controller, value);
+            } else {
+                const int program = readInt(event, "program", 0, 0, 127, &ok);
+                if (!ok) return fail(where + ".program\" must be 0-127");
+                result.addProgramChange(at, channel, program);
+            }
+            if (result.events.size() > CompiledPattern::MAX_EVENTS) {
+                return fail(QString("At most %1 pattern events").arg(CompiledPattern::MAX_EVENTS));
+            }
+        }
+    }
+    *pattern = result;
+    return true;
+}
+
+std::unique_ptr<CompiledPattern> CompiledPattern::compile(const MidiPattern &pattern, QString *error) {
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return std::unique_ptr<CompiledPattern>();
+    };
+    const int length = pattern.lengthTicks;
+    if (length < 1 || length > MAX_LENGTH_TICKS) {
+        return fail(QString("Pattern length must be 1-%1 ticks").arg(MAX_LENGTH_TICKS));
+    }
+    if (pattern.events.size() > MAX_EVENTS) {
+        return fail(QString("At most %1 pattern events").arg(MAX_EVENTS));
+    }
+    if (pattern.swing < 0.5 || pattern.swing > 0.75 || pattern.swingTicks < 1) {
+        return fail("Swing must be 0.5-0.75 over a subdivision of at least one tick");
+    }
+    // Swing resolves to whole ticks here, once, rather than per tick
+    const int swingShift = static_cast<int>(std::lround((pattern.swing - 0.5) * 2.0 * pattern.swingTicks));
+
+    std::unique_ptr<CompiledPattern> compiled(new CompiledPattern());
+    compiled->m_lengthTicks = length;
+    QVector<RowEntry> entries;
+    entries.reserve(pattern.events.size() * 2);
+    for (const MidiPatternEvent &event : pattern.events) {
+        if (event.tick < 0 || event.tick >= length || event.size < 1 ||
+            event.size > MidiOutputBatch::MAX_MESSAGE_SIZE || event.bytes[0] < 0x80) {
+            return fail(QString("Pattern event at tick %1 is not a message within the pattern").arg(event.tick));
+        }
+        const bool swung = swingShift > 0 && event.tick % (2 * pattern.swingTicks) >= pattern.swingTicks;
+        // Swung past the end, a start stays on the last tick rather than
+        // wrapping ahead of the bar it belongs to
+        const int start = swung ? qMin(event.tick + swingShift, length - 1) : event.tick;
+        entries.append({start, 1, makeMessage(event.bytes, event.size)});
+        if (!isNoteOn(event) || event.lengthTicks <= 0) {
+            continue;
+        }
+        // A note as long as the pattern is released just before it retriggers
+        const int end = start + qMin(event.lengthTicks, length);
+        const MidiOutputBatch::Message noteOff = noteOffFor(event);
+        entries.append({end % length, 0, noteOff});
+        if (end >= length) {
+            compiled->m_tailNoteOffs.append(noteOff);
+        }
+        const bool known = std::any_of(compiled->m_allNoteOffs.cbegin(), compiled->m_allNoteOffs.cend(),
+                                       [&noteOff](const MidiOutputBatch::Message &other) {
+            return sameNote(noteOff, other);
+        });
+        if (!known) {
+            compiled->m_allNoteOffs.append(noteOff);
+        }
+    }
+    if (compiled->m_tailNoteOffs.size() > MidiOutputBatch::MAX_MESSAGES) {
+        return fail(QString("At most %1 notes may carry past the end of a pattern").arg(int(MidiOutputBatch::MAX_MESSAGES)));
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), [](const RowEntry &a, const RowEntry &b) {
+        return a.row != b.row ? a.row < b.row : a.order < b.order;
+    });
+    compiled->m_rowStart.resize(length + 1);
+    compiled->m_messages.reserve(entries.size());
+    int next = 0;
+    for (int row = 0; row < length; ++row) {
+        compiled->m_rowStart[row] = compiled->m_messages.size();
+        while (next < entries.size() && entries.at(next).row == row) {
+            compiled->m_messages.append(entries.at(next++).message);
+        }
+        if (compiled->m_messages.size() - compiled->m_rowStart.at(row) > MidiOutputBatch::MAX_MESSAGES) {
+            return fail(QString("Pattern tick %1 has more than %2 messages").arg(row).arg(int(MidiOutputBatch::MAX_MESSAGES)));
+        }
+    }
+    compiled->m_rowStart[length] = compiled->m_messages.size();
+    return compiled;
+}
+
+int CompiledPattern::appendTick(qint64 tick, MidiOutputBatch &batch) const {
+    const int index = row(tick);
+    int appended = 0;
+    for (int i = m_rowStart.at(index); i < m_rowStart.at(index + 1); ++i) {
+        const MidiOutputBatch::Message &message = m_messages.at(i);
+        if (batch.append(message.bytes, message.size)) {
+            ++appended;
+        }
+    }
+    return appended;
+}
+
+int CompiledPattern::rowSize(qint64 tick) const {
+    const int index = row(tick);
+    return m_rowStart.at(index + 1) - m_rowStart.at(index);
+}
+
+void CompiledPattern::appendTailNoteOffs(MidiOutputBatch &batch) const {
+    for (const MidiOutputBatch::Message &message : m_tailNoteOffs) {
+        batch.append(message.bytes, message.size);
+    }
+}
+
+int CompiledPattern::appendAllNoteOffs(MidiOutputBatch &batch, int first) const {
+    int index = first;
+    while (index < m_allNoteOffs.size() &&
+           batch.append(m_allNoteOffs.at(index).bytes, m_allNoteOffs.at(index).size)) {
+        ++index;
+    }
+    return index;
+}
@@ -0,0 +1,93 @@
+#ifndef MIDIPATTERN_H
+#define MIDIPATTERN_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include <memory>
+#include "MidiOutputBatch.h"
+
+// One message of a pattern, at a tick from the pattern's start (24 per
+// quarter note, the MIDI clock's resolution)
+struct MidiPatternEvent {
+    int tick;
+    int lengthTicks; // Note On: its Note Off this many ticks later (0 = a single message)
+    quint8 bytes[MidiOutputBatch::MAX_MESSAGE_SIZE];
+    quint8 size;
+};
+
+// What the sync controller plays against the clock, as written
+// A note's Note Off wraps past the end into the next repeat. Swing
+// delays whatever starts in the second of each pair of swingTicks
+// subdivisions (a note keeps its length; nothing is pushed past the
+// last tick): 0.5 is straight, 0.66 a triplet feel, 0.75 a dotted one.
+// Compile it (CompiledPattern) to play it.
+struct MidiPattern {
+    int lengthTicks;   // 96 = one 4/4 bar
+    double swing;      // 0.5-0.75
+    int swingTicks;    // Swung subdivision: 6 = 16ths, 12 = 8ths
+    QVector<MidiPatternEvent> events;
+
+    MidiPattern();
+
+    void addNote(int tick, int lengthTicks, int channel, int note, int velocity);
+    void addControlChange(int tick, int channel, int controller, int value);
+    void addProgramChange(int tick, int channel, int program);
+
+    // JSON object, every key optional but "events":
+    //   {"bars": 1, (or "lengthTicks": 96)
+    //    "swing": 0.6, "swingTicks": 6,
+    //    "events": [
+    //      {"tick": 0, "note": 36, "velocity": 110, "length": 12, "channel": 9},
+    //      {"tick": 0, "every": 24, "note": 42, "velocity": 80, "length": 6},
+    //      {"tick": 0, "program": 5},
+    //      {"tick": 0, "every": 6, "cc": 74, "values": [0, 16, 32, 48]}]}
+    // "every" repeats the event to the end of the pattern; "values" steps
+    // through a control change's values on each repeat. Channels are 0-15
+    // (0 when omitted). false with a message on a bad value.
+    static bool fromJson(const QJsonObject &json, MidiPattern *pattern, QString *error);
+};
+
+// A pattern flattened for the tick path: one row of messages per tick,
+// so playing tick n is a lookup of row n % lengthTicks() and a copy into
+// the tick's batch, whatever the pattern holds. Immutable once compiled
+// (the tick thread reads it while other threads build the next one).
+class CompiledPattern {
+public:
+    static constexpr int MAX_LENGTH_TICKS = 96 * 16; // 16 bars
+    static constexpr int MAX_EVENTS = 4096;
+
+    // nullptr with a message if it can't be played: a length out of
+    // range, or more messages on one tick than a batch holds
+    static std::unique_ptr<CompiledPattern> compile(const MidiPattern &pattern, QString *error = nullptr);
+
+    int lengthTicks() const { return m_lengthTicks; }
+    int eventCount() const { return m_messages.size(); }
+
+    // Appends tick's row (Note Offs first) to batch; returns how many
+    // messages it added
+    int appendTick(qint64 tick, MidiOutputBatch &batch) const;
+    int rowSize(qint64 tick) const;
+
+    // Note Offs still owed when playback leaves the pattern at its end
+    // (notes wrapping past it; at most a batch)
+    void appendTailNoteOffs(MidiOutputBatch &batch) const;
+    // A Note Off for every note it plays (a stop anywhere in it), from
+    // index first; returns the index after the last one that fit
+    int noteCount() const { return m_allNoteOffs.size(); }
+    int appendAllNoteOffs(MidiOutputBatch &batch, int first = 0) const;
+
+private:
+    CompiledPattern() : m_lengthTicks(0) {}
+
+    int row(qint64 tick) const { return static_cast<int>(((tick % m_lengthTicks) + m_lengthTicks) % m_lengthTicks); }
+
+    int m_lengthTicks;
+    QVector<int> m_rowStart; // lengthTicks + 1 offsets into m_messages
+    QVector<MidiOutputBatch::Message> m_messages;
+    QVector<MidiOutputBatch::Message> m_tailNoteOffs;
+    QVector<MidiOutputBatch::Message> m_allNoteOffs;
+};
+
+#endif // MIDIPATTERN_H
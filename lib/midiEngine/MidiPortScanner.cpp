@@ -0,0 +1,352 @@
+#include "MidiPortScanner.h"
+#include <RtMidi.h>
+#include <chrono>
+
+#if defined(__MACOSX_CORE__)
+#include <CoreMIDI/CoreMIDI.h>
+#elif defined(__LINUX_ALSA__)
+#include <alsa/asoundlib.h>
+#endif
+
+#if defined(__MACOSX_CORE__)
+
+struct MidiPortScanner::NotifyClient {
+    MIDIClientRef client = 0;
+};
+
+namespace {
+
+void coreMidiNotify(const MIDINotification *message, void *context) {
+    // Sent once after any batch of added/removed/changed objects
+    if (message->messageID == kMIDIMsgSetupChanged) {
+        static_cast<MidiPortScanner *>(context)->requestScan();
+    }
+}
+
+// RtMidi's CoreMIDI indexes are MIDIGetSource()/MIDIGetDestination() indexes
+QString endpointId(MIDIEndpointRef endpoint) {
+    SInt32 uniqueId = 0;
+    if (endpoint == 0 || MIDIObjectGetIntegerProperty(endpoint, kMIDIPropertyUniqueID, &uniqueId) != noErr) {
+        return QString();
+    }
+    return "coremidi:" + QString::number(static_cast<int>(uniqueId));
+}
+
+QString inputPortId(unsigned int index) { return endpointId(MIDIGetSource(index)); }
+QString outputPortId(unsigned int index) { return endpointId(MIDIGetDestination(index)); }
+
+} // namespace
+
+#else
+
+#if defined(__LINUX_ALSA__)
+struct MidiPortScanner::NotifyClient {
+    snd_seq_t *seq = nullptr;
+};
+#else
+struct MidiPortScanner::NotifyClient {
+};
+#endif
+
+namespace {
+// Name-based IDs (MidiPortTable::append)
+QString inputPortId(unsigned int) { return QString(); }
+QString outputPortId(unsigned int) { return QString(); }
+} // namespace
+
+#endif
+
+namespace {
+
+#if defined(__LINUX_ALSA__)
+// Announcements are read this often while idle
+const int ALSA_POLL_MS = 100;
+#endif
+
+template <typename Port>
+MidiPortTable enumerate(QString (*portId)(unsigned int)) {
+    MidiPortTable table;
+    try {
+        Port port;
+        const unsigned int count = port.getPortCount();
+        for (unsigned int i = 0; i < count; ++i) {
+            try {
+                table.append(portId(i), QString::fromStdString(port.getPortName(i)));
+            } catch (const RtMidiError &rtmidiError) {
+                // Ignore errors getting individual port names
+            }
+        }
+    } catch (const RtMidiError &rtmidiError) {
+        // No MIDI client: an empty table
+    }
+    return table;
+}
+
+} // namespace
+
+MidiPortTable MidiPortTable::fromNames(const QStringList &names) {
+    MidiPortTable table;
+    for (const QString &name : names) {
+        table.append(QString(), name);
+    }
+    return table;
+}
+
+MidiPortTable MidiPortTable::fromIdsAndNames(const QStringList &ids, const QStringList &names) {
+    MidiPortTable table;
+    for (int i = 0; i < names.size(); ++i) {
+        table.append(i < ids.size() ? ids[i] : QString(), names[i]);
+    }
+    return table;
+}
+
+void MidiPortTable::append(const QString &id, const QString &name) {
+    QString portId = id;
+    if (portId.isEmpty()) {
+        // The name, numbered from the second port of that name on
+        int sameName = 0;
+        for (const MidiPortInfo &port : m_ports) {
+            if (port.name == name) {
+                ++sameName;
+            }
+        }
+        portId = sameName == 0 ? name : name + "#" + QString::number(sameName + 1);
+    }
+
+    const int index = m_ports.size();
+    m_ports.append({portId, name, index});
+    m_byId.insert(portId, index);
+    if (!m_byName.contains(name)) {
+        m_byName.insert(name, index);
+    }
+}
+
+QStringList MidiPortTable::names() const {
+    QStringList names;
+    for (const MidiPortInfo &port : m_ports) {
+        names.append(port.name);
+    }
+    return names;
+}
+
+QStringList MidiPortTable::ids() const {
+    QStringList ids;
+    for (const MidiPortInfo &port : m_ports) {
+        ids.append(port.id);
+    }
+    return ids;
+}
+
+const MidiPortInfo *MidiPortTable::findById(const QString &id) const {
+    const int index = m_byId.value(id, -1);
+    return index >= 0 ? &m_ports[index] : nullptr;
+}
+
+const MidiPortInfo *MidiPortTable::findByName(const QString &name) const {
+    const int index = m_byName.value(name, -1);
+    return index >= 0 ? &m_ports[index] : nullptr;
+}
+
+MidiPortScanner::MidiPortScanner(QObject *parent)
+    : QThread(parent)
+    , m_scanRequested(false)
+    , m_settleScan(false)
+    , m_stopRequested(false)
+    , m_notifications(false)
+    , m_hasLastSnapshot(false)
+    , m_notifyClient(new NotifyClient())
+{
+    qRegisterMetaType<MidiPortSnapshot>("MidiPortSnapshot");
+    m_lastSnapshot.cached = false;
+}
+
+MidiPortScanner::~MidiPortScanner() {
+    stopScanning();
+}
+
+void MidiPortScanner::startScanning() {
+    stopScanning();
+    openNotifications();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = false;
+        m_scanRequested = true;
+        m_settleScan = false;
+    }
+    start(QThread::LowPriority);
+}
+
+void MidiPortScanner::stopScanning() {
+    if (isRunning()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopRequested = true;
+        }
+        m_condition.notify_all();
+        wait();
+    }
+    closeNotifications();
+}
+
+void MidiPortScanner::requestScan() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_scanRequested = true;
+    }
+    m_condition.notify_all();
+}
+
+MidiPortSnapshot MidiPortScanner::scanPorts() {
+    MidiPortSnapshot snapshot;
+    snapshot.inputs = enumerate<RtMidiIn>(&inputPortId);
+    snapshot.outputs = enumerate<RtMidiOut>(&outputPortId);
+    snapshot.cached = false;
+    return snapshot;
+}
+
+void MidiPortScanner::run() {
+    while (waitForRequest()) {
+        const MidiPortSnapshot snapshot = scanPorts();
+        if (m_hasLastSnapshot && snapshot.inputs == m_lastSnapshot.inputs
+            && snapshot.outputs == m_lastSnapshot.outputs) {
+            continue;
+        }
+        m_lastSnapshot = snapshot;
+        m_hasLastSnapshot = true;
+        emit portsScanned(snapshot);
+    }
+}
+
+bool MidiPortScanner::waitForRequest() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        if (m_stopRequested) {
+            return false;
+        }
+        if (m_scanRequested) {
+            // Let the rest of a burst of changes arrive first
+            if (m_settleScan) {
+                m_condition.wait_for(lock, std::chrono::milliseconds(SETTLE_MS), [this]() {
+                    return m_stopRequested;
+                });
+                if (m_stopRequested) {
+                    return false;
+                }
+            }
+            m_scanRequested = false;
+            m_settleScan = true;
+            return true;
+        }
+
+        auto requested = [this]() { return m_stopRequested || m_scanRequested; };
+#if defined(__MACOSX_CORE__)
+        if (m_notifications) {
+            m_condition.wait(lock, requested);
+            continue;
+        }
+#elif defined(__LINUX_ALSA__)
+        if (m_notifications) {
+            if (!m_condition.wait_for(lock, std::chrono::milliseconds(ALSA_POLL_MS), requested)) {
+                lock.unlock();
+                const bool changed = pollNotifications();
+                lock.lock();
+                m_scanRequested = m_scanRequested || changed;
+            }
+            continue;
+        }
+#endif
+        if (!m_condition.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL_MS), requested)) {
+            m_scanRequested = true;
+        }
+    }
+}
+
+#if defined(__MACOSX_CORE__)
+
+void MidiPortScanner::openNotifications() {
+    // Notifications arrive on this thread's run loop
+    if (m_notifyClient->client == 0) {
+        MIDIClientRef client = 0;
+        if (MIDIClientCreate(CFSTR("MidiMaster2 Port Watcher"), &coreMidiNotify, this, &client) == noErr) {
+            m_notifyClient->client = client;
+        }
+    }
+    m_notifications = m_notifyClient->client != 0;
+}
+
+void MidiPortScanner::closeNotifications() {
+    if (m_notifyClient->client != 0) {
+        MIDIClientDispose(m_notifyClient->client);
+        m_notifyClient->client = 0;
+    }
+    m_notifications = false;
+}
+
+bool MidiPortScanner::pollNotifications() {
+    return false;
+}
+
+#elif defined(__LINUX_ALSA__)
+
+void MidiPortScanner::openNotifications() {
+    if (m_notifyClient->seq == nullptr) {
+        snd_seq_t *seq = nullptr;
+        if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+            m_notifications = false;
+            return;
+        }
+        snd_seq_set_client_name(seq, "MidiMaster2 Port Watcher");
+        const int port = snd_seq_create_simple_port(seq, "announce",
+                                                    SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+                                                    SND_SEQ_PORT_TYPE_APPLICATION);
+        if (port < 0 || snd_seq_connect_from(seq, port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0) {
+            snd_seq_close(seq);
+            m_notifications = false;
+            return;
+        }
+        m_notifyClient->seq = seq;
+    }
+    m_notifications = true;
+}
+
+void MidiPortScanner::closeNotifications() {
+    if (m_notifyClient->seq) {
+        snd_seq_close(m_notifyClient->seq);
+        m_notifyClient->seq = nullptr;
+    }
+    m_notifications = false;
+}
+
+bool MidiPortScanner::pollNotifications() {
+    bool changed = false;
+    snd_seq_event_t *event = nullptr;
+    while (snd_seq_event_input(m_notifyClient->seq, &event) >= 0) {
+        switch (event->type) {
+        case SND_SEQ_EVENT_CLIENT_START:
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+        case SND_SEQ_EVENT_PORT_START:
+        case SND_SEQ_EVENT_PORT_EXIT:
+        case SND_SEQ_EVENT_PORT_CHANGE:
+            changed = true;
+            break;
+        default:
+            break;
+        }
+    }
+    return changed;
+}
+
+#else
+
+void MidiPortScanner::openNotifications() {
+    m_notifications = false;
+}
+
+void MidiPortScanner::closeNotifications() {
+}
+
+bool MidiPortScanner::pollNotifications() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef MIDIPORTSCANNER_H
+#define MIDIPORTSCANNER_H
+
+#include <QThread>
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QString>
+#include <QStringList>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// One enumerated port: its RtMidi index at scan time and an ID that stays
+// the same while the port exists, whatever is plugged in around it
+// (the CoreMIDI endpoint unique ID on macOS; elsewhere the name, with
+// "#2", "#3"... for ports sharing a name)
+struct MidiPortInfo {
+    QString id;
+    QString name;
+    int index;
+
+    bool operator==(const MidiPortInfo &other) const {
+        return id == other.id && name == other.name && index == other.index;
+    }
+};
+
+// Ports of one direction in RtMidi order, with hashed lookup by ID and
+// by name (the first port of that name)
+class MidiPortTable {
+public:
+    // IDs default to the name-based scheme
+    static MidiPortTable fromNames(const QStringList &names);
+    static MidiPortTable fromIdsAndNames(const QStringList &ids, const QStringList &names);
+
+    void append(const QString &id, const QString &name);
+
+    const QList<MidiPortInfo> &ports() const { return m_ports; }
+    int size() const { return m_ports.size(); }
+    bool isEmpty() const { return m_ports.isEmpty(); }
+    QStringList names() const;
+    QStringList ids() const;
+
+    // nullptr when absent
+    const MidiPortInfo *findById(const QString &id) const;
+    const MidiPortInfo *findByName(const QString &name) const;
+
+    bool operator==(const MidiPortTable &other) const { return m_ports == other.m_ports; }
+    bool operator!=(const MidiPortTable &other) const { return !(*this == other); }
+
+private:
+    QList<MidiPortInfo> m_ports;
+    QHash<QString, int> m_byId;
+    QHash<QString, int> m_byName;
+};
+
+// Both directions at one moment
+struct MidiPortSnapshot {
+    MidiPortTable inputs;
+    MidiPortTable outputs;
+    bool cached; // Loaded from the last session: indexes unverified
+};
+
+Q_DECLARE_METATYPE(MidiPortSnapshot)
+
+// Background port enumeration
+// Enumerating asks the driver for every port name, which takes long
+// enough with many ports (network sessions, several interfaces) to stall
+// the GUI thread, so it runs here, on the scanner's own RtMidi clients.
+// Scans are requested by the OS hot-plug notification (CoreMIDI setup
+// changes; ALSA sequencer port announcements) or requestScan(); requests
+// arriving together are coalesced into one scan, and a scan that finds
+// nothing new is not reported. Without a notification source the ports
+// are polled every POLL_INTERVAL_MS.
+class MidiPortScanner : public QThread {
+    Q_OBJECT
+
+public:
+    static const int SETTLE_MS = 100;          // A device adds its ports in a burst
+    static const int POLL_INTERVAL_MS = 2000;  // No hot-plug notifications
+
+    explicit MidiPortScanner(QObject *parent = nullptr);
+    ~MidiPortScanner();
+
+    // Call on a thread that runs an event loop (the CoreMIDI notification
+    // arrives on its run loop); the first scan starts at once, without
+    // the SETTLE_MS wait
+    void startScanning();
+    void stopScanning();
+
+    // Any thread
+    void requestScan();
+    bool hasHotPlugNotifications() const { return m_notifications; }
+
+    // Synchronous enumeration (what a scan does), for any thread
+    static MidiPortSnapshot scanPorts();
+
+signals:
+    // Emitted on the scanner thread when the ports differ from the last
+    // scan (always for the first one)
+    void portsScanned(const MidiPortSnapshot &snapshot);
+
+protected:
+    void run() override;
+
+private:
+    void openNotifications();
+    void closeNotifications();
+    bool pollNotifications(); // ALSA: drains announcements, true if any
+    bool waitForRequest();    // false on stop
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_scanRequested;
+    bool m_settleScan;      // False for the first scan: nothing to settle yet
+    bool m_stopRequested;
+    bool m_notifications;
+    MidiPortSnapshot m_lastSnapshot;
+    bool m_hasLastSnapshot;
+
+    // Native notification client (CoreMIDI or ALSA sequencer), defined
+    // in the .cpp to keep the platform headers out
+    struct NotifyClient;
+    std::unique_ptr<NotifyClient> m_notifyClient;
+};
+
+#endif // MIDIPORTSCANNER_H
@@ -0,0 +1,736 @@
+#include "MidiSession.h"
+#include "MidiEngine.h"
+#include "StatsReporter.h"
+#include "SyncController.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QSettings>
+#include <QStandardPaths>
+#if MIDIMASTER2_LINK
+#include "AbletonLinkTimebase.h"
+#endif
+
+namespace {
+
+const char *SETTINGS_ORGANIZATION = "MidiMaster2";
+const char *SETTINGS_APPLICATION = "MidiMaster2";
+
+bool frameRateFromString(const QString &text, MtcFrameRate *rate) {
+    if (text == "24") {
+        *rate = MtcFrameRate::Fps24;
+    } else if (text == "25") {
+        *rate = MtcFrameRate::Fps25;
+    } else if (text == "29.97df" || text == "29.97") {
+        *rate = MtcFrameRate::Fps2997Drop;
+    } else if (text == "30") {
+        *rate = MtcFrameRate::Fps30;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// A port named in the config, by ID first, then by name
+QString resolvePort(const MidiPortTable &table, const QString &configured) {
+    if (const MidiPortInfo *port = table.findById(configured)) {
+        return port->name;
+    }
+    if (const MidiPortInfo *port = table.findByName(configured)) {
+        return port->name;
+    }
+    return QString();
+}
+
+} // namespace
+
+MidiSessionConfig::MidiSessionConfig()
+    : bpm(120.0)
+    , startClock(true)
+    , timeCodeOutput(false)
+    , timeCodeRate(MtcFrameRate::Fps25)
+    , statsIntervalMs(1000)
+    , clockFailover(false)
+    , clockTimeoutPeriods(ClockArbiter::DEFAULT_TIMEOUT_PERIODS)
+    , linkMode(LinkMode::Off)
+    , networkInput(false)
+    , networkPort(RtpMidiSession::DEFAULT_PORT)
+    , networkName("MidiMaster2")
+    , capture(true)
+    , replaySpeed(1.0)
+    , timestampedOutput(false)
+    , clockLookaheadTicks(24) // One beat
+    , hasPattern(false)
+{
+}
+
+MidiSessionConfig::Zone::Zone()
+    : bpm(120.0)
+    , followInput(false)
+    , startClock(true)
+{
+}
+
+bool MidiSessionConfig::fromJson(const QJsonObject &json, MidiSessionConfig *config, QString *error) {
+    auto fail = [error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        return false;
+    };
+    
+    if (json.contains("output")) {
+        if (!json.value("output").isString()) return fail("\"output\" must be a port name or ID");
+        config->outputPort = json.value("output").toString();
+    }
+    if (json.contains("input")) {
+        if (!json.value("input").isString()) return fail("\"input\" must be a port name or ID");
+        config->inputPort = json.value("input").toString();
+    }
+    if (json.contains("bpm")) {
+        const double bpm = json.value("bpm").toDouble();
+        if (!json.value("bpm").isDouble() || bpm < 20.0 || bpm > 300.0) return fail("\"bpm\" must be 20-300");
+        config->bpm = bpm;
+    }
+    if (json.contains("start")) {
+        if (!json.value("start").isBool()) return fail("\"start\" must be true or false");
+        config->startClock = json.value("start").toBool();
+    }
+    if (json.contains("latencyOffsetsMs")) {
+        if (!json.value("latencyOffsetsMs").isObject()) return fail("\"latencyOffsetsMs\" must map output names to milliseconds");
+        const QJsonObject offsets = json.value("latencyOffsetsMs").toObject();
+        for (const QString &port : offsets.keys()) {
+            if (!offsets.value(port).isDouble()) return fail("Latency offset for \"" + port + "\" must be a number");
+            config->latencyOffsetsMs.insert(port, offsets.value(port).toDouble());
+        }
+    }
+    if (json.contains("timeCode")) {
+        if (!json.value("timeCode").isObject()) return fail("\"timeCode\" must be an object");
+        const QJsonObject timeCode = json.value("timeCode").toObject();
+        if (timeCode.contains("enabled")) {
+            if (!timeCode.value("enabled").isBool()) return fail("\"timeCode.enabled\" must be true or false");
+            config->timeCodeOutput = timeCode.value("enabled").toBool();
+        }
+        if (timeCode.contains("rate") && !frameRateFromString(timeCode.value("rate").toString(), &config->timeCodeRate)) {
+            return fail("\"timeCode.rate\" must be 24, 25, 29.97df or 30");
+        }
+    }
+    if (json.contains("stats")) {
+        if (!json.value("stats").isObject()) return fail("\"stats\" must be an object");
+        const QJsonObject stats = json.value("stats").toObject();
+        config->statsPath = stats.value("path").toString();
+        if (stats.contains("intervalMs")) {
+            config->statsIntervalMs = stats.value("intervalMs").toInt();
+        }
+    }
+    if (json.contains("clockFailover")) {
+        if (!json.value("clockFailover").isObject()) return fail("\"clockFailover\" must be an object");
+        const QJsonObject failover = json.value("clockFailover").toObject();
+        if (failover.contains("enabled")) {
+            if (!failover.value("enabled").isBool()) return fail("\"clockFailover.enabled\" must be true or false");
+            config->clockFailover = failover.value("enabled").toBool();
+        }
+        if (failover.contains("backups")) {
+            if (!failover.value("backups").isArray()) return fail("\"clockFailover.backups\" must list port names or IDs");
+            const QJsonArray backups = failover.value("backups").toArray();
+            for (int i = 0; i < backups.size(); ++i) {
+                if (!backups.at(i).isString()) return fail("\"clockFailover.backups\" must list port names or IDs");
+                config->backupInputs.append(backups.at(i).toString());
+            }
+            if (config->backupInputs.size() > MidiEngine::MAX_BACKUP_INPUTS) {
+                return fail(QString("At most %1 clock failover backups").arg(MidiEngine::MAX_BACKUP_INPUTS));
+            }
+        }
+        if (failover.contains("timeoutPeriods")) {
+            const double periods = failover.value("timeoutPeriods").toDouble();
+            if (!failover.value("timeoutPeriods").isDouble() || periods < 2.0) return fail("\"clockFailover.timeoutPeriods\" must be at least 2");
+            config->clockTimeoutPeriods = periods;
+        }
+    }
+    if (json.contains("link")) {
+        if (!json.value("link").isObject()) return fail("\"link\" must be an object");
+        const QString mode = json.value("link").toObject().value("mode").toString();
+        if (mode == "off") {
+            config->linkMode = LinkMode::Off;
+        } else if (mode == "follow") {
+            config->linkMode = LinkMode::Follow;
+        } else if (mode == "publish") {
+            config->linkMode = LinkMode::Publish;
+        } else {
+            return fail("\"link.mode\" must be off, follow or publish");
+        }
+    }
+    if (json.contains("network")) {
+        if (!json.value("network").isObject()) return fail("\"network\" must be an object");
+        const QJsonObject network = json.value("network").toObject();
+        if (network.contains("enabled")) {
+            if (!network.value("enabled").isBool()) return fail("\"network.enabled\" must be true or false");
+            config->networkInput = network.value("enabled").toBool();
+        }
+        if (network.contains("port")) {
+            const int port = network.value("port").toInt();
+            if (!network.value("port").isDouble() || port < 1 || port > 65534) return fail("\"network.port\" must be 1-65534");
+            config->networkPort = static_cast<quint16>(port);
+        }
+        if (network.contains("name")) {
+            if (!network.value("name").isString()) return fail("\"network.name\" must be a string");
+            config->networkName = network.value("name").toString();
+        }
+    }
+    if (json.contains("capture")) {
+        if (!json.value("capture").isObject()) return fail("\"capture\" must be an object");
+        const QJsonObject capture = json.value("capture").toObject();
+        if (capture.contains("enabled")) {
+            if (!capture.value("enabled").isBool()) return fail("\"capture.enabled\" must be true or false");
+            config->capture = capture.value("enabled").toBool();
+        }
+        if (capture.contains("path")) {
+            if (!capture.value("path").isString()) return fail("\"capture.path\" must be a string");
+            config->capturePath = capture.value("path").toString();
+        }
+    }
+    if (json.contains("realtime")) {
+        if (!json.value("realtime").isObject()) return fail("\"realtime\" must be an object");
+        const QJsonObject realtime = json.value("realtime").toObject();
+        RealtimeProfile &profile = config->realtime;
+        for (const char *key : {"enabled", "lockMemory", "prefault"}) {
+            if (realtime.contains(key) && !realtime.value(key).isBool()) {
+                return fail(QString("\"realtime.%1\" must be true or false").arg(key));
+            }
+        }
+        profile.schedulingPolicy = realtime.value("enabled").toBool();
+        profile.lockMemory = realtime.value("lockMemory").toBool();
+        profile.prefault = realtime.value("prefault").toBool();
+        if (realtime.contains("priority")) {
+            const int priority = realtime.value("priority").toInt();
+            if (!realtime.value("priority").isDouble() || priority < 1 || priority > 99) return fail("\"realtime.priority\" must be 1-99");
+            profile.priority = priority;
+        }
+        if (realtime.contains("cpus")) {
+            if (!realtime.value("cpus").isArray()) return fail("\"realtime.cpus\" must be an array of core numbers");
+            const QJsonArray cpus = realtime.value("cpus").toArray();
+            profile.cpus.clear();
+            for (int i = 0; i < cpus.size(); ++i) {
+                if (!cpus.at(i).isDouble() || cpus.at(i).toInt() < 0) return fail("\"realtime.cpus\" must be an array of core numbers");
+                profile.cpus.append(cpus.at(i).toInt());
+            }
+        }
+    }
+    if (json.contains("scheduledOutput")) {
+        if (!json.value("scheduledOutput").isObject()) return fail("\"scheduledOutput\" must be an object");
+        const QJsonObject scheduled = json.value("scheduledOutput").toObject();
+        if (scheduled.contains("enabled")) {
+            if (!scheduled.value("enabled").isBool()) return fail("\"scheduledOutput.enabled\" must be true or false");
+            config->timestampedOutput = scheduled.value("enabled").toBool();
+        }
+        if (scheduled.contains("lookaheadTicks")) {
+            const int ticks = scheduled.value("lookaheadTicks").toInt();
+            if (!scheduled.value("lookaheadTicks").isDouble() || ticks < 1 || ticks > 96) {
+                return fail("\"scheduledOutput.lookaheadTicks\" must be 1-96");
+            }
+            config->clockLookaheadTicks = ticks;
+        }
+    }
+    if (json.contains("clockRates")) {
+        if (!json.value("clockRates").isObject()) return fail("\"clockRates\" must map output names to rates");
+        const QJsonObject rates = json.value("clockRates").toObject();
+        for (const QString &port : rates.keys()) {
+            const QString rateError = QString("Clock rate for \"%1\" must be {\"multiply\": 1-%2, \"divide\": 1-%2}")
+                                      .arg(port).arg(MidiOutputPort::MAX_CLOCK_RATE);
+            if (!rates.value(port).isObject()) return fail(rateError);
+            const QJsonObject rate = rates.value(port).toObject();
+            const QJsonValue multiply = rate.contains("multiply") ? rate.value("multiply") : QJsonValue(1.0);
+            const QJsonValue divide = rate.contains("divide") ? rate.value("divide") : QJsonValue(1.0);
+            if (!multiply.isDouble() || !divide.isDouble() ||
+                multiply.toInt() < 1 || multiply.toInt() > MidiOutputPort::MAX_CLOCK_RATE ||
+                divide.toInt() < 1 || divide.toInt() > MidiOutputPort::MAX_CLOCK_RATE) {
+                return fail(rateError);
+            }
+            config->clockRates.insert(port, {multiply.toInt(), divide.toInt()});
+        }
+    }
+    if (json.contains("pattern")) {
+        if (!json.value("pattern").isObject()) return fail("\"pattern\" must be an object");
+        QString patternError;
+        MidiPattern pattern;
+        // Compiled here too, so a pattern that can't play fails the load
+        if (!MidiPattern::fromJson(json.value("pattern").toObject(), &pattern, &patternError) ||
+            !CompiledPattern::compile(pattern, &patternError)) {
+            return fail("In \"pattern\": " + patternError);
+        }
+        config->pattern = pattern;
+        config->hasPattern = true;
+    }
+    if (json.contains("zones")) {
+        if (!json.value("zones").isArray()) return fail("\"zones\" must be an array of objects");
+        const QJsonArray zones = json.value("zones").toArray();
+        if (zones.size() > MidiOutputZone::MAX_ZONES - 1) {
+            return fail(QString("At most %1 zones").arg(MidiOutputZone::MAX_ZONES - 1));
+        }
+        config->zones.clear();
+        for (int i = 0; i < zones.size(); ++i) {
+            const QString key = QString("\"zones[%1]").arg(i);
+            if (!zones.at(i).isObject()) return fail(key + "\" must be an object");
+            const QJsonObject object = zones.at(i).toObject();
+            MidiSessionConfig::Zone zone;
+            if (!object.value("outputs").isArray() || object.value("outputs").toArray().size() == 0) {
+                return fail(key + ".outputs\" must list port names or IDs");
+            }
+            const QJsonArray outputs = object.value("outputs").toArray();
+            for (int j = 0; j < outputs.size(); ++j) {
+                if (!outputs.at(j).isString()) return fail(key + ".outputs\" must list port names or IDs");
+                zone.outputs.append(outputs.at(j).toString());
+            }
+            if (object.contains("bpm")) {
+                const double bpm = object.value("bpm").toDouble();
+                if (!object.value("bpm").isDouble() || bpm < 20.0 || bpm > 300.0) return fail(key + ".bpm\" must be 20-300");
+                zone.bpm = bpm;
+            }
+            if (object.contains("follow")) {
+                if (!object.value("follow").isBool()) return fail(key + ".follow\" must be true or false");
+                zone.followInput = object.value("follow").toBool();
+            }
+            if (object.contains("start")) {
+                if (!object.value("start").isBool()) return fail(key + ".start\" must be true or false");
+                zone.startClock = object.value("start").toBool();
+            }
+            config->zones.append(zone);
+        }
+    }
+    return true;
+}
+
+bool MidiSessionConfig::load(const QString &path, MidiSessionConfig *config, QString *error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) {
+            *error = path + ": " + file.errorString();
+        }
+        return false;
+    }
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!document.isObject()) {
+        if (error) {
+            *error = path + ": " + (parseError.error != QJsonParseError::NoError
+                                        ? parseError.errorString() : QString("not a JSON object"));
+        }
+        return false;
+    }
+    if (!fromJson(document.object(), config, error)) {
+        if (error) {
+            *error = path + ": " + *error;
+        }
+        return false;
+    }
+    return true;
+}
+
+MidiSession::MidiSession(QObject *parent)
+    : QObject(parent)
+    , m_engine(new MidiEngine(this))
+    , m_syncController(nullptr)
+    , m_statsReporter(nullptr)
+    , m_configured(false)
+    , m_outputApplied(false)
+    , m_inputApplied(false)
+    , m_clockStarted(false)
+{
+    // Parse incoming MIDI and run clock handling on the engine's real-time
+    // input thread so boundary checks don't wait behind the event loop
+    m_engine->setProcessingMode(MidiEngine::ProcessingMode::RealtimeThread);
+    
+    m_syncController = new SyncController(m_engine, this);
+    
+    // Clock and transport go from the engine's input thread straight into
+    // the sync controller; nothing else sits on that path
+    m_engine->setTransportSink(m_syncController);
+    
+    connect(m_engine, &MidiEngine::outputPortsRefreshed, this, &MidiSession::onPortsRefreshed);
+    connect(m_engine, &MidiEngine::inputPortsRefreshed, this, &MidiSession::onPortsRefreshed);
+}
+
+MidiSession::~MidiSession() {
+    // Reads the engine and controller, so it goes first; the controller's
+    // stop may still send through the engine
+    delete m_statsReporter;
+    // No input may still be delivering into a controller being deleted
+    m_engine->closeInputs();
+    deleteZones();
+    m_engine->setTransportSink(nullptr);
+    delete m_syncController;
+    delete m_engine;
+}
+
+bool MidiSession::initialize() {
+    return m_engine->initialize();
+}
+
+void MidiSession::applyConfig(const MidiSessionConfig &config) {
+    m_config = config;
+    m_configured = true;
+    m_outputApplied = false;
+    m_inputApplied = false;
+    m_backupsPending = config.clockFailover ? config.backupInputs : QStringList();
+    // The zones are replaced below, and none may be deleted while input
+    // still delivers into it: every input reopens from the new config
+    if (!m_zoneControllers.isEmpty()) {
+        m_engine->closeInputs();
+    }
+    
+    applyRealtimeProfile(config.realtime);
+    m_engine->setClockTimeoutPeriods(config.clockTimeoutPeriods);
+    m_engine->setClockFailover(config.clockFailover);
+    if (!setLinkMode(config.linkMode)) {
+        qWarning() << "Ableton Link support is not built in; following MIDI clock";
+    }
+    if (config.networkInput) {
+        // Takes the input's place: the input port is not opened
+        m_inputApplied = true;
+        if (!m_engine->openNetworkInput(config.networkPort, config.networkName)) {
+            qWarning() << "Cannot listen for RTP-MIDI on UDP ports" << config.networkPort
+                       << "and" << config.networkPort + 1;
+        }
+    } else if (!config.replayPath.isEmpty()) {
+        // So does a replay
+        m_inputApplied = true;
+        QString error;
+        if (!m_engine->startCaptureReplay(config.replayPath, config.replaySpeed, &error)) {
+            qWarning() << "Cannot replay" << error;
+        }
+    }
+    if (config.capture) {
+        startCapture(config.capturePath);
+    } else {
+        m_engine->stopCapture();
+    }
+    m_syncController->setBPM(config.bpm);
+    m_syncController->setTimeCodeOutput(config.timeCodeOutput, config.timeCodeRate);
+    // Before the outputs open (each picks its backend as it opens)
+    if (config.timestampedOutput && !MidiEngine::timestampedOutputAvailable()) {
+        qWarning() << "Timestamped output is not built in; sending each clock at its deadline";
+    }
+    m_engine->setTimestampedOutput(config.timestampedOutput);
+    m_syncController->setClockLookaheadTicks(m_engine->timestampedOutput() ? config.clockLookaheadTicks : 0);
+    if (config.hasPattern) {
+        QString error;
+        if (!m_syncController->setPattern(config.pattern, &error)) {
+            qWarning() << "Cannot play the pattern:" << error;
+        }
+    }
+    createZones();
+    if (!config.statsPath.isEmpty()) {
+        startStatsExport(config.statsPath, config.statsIntervalMs);
+    }
+    openConfiguredPorts();
+}
+
+void MidiSession::createZones() {
+    deleteZones();
+    // Zone 0 is the main controller, on the output; with no zones it (and
+    // every port) stays on all of them
+    m_syncController->setOutputZone(m_config.zones.isEmpty() ? -1 : 0);
+    for (int i = 0; i < m_config.zones.size(); ++i) {
+        const MidiSessionConfig::Zone &zone = m_config.zones.at(i);
+        SyncController *controller = new SyncController(m_engine, this);
+        controller->setOutputZone(i + 1);
+        controller->setBPM(zone.bpm);
+        if (zone.followInput && !m_engine->addTransportSink(controller)) {
+            qWarning() << "Zone" << i + 1 << "cannot follow the input: too many zones follow it";
+        }
+        m_zoneControllers.append(controller);
+        m_zoneOutputsPending.append(zone.outputs);
+        m_zoneStarted.append(false);
+    }
+    if (m_statsReporter) {
+        m_statsReporter->setZoneControllers(m_zoneControllers);
+    }
+}
+
+void MidiSession::deleteZones() {
+    // Caller has closed the inputs (see MidiTransportFanOut)
+    for (SyncController *controller : m_zoneControllers) {
+        m_engine->removeTransportSink(controller);
+        delete controller;
+    }
+    m_zoneControllers.clear();
+    m_zoneOutputsPending.clear();
+    m_zoneStarted.clear();
+    m_outputZones.clear();
+    if (m_statsReporter) {
+        m_statsReporter->setZoneControllers(m_zoneControllers);
+    }
+}
+
+void MidiSession::assignOutputZone(const QString &port, int zone) {
+    const quint8 zones = m_outputZones.value(port) | MidiOutputZone::forZone(zone);
+    m_outputZones.insert(port, zones);
+    m_engine->setOutputPortZones(port, zones);
+}
+
+QString MidiSession::preferredOutputPort() const {
+    QSettings settings(SETTINGS_ORGANIZATION, SETTINGS_APPLICATION);
+    const MidiPortTable table = m_engine->outputPortTable();
+    const MidiPortInfo *remembered = table.findById(settings.value("ports/outputId").toString());
+    return remembered ? remembered->name : findAutoSelectPort(table.names());
+}
+
+QString MidiSession::preferredInputPort() const {
+    QSettings settings(SETTINGS_ORGANIZATION, SETTINGS_APPLICATION);
+    const MidiPortTable table = m_engine->inputPortTable();
+    const MidiPortInfo *remembered = table.findById(settings.value("ports/inputId").toString());
+    return remembered ? remembered->name : findAutoSelectPort(table.names());
+}
+
+void MidiSession::rememberOutputPort(const QString &portName) {
+    if (const MidiPortInfo *port = m_engine->outputPortTable().findByName(portName)) {
+        QSettings settings(SETTINGS_ORGANIZATION, SETTINGS_APPLICATION);
+        settings.setValue("ports/outputId", port->id);
+    }
+}
+
+void MidiSession::rememberInputPort(const QString &portName) {
+    if (const MidiPortInfo *port = m_engine->inputPortTable().findByName(portName)) {
+        QSettings settings(SETTINGS_ORGANIZATION, SETTINGS_APPLICATION);
+        settings.setValue("ports/inputId", port->id);
+    }
+}
+
+void MidiSession::startStatsExport(const QString &path, int intervalMs) {
+    if (!m_statsReporter) {
+        m_statsReporter = new StatsReporter(m_engine, m_syncController);
+    }
+    m_statsReporter->setZoneControllers(m_zoneControllers);
+    m_statsReporter->start(path, intervalMs);
+}
+
+bool MidiSession::startCapture(const QString &path) {
+    QString capturePath = path;
+    if (capturePath.isEmpty()) {
+        QDir directory(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+        if (!directory.mkpath("captures") || !directory.cd("captures")) {
+            qWarning() << "Cannot create the capture directory in" << directory.path();
+            return false;
+        }
+        const QStringList previous = directory.entryList(QStringList() << "capture-*.mm2cap",
+                                                         QDir::Files, QDir::Name | QDir::Reversed);
+        for (int i = MAX_CAPTURES - 1; i < previous.size(); ++i) {
+            directory.remove(previous.at(i));
+        }
+        capturePath = directory.filePath(QString("capture-%1.mm2cap")
+                                         .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss")));
+    }
+    if (!m_engine->startCapture(capturePath)) {
+        qWarning() << "Cannot record a capture to" << capturePath;
+        return false;
+    }
+    return true;
+}
+
+void MidiSession::applyRealtimeProfile(const RealtimeProfile &profile) {
+    const RealtimeScheduling::ProcessReport process = RealtimeScheduling::setProfile(profile);
+    if (!profile.isEnabled()) {
+        return;
+    }
+    if (profile.prefault) {
+        m_engine->prefaultMemory();
+        RealtimeScheduling::prefault(m_syncController, sizeof(SyncController));
+    }
+    
+    // Reported at startup so a refused setting is told apart from a
+    // timing problem: what each role's thread will get when it starts
+    bool refused = process.memoryLock == RealtimeScheduling::Grant::Denied;
+    QStringList lines;
+    lines.append(RealtimeScheduling::describe(RealtimeScheduling::processReport()));
+    for (int role = 0; role < static_cast<int>(RealtimeThreadRole::Count); ++role) {
+        const RealtimeThreadRole threadRole = static_cast<RealtimeThreadRole>(role);
+        const RealtimeScheduling::ThreadReport report = RealtimeScheduling::probe(threadRole);
+        refused = refused || report.policy == RealtimeScheduling::Grant::Denied ||
+                  report.affinity == RealtimeScheduling::Grant::Denied;
+        lines.append(RealtimeScheduling::describe(threadRole, report));
+    }
+    for (const QString &line : lines) {
+        if (refused) {
+            qWarning().noquote() << "Real-time:" << line;
+        } else {
+            qDebug().noquote() << "Real-time:" << line;
+        }
+    }
+}
+
+bool MidiSession::linkAvailable() {
+    return MIDIMASTER2_LINK != 0;
+}
+
+bool MidiSession::setLinkMode(LinkMode mode) {
+    if (mode == m_syncController->linkMode()) {
+        return true;
+    }
+    if (mode != LinkMode::Off && !m_linkTimebase) {
+#if MIDIMASTER2_LINK
+        m_linkTimebase.reset(new AbletonLinkTimebase(m_syncController->currentBPM()));
+#else
+        return false;
+#endif
+    }
+    if (m_syncController->isRunning()) {
+        m_syncController->stop(true);
+    }
+    m_syncController->setLinkTimebase(m_linkTimebase.get(), mode);
+    return true;
+}
+
+void MidiSession::onPortsRefreshed() {
+    if (m_configured) {
+        openConfiguredPorts();
+    }
+}
+
+QString MidiSession::resolveOutputPort(const QString &configured) const {
+    return configured.isEmpty() ? preferredOutputPort() : resolvePort(m_engine->outputPortTable(), configured);
+}
+
+QString MidiSession::resolveInputPort(const QString &configured) const {
+    return configured.isEmpty() ? preferredInputPort() : resolvePort(m_engine->inputPortTable(), configured);
+}
+
+void MidiSession::openConfiguredPorts() {
+    // Each side once; a port not listed yet (or whose cached index moved)
+    // is retried on the next refresh
+    if (!m_outputApplied) {
+        const QString port = resolveOutputPort(m_config.outputPort);
+        if (!port.isEmpty() && m_engine->openOutputPort(port)) {
+            m_outputApplied = true;
+            for (const QString &output : m_config.latencyOffsetsMs.keys()) {
+                m_engine->setOutputLatencyOffset(output, m_config.latencyOffsetsMs.value(output));
+            }
+            for (const QString &output : m_config.clockRates.keys()) {
+                const MidiSessionConfig::ClockRate rate = m_config.clockRates.value(output);
+                m_engine->setOutputClockRate(output, rate.multiplier, rate.divider);
+            }
+            if (!m_zoneControllers.isEmpty()) {
+                assignOutputZone(port, 0);
+            }
+        }
+    }
+    
+    // Each zone's outputs as they are listed, with the same offsets and
+    // clock rates; a master zone starts with its first output
+    for (int i = 0; i < m_zoneControllers.size(); ++i) {
+        for (const QString &output : QStringList(m_zoneOutputsPending.at(i))) {
+            const QString port = resolvePort(m_engine->outputPortTable(), output);
+            if (port.isEmpty() || !m_engine->addOutputPort(port)) {
+                continue;
+            }
+            m_zoneOutputsPending[i].removeAll(output);
+            assignOutputZone(port, i + 1);
+            if (m_config.latencyOffsetsMs.contains(port)) {
+                m_engine->setOutputLatencyOffset(port, m_config.latencyOffsetsMs.value(port));
+            }
+            if (m_config.clockRates.contains(port)) {
+                const MidiSessionConfig::ClockRate rate = m_config.clockRates.value(port);
+                m_engine->setOutputClockRate(port, rate.multiplier, rate.divider);
+            }
+        }
+        const MidiSessionConfig::Zone &zone = m_config.zones.at(i);
+        const bool anyOpen = m_zoneOutputsPending.at(i).size() < zone.outputs.size();
+        if (anyOpen && !zone.followInput && zone.startClock && !m_zoneStarted.at(i)) {
+            m_zoneStarted[i] = true;
+            m_zoneControllers.at(i)->start(true);
+        }
+    }
+    
+    if (!m_inputApplied) {
+        const QString port = resolveInputPort(m_config.inputPort);
+        if (!port.isEmpty() && m_engine->openInputPort(port)) {
+            m_inputApplied = true;
+        }
+    }
+    
+    // Backups once the input is settled (an automatic input choice could
+    // otherwise land on a backup's port); a configured input that is not
+    // there yet is exactly what they are for, so they open regardless
+    const bool inputSettled = m_inputApplied || !m_config.inputPort.isEmpty();
+    for (const QString &backup : QStringList(m_backupsPending)) {
+        const QString port = resolvePort(m_engine->inputPortTable(), backup);
+        if (inputSettled && !port.isEmpty() && m_engine->addBackupInput(port)) {
+            m_backupsPending.removeAll(backup);
+        }
+    }
+    
+    if (m_outputApplied && m_config.startClock && !m_clockStarted) {
+        m_clockStarted = true;
+        m_syncController->start(true);
+        emit clockStarted();
+    }
+}
+
+QString MidiSession::findAutoSelectPort(const QStringList &ports) {
+    // Priority: IAC Driver > Virtual ports > Other CoreMIDI ports
+    // Network MIDI is excluded to avoid UDP buffering issues that cause timing problems
+    
+    // First priority: IAC Driver (CoreMIDI-based, best for loopback and DAW communication)
+    // IAC drivers provide lowest latency and most reliable timing
+    for (const QString &port : ports) {
+        if (port.contains("IAC", Qt::CaseInsensitive)) {
+            qDebug() << "Auto-selected IAC Driver port:" << port;
+            return port;
+        }
+    }
+    
+    // Second priority: Virtual MIDI ports (CoreMIDI-based, good alternative to IAC)
+    for (const QString &port : ports) {
+        if (port.contains("Virtual", Qt::CaseInsensitive)) {
+            qDebug() << "Auto-selected Virtual MIDI port:" << port;
+            return port;
+        }
+    }
+    
+    // Third priority: Other CoreMIDI loopback ports (but exclude Network/rtpMIDI)
+    // Network MIDI uses UDP which has buffering and can cause rushed/dragged notes
+    // (the driver only passes on arrival times; MidiEngine::openNetworkInput
+    // joins the session itself and plays it out on the sender's timestamps)
+    for (const QString &port : ports) {
+        if (port.contains("Loopback", Qt::CaseInsensitive) &&
+            !port.contains("Network", Qt::CaseInsensitive) &&
+            !port.contains("rtpMIDI", Qt::CaseInsensitive) &&
+            !port.contains("rtp.MIDI", Qt::CaseInsensitive)) {
+            qDebug() << "Auto-selected Loopback port (non-Network):" << port;
+            return port;
+        }
+    }
+    
+    // Final fallback: Any CoreMIDI port (excluding Network MIDI)
+    // Filter out Network MIDI ports to avoid timing issues
+    QStringList coreMIDIPorts;
+    for (const QString &port : ports) {
+        bool isNetworkPort = false;
+        bool ok;
+        int portNum = port.toInt(&ok);
+        if (ok && portNum >= 21928 && portNum <= 21948) {
+            isNetworkPort = true;
+        }
+        if (port.contains("Network", Qt::CaseInsensitive) ||
+            port.contains("rtpMIDI", Qt::CaseInsensitive) ||
+            port.contains("rtp.MIDI", Qt::CaseInsensitive)) {
+            isNetworkPort = true;
+        }
+        if (!isNetworkPort) {
+            coreMIDIPorts.append(port);
+        }
+    }
+    
+    // Return first CoreMIDI port if available, or empty string if none
+    if (!coreMIDIPorts.isEmpty()) {
+        qDebug() << "Auto-selected CoreMIDI port:" << coreMIDIPorts.first();
+        return coreMIDIPorts.first();
+    }
+    
+    // Last resort: if all ports were filtered, return empty (user must configure manually)
+    qDebug() << "WARNING: No suitable CoreMIDI ports found. All ports may be Network MIDI.";
+    return QString();
+}
@@ -0,0 +1,176 @@
+#ifndef MIDISESSION_H
+#define MIDISESSION_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+#include "LinkTimebase.h"
+#include "MidiPattern.h"
+#include "MidiTimeCode.h"
+#include "RealtimeScheduling.h"
+
+class MidiEngine;
+class StatsReporter;
+class SyncController;
+
+// What a session sets up at launch (headless mode loads it from a file)
+// Ports are names or port IDs (MidiPortInfo::id); empty = the port used
+// last time, else the best loopback port (MidiSession::findAutoSelectPort).
+struct MidiSessionConfig {
+    struct ClockRate {
+        int multiplier;
+        int divider;
+    };
+
+    // A tempo zone besides the main one (zone 0, the controller above):
+    // its own sync controller on the same engine, driving only its outputs
+    struct Zone {
+        QStringList outputs;  // Opened alongside the output, taking only this zone
+        double bpm;
+        bool followInput;     // Follow the input's clock and transport (else master at bpm)
+        bool startClock;      // Master: start once an output is open
+
+        Zone();
+    };
+
+    QString outputPort;
+    QString inputPort;
+    double bpm;
+    QHash<QString, double> latencyOffsetsMs; // By output name
+    bool startClock;      // Start the master clock once the output is open
+    bool timeCodeOutput;
+    MtcFrameRate timeCodeRate;
+    QString statsPath;    // Empty = no stats dump
+    int statsIntervalMs;
+    bool clockFailover;
+    QStringList backupInputs;     // In priority order, after the input
+    double clockTimeoutPeriods;
+    LinkMode linkMode;
+    bool networkInput;            // RTP-MIDI session instead of the input port
+    quint16 networkPort;
+    QString networkName;
+    bool capture;                 // Record all MIDI traffic (MidiSession::startCapture)
+    QString capturePath;          // Empty = a new file under captures/
+    QString replayPath;           // Capture replayed as the input (command line only)
+    double replaySpeed;
+    RealtimeProfile realtime;     // Timing threads' scheduling (MidiSession::applyRealtimeProfile)
+    bool timestampedOutput;       // OS-scheduled outputs with clock lookahead (MidiEngine::setTimestampedOutput)
+    int clockLookaheadTicks;
+    QHash<QString, ClockRate> clockRates; // By output name (MidiEngine::setOutputClockRate)
+    bool hasPattern;              // Play pattern instead of the downbeat note
+    MidiPattern pattern;
+    QVector<Zone> zones;          // Up to MidiOutputZone::MAX_ZONES - 1
+
+    MidiSessionConfig();
+
+    // JSON object, every key optional:
+    //   {"output": "IAC Driver Bus 1", "input": "IAC Driver Bus 2",
+    //    "bpm": 120, "start": true,
+    //    "latencyOffsetsMs": {"IAC Driver Bus 1": 12.5},
+    //    "timeCode": {"enabled": true, "rate": "25"},  (24, 25, 29.97df, 30)
+    //    "stats": {"path": "/tmp/midimaster2.json", "intervalMs": 1000},
+    //    "clockFailover": {"enabled": true, "backups": ["Interface 2"], "timeoutPeriods": 3},
+    //    "link": {"mode": "follow"},  (off, follow, publish)
+    //    "network": {"enabled": true, "port": 5004, "name": "MidiMaster2"},
+    //    "capture": {"enabled": true, "path": "/tmp/session.mm2cap"},
+    //    "realtime": {"enabled": true, "priority": 80, "cpus": [3], "lockMemory": true, "prefault": true},
+    //    "scheduledOutput": {"enabled": true, "lookaheadTicks": 24},  (1-96)
+    //    "clockRates": {"Volca": {"multiply": 1, "divide": 2}},  (1-8 each)
+    //    "pattern": {"bars": 1, "events": [...]},  (MidiPattern::fromJson)
+    //    "zones": [{"outputs": ["Stage 2"], "bpm": 60, "follow": false, "start": true}]}
+    // false with a message on a value of the wrong type
+    static bool fromJson(const QJsonObject &json, MidiSessionConfig *config, QString *error);
+    static bool load(const QString &path, MidiSessionConfig *config, QString *error);
+};
+
+// The engine and sync controller wired together, with the port choice
+// around them: what the window and the headless daemon share
+// initialize() brings the engine up on last session's port list, so a
+// configured or remembered port opens (and the clock starts) at once
+// when it is still there; otherwise it opens as soon as a scan lists it.
+class MidiSession : public QObject {
+    Q_OBJECT
+
+public:
+    explicit MidiSession(QObject *parent = nullptr);
+    ~MidiSession();
+
+    MidiEngine *engine() const { return m_engine; }
+    SyncController *controller() const { return m_syncController; }
+    // The configured zones' controllers, in config order (zone i + 1)
+    QVector<SyncController *> zoneControllers() const { return m_zoneControllers; }
+
+    bool initialize();
+
+    // Opens the configured ports as they become available, then applies
+    // tempo, offsets, MTC and stats, and starts the clock if asked
+    void applyConfig(const MidiSessionConfig &config);
+
+    // Remembered port (by ID) if listed, else findAutoSelectPort()
+    QString preferredOutputPort() const;
+    QString preferredInputPort() const;
+    void rememberOutputPort(const QString &portName);
+    void rememberInputPort(const QString &portName);
+
+    void startStatsExport(const QString &path, int intervalMs = 1000);
+    
+    // Records the engine's MIDI traffic to path, or by default to a new
+    // timestamped file in the application data's captures/ directory
+    // (which keeps the newest MAX_CAPTURES)
+    bool startCapture(const QString &path = QString());
+    static constexpr int MAX_CAPTURES = 20;
+    
+    // Sets the timing threads' real-time profile (before their ports open
+    // or the clock starts), prefaults if asked, and logs per thread what
+    // the system granted, probed on a throwaway thread of each role
+    void applyRealtimeProfile(const RealtimeProfile &profile);
+    
+    // Joins the Link session on first use (builds without Link support
+    // only take Off); stops the controller first if it is running
+    static bool linkAvailable();
+    bool setLinkMode(LinkMode mode);
+
+    // Priority: IAC Driver > Virtual ports > other loopback ports (never
+    // Network MIDI); empty if none
+    static QString findAutoSelectPort(const QStringList &ports);
+
+signals:
+    // The configured clock start happened
+    void clockStarted();
+
+private slots:
+    void onPortsRefreshed();
+
+private:
+    QString resolveOutputPort(const QString &configured) const;
+    QString resolveInputPort(const QString &configured) const;
+    void openConfiguredPorts();
+    void createZones();
+    void deleteZones();
+    // Records that port takes zone and applies the port's zone mask
+    void assignOutputZone(const QString &port, int zone);
+
+    MidiEngine *m_engine;
+    SyncController *m_syncController;
+    StatsReporter *m_statsReporter;
+    std::unique_ptr<LinkTimebase> m_linkTimebase;
+
+    MidiSessionConfig m_config;
+    bool m_configured;      // applyConfig() was called
+    bool m_outputApplied;
+    bool m_inputApplied;
+    QStringList m_backupsPending;
+    bool m_clockStarted;
+    
+    // Tempo zones beyond zone 0 (m_syncController)
+    QVector<SyncController *> m_zoneControllers;
+    QVector<QStringList> m_zoneOutputsPending;
+    QVector<bool> m_zoneStarted;
+    QHash<QString, quint8> m_outputZones; // Zone masks of the zones' outputs as opened
+};
+
+#endif // MIDISESSION_H
@@ -0,0 +1,204 @@
+#ifndef MIDISTREAMPARSER_H
+#define MIDISTREAMPARSER_H
+
+#include <QtGlobal>
+#include <array>
+#include <type_traits>
+#include <utility>
+#include "SysExBufferPool.h"
+
+// One complete short message out of the parser (running status expanded)
+struct MidiMessage {
+    quint8 bytes[3];
+    quint8 size;
+    qint64 timestamp; // Of the chunk that completed it, MidiTime nanoseconds
+
+    quint8 status() const { return bytes[0]; }
+};
+
+// Data bytes following each status byte, as a table indexed by
+// status - 0x80 and built at compile time (SYSEX_LENGTH marks 0xF0, whose
+// payload runs until the next status byte)
+namespace MidiStatusTable {
+const quint8 SYSEX_LENGTH = 0xFF;
+
+constexpr quint8 lengthFor(int status) {
+    return status < 0xC0 ? 2                    // Note Off/On, Poly Pressure, CC
+         : status < 0xE0 ? 1                    // Program Change, Channel Pressure
+         : status < 0xF0 ? 2                    // Pitch Bend
+         : status == 0xF0 ? SYSEX_LENGTH
+         : status == 0xF1 || status == 0xF3 ? 1 // MTC Quarter Frame, Song Select
+         : status == 0xF2 ? 2                   // Song Position Pointer
+         : 0;                                   // Tune Request, EOX, undefined, Real-Time
+}
+
+template <std::size_t... Index>
+constexpr std::array<quint8, sizeof...(Index)> makeLengths(std::index_sequence<Index...>) {
+    return {{lengthFor(0x80 + static_cast<int>(Index))...}};
+}
+
+inline constexpr std::array<quint8, 128> LENGTHS = makeLengths(std::make_index_sequence<128>());
+} // namespace MidiStatusTable
+
+// Streaming MIDI 1.0 byte parser
+// Turns an arbitrary byte stream (RtMidi messages, a serial line, a
+// network payload split anywhere) into complete messages. Handles running
+// status, System Real-Time bytes interleaved anywhere (even inside a
+// message or a SysEx, where they are passed on at once without disturbing
+// the message being assembled), System Common cancelling running status,
+// and SysEx, which is reassembled into a pool buffer when a pool is set
+// (skipped otherwise). Data bytes with no status to belong to are dropped
+// and counted. Nothing allocates. Not thread-safe: one parser per stream.
+class MidiStreamParser {
+public:
+    static constexpr quint8 dataLength(quint8 status) {
+        return MidiStatusTable::LENGTHS[status & 0x7F];
+    }
+
+    MidiStreamParser()
+        : m_expected(0)
+        , m_count(0)
+        , m_runningStatus(0)
+        , m_inSysEx(false)
+        , m_droppedBytes(0)
+        , m_interruptedMessages(0)
+    {
+        m_message.size = 0;
+    }
+
+    // SysEx buffers (not owned; nullptr = skip SysEx payloads)
+    void setSysExPool(SysExBufferPool *pool) { m_sysEx.setPool(pool); }
+
+    // Calls deliver(const MidiMessage &) for every message completed by
+    // data, and deliver(const SysExMessage &) for every complete SysEx if
+    // it takes one (the view is released when deliver returns)
+    template <typename Deliver>
+    void parse(const quint8 *data, int size, qint64 timestamp, Deliver &&deliver) {
+        for (int i = 0; i < size; ++i) {
+            parseByte(data[i], timestamp, deliver);
+        }
+    }
+
+    template <typename Deliver>
+    void parseByte(quint8 byte, qint64 timestamp, Deliver &&deliver) {
+        // Real-Time: a message of its own, wherever it falls
+        if (byte >= 0xF8) {
+            MidiMessage realtime = {{byte, 0, 0}, 1, timestamp};
+            deliver(realtime);
+            return;
+        }
+
+        if (byte & 0x80) {
+            startStatus(byte, timestamp, deliver);
+            return;
+        }
+
+        if (m_inSysEx) {
+            m_sysEx.append(&byte, 1);
+            return;
+        }
+
+        if (m_count == 0) {
+            // Running status: data byte without a status repeats the last one
+            if (m_runningStatus == 0) {
+                ++m_droppedBytes;
+                return;
+            }
+            m_message.bytes[0] = m_runningStatus;
+            m_expected = dataLength(m_runningStatus);
+            m_count = 1;
+        }
+
+        m_message.bytes[m_count++] = byte;
+        if (m_count == m_expected + 1) {
+            m_message.size = m_count;
+            m_message.timestamp = timestamp;
+            m_count = 0;
+            deliver(m_message);
+        }
+    }
+
+    // Forget any partial message, SysEx and running status (e.g. after
+    // reopening the port)
+    void reset() {
+        m_count = 0;
+        m_expected = 0;
+        m_runningStatus = 0;
+        m_inSysEx = false;
+        m_sysEx.abort();
+    }
+
+    quint8 runningStatus() const { return m_runningStatus; }
+    bool inSysEx() const { return m_inSysEx; }
+    // Data bytes with no status to attach to
+    quint64 droppedBytes() const { return m_droppedBytes; }
+    // Messages cut short by a new status byte
+    quint64 interruptedMessages() const { return m_interruptedMessages; }
+
+private:
+    template <typename Deliver>
+    void startStatus(quint8 status, qint64 timestamp, Deliver &&deliver) {
+        if (m_count > 0) {
+            ++m_interruptedMessages;
+            m_count = 0;
+        }
+        // Any status ends a SysEx; 0xF7 is its proper end and nothing more
+        if (m_inSysEx) {
+            m_inSysEx = false;
+            if (status == 0xF7) {
+                m_sysEx.append(&status, 1);
+                deliverSysEx(deliver);
+                return;
+            }
+            m_sysEx.interrupt();
+        }
+
+        const quint8 length = dataLength(status);
+        if (status < 0xF0) {
+            m_runningStatus = status;
+        } else {
+            // System Common cancels running status
+            m_runningStatus = 0;
+            if (length == MidiStatusTable::SYSEX_LENGTH) {
+                m_inSysEx = true;
+                m_sysEx.begin(timestamp);
+                m_sysEx.append(&status, 1);
+                return;
+            }
+        }
+
+        m_message.bytes[0] = status;
+        if (length == 0) {
+            m_message.size = 1;
+            m_message.timestamp = timestamp;
+            deliver(m_message);
+            return;
+        }
+        m_expected = length;
+        m_count = 1;
+    }
+
+    template <typename Deliver>
+    void deliverSysEx(Deliver &&deliver) {
+        SysExMessage message;
+        const quint16 handle = m_sysEx.take(&message);
+        if (handle == 0) {
+            return;
+        }
+        if constexpr (std::is_invocable_v<Deliver, const SysExMessage &>) {
+            deliver(static_cast<const SysExMessage &>(message));
+        }
+        m_sysEx.pool()->release(handle);
+    }
+
+    MidiMessage m_message;
+    SysExAssembler m_sysEx;
+    quint8 m_expected;
+    quint8 m_count;          // Bytes of m_message assembled (0 = waiting for status/data)
+    quint8 m_runningStatus;  // 0 = none
+    bool m_inSysEx;
+    quint64 m_droppedBytes;
+    quint64 m_interruptedMessages;
+};
+
+#endif // MIDISTREAMPARSER_H
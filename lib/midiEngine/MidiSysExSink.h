@@ -0,0 +1,19 @@
+#ifndef MIDISYSEXSINK_H
+#define MIDISYSEXSINK_H
+
+#include "SysExBufferPool.h"
+
+// Receiver for reassembled incoming SysEx
+// MidiEngine calls the sink set with MidiEngine::setSysExSink() from its
+// input processing, in arrival order with the clock and transport. The
+// message is a view into a pooled buffer that goes back to the pool when
+// the call returns: copy what you need and return quickly, the clock
+// behind it is waiting.
+class MidiSysExSink {
+public:
+    virtual ~MidiSysExSink() {}
+
+    virtual void midiSysEx(const SysExMessage &message) = 0;
+};
+
+#endif // MIDISYSEXSINK_H
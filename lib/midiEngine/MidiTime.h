@@ -0,0 +1,83 @@
+#ifndef MIDITIME_H
+#define MIDITIME_H
+
+#include <QtGlobal>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Common timebase for MIDI event timestamps
+// Everything is expressed as nanoseconds on the monotonic steady clock so
+// timestamps can be passed through queues and signals as a plain qint64.
+namespace MidiTime {
+
+using Clock = std::chrono::steady_clock;
+using TimePoint = Clock::time_point;
+
+inline qint64 toNanoseconds(TimePoint time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+inline TimePoint fromNanoseconds(qint64 ns) {
+    return TimePoint(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(ns)));
+}
+
+inline qint64 nowNanoseconds() {
+    return toNanoseconds(Clock::now());
+}
+
+// Busy-wait hint for spin loops
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
+} // namespace MidiTime
+
+// Reconstructs the driver arrival time of each incoming message
+// RtMidi passes the time since the previous message, derived from the
+// driver's own timestamps (CoreMIDI host time, ALSA queue time). Chaining
+// those deltas recovers when each message actually arrived, which can be
+// earlier than when the callback runs. The chain is re-anchored to the
+// callback time whenever it drifts outside a small window, so a bogus or
+// missing deltatime can never push timestamps far from reality.
+class MidiArrivalClock {
+public:
+    MidiArrivalClock()
+        : m_lastArrivalNs(0)
+    {
+    }
+
+    void reset() {
+        m_lastArrivalNs = 0;
+    }
+
+    // Call from the RtMidi callback thread only
+    qint64 stamp(double deltatime) {
+        const qint64 nowNs = MidiTime::nowNanoseconds();
+        qint64 arrivalNs = nowNs;
+        
+        if (m_lastArrivalNs != 0 && deltatime > 0.0) {
+            qint64 fromDriver = m_lastArrivalNs + static_cast<qint64>(deltatime * 1e9);
+            // Never in the future, and never older than the allowed driver lag
+            if (fromDriver <= nowNs && nowNs - fromDriver <= MAX_DRIVER_LAG_NS) {
+                arrivalNs = fromDriver;
+            }
+        }
+        
+        m_lastArrivalNs = arrivalNs;
+        return arrivalNs;
+    }
+
+private:
+    static const qint64 MAX_DRIVER_LAG_NS = 5000000; // 5ms
+
+    qint64 m_lastArrivalNs;
+};
+
+#endif // MIDITIME_H
@@ -0,0 +1,212 @@
+#include "MidiTimeCode.h"
+#include <cmath>
+
+namespace {
+const int DROP_FRAMES_PER_MINUTE = 2;
+const qint64 DROP_FRAMES_PER_10_MINUTES = 17982; // 10 * 60 * 30 - 9 * 2
+const qint64 DROP_FRAMES_PER_MINUTE_BLOCK = 1798; // 60 * 30 - 2
+}
+
+double MidiTimeCode::framesPerSecond(MtcFrameRate rate) {
+    switch (rate) {
+    case MtcFrameRate::Fps24: return 24.0;
+    case MtcFrameRate::Fps25: return 25.0;
+    case MtcFrameRate::Fps2997Drop: return 30000.0 / 1001.0;
+    case MtcFrameRate::Fps30: return 30.0;
+    }
+    return 30.0;
+}
+
+int MidiTimeCode::nominalFramesPerSecond(MtcFrameRate rate) {
+    switch (rate) {
+    case MtcFrameRate::Fps24: return 24;
+    case MtcFrameRate::Fps25: return 25;
+    default: return 30;
+    }
+}
+
+double MidiTimeCode::frameNs(MtcFrameRate rate) {
+    return 1.0e9 / framesPerSecond(rate);
+}
+
+double MidiTimeCode::quarterFrameNs(MtcFrameRate rate) {
+    return frameNs(rate) / 4.0;
+}
+
+qint64 MidiTimeCode::frameCount(const MtcTime &time) {
+    const qint64 nominal = nominalFramesPerSecond(time.rate);
+    const qint64 totalMinutes = 60 * time.hours + time.minutes;
+    qint64 frames = (totalMinutes * 60 + time.seconds) * nominal + time.frames;
+    if (time.rate == MtcFrameRate::Fps2997Drop) {
+        frames -= DROP_FRAMES_PER_MINUTE * (totalMinutes - totalMinutes / 10);
+    }
+    return frames;
+}
+
+MtcTime MidiTimeCode::timeForFrameCount(qint64 frames, MtcFrameRate rate) {
+    const qint64 nominal = nominalFramesPerSecond(rate);
+    const bool drop = rate == MtcFrameRate::Fps2997Drop;
+    const qint64 framesPerDay = drop ? 24 * 6 * DROP_FRAMES_PER_10_MINUTES : 24 * 3600 * nominal;
+    frames = ((frames % framesPerDay) + framesPerDay) % framesPerDay;
+
+    // Drop-frame: put the skipped frame numbers back to get the label
+    if (drop) {
+        const qint64 tens = frames / DROP_FRAMES_PER_10_MINUTES;
+        const qint64 rest = frames % DROP_FRAMES_PER_10_MINUTES;
+        frames += 18 * tens;
+        if (rest > DROP_FRAMES_PER_MINUTE) {
+            frames += DROP_FRAMES_PER_MINUTE * ((rest - DROP_FRAMES_PER_MINUTE) / DROP_FRAMES_PER_MINUTE_BLOCK);
+        }
+    }
+
+    MtcTime time;
+    time.frames = static_cast<int>(frames % nominal);
+    time.seconds = static_cast<int>((frames / nominal) % 60);
+    time.minutes = static_cast<int>((frames / (nominal * 60)) % 60);
+    time.hours = static_cast<int>((frames / (nominal * 3600)) % 24);
+    time.rate = rate;
+    return time;
+}
+
+qint64 MidiTimeCode::frameCountForNs(qint64 ns, MtcFrameRate rate) {
+    return static_cast<qint64>(std::floor(static_cast<double>(ns) / frameNs(rate)));
+}
+
+QString MidiTimeCode::toString(const MtcTime &time) {
+    return QString("%1:%2:%3%4%5")
+        .arg(time.hours, 2, 10, QChar('0'))
+        .arg(time.minutes, 2, 10, QChar('0'))
+        .arg(time.seconds, 2, 10, QChar('0'))
+        .arg(time.rate == MtcFrameRate::Fps2997Drop ? ";" : ":")
+        .arg(time.frames, 2, 10, QChar('0'));
+}
+
+MtcGenerator::MtcGenerator()
+    : m_rate(MtcFrameRate::Fps25)
+    , m_cycleFrames(0)
+    , m_piece(0)
+{
+    loadCycle();
+}
+
+void MtcGenerator::start(const MtcTime &time) {
+    m_rate = time.rate;
+    m_cycleFrames = MidiTimeCode::frameCount(time);
+    m_piece = 0;
+    loadCycle();
+}
+
+quint8 MtcGenerator::nextQuarterFrame() {
+    if (m_piece == 8) {
+        // Eight quarter frames span two frames
+        m_cycleFrames += 2;
+        m_piece = 0;
+        loadCycle();
+    }
+    return m_cycle[m_piece++];
+}
+
+void MtcGenerator::loadCycle() {
+    using namespace MidiTimeCode;
+    const MtcTime time = timeForFrameCount(m_cycleFrames, m_rate);
+    const PiecePair &frames = FRAME_PIECES[time.frames];
+    const PiecePair &seconds = SECOND_PIECES[time.seconds];
+    const PiecePair &minutes = MINUTE_PIECES[time.minutes];
+    const PiecePair &hours = HOUR_PIECES[static_cast<int>(m_rate) * 24 + time.hours];
+    m_cycle[0] = frames[0];
+    m_cycle[1] = frames[1];
+    m_cycle[2] = seconds[0];
+    m_cycle[3] = seconds[1];
+    m_cycle[4] = minutes[0];
+    m_cycle[5] = minutes[1];
+    m_cycle[6] = hours[0];
+    m_cycle[7] = hours[1];
+}
+
+MtcDecoder::MtcDecoder()
+    : m_arrivals(500000.0) // Quarter frames come from a timer, not a musician
+    , m_lastPiece(-1)
+    , m_sequentialPieces(0)
+    , m_cycleFrames(0)
+    , m_relocateCount(0)
+{
+    reset();
+}
+
+void MtcDecoder::reset() {
+    m_state.locked = false;
+    m_state.rate = MtcFrameRate::Fps25;
+    m_state.positionNs = 0;
+    m_state.quarterFrameNs = 0;
+    m_state.speed = 1.0;
+    m_state.quarterFramePeriodNs = MidiTimeCode::quarterFrameNs(m_state.rate);
+    for (quint8 &nibble : m_nibbles) {
+        nibble = 0;
+    }
+    m_lastPiece = -1;
+    m_sequentialPieces = 0;
+    m_cycleFrames = 0;
+    m_arrivals.reset();
+}
+
+bool MtcDecoder::quarterFrame(quint8 data, qint64 arrivalNs) {
+    const int piece = (data >> 4) & 0x07;
+
+    // Out of order (a lost byte, reverse play, a jump): not trustworthy
+    // until a fresh cycle has been read
+    if (m_lastPiece >= 0 && piece != (m_lastPiece + 1) % 8) {
+        if (m_state.locked) {
+            ++m_relocateCount;
+        }
+        m_sequentialPieces = 0;
+        m_state.locked = false;
+        m_arrivals.reset();
+    }
+    m_lastPiece = piece;
+    m_nibbles[piece] = data & 0x0F;
+    ++m_sequentialPieces;
+
+    const TempoEstimate arrival = m_arrivals.update(arrivalNs);
+    if (piece == 0 && m_state.locked) {
+        m_cycleFrames += 2;
+    }
+
+    // Last piece of a complete cycle: the full time code of its first piece
+    if (piece == 7 && m_sequentialPieces >= 8) {
+        MtcTime time;
+        time.frames = m_nibbles[0] | ((m_nibbles[1] & 0x01) << 4);
+        time.seconds = m_nibbles[2] | ((m_nibbles[3] & 0x03) << 4);
+        time.minutes = m_nibbles[4] | ((m_nibbles[5] & 0x03) << 4);
+        time.hours = m_nibbles[6] | ((m_nibbles[7] & 0x01) << 4);
+        time.rate = static_cast<MtcFrameRate>((m_nibbles[7] >> 1) & 0x03);
+        const qint64 frames = MidiTimeCode::frameCount(time);
+        if (!m_state.locked || frames != m_cycleFrames || time.rate != m_state.rate) {
+            if (m_state.locked) {
+                ++m_relocateCount;
+            }
+            m_cycleFrames = frames;
+            m_state.rate = time.rate;
+            m_state.quarterFramePeriodNs = MidiTimeCode::quarterFrameNs(time.rate);
+            m_state.locked = true;
+        }
+    }
+
+    if (!m_state.locked) {
+        return false;
+    }
+
+    const double quarterFrameNs = m_state.quarterFramePeriodNs;
+    m_state.positionNs = std::llround(m_cycleFrames * MidiTimeCode::frameNs(m_state.rate) + piece * quarterFrameNs);
+    m_state.quarterFrameNs = arrival.valid ? arrival.tickTimeNs : arrivalNs;
+    m_state.speed = arrival.valid ? quarterFrameNs / arrival.periodNs : 1.0;
+    return true;
+}
+
+qint64 MtcDecoder::positionAt(const MtcChaseState &state, qint64 nowNs) {
+    if (!state.locked) {
+        return 0;
+    }
+    const double elapsedNs = qMin(static_cast<double>(nowNs - state.quarterFrameNs),
+                                  2.0 * state.quarterFramePeriodNs / state.speed);
+    return state.positionNs + std::llround(elapsedNs * state.speed);
+}
@@ -0,0 +1,140 @@
+#ifndef MIDITIMECODE_H
+#define MIDITIMECODE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <array>
+#include <utility>
+#include "TempoEstimator.h"
+
+// MTC frame rates, as coded in the hours quarter frame
+enum class MtcFrameRate : quint8 {
+    Fps24 = 0,
+    Fps25 = 1,
+    Fps2997Drop = 2,
+    Fps30 = 3
+};
+
+// hours:minutes:seconds:frames at a frame rate
+struct MtcTime {
+    int hours;
+    int minutes;
+    int seconds;
+    int frames;
+    MtcFrameRate rate;
+};
+
+// Conversions between time code, frame counts and nanoseconds
+// Frame counts are frames since 00:00:00:00; 29.97 drop-frame skips frame
+// numbers 0 and 1 at the start of every minute except each tenth.
+namespace MidiTimeCode {
+    double framesPerSecond(MtcFrameRate rate);
+    int nominalFramesPerSecond(MtcFrameRate rate); // Frame numbers per second (30 for 29.97)
+    double frameNs(MtcFrameRate rate);
+    double quarterFrameNs(MtcFrameRate rate);
+
+    qint64 frameCount(const MtcTime &time);
+    MtcTime timeForFrameCount(qint64 frames, MtcFrameRate rate);
+    qint64 frameCountForNs(qint64 ns, MtcFrameRate rate);
+
+    QString toString(const MtcTime &time); // hh:mm:ss:ff (';' before the frames for drop-frame)
+
+    // Quarter frame data bytes, piece number included, for each value of
+    // each field: [value][0] = low nibble piece, [value][1] = high nibble
+    // piece. Built at compile time.
+    using PiecePair = std::array<quint8, 2>;
+
+    constexpr PiecePair piecesFor(int piece, int value) {
+        return {{static_cast<quint8>((piece << 4) | (value & 0x0F)),
+                 static_cast<quint8>(((piece + 1) << 4) | ((value >> 4) & 0x0F))}};
+    }
+
+    template <int Piece, std::size_t... Value>
+    constexpr std::array<PiecePair, sizeof...(Value)> makePieces(std::index_sequence<Value...>) {
+        return {{piecesFor(Piece, static_cast<int>(Value))...}};
+    }
+
+    // Hours carry the rate in bits 5-6 of the value
+    template <std::size_t... Value>
+    constexpr std::array<PiecePair, sizeof...(Value)> makeHourPieces(std::index_sequence<Value...>) {
+        return {{piecesFor(6, static_cast<int>(Value % 24) | static_cast<int>(Value / 24) << 5)...}};
+    }
+
+    inline constexpr std::array<PiecePair, 30> FRAME_PIECES = makePieces<0>(std::make_index_sequence<30>());
+    inline constexpr std::array<PiecePair, 60> SECOND_PIECES = makePieces<2>(std::make_index_sequence<60>());
+    inline constexpr std::array<PiecePair, 60> MINUTE_PIECES = makePieces<4>(std::make_index_sequence<60>());
+    // Index rate * 24 + hours
+    inline constexpr std::array<PiecePair, 96> HOUR_PIECES = makeHourPieces(std::make_index_sequence<96>());
+}
+
+// Master side: the quarter frame stream for a running time code
+// Every two frames the eight data bytes of the next cycle are assembled
+// from the piece tables (eight lookups); each quarter frame then just
+// returns the next byte. Used by one thread.
+class MtcGenerator {
+public:
+    MtcGenerator();
+
+    // Next nextQuarterFrame() starts a cycle at this time code
+    void start(const MtcTime &time);
+    quint8 nextQuarterFrame();
+
+    MtcFrameRate rate() const { return m_rate; }
+    // Frame the current cycle describes
+    qint64 cycleFrameCount() const { return m_cycleFrames; }
+
+private:
+    void loadCycle();
+
+    MtcFrameRate m_rate;
+    qint64 m_cycleFrames;
+    int m_piece; // Next piece to send (0-7)
+    quint8 m_cycle[8];
+};
+
+// Published chase state: the time code at one quarter frame, its filtered
+// arrival, and the playback speed against the nominal frame rate
+struct MtcChaseState {
+    bool locked;
+    MtcFrameRate rate;
+    qint64 positionNs;   // Time code (since 00:00:00:00) at quarterFrameNs
+    qint64 quarterFrameNs; // Filtered arrival of that quarter frame, MidiTime nanoseconds
+    double speed;        // 1.0 = nominal
+    double quarterFramePeriodNs;
+};
+
+// Slave side: incoming quarter frames to a continuous position
+// A full time code needs eight consecutive quarter frames (two frames);
+// once locked, every quarter frame advances the position by a quarter
+// frame and the next complete cycle confirms (or relocates) it. Arrival
+// times run through a tempo tracker, so the position can be interpolated
+// between quarter frames at the measured speed instead of stepping.
+class MtcDecoder {
+public:
+    MtcDecoder();
+
+    // Quarter frame data byte (after 0xF1), arrival in MidiTime nanoseconds.
+    // Returns true while locked.
+    bool quarterFrame(quint8 data, qint64 arrivalNs);
+    void reset();
+
+    const MtcChaseState &state() const { return m_state; }
+    // Times a lock was lost: a quarter frame out of sequence, or a full
+    // cycle that disagreed with the running position
+    quint64 relocateCount() const { return m_relocateCount; }
+
+    // Interpolated time code position at nowNs; never runs more than two
+    // quarter frames past the last one received (the stream stopped)
+    static qint64 positionAt(const MtcChaseState &state, qint64 nowNs);
+
+private:
+    MtcChaseState m_state;
+    KalmanTempoEstimator m_arrivals;
+    quint8 m_nibbles[8];
+    int m_lastPiece;      // -1 = none yet
+    int m_sequentialPieces; // Consecutive in-order pieces received
+    qint64 m_cycleFrames; // Frame of the current cycle (locked only)
+    quint64 m_relocateCount;
+};
+
+#endif // MIDITIMECODE_H
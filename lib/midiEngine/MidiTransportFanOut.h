@@ -0,0 +1,104 @@
+#ifndef MIDITRANSPORTFANOUT_H
+#define MIDITRANSPORTFANOUT_H
+
+#include <atomic>
+#include "MidiTransportSink.h"
+
+// Transport sink that hands every call on to up to MAX_SINKS sinks, in
+// the order they were added: one parse of the input feeds several sync
+// controllers (tempo zones). Delivery is a loop over a fixed array of
+// atomic pointers, with no lock or allocation. Add and remove while no
+// input is delivering (like MidiEngine::setTransportSink).
+class MidiTransportFanOut : public MidiTransportSink {
+public:
+    static constexpr int MAX_SINKS = 8;
+
+    MidiTransportFanOut() : m_count(0) {
+        for (std::atomic<MidiTransportSink *> &sink : m_sinks) {
+            sink.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    // false if it is already there or every slot is taken
+    bool add(MidiTransportSink *sink) {
+        const int count = m_count.load(std::memory_order_relaxed);
+        if (!sink || indexOf(sink) >= 0 || count >= MAX_SINKS) {
+            return false;
+        }
+        m_sinks[count].store(sink, std::memory_order_relaxed);
+        m_count.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The others keep their order
+    bool remove(MidiTransportSink *sink) {
+        const int index = indexOf(sink);
+        if (index < 0) {
+            return false;
+        }
+        const int count = m_count.load(std::memory_order_relaxed);
+        for (int i = index; i + 1 < count; ++i) {
+            m_sinks[i].store(m_sinks[i + 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        m_sinks[count - 1].store(nullptr, std::memory_order_relaxed);
+        m_count.store(count - 1, std::memory_order_release);
+        return true;
+    }
+
+    void clear() {
+        while (count() > 0) {
+            remove(at(0));
+        }
+    }
+
+    int count() const { return m_count.load(std::memory_order_acquire); }
+    MidiTransportSink *at(int index) const { return m_sinks[index].load(std::memory_order_relaxed); }
+
+    int indexOf(const MidiTransportSink *sink) const {
+        const int count = m_count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            if (at(i) == sink) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void midiStart(qint64 timestamp) override {
+        forEach([timestamp](MidiTransportSink *sink) { sink->midiStart(timestamp); });
+    }
+    void midiStop(qint64 timestamp) override {
+        forEach([timestamp](MidiTransportSink *sink) { sink->midiStop(timestamp); });
+    }
+    void midiContinue(qint64 timestamp) override {
+        forEach([timestamp](MidiTransportSink *sink) { sink->midiContinue(timestamp); });
+    }
+    void midiClock(qint64 timestamp) override {
+        forEach([timestamp](MidiTransportSink *sink) { sink->midiClock(timestamp); });
+    }
+    void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) override {
+        forEach([positionBeats, positionQuarterNotes](MidiTransportSink *sink) {
+            sink->midiSongPositionPointer(positionBeats, positionQuarterNotes);
+        });
+    }
+    void midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) override {
+        forEach([data, timestamp](MidiTransportSink *sink) { sink->midiTimeCodeQuarterFrame(data, timestamp); });
+    }
+
+private:
+    template <typename Call>
+    void forEach(Call call) {
+        const int count = m_count.load(std::memory_order_acquire);
+        for (int i = 0; i < count; ++i) {
+            MidiTransportSink *sink = m_sinks[i].load(std::memory_order_relaxed);
+            if (sink) {
+                call(sink);
+            }
+        }
+    }
+
+    std::atomic<MidiTransportSink *> m_sinks[MAX_SINKS];
+    std::atomic<int> m_count;
+};
+
+#endif // MIDITRANSPORTFANOUT_H
@@ -0,0 +1,28 @@
+#ifndef MIDITRANSPORTSINK_H
+#define MIDITRANSPORTSINK_H
+
+#include <QtGlobal>
+
+// Receiver for incoming clock and transport messages
+// MidiEngine calls the sink set with MidiEngine::setTransportSink()
+// directly from its input processing (the real-time input thread or the
+// poll timer), with no signal dispatch or event loop in between.
+// Implementations run on the timing path and must not block.
+// Timestamps are driver arrival times in MidiTime nanoseconds.
+class MidiTransportSink {
+public:
+    virtual ~MidiTransportSink() {}
+
+    virtual void midiStart(qint64 timestamp) = 0;
+    virtual void midiStop(qint64 timestamp) = 0;
+    virtual void midiContinue(qint64 timestamp) = 0;
+    virtual void midiClock(qint64 timestamp) = 0;
+    virtual void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) = 0;
+    // MTC quarter frame data byte (the byte after 0xF1); optional
+    virtual void midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) {
+        Q_UNUSED(data);
+        Q_UNUSED(timestamp);
+    }
+};
+
+#endif // MIDITRANSPORTSINK_H
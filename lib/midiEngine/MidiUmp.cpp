@@ -0,0 +1,316 @@
+#include "MidiUmp.h"
+#include "MidiTime.h"
+#include <cmath>
+
+namespace {
+
+MidiMessage midi1(quint8 status, quint8 data1 = 0, quint8 data2 = 0) {
+    const quint8 length = MidiStreamParser::dataLength(status);
+    return {{status, static_cast<quint8>(data1 & 0x7F), static_cast<quint8>(data2 & 0x7F)},
+            static_cast<quint8>(1 + length), 0};
+}
+
+// The MIDI 1.0 form of a MIDI 2.0 channel voice packet
+int midi2ToMidi1(const UmpPacket &packet, MidiMessage *messages) {
+    const quint32 first = packet.words[0];
+    const quint32 data = packet.words[1];
+    const quint8 opcode = (first >> 20) & 0x0F;
+    const quint8 channel = (first >> 16) & 0x0F;
+    const quint8 index = (first >> 8) & 0x7F; // Note, controller or RPN bank
+    const quint8 low = first & 0x7F;          // RPN index
+    const quint8 data7 = static_cast<quint8>(Ump::scaleDown(data, 32, 7));
+    const quint32 data14 = Ump::scaleDown(data, 32, 14);
+    const quint8 velocity = static_cast<quint8>(Ump::scaleDown(data >> 16, 16, 7));
+
+    switch (opcode) {
+    case 0x8:
+        messages[0] = midi1(0x80 | channel, index, velocity);
+        return 1;
+    case 0x9:
+        // Velocity 0 is a Note On in MIDI 2.0, a Note Off in MIDI 1.0
+        messages[0] = midi1(0x90 | channel, index, velocity > 0 ? velocity : 1);
+        return 1;
+    case 0xA:
+        messages[0] = midi1(0xA0 | channel, index, data7);
+        return 1;
+    case 0xB:
+        messages[0] = midi1(0xB0 | channel, index, data7);
+        return 1;
+    case 0xC: {
+        int count = 0;
+        if (first & 0x01) { // Bank valid
+            messages[count++] = midi1(0xB0 | channel, 0, (data >> 8) & 0x7F);
+            messages[count++] = midi1(0xB0 | channel, 32, data & 0x7F);
+        }
+        messages[count++] = midi1(0xC0 | channel, (data >> 24) & 0x7F);
+        return count;
+    }
+    case 0xD:
+        messages[0] = midi1(0xD0 | channel, data7);
+        return 1;
+    case 0xE:
+        messages[0] = midi1(0xE0 | channel, data14 & 0x7F, data14 >> 7);
+        return 1;
+    case 0x2:   // Registered controller
+    case 0x3: { // Assignable (NRPN)
+        const quint8 bankController = opcode == 0x2 ? 101 : 99;
+        messages[0] = midi1(0xB0 | channel, bankController, index);
+        messages[1] = midi1(0xB0 | channel, bankController - 1, low);
+        messages[2] = midi1(0xB0 | channel, 6, data14 >> 7);
+        messages[3] = midi1(0xB0 | channel, 38, data14 & 0x7F);
+        return 4;
+    }
+    default:
+        return 0; // Per-note controllers and management
+    }
+}
+
+} // namespace
+
+quint32 Ump::scaleUp(quint32 value, int sourceBits, int destinationBits) {
+    const int scaleBits = destinationBits - sourceBits;
+    quint32 shifted = value << scaleBits;
+    if (value <= (1u << (sourceBits - 1))) {
+        return shifted;
+    }
+    // Above the center the low bits are filled by repeating the value's
+    // own, so the maximum maps to the maximum
+    const int repeatBits = sourceBits - 1;
+    quint32 repeat = value & ((1u << repeatBits) - 1);
+    repeat = scaleBits > repeatBits ? repeat << (scaleBits - repeatBits) : repeat >> (repeatBits - scaleBits);
+    while (repeat != 0) {
+        shifted |= repeat;
+        repeat >>= repeatBits;
+    }
+    return shifted;
+}
+
+bool Ump::fromMidi1(const quint8 *bytes, int size, quint8 group, Protocol protocol, UmpPacket *packet) {
+    if (size < 1 || bytes[0] < 0x80 || bytes[0] == 0xF0 || bytes[0] == 0xF7) {
+        return false;
+    }
+    const quint8 status = bytes[0];
+    const int length = MidiStreamParser::dataLength(status);
+    if (size < 1 + length) {
+        return false;
+    }
+    const quint8 data1 = length > 0 ? bytes[1] & 0x7F : 0;
+    const quint8 data2 = length > 1 ? bytes[2] & 0x7F : 0;
+    const quint32 header = (static_cast<quint32>(group & 0x0F) << 24);
+
+    if (status >= 0xF0 || protocol == Protocol::Midi1) {
+        const quint32 type = status >= 0xF0 ? System : Midi1ChannelVoice;
+        *packet = {{(type << 28) | header | (static_cast<quint32>(status) << 16) |
+                    (static_cast<quint32>(data1) << 8) | data2, 0, 0, 0}, 1};
+        return true;
+    }
+
+    quint32 opcode = status >> 4;
+    quint32 index = 0;
+    quint32 data = 0;
+    switch (opcode) {
+    case 0x8:
+    case 0x9:
+        if (opcode == 0x9 && data2 == 0) {
+            opcode = 0x8; // MIDI 1.0's Note Off spelling
+        }
+        index = data1;
+        data = scaleUp(data2, 7, 16) << 16;
+        break;
+    case 0xA:
+    case 0xB:
+        index = data1;
+        data = scaleUp(data2, 7, 32);
+        break;
+    case 0xC:
+        data = static_cast<quint32>(data1) << 24;
+        break;
+    case 0xD:
+        data = scaleUp(data1, 7, 32);
+        break;
+    default: // 0xE
+        data = scaleUp(data1 | (static_cast<quint32>(data2) << 7), 14, 32);
+        break;
+    }
+    *packet = {{(static_cast<quint32>(Midi2ChannelVoice) << 28) | header | (opcode << 20) |
+                (static_cast<quint32>(status & 0x0F) << 16) | (index << 8), data, 0, 0}, 2};
+    return true;
+}
+
+int Ump::toMidi1(const UmpPacket &packet, MidiMessage *messages) {
+    const quint32 first = packet.words[0];
+    const quint8 status = (first >> 16) & 0xFF;
+    switch (packet.messageType()) {
+    case System:
+        // SysEx travels as Data64, never here
+        if (status < 0xF0 || status == 0xF0 || status == 0xF7) {
+            return 0;
+        }
+        messages[0] = midi1(status, first >> 8, first);
+        return 1;
+    case Midi1ChannelVoice:
+        if (status < 0x80 || status >= 0xF0) {
+            return 0;
+        }
+        messages[0] = midi1(status, first >> 8, first);
+        return 1;
+    case Midi2ChannelVoice:
+        return midi2ToMidi1(packet, messages);
+    default:
+        return 0;
+    }
+}
+
+JrTimestampMapper::JrTimestampMapper() {
+    reset();
+}
+
+void JrTimestampMapper::reset() {
+    m_hasLast = false;
+    m_lastTicks = 0;
+    m_lastArrivalNs = 0;
+    m_senderTicks = 0;
+    m_transitCount = 0;
+    m_transitNext = 0;
+    m_count = 0;
+}
+
+qint64 JrTimestampMapper::map(quint16 timestamp, qint64 arrivalNs) {
+    if (!m_hasLast) {
+        m_senderTicks = timestamp;
+    } else {
+        // The wraps are whatever brings the step closest to the time that
+        // passed here
+        const qint64 elapsedTicks = (arrivalNs - m_lastArrivalNs) / Ump::JR_TICK_NS;
+        const qint64 step = static_cast<quint16>(timestamp - m_lastTicks);
+        const qint64 wraps = std::llround(static_cast<double>(elapsedTicks - step) / 65536.0);
+        m_senderTicks += step + wraps * 65536;
+    }
+    m_hasLast = true;
+    m_lastTicks = timestamp;
+    m_lastArrivalNs = arrivalNs;
+    ++m_count;
+
+    const qint64 senderNs = m_senderTicks * Ump::JR_TICK_NS;
+    m_transits[m_transitNext] = arrivalNs - senderNs;
+    m_transitNext = (m_transitNext + 1) % WINDOW;
+    m_transitCount = qMin(m_transitCount + 1, WINDOW);
+    qint64 fastest = m_transits[0];
+    for (int i = 1; i < m_transitCount; ++i) {
+        fastest = qMin(fastest, m_transits[i]);
+    }
+    return senderNs + fastest;
+}
+
+qint64 JrTimestampMapper::jitterNs() const {
+    if (m_transitCount == 0) {
+        return 0;
+    }
+    qint64 fastest = m_transits[0];
+    qint64 slowest = m_transits[0];
+    for (int i = 1; i < m_transitCount; ++i) {
+        fastest = qMin(fastest, m_transits[i]);
+        slowest = qMax(slowest, m_transits[i]);
+    }
+    return slowest - fastest;
+}
+
+UmpStreamDecoder::UmpStreamDecoder()
+    : m_expected(0)
+    , m_pendingTimestampNs(0)
+{
+    m_packet.wordCount = 0;
+    m_stats = Stats();
+}
+
+void UmpStreamDecoder::reset() {
+    m_packet.wordCount = 0;
+    m_expected = 0;
+    m_timestamps.reset();
+    m_pendingTimestampNs = 0;
+    m_sysEx.abort();
+}
+
+UmpStreamDecoder::Stats UmpStreamDecoder::stats() const {
+    Stats stats = m_stats;
+    stats.jrJitterNs = m_timestamps.jitterNs();
+    return stats;
+}
+
+bool UmpStreamDecoder::appendSysEx(const UmpPacket &packet, qint64 timestamp) {
+    static const quint8 START = 0xF0;
+    static const quint8 END = 0xF7;
+    const quint32 first = packet.words[0];
+    const quint32 second = packet.words[1];
+    const quint8 status = (first >> 20) & 0x0F; // 0 complete, 1 start, 2 continue, 3 end
+    const int count = qMin<int>((first >> 16) & 0x0F, 6);
+    const quint8 bytes[6] = {
+        static_cast<quint8>((first >> 8) & 0x7F), static_cast<quint8>(first & 0x7F),
+        static_cast<quint8>((second >> 24) & 0x7F), static_cast<quint8>((second >> 16) & 0x7F),
+        static_cast<quint8>((second >> 8) & 0x7F), static_cast<quint8>(second & 0x7F)
+    };
+
+    if (status == 0x0 || status == 0x1) {
+        if (m_sysEx.active()) {
+            m_sysEx.interrupt();
+        }
+        m_sysEx.begin(timestamp);
+        m_sysEx.append(&START, 1);
+    } else if (!m_sysEx.active()) {
+        return false; // The start was lost
+    }
+    m_sysEx.append(bytes, count);
+    if (status == 0x0 || status == 0x3) {
+        return m_sysEx.append(&END, 1);
+    }
+    return false;
+}
+
+UmpOutputBackend::UmpOutputBackend(Ump::Protocol protocol, quint8 group)
+    : m_protocol(protocol)
+    , m_group(group)
+    , m_lastJrClockNs(0)
+    , m_untranslated(0)
+{
+}
+
+void UmpOutputBackend::sendMessage(const unsigned char *data, size_t size) {
+    MidiOutputBatch batch;
+    batch.append(data, size);
+    deliver(batch, 0);
+}
+
+void UmpOutputBackend::sendBatch(const MidiOutputBatch &batch) {
+    deliver(batch, 0);
+}
+
+void UmpOutputBackend::scheduleBatch(const MidiOutputBatch &batch, qint64 deliverAtNs) {
+    deliver(batch, deliverAtNs);
+}
+
+void UmpOutputBackend::deliver(const MidiOutputBatch &batch, qint64 deliverAtNs) {
+    UmpPacket packets[MAX_PACKETS];
+    int count = 0;
+    const qint64 now = MidiTime::nowNanoseconds();
+    if (m_lastJrClockNs == 0 || now - m_lastJrClockNs >= JR_CLOCK_INTERVAL_NS) {
+        packets[count++] = Ump::utility(Ump::JrClock, Ump::jrTicks(now));
+        m_lastJrClockNs = now;
+    }
+    const UmpPacket stamp = Ump::utility(Ump::JrTimestamp, Ump::jrTicks(deliverAtNs > 0 ? deliverAtNs : now));
+    const int firstMessage = count;
+    for (int i = 0; i < batch.count(); ++i) {
+        const MidiOutputBatch::Message &message = batch.at(i);
+        if (message.dropped) {
+            continue;
+        }
+        packets[count] = stamp;
+        if (Ump::fromMidi1(message.bytes, message.size, m_group, m_protocol, &packets[count + 1])) {
+            count += 2;
+        } else {
+            ++m_untranslated;
+        }
+    }
+    if (count > firstMessage) {
+        sendPackets(packets, count, deliverAtNs);
+    }
+}
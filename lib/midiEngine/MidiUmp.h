@@ -0,0 +1,251 @@
+#ifndef MIDIUMP_H
+#define MIDIUMP_H
+
+#include <QtGlobal>
+#include <type_traits>
+#include "MidiOutputBackend.h"
+#include "MidiOutputBatch.h"
+#include "MidiStreamParser.h"
+#include "SysExBufferPool.h"
+
+// One Universal MIDI Packet (MIDI 2.0): 1 to 4 32-bit words, the count
+// fixed by the message type in the top nibble of the first word
+struct UmpPacket {
+    static constexpr int MAX_WORDS = 4;
+
+    quint32 words[MAX_WORDS];
+    quint8 wordCount;
+
+    quint8 messageType() const { return static_cast<quint8>(words[0] >> 28); }
+    quint8 group() const { return static_cast<quint8>((words[0] >> 24) & 0x0F); }
+};
+
+namespace Ump {
+    enum MessageType : quint8 {
+        Utility = 0x0,           // NOOP, JR Clock, JR Timestamp
+        System = 0x1,            // System Common and Real-Time, as in MIDI 1.0
+        Midi1ChannelVoice = 0x2, // MIDI 1.0 protocol channel voice
+        Data64 = 0x3,            // SysEx, 6 bytes a packet
+        Midi2ChannelVoice = 0x4  // MIDI 2.0 protocol channel voice
+    };
+
+    enum UtilityStatus : quint8 {
+        Noop = 0x0,
+        JrClock = 0x1,
+        JrTimestamp = 0x2
+    };
+
+    enum class Protocol {
+        Midi1, // Channel voice as MT 0x2 (every MIDI 1.0 device takes it)
+        Midi2  // Channel voice upscaled to MT 0x4 (16-bit velocity, 32-bit controllers)
+    };
+
+    // Jitter Reduction time unit: 1/31250 s, a 16-bit count (wraps every 2.1 s)
+    constexpr qint64 JR_TICK_NS = 32000;
+
+    // Words in a packet of each message type
+    constexpr int wordCount(quint8 messageType) {
+        return messageType <= 0x2 || messageType == 0x6 || messageType == 0x7 ? 1
+             : messageType <= 0x4 || (messageType >= 0x8 && messageType <= 0xA) ? 2
+             : messageType == 0x5 || messageType >= 0xD ? 4
+             : 3;
+    }
+
+    inline quint16 jrTicks(qint64 ns) { return static_cast<quint16>((ns / JR_TICK_NS) & 0xFFFF); }
+
+    inline UmpPacket utility(UtilityStatus status, quint16 data) {
+        return {{(static_cast<quint32>(status) << 20) | data, 0, 0, 0}, 1};
+    }
+
+    // A MIDI 1.0 short message as a packet (SysEx and EOX excluded); false
+    // if it has no packet form
+    bool fromMidi1(const quint8 *bytes, int size, quint8 group, Protocol protocol, UmpPacket *packet);
+
+    // The MIDI 1.0 messages a packet translates to (a MIDI 2.0 program
+    // change with its bank, or an RPN, is several); returns how many went
+    // into messages (at most MAX_MIDI1_MESSAGES), 0 for anything with no
+    // MIDI 1.0 form (utility, SysEx, per-note controllers, Flex Data, ...)
+    constexpr int MAX_MIDI1_MESSAGES = 4;
+    int toMidi1(const UmpPacket &packet, MidiMessage *messages);
+
+    // MIDI 2.0 value scaling (min-center-max, so both ends and the center
+    // survive the round trip)
+    quint32 scaleUp(quint32 value, int sourceBits, int destinationBits);
+    inline quint32 scaleDown(quint32 value, int sourceBits, int destinationBits) {
+        return value >> (sourceBits - destinationBits);
+    }
+}
+
+// Sender time of incoming JR Timestamps mapped onto local time
+// A JR Timestamp carries when the sender sent (or meant to send) the
+// message after it. Its 16-bit count is unwrapped against the local
+// arrival clock (so a pause longer than the wrap is no problem), and the
+// sender time is moved onto ours by the fastest transit among the last
+// WINDOW stamps: the transport delay every stamp saw at the least. What
+// is left is the sender's own timing, whatever the transport added on
+// top. No clock synchronisation is needed (only differences matter), and
+// sender drift is followed as the window moves. Single-threaded.
+class JrTimestampMapper {
+public:
+    static constexpr int WINDOW = 64;
+
+    JrTimestampMapper();
+
+    void reset();
+
+    // Local time of the sender time in timestamp (never after arrivalNs)
+    qint64 map(quint16 timestamp, qint64 arrivalNs);
+
+    quint64 count() const { return m_count; }
+    // Transit spread over the window: the jitter the stamps took out
+    qint64 jitterNs() const;
+
+private:
+    bool m_hasLast;
+    quint16 m_lastTicks;
+    qint64 m_lastArrivalNs;
+    qint64 m_senderTicks; // Unwrapped
+    qint64 m_transits[WINDOW];
+    int m_transitCount;
+    int m_transitNext;
+    quint64 m_count;
+};
+
+// Streaming UMP decoder: 32-bit words in (split anywhere, packets are
+// reassembled), MIDI 1.0 messages out for the engine's dispatch.
+// Each message is timed by the JR Timestamp in front of it when the
+// sender gives one (JrTimestampMapper), else by its arrival. SysEx7 is
+// reassembled into a pool buffer (F0 ... F7) when a pool is set. Packets
+// with no MIDI 1.0 form are counted and dropped. Nothing allocates. Not
+// thread-safe: one decoder per stream.
+class UmpStreamDecoder {
+public:
+    struct Stats {
+        quint64 packets;
+        quint64 jrTimestamped; // Messages timed by a JR Timestamp
+        quint64 untranslated;  // No MIDI 1.0 form
+        qint64 jrJitterNs;     // JrTimestampMapper::jitterNs()
+    };
+
+    UmpStreamDecoder();
+
+    void setSysExPool(SysExBufferPool *pool) { m_sysEx.setPool(pool); }
+
+    // Calls deliver(const MidiMessage &) for every message the words
+    // complete, and deliver(const SysExMessage &) for every complete SysEx
+    // if it takes one (the view is released when deliver returns)
+    template <typename Deliver>
+    void decode(const quint32 *words, int wordCount, qint64 arrivalNs, Deliver &&deliver) {
+        for (int i = 0; i < wordCount; ++i) {
+            if (m_packet.wordCount == 0) {
+                m_expected = Ump::wordCount(static_cast<quint8>(words[i] >> 28));
+            }
+            m_packet.words[m_packet.wordCount++] = words[i];
+            if (m_packet.wordCount == m_expected) {
+                decodePacket(m_packet, arrivalNs, deliver);
+                m_packet.wordCount = 0;
+            }
+        }
+    }
+
+    // Forgets a partial packet, a SysEx in progress and the JR timeline
+    void reset();
+
+    Stats stats() const;
+
+private:
+    template <typename Deliver>
+    void decodePacket(const UmpPacket &packet, qint64 arrivalNs, Deliver &&deliver) {
+        ++m_stats.packets;
+        const quint8 type = packet.messageType();
+        if (type == Ump::Utility) {
+            if (((packet.words[0] >> 20) & 0x0F) == Ump::JrTimestamp) {
+                m_pendingTimestampNs = m_timestamps.map(static_cast<quint16>(packet.words[0] & 0xFFFF), arrivalNs);
+            }
+            return;
+        }
+        // A JR Timestamp times the message after it
+        const qint64 timestamp = m_pendingTimestampNs > 0 ? m_pendingTimestampNs : arrivalNs;
+        if (m_pendingTimestampNs > 0) {
+            ++m_stats.jrTimestamped;
+        }
+        m_pendingTimestampNs = 0;
+
+        if (type == Ump::Data64) {
+            if (appendSysEx(packet, timestamp)) {
+                deliverSysEx(deliver);
+            }
+            return;
+        }
+        MidiMessage messages[Ump::MAX_MIDI1_MESSAGES];
+        const int count = Ump::toMidi1(packet, messages);
+        if (count == 0) {
+            ++m_stats.untranslated;
+        }
+        for (int i = 0; i < count; ++i) {
+            messages[i].timestamp = timestamp;
+            deliver(static_cast<const MidiMessage &>(messages[i]));
+        }
+    }
+
+    // true when the packet completed a SysEx
+    bool appendSysEx(const UmpPacket &packet, qint64 timestamp);
+
+    template <typename Deliver>
+    void deliverSysEx(Deliver &&deliver) {
+        SysExMessage message;
+        const quint16 handle = m_sysEx.take(&message);
+        if (handle == 0) {
+            return;
+        }
+        if constexpr (std::is_invocable_v<Deliver, const SysExMessage &>) {
+            deliver(static_cast<const SysExMessage &>(message));
+        }
+        m_sysEx.pool()->release(handle);
+    }
+
+    UmpPacket m_packet; // Being assembled (wordCount words so far)
+    int m_expected;
+    JrTimestampMapper m_timestamps;
+    qint64 m_pendingTimestampNs; // 0 = none
+    SysExAssembler m_sysEx;
+    Stats m_stats;
+};
+
+// Output port speaking UMP (an OS MIDI 2.0 endpoint, a UMP network
+// session): batches are translated to packets here, at the port, and
+// handed over with sendPackets(). Each message is led by a JR Timestamp
+// of its delivery time (now for an immediate send), and for receivers to
+// follow the timeline, a JR Clock goes out at least every
+// JR_CLOCK_INTERVAL_NS.
+// Implementations only have to move words; the send side never
+// allocates.
+class UmpOutputBackend : public MidiOutputBackend {
+public:
+    static constexpr qint64 JR_CLOCK_INTERVAL_NS = 250000000; // 250 ms
+    // JR Clock + a JR Timestamp and a packet per message
+    static constexpr int MAX_PACKETS = 1 + 2 * MidiOutputBatch::MAX_MESSAGES;
+
+    explicit UmpOutputBackend(Ump::Protocol protocol = Ump::Protocol::Midi1, quint8 group = 0);
+
+    void sendMessage(const unsigned char *data, size_t size) override;
+    void sendBatch(const MidiOutputBatch &batch) override;
+    void scheduleBatch(const MidiOutputBatch &batch, qint64 deliverAtNs) override;
+
+    // deliverAtNs: MidiTime nanoseconds, 0 = now
+    virtual void sendPackets(const UmpPacket *packets, int count, qint64 deliverAtNs) = 0;
+
+    Ump::Protocol protocol() const { return m_protocol; }
+    // Messages with no packet form (skipped)
+    quint64 untranslatedCount() const { return m_untranslated; }
+
+private:
+    void deliver(const MidiOutputBatch &batch, qint64 deliverAtNs);
+
+    Ump::Protocol m_protocol;
+    quint8 m_group;
+    qint64 m_lastJrClockNs;
+    quint64 m_untranslated;
+};
+
+#endif // MIDIUMP_H
@@ -0,0 +1,258 @@
+#include "RealtimeScheduling.h"
+#include <QStringList>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#endif
+
+namespace {
+
+const int ROLE_COUNT = static_cast<int>(RealtimeThreadRole::Count);
+
+std::mutex s_mutex;
+RealtimeProfile s_profile;
+RealtimeScheduling::ThreadReport s_threadReports[ROLE_COUNT];
+RealtimeScheduling::ProcessReport s_processReport = {RealtimeScheduling::Grant::NotRequested, 0, 0};
+std::atomic<quint64> s_prefaultedBytes(0);
+
+constexpr std::size_t PAGE_BYTES = 4096;
+
+// Deep enough to cover what the thread's loop will use; the frame is
+// gone once this returns, but its pages stay mapped
+Q_NEVER_INLINE void prefaultStack() {
+    volatile quint8 stack[RealtimeScheduling::STACK_PREFAULT_BYTES];
+    for (int i = 0; i < RealtimeScheduling::STACK_PREFAULT_BYTES; i += static_cast<int>(PAGE_BYTES)) {
+        stack[i] = 0;
+    }
+    RealtimeScheduling::countPrefaulted(RealtimeScheduling::STACK_PREFAULT_BYTES);
+}
+
+QString errorText(int error) {
+#if defined(__APPLE__)
+    return QString::fromLocal8Bit(mach_error_string(error));
+#else
+    return QString::fromLocal8Bit(std::strerror(error));
+#endif
+}
+
+QString grantText(RealtimeScheduling::Grant grant, int error) {
+    if (grant == RealtimeScheduling::Grant::Denied && error != 0) {
+        return QString("denied (%1)").arg(errorText(error));
+    }
+    return RealtimeScheduling::grantName(grant);
+}
+
+} // namespace
+
+RealtimeProfile::RealtimeProfile()
+    : schedulingPolicy(false)
+    , priority(80)
+    , lockMemory(false)
+    , prefault(false)
+{
+}
+
+RealtimeScheduling::ProcessReport RealtimeScheduling::setProfile(const RealtimeProfile &profile) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    const bool wasLocked = s_processReport.memoryLock == Grant::Granted;
+    s_profile = profile;
+    s_processReport.memoryLockError = 0;
+    if (profile.lockMemory) {
+#if defined(__linux__)
+        if (wasLocked || ::mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            s_processReport.memoryLock = Grant::Granted;
+        } else {
+            s_processReport.memoryLock = Grant::Denied;
+            s_processReport.memoryLockError = errno;
+        }
+#else
+        Q_UNUSED(wasLocked);
+        s_processReport.memoryLock = Grant::Unsupported;
+#endif
+    } else {
+#if defined(__linux__)
+        if (wasLocked) {
+            ::munlockall();
+        }
+#endif
+        s_processReport.memoryLock = Grant::NotRequested;
+    }
+    s_processReport.prefaultedBytes = s_prefaultedBytes.load(std::memory_order_relaxed);
+    return s_processReport;
+}
+
+RealtimeProfile RealtimeScheduling::profile() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_profile;
+}
+
+void RealtimeScheduling::applyToCurrentThread(RealtimeThreadRole role) {
+    const RealtimeProfile current = profile();
+    const ThreadReport report = apply(role, current);
+    if (current.prefault) {
+        prefaultStack();
+    }
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_threadReports[static_cast<int>(role)] = report;
+}
+
+RealtimeScheduling::ThreadReport RealtimeScheduling::probe(RealtimeThreadRole role) {
+    const RealtimeProfile current = profile();
+    ThreadReport report;
+    std::thread probeThread([&]() { report = apply(role, current); });
+    probeThread.join();
+    return report;
+}
+
+RealtimeScheduling::ThreadReport RealtimeScheduling::apply(RealtimeThreadRole role, const RealtimeProfile &profile) {
+    ThreadReport report = {true, Grant::NotRequested, Grant::NotRequested, -1, 0, 0};
+
+    if (profile.schedulingPolicy) {
+#if defined(__linux__)
+        sched_param param = {};
+        param.sched_priority = qBound(1, profile.priority, 99);
+        const int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        report.policy = result == 0 ? Grant::Granted : Grant::Denied;
+        report.policyError = result;
+#elif defined(__APPLE__)
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        auto toAbsolute = [&timebase](qint64 ns) {
+            return static_cast<uint32_t>(ns * timebase.denom / timebase.numer);
+        };
+        thread_time_constraint_policy_data_t policy;
+        policy.period = toAbsolute(TIME_CONSTRAINT_PERIOD_NS);
+        policy.computation = toAbsolute(TIME_CONSTRAINT_COMPUTATION_NS);
+        policy.constraint = toAbsolute(TIME_CONSTRAINT_CONSTRAINT_NS);
+        policy.preemptible = 1;
+        const kern_return_t result = thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                                       THREAD_TIME_CONSTRAINT_POLICY,
+                                                       reinterpret_cast<thread_policy_t>(&policy),
+                                                       THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+        report.policy = result == KERN_SUCCESS ? Grant::Granted : Grant::Denied;
+        report.policyError = result;
+#else
+        report.policy = Grant::Unsupported;
+#endif
+    }
+
+    if (!profile.cpus.isEmpty()) {
+        const int cpu = profile.cpus.at(static_cast<int>(role) % profile.cpus.size());
+#if defined(__linux__)
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            report.affinity = Grant::Denied;
+            report.affinityError = EINVAL;
+        } else {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            const int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            report.affinity = result == 0 ? Grant::Granted : Grant::Denied;
+            report.affinityError = result;
+            if (result == 0) {
+                report.cpu = cpu;
+            }
+        }
+#else
+        // macOS only takes affinity hints (tags), not cores
+        Q_UNUSED(cpu);
+        report.affinity = Grant::Unsupported;
+#endif
+    }
+    return report;
+}
+
+quint64 RealtimeScheduling::prefault(void *data, std::size_t size) {
+    if (!data || size == 0) {
+        return 0;
+    }
+    // An atomic add of zero is a write access (so copy-on-write and zero
+    // pages are really faulted in) that leaves the contents as they are
+    quint8 *bytes = static_cast<quint8 *>(data);
+    const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(bytes);
+    for (std::uintptr_t page = first & ~(PAGE_BYTES - 1); page < first + size; page += PAGE_BYTES) {
+        quint8 *touch = page < first ? bytes : reinterpret_cast<quint8 *>(page);
+        __atomic_fetch_add(touch, 0, __ATOMIC_RELAXED);
+    }
+    countPrefaulted(size);
+    return size;
+}
+
+void RealtimeScheduling::countPrefaulted(quint64 bytes) {
+    s_prefaultedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+RealtimeScheduling::ThreadReport RealtimeScheduling::threadReport(RealtimeThreadRole role) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_threadReports[static_cast<int>(role)];
+}
+
+RealtimeScheduling::ProcessReport RealtimeScheduling::processReport() {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    ProcessReport report = s_processReport;
+    report.prefaultedBytes = s_prefaultedBytes.load(std::memory_order_relaxed);
+    return report;
+}
+
+const char *RealtimeScheduling::grantName(Grant grant) {
+    switch (grant) {
+    case Grant::NotRequested: return "not requested";
+    case Grant::Granted: return "granted";
+    case Grant::Denied: return "denied";
+    case Grant::Unsupported: return "unsupported";
+    }
+    return "";
+}
+
+const char *RealtimeScheduling::roleName(RealtimeThreadRole role) {
+    switch (role) {
+    case RealtimeThreadRole::Input: return "input";
+    case RealtimeThreadRole::Clock: return "clock";
+    case RealtimeThreadRole::Boundary: return "boundary";
+    case RealtimeThreadRole::Output: return "output";
+    case RealtimeThreadRole::Count: break;
+    }
+    return "";
+}
+
+QString RealtimeScheduling::describe(RealtimeThreadRole role, const ThreadReport &report) {
+    const RealtimeProfile current = profile();
+    QStringList settings;
+    if (report.policy != Grant::NotRequested) {
+#if defined(__APPLE__)
+        const QString policy = "time-constraint policy";
+#else
+        const QString policy = QString("SCHED_FIFO %1").arg(qBound(1, current.priority, 99));
+#endif
+        settings.append(policy + " " + grantText(report.policy, report.policyError));
+    }
+    if (report.affinity != Grant::NotRequested) {
+        const int cpu = current.cpus.isEmpty() ? -1
+            : current.cpus.at(static_cast<int>(role) % current.cpus.size());
+        settings.append(QString("CPU %1 %2").arg(cpu).arg(grantText(report.affinity, report.affinityError)));
+    }
+    if (settings.isEmpty()) {
+        settings.append("default scheduling");
+    }
+    return QString("%1 thread: %2").arg(roleName(role)).arg(settings.join(", "));
+}
+
+QString RealtimeScheduling::describe(const ProcessReport &report) {
+    QString text = QString("memory lock %1").arg(grantText(report.memoryLock, report.memoryLockError));
+    if (report.prefaultedBytes > 0) {
+        text += QString(", %1 KB prefaulted").arg(report.prefaultedBytes / 1024);
+    }
+    return text;
+}
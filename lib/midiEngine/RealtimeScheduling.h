@@ -0,0 +1,98 @@
+#ifndef REALTIMESCHEDULING_H
+#define REALTIMESCHEDULING_H
+
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include <cstddef>
+
+// What real-time treatment the timing threads ask for; all off by default
+// (Qt's TimeCriticalPriority only, which ordinary Linux scheduling ignores)
+struct RealtimeProfile {
+    bool schedulingPolicy;  // SCHED_FIFO (Linux), time-constraint policy (macOS)
+    int priority;           // SCHED_FIFO priority, 1-99
+    QVector<int> cpus;      // Cores to pin to, one per thread role in turn (Linux); empty = any
+    bool lockMemory;        // mlockall: current and future pages stay resident (Linux)
+    bool prefault;          // Touch the engine's pools and rings and each thread's stack up front
+
+    RealtimeProfile();
+
+    bool isEnabled() const { return schedulingPolicy || !cpus.isEmpty() || lockMemory || prefault; }
+};
+
+// The timing threads, each applying the profile when it starts
+enum class RealtimeThreadRole {
+    Input,      // MidiInputThread: queue drain and clock handling
+    Clock,      // MidiClockGenerator
+    Boundary,   // BoundaryScheduler: downbeats between clocks
+    Output,     // MidiOutputPortWorker: per-port sends
+    Count
+};
+
+// Process-wide real-time setup for the timing threads
+// setProfile() applies the process-wide parts (memory locking) and is
+// read by every timing thread as it starts; each records what it was
+// granted, so a denied setting shows up in the log and the stats rather
+// than as late clock. Not for RtMidi's own callback thread (CoreMIDI's
+// is already time-constrained; ALSA's isn't ours to start).
+class RealtimeScheduling {
+public:
+    enum class Grant : quint8 {
+        NotRequested,
+        Granted,
+        Denied,       // Permission or resource (see the error)
+        Unsupported   // Not on this platform
+    };
+
+    struct ThreadReport {
+        bool started;      // A thread of this role has applied the profile
+        Grant policy;
+        Grant affinity;
+        int cpu;           // Pinned core, -1 if none
+        int policyError;   // errno (kern_return_t on macOS) when denied
+        int affinityError;
+    };
+
+    struct ProcessReport {
+        Grant memoryLock;
+        int memoryLockError;
+        quint64 prefaultedBytes;
+    };
+
+    static constexpr int STACK_PREFAULT_BYTES = 256 * 1024;
+    // macOS time-constraint policy: CPU time wanted within each period
+    static constexpr qint64 TIME_CONSTRAINT_PERIOD_NS = 1000000;       // 1 ms
+    static constexpr qint64 TIME_CONSTRAINT_COMPUTATION_NS = 250000;   // 250 us
+    static constexpr qint64 TIME_CONSTRAINT_CONSTRAINT_NS = 500000;    // 500 us
+
+    // Before the timing threads start (running ones keep what they have)
+    static ProcessReport setProfile(const RealtimeProfile &profile);
+    static RealtimeProfile profile();
+
+    // First thing in a timing thread's run()
+    static void applyToCurrentThread(RealtimeThreadRole role);
+
+    // Applies the profile to a short-lived thread of the given role and
+    // reports the outcome without recording it: what the real thread
+    // will get, known at startup
+    static ThreadReport probe(RealtimeThreadRole role);
+
+    // Faults every page in for writing without changing it (safe on
+    // memory other threads already use)
+    static quint64 prefault(void *data, std::size_t size);
+    static void countPrefaulted(quint64 bytes);
+
+    static ThreadReport threadReport(RealtimeThreadRole role);
+    static ProcessReport processReport();
+
+    static const char *grantName(Grant grant);
+    static const char *roleName(RealtimeThreadRole role);
+    // One line per setting, e.g. "input thread: SCHED_FIFO 80 granted, CPU 3 denied (Invalid argument)"
+    static QString describe(RealtimeThreadRole role, const ThreadReport &report);
+    static QString describe(const ProcessReport &report);
+
+private:
+    static ThreadReport apply(RealtimeThreadRole role, const RealtimeProfile &profile);
+};
+
+#endif // REALTIMESCHEDULING_H
@@ -0,0 +1,472 @@
+#include "RtpMidiSession.h"
+#include "MidiTime.h"
+#include <QMutexLocker>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <dns_sd.h>
+#endif
+
+namespace {
+
+const int MAX_PACKET_SIZE = 1500;
+
+quint16 read16(const quint8 *bytes) {
+    return static_cast<quint16>((bytes[0] << 8) | bytes[1]);
+}
+
+quint32 read32(const quint8 *bytes) {
+    return (quint32(bytes[0]) << 24) | (quint32(bytes[1]) << 16) | (quint32(bytes[2]) << 8) | bytes[3];
+}
+
+quint64 read64(const quint8 *bytes) {
+    return (quint64(read32(bytes)) << 32) | read32(bytes + 4);
+}
+
+void write32(quint8 *bytes, quint32 value) {
+    bytes[0] = static_cast<quint8>(value >> 24);
+    bytes[1] = static_cast<quint8>(value >> 16);
+    bytes[2] = static_cast<quint8>(value >> 8);
+    bytes[3] = static_cast<quint8>(value);
+}
+
+void write64(quint8 *bytes, quint64 value) {
+    write32(bytes, static_cast<quint32>(value >> 32));
+    write32(bytes + 4, static_cast<quint32>(value));
+}
+
+bool isExchange(const quint8 *packet, int size) {
+    return size >= 4 && packet[0] == 0xFF && packet[1] == 0xFF;
+}
+
+bool isCommand(const quint8 *packet, const char *command) {
+    return packet[2] == command[0] && packet[3] == command[1];
+}
+
+// Data bytes after a status byte (-1 = SysEx, which has no fixed length)
+int dataLength(quint8 status) {
+    if (status < 0xF0) {
+        const quint8 kind = status & 0xF0;
+        return kind == 0xC0 || kind == 0xD0 ? 1 : 2;
+    }
+    switch (status) {
+    case 0xF0: return -1;
+    case 0xF1:
+    case 0xF3: return 1;
+    case 0xF2: return 2;
+    default: return 0;
+    }
+}
+
+int bindUdp(quint16 port) {
+    const int socketFd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd < 0) {
+        return -1;
+    }
+    const int reuse = 1;
+    ::setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(socketFd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(socketFd);
+        return -1;
+    }
+    return socketFd;
+}
+
+} // namespace
+
+RtpMidiSession::RtpMidiSession(QObject *parent)
+    : QThread(parent)
+    , m_controlPort(0)
+    , m_ssrc(0)
+    , m_controlSocket(-1)
+    , m_dataSocket(-1)
+    , m_advertisement(nullptr)
+    , m_hasTimestamp(false)
+    , m_lastTimestampTicks(0)
+    , m_packetsSinceFeedback(0)
+    , m_clockOffsetNs(0)
+    , m_roundTripNs(0)
+    , m_stopRequested(false)
+{
+    std::memset(&m_peer, 0, sizeof(m_peer));
+    m_stats.store(Stats());
+}
+
+RtpMidiSession::~RtpMidiSession() {
+    stopSession();
+}
+
+void RtpMidiSession::setDeliverCallback(DeliverCallback callback) {
+    m_deliver = std::move(callback);
+}
+
+bool RtpMidiSession::startSession(quint16 controlPort, const QString &name) {
+    stopSession();
+
+    m_controlSocket = bindUdp(controlPort);
+    m_dataSocket = m_controlSocket >= 0 ? bindUdp(controlPort + 1) : -1;
+    if (m_dataSocket < 0) {
+        if (m_controlSocket >= 0) {
+            ::close(m_controlSocket);
+            m_controlSocket = -1;
+        }
+        return false;
+    }
+
+    m_controlPort = controlPort;
+    m_name = name;
+    m_nameUtf8 = name.toUtf8();
+    m_ssrc = std::random_device()();
+    std::memset(&m_peer, 0, sizeof(m_peer));
+    m_buffer.reset();
+    m_hasTimestamp = false;
+    m_packetsSinceFeedback = 0;
+    m_clockOffsetNs = 0;
+    m_roundTripNs = 0;
+    {
+        QMutexLocker locker(&m_peerMutex);
+        m_peerName.clear();
+    }
+    publishStats();
+
+    advertise();
+    m_stopRequested.store(false);
+    start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void RtpMidiSession::stopSession() {
+    if (isRunning()) {
+        m_stopRequested.store(true);
+        wait();
+    }
+#ifdef __APPLE__
+    if (m_advertisement) {
+        DNSServiceRefDeallocate(static_cast<DNSServiceRef>(m_advertisement));
+    }
+#endif
+    m_advertisement = nullptr;
+
+    for (int *socketFd : {&m_controlSocket, &m_dataSocket}) {
+        if (*socketFd >= 0) {
+            // Say goodbye so the initiator doesn't keep sending
+            if (m_peer.connected && socketFd == &m_controlSocket) {
+                quint8 bye[16] = {0xFF, 0xFF, 'B', 'Y'};
+                write32(bye + 4, 2);
+                write32(bye + 8, m_peer.token);
+                write32(bye + 12, m_ssrc);
+                ::sendto(*socketFd, bye, sizeof(bye), 0,
+                         reinterpret_cast<const sockaddr *>(m_peer.controlAddress),
+                         static_cast<socklen_t>(m_peer.controlAddressSize));
+            }
+            ::close(*socketFd);
+            *socketFd = -1;
+        }
+    }
+    m_peer.connected = false;
+    {
+        QMutexLocker locker(&m_peerMutex);
+        m_peerName.clear();
+    }
+    publishStats();
+}
+
+QString RtpMidiSession::peerName() const {
+    QMutexLocker locker(&m_peerMutex);
+    return m_peerName;
+}
+
+RtpMidiSession::Stats RtpMidiSession::stats() const {
+    return m_stats.load();
+}
+
+void RtpMidiSession::advertise() {
+#ifdef __APPLE__
+    // So the session shows up in the initiator's Network Session directory
+    DNSServiceRef advertisement = nullptr;
+    if (DNSServiceRegister(&advertisement, 0, 0, m_nameUtf8.constData(), "_apple-midi._udp",
+                           nullptr, nullptr, htons(m_controlPort), 0, nullptr,
+                           nullptr, nullptr) == kDNSServiceErr_NoError) {
+        m_advertisement = advertisement;
+    }
+#endif
+}
+
+qint64 RtpMidiSession::nowTicks() {
+    return MidiTime::nowNanoseconds() / NS_PER_TICK;
+}
+
+void RtpMidiSession::run() {
+    pollfd sockets[2] = {{m_controlSocket, POLLIN, 0}, {m_dataSocket, POLLIN, 0}};
+    auto deliver = [this](const quint8 *bytes, int size, qint64 timestampNs) {
+        if (m_deliver) {
+            m_deliver(bytes, size, timestampNs);
+        }
+    };
+
+    while (!m_stopRequested.load()) {
+        // Sleep until the next playout time (rounded up to the poll
+        // resolution: the delivered timestamp is the playout time anyway)
+        int timeoutMs = POLL_TIMEOUT_MS;
+        const qint64 nextPlayoutNs = m_buffer.nextPlayoutNs();
+        if (nextPlayoutNs > 0) {
+            const qint64 waitNs = nextPlayoutNs - MidiTime::nowNanoseconds();
+            timeoutMs = waitNs <= 0 ? 0
+                : static_cast<int>(std::min<qint64>(POLL_TIMEOUT_MS, (waitNs + 999999) / 1000000));
+        }
+        if (::poll(sockets, 2, timeoutMs) > 0) {
+            if (sockets[0].revents & POLLIN) {
+                receive(m_controlSocket, false);
+            }
+            if (sockets[1].revents & POLLIN) {
+                receive(m_dataSocket, true);
+            }
+        }
+
+        if (m_buffer.releaseDue(MidiTime::nowNanoseconds(), deliver) > 0) {
+            publishStats();
+        }
+    }
+}
+
+void RtpMidiSession::receive(int socket, bool data) {
+    quint8 packet[MAX_PACKET_SIZE];
+    sockaddr_storage address;
+    for (;;) {
+        socklen_t addressSize = sizeof(address);
+        const ssize_t size = ::recvfrom(socket, packet, sizeof(packet), MSG_DONTWAIT,
+                                        reinterpret_cast<sockaddr *>(&address), &addressSize);
+        if (size <= 0) {
+            return;
+        }
+        const qint64 arrivalNs = MidiTime::nowNanoseconds();
+        if (isExchange(packet, static_cast<int>(size))) {
+            handleExchange(socket, data, packet, static_cast<int>(size), &address,
+                           static_cast<int>(addressSize));
+        } else if (data && m_peer.connected) {
+            handleData(packet, static_cast<int>(size), arrivalNs);
+        }
+    }
+}
+
+void RtpMidiSession::handleExchange(int socket, bool data, const quint8 *packet, int size,
+                                    const void *address, int addressSize) {
+    if (isCommand(packet, "IN") && size >= 16) {
+        // Invitation: first on the control port, then on the data port
+        const quint32 token = read32(packet + 8);
+        const quint32 ssrc = read32(packet + 12);
+        const int storedSize = std::min<int>(addressSize, sizeof(m_peer.controlAddress));
+        if (!data) {
+            if (m_peer.connected && ssrc != m_peer.ssrc) {
+                // A new initiator replaces the old one
+                m_peer.connected = false;
+            }
+            m_peer.ssrc = ssrc;
+            m_peer.token = token;
+            std::memcpy(m_peer.controlAddress, address, storedSize);
+            m_peer.controlAddressSize = storedSize;
+            const int nameLength = static_cast<int>(strnlen(reinterpret_cast<const char *>(packet + 16),
+                                                            size - 16));
+            QMutexLocker locker(&m_peerMutex);
+            m_peerName = QString::fromUtf8(reinterpret_cast<const char *>(packet + 16), nameLength);
+        } else if (ssrc == m_peer.ssrc) {
+            std::memcpy(m_peer.dataAddress, address, storedSize);
+            m_peer.dataAddressSize = storedSize;
+            m_peer.connected = true;
+            m_buffer.reset();
+            m_hasTimestamp = false;
+        } else {
+            return; // Data invitation without the control one first
+        }
+
+        quint8 reply[16 + 64] = {0xFF, 0xFF, 'O', 'K'};
+        write32(reply + 4, 2); // Protocol version
+        write32(reply + 8, token);
+        write32(reply + 12, m_ssrc);
+        const int nameSize = std::min<int>(m_nameUtf8.size(), sizeof(reply) - 17);
+        std::memcpy(reply + 16, m_nameUtf8.constData(), nameSize);
+        reply[16 + nameSize] = 0;
+        ::sendto(socket, reply, 17 + nameSize, 0, static_cast<const sockaddr *>(address),
+                 static_cast<socklen_t>(addressSize));
+        publishStats();
+    } else if (isCommand(packet, "BY") && size >= 16) {
+        if (read32(packet + 12) == m_peer.ssrc) {
+            m_peer.connected = false;
+            m_buffer.reset();
+            {
+                QMutexLocker locker(&m_peerMutex);
+                m_peerName.clear();
+            }
+            publishStats();
+        }
+    } else if (isCommand(packet, "CK") && size >= 36) {
+        const int count = packet[8];
+        if (count == 0) {
+            // Their timestamp 1 in, ours as timestamp 2 back
+            quint8 reply[36];
+            std::memcpy(reply, packet, sizeof(reply));
+            write32(reply + 4, m_ssrc);
+            reply[8] = 1;
+            write64(reply + 20, static_cast<quint64>(nowTicks()));
+            ::sendto(socket, reply, sizeof(reply), 0, static_cast<const sockaddr *>(address),
+                     static_cast<socklen_t>(addressSize));
+        } else if (count == 2) {
+            // The initiator's clock at our timestamp 2 was halfway
+            // between its timestamps 1 and 3
+            const qint64 sent = static_cast<qint64>(read64(packet + 12));
+            const qint64 ours = static_cast<qint64>(read64(packet + 20));
+            const qint64 received = static_cast<qint64>(read64(packet + 28));
+            m_clockOffsetNs = ((sent + received) / 2 - ours) * NS_PER_TICK;
+            m_roundTripNs = (received - sent) * NS_PER_TICK;
+            publishStats();
+        }
+    }
+}
+
+qint64 RtpMidiSession::unwrapTimestamp(quint32 ticks) {
+    if (!m_hasTimestamp) {
+        m_hasTimestamp = true;
+        m_lastTimestampTicks = ticks;
+        return ticks;
+    }
+    const qint64 unwrapped = m_lastTimestampTicks
+        + static_cast<qint32>(ticks - static_cast<quint32>(m_lastTimestampTicks));
+    m_lastTimestampTicks = std::max(m_lastTimestampTicks, unwrapped);
+    return unwrapped;
+}
+
+void RtpMidiSession::handleData(const quint8 *packet, int size, qint64 arrivalNs) {
+    if (size < 12 || (packet[0] >> 6) != 2 || read32(packet + 8) != m_peer.ssrc) {
+        return;
+    }
+    const quint16 sequence = read16(packet + 2);
+    const qint64 packetNs = unwrapTimestamp(read32(packet + 4)) * NS_PER_TICK;
+    if (!m_buffer.packetArrived(sequence, packetNs, arrivalNs)) {
+        return;
+    }
+
+    const quint32 packetTicks = read32(packet + 4);
+    parseMidiPacket(packet, size, [this, packetNs, packetTicks, arrivalNs](const quint8 *bytes, int length,
+                                                                           quint32 ticks) {
+        const qint64 senderNs = packetNs + static_cast<qint32>(ticks - packetTicks) * NS_PER_TICK;
+        m_buffer.push(bytes, length, senderNs, arrivalNs);
+    });
+
+    if (++m_packetsSinceFeedback >= FEEDBACK_PACKETS) {
+        sendFeedback(sequence);
+        m_packetsSinceFeedback = 0;
+    }
+    publishStats();
+}
+
+void RtpMidiSession::sendFeedback(quint16 sequence) {
+    // Receiver feedback: lets the sender trim its recovery journal
+    quint8 feedback[12] = {0xFF, 0xFF, 'R', 'S'};
+    write32(feedback + 4, m_ssrc);
+    write32(feedback + 8, quint32(sequence) << 16);
+    ::sendto(m_controlSocket, feedback, sizeof(feedback), 0,
+             reinterpret_cast<const sockaddr *>(m_peer.controlAddress),
+             static_cast<socklen_t>(m_peer.controlAddressSize));
+}
+
+void RtpMidiSession::publishStats() {
+    Stats stats;
+    stats.connected = m_peer.connected;
+    stats.buffer = m_buffer.stats();
+    stats.clockOffsetNs = m_clockOffsetNs;
+    stats.roundTripNs = m_roundTripNs;
+    m_stats.store(stats);
+}
+
+int RtpMidiSession::parseMidiPacket(const quint8 *packet, int size, const PacketEvent &event) {
+    if (size < 13 || (packet[0] >> 6) != 2) {
+        return -1;
+    }
+    const int sequence = read16(packet + 2);
+    quint32 ticks = read32(packet + 4);
+
+    // MIDI command section header (after any CSRCs)
+    int position = 12 + 4 * (packet[0] & 0x0F);
+    if (position >= size) {
+        return -1;
+    }
+    const quint8 flags = packet[position++];
+    int length = flags & 0x0F;
+    if (flags & 0x80) {
+        if (position >= size) {
+            return -1;
+        }
+        length = (length << 8) | packet[position++];
+    }
+    const bool firstHasDelta = flags & 0x20;
+    const int end = std::min(size, position + length);
+
+    quint8 runningStatus = 0;
+    bool first = true;
+    while (position < end) {
+        if (!first || firstHasDelta) {
+            // Delta time: up to four 7-bit groups, most significant first
+            quint32 delta = 0;
+            for (int i = 0; i < 4 && position < end; ++i) {
+                const quint8 byte = packet[position++];
+                delta = (delta << 7) | (byte & 0x7F);
+                if (!(byte & 0x80)) {
+                    break;
+                }
+            }
+            ticks += delta;
+        }
+        first = false;
+        if (position >= end) {
+            break;
+        }
+
+        quint8 status = packet[position];
+        if (status & 0x80) {
+            ++position;
+        } else if (runningStatus) {
+            status = runningStatus;
+        } else {
+            break; // Data byte with no status to run on (phantom status)
+        }
+
+        const int data = dataLength(status);
+        if (data < 0) {
+            // SysEx (whole or a segment): skipped through its end byte
+            while (position < end && packet[position] != 0xF7 && packet[position] != 0xF0
+                   && packet[position] != 0xF4) {
+                ++position;
+            }
+            ++position;
+            runningStatus = 0;
+            continue;
+        }
+        if (position + data > end) {
+            break;
+        }
+        if (status < 0xF0) {
+            runningStatus = status;
+        } else if (status < 0xF8) {
+            runningStatus = 0; // System common cancels running status
+        }
+
+        quint8 message[3] = {status, 0, 0};
+        std::memcpy(message + 1, packet + position, data);
+        position += data;
+        event(message, 1 + data, ticks);
+    }
+    return sequence;
+}
@@ -0,0 +1,117 @@
+#ifndef RTPMIDISESSION_H
+#define RTPMIDISESSION_H
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <functional>
+#include "JitterBuffer.h"
+#include "SeqLock.h"
+
+// Network MIDI input: an RTP-MIDI (RFC 6295, AppleMIDI session protocol)
+// participant that accepts one initiator, e.g. a macOS Network Session
+// or rtpMIDI on Windows, on a UDP port pair (control port, data port =
+// control + 1). Unlike the OS's network MIDI drivers, which hand over
+// messages at their (UDP-buffered) arrival times, it keeps the sender's
+// RTP timestamps: every event goes through a JitterBuffer and comes out
+// at the sender's timing plus the adaptive playout delay, with that time
+// as its timestamp.
+// Clock sync (CK) exchanges are answered so the initiator keeps the
+// session up; the recovery journal is ignored (a lost packet's events
+// are lost) and SysEx is skipped. On macOS the session is advertised
+// over Bonjour; elsewhere, add it on the initiator by host and port.
+class RtpMidiSession : public QThread {
+    Q_OBJECT
+
+public:
+    static const quint16 DEFAULT_PORT = 5004;
+    static const qint64 NS_PER_TICK = 100000; // RTP and CK timestamps: 10 kHz
+
+    // Called on the session thread at each event's playout time
+    using DeliverCallback = std::function<void(const quint8 *bytes, int size, qint64 timestampNs)>;
+
+    struct Stats {
+        bool connected;
+        JitterBuffer::Stats buffer;
+        qint64 clockOffsetNs;   // Initiator clock minus ours, from CK (0 until synced)
+        qint64 roundTripNs;     // Last CK round trip
+    };
+
+    explicit RtpMidiSession(QObject *parent = nullptr);
+    ~RtpMidiSession();
+
+    // Set while stopped
+    void setDeliverCallback(DeliverCallback callback);
+
+    // Binds the port pair and starts listening; false if either is taken
+    bool startSession(quint16 controlPort, const QString &name);
+    void stopSession();
+
+    quint16 controlPort() const { return m_controlPort; }
+    QString name() const { return m_name; }
+    // Initiator's session name, empty while nobody is connected
+    QString peerName() const;
+    Stats stats() const;
+
+    // One RTP-MIDI data packet (RTP header, MIDI command section):
+    // every complete message it carries, running status expanded, with
+    // its sender time in RTP ticks (the packet timestamp plus the delta
+    // times), as event(bytes, size, timestampTicks). Returns the
+    // sequence number, or -1 if the packet isn't RTP-MIDI.
+    using PacketEvent = std::function<void(const quint8 *bytes, int size, quint32 timestampTicks)>;
+    static int parseMidiPacket(const quint8 *packet, int size, const PacketEvent &event);
+
+protected:
+    void run() override;
+
+private:
+    struct Peer {
+        bool connected;
+        quint32 ssrc;
+        quint32 token;
+        quint8 controlAddress[32]; // sockaddr storage, as received
+        quint8 dataAddress[32];
+        int controlAddressSize;
+        int dataAddressSize;
+    };
+
+    void receive(int socket, bool data);
+    void handleExchange(int socket, bool data, const quint8 *packet, int size,
+                        const void *address, int addressSize);
+    void handleData(const quint8 *packet, int size, qint64 arrivalNs);
+    void sendFeedback(quint16 sequence);
+    void publishStats();
+    qint64 unwrapTimestamp(quint32 ticks);
+    void advertise();
+
+    static qint64 nowTicks();
+
+    DeliverCallback m_deliver;
+    quint16 m_controlPort;
+    QString m_name;
+    QByteArray m_nameUtf8;
+    quint32 m_ssrc;
+    int m_controlSocket;
+    int m_dataSocket;
+    void *m_advertisement; // DNSServiceRef (macOS)
+
+    // Session thread only
+    Peer m_peer;
+    JitterBuffer m_buffer;
+    bool m_hasTimestamp;
+    qint64 m_lastTimestampTicks; // Unwrapped
+    int m_packetsSinceFeedback;
+    qint64 m_clockOffsetNs;
+    qint64 m_roundTripNs;
+
+    mutable QMutex m_peerMutex;
+    QString m_peerName;
+    SeqLock<Stats> m_stats;
+    std::atomic<bool> m_stopRequested;
+
+    static const int POLL_TIMEOUT_MS = 50;      // Stop latency while idle
+    static const int FEEDBACK_PACKETS = 64;     // RS every so many packets
+};
+
+#endif // RTPMIDISESSION_H
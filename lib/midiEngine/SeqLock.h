@@ -0,0 +1,118 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstring>
+#include <pthread.h>
+#include <type_traits>
+#include "MidiTime.h"
+
+// Single-writer sequence lock for small trivially copyable structs
+// The writer never waits for readers; readers retry if they raced with a
+// write, so they always observe a consistent copy. The payload is stored
+// in atomic words, which keeps the concurrent copy free of data races.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock payload must be trivially copyable");
+
+public:
+    SeqLock()
+        : m_sequence(0)
+    {
+        for (std::size_t i = 0; i < WORDS; ++i) {
+            m_words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    explicit SeqLock(const T &initial)
+        : SeqLock()
+    {
+        store(initial);
+    }
+
+    SeqLock(const SeqLock &) = delete;
+    SeqLock &operator=(const SeqLock &) = delete;
+
+    // Writer side: callers must guarantee a single writer at a time
+    void store(const T &value) {
+        quint64 words[WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+        
+        const quint32 sequence = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < WORDS; ++i) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+        m_sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // Reader side: wait-free for the writer, lock-free for readers
+    T load() const {
+        quint64 words[WORDS];
+        for (;;) {
+            const quint32 before = m_sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                MidiTime::cpuRelax();
+                continue;
+            }
+            for (std::size_t i = 0; i < WORDS; ++i) {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_sequence.load(std::memory_order_relaxed) == before) {
+                break;
+            }
+        }
+        
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    static const std::size_t WORDS = (sizeof(T) + sizeof(quint64) - 1) / sizeof(quint64);
+
+    std::atomic<quint32> m_sequence;
+    std::atomic<quint64> m_words[WORDS];
+};
+
+// Serializes the (rare) cases where transport control and the tick path
+// could both write. Held for a handful of instructions and never taken by
+// readers, so it is effectively always uncontended, and then costs one
+// atomic exchange. It blocks rather than spins, with priority
+// inheritance: a real-time thread that finds it held by a preempted GUI
+// thread lends that thread its priority until it unlocks, instead of
+// spinning away its time slice.
+class WriterLock {
+public:
+    WriterLock() {
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setprotocol(&attributes, PTHREAD_PRIO_INHERIT);
+        pthread_mutex_init(&m_mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+    }
+
+    ~WriterLock() {
+        pthread_mutex_destroy(&m_mutex);
+    }
+
+    WriterLock(const WriterLock &) = delete;
+    WriterLock &operator=(const WriterLock &) = delete;
+
+    void lock() {
+        pthread_mutex_lock(&m_mutex);
+    }
+
+    void unlock() {
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+private:
+    pthread_mutex_t m_mutex;
+};
+
+#endif // SEQLOCK_H
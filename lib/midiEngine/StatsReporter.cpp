@@ -0,0 +1,292 @@
+#include "StatsReporter.h"
+#include "LatencyHistogram.h"
+#include "MidiEngine.h"
+#include "MidiTime.h"
+#include "RealtimeScheduling.h"
+#include "SyncController.h"
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+StatsReporter::StatsReporter(MidiEngine *engine, SyncController *syncController, QObject *parent)
+    : QObject(parent)
+    , m_engine(engine)
+    , m_syncController(syncController)
+{
+    connect(&m_timer, &QTimer::timeout, this, &StatsReporter::writeSnapshot);
+}
+
+void StatsReporter::start(const QString &path, int intervalMs) {
+    m_path = path;
+    m_timer.start(qMax(intervalMs, 100));
+}
+
+void StatsReporter::stop() {
+    m_timer.stop();
+}
+
+QJsonObject StatsReporter::histogramToJson(const LatencyHistogram &histogram) {
+    const LatencySummary summary = histogram.summary();
+    QJsonObject json;
+    json["count"] = static_cast<double>(summary.count);
+    json["minNs"] = static_cast<double>(summary.minNs);
+    json["maxNs"] = static_cast<double>(summary.maxNs);
+    json["meanNs"] = summary.meanNs;
+    json["p50Ns"] = static_cast<double>(summary.p50Ns);
+    json["p90Ns"] = static_cast<double>(summary.p90Ns);
+    json["p99Ns"] = static_cast<double>(summary.p99Ns);
+    json["p999Ns"] = static_cast<double>(summary.p999Ns);
+    
+    QJsonArray buckets;
+    for (int bucket = 0; bucket < LatencyHistogram::BUCKETS; ++bucket) {
+        const quint64 count = histogram.bucketCount(bucket);
+        if (count > 0) {
+            buckets.append(QJsonArray{static_cast<double>(LatencyHistogram::bucketUpperBound(bucket)),
+                                      static_cast<double>(count)});
+        }
+    }
+    json["buckets"] = buckets;
+    return json;
+}
+
+QJsonObject StatsReporter::snapshot() const {
+    QJsonObject json;
+    json["timestampNs"] = static_cast<double>(MidiTime::nowNanoseconds());
+    
+    if (m_engine) {
+        const MidiEngine::InputCounters counters = m_engine->inputCounters();
+        QJsonObject input;
+        input["received"] = static_cast<double>(counters.received);
+        input["dropped"] = static_cast<double>(counters.dropped);
+        input["queueHighWaterMark"] = counters.queueHighWaterMark;
+        input["queueCapacity"] = counters.queueCapacity;
+        
+        QJsonObject latency;
+        latency["driverToCallback"] = histogramToJson(
+            m_engine->latencyHistogram(MidiEngine::LatencyStage::DriverToCallback));
+        latency["queueWait"] = histogramToJson(
+            m_engine->latencyHistogram(MidiEngine::LatencyStage::QueueWait));
+        latency["outputSend"] = histogramToJson(
+            m_engine->latencyHistogram(MidiEngine::LatencyStage::OutputSend));
+        
+        QJsonArray outputs;
+        for (const OutputPortStats &stats : m_engine->outputPortStats()) {
+            QJsonObject output;
+            output["name"] = stats.name;
+            output["batches"] = static_cast<double>(stats.batches);
+            output["messages"] = static_cast<double>(stats.messages);
+            output["dropped"] = static_cast<double>(stats.dropped);
+            output["sentEarly"] = static_cast<double>(stats.sentEarly);
+            output["averageLatencyUs"] = stats.averageLatencyUs;
+            output["maxLatencyUs"] = stats.maxLatencyUs;
+            output["latencyOffsetMs"] = stats.latencyOffsetMs;
+            output["timestamped"] = stats.timestamped;
+            output["clockMultiplier"] = stats.clockMultiplier;
+            output["clockDivider"] = stats.clockDivider;
+            output["zones"] = stats.zones;
+            outputs.append(output);
+        }
+        
+        const SysExBufferPool::Stats sysExStats = m_engine->sysExStats();
+        QJsonObject sysEx;
+        sysEx["completed"] = static_cast<double>(sysExStats.completed);
+        sysEx["dropped"] = static_cast<double>(sysExStats.dropped);
+        sysEx["truncated"] = static_cast<double>(sysExStats.truncated);
+        sysEx["interrupted"] = static_cast<double>(sysExStats.interrupted);
+        sysEx["bufferCount"] = sysExStats.bufferCount;
+        sysEx["bufferSize"] = sysExStats.bufferSize;
+        input["sysEx"] = sysEx;
+        
+        const ClockArbiter &arbiter = m_engine->clockArbiter();
+        const ClockArbiter::Stats arbiterStats = arbiter.stats();
+        QJsonArray sources;
+        for (int source = 0; source < ClockArbiter::MAX_SOURCES; ++source) {
+            const QString name = m_engine->clockSourceName(source);
+            if (name.isEmpty()) {
+                continue;
+            }
+            const ClockArbiter::SourceHealth health = arbiter.sourceHealth(source);
+            QJsonObject entry;
+            entry["name"] = name;
+            entry["state"] = health.state == ClockArbiter::SourceState::Live ? "live"
+                           : health.state == ClockArbiter::SourceState::TimedOut ? "timedOut" : "idle";
+            entry["active"] = health.active;
+            entry["clocks"] = static_cast<double>(health.clocks);
+            entry["mergedClocks"] = static_cast<double>(health.mergedClocks);
+            entry["lateClocks"] = static_cast<double>(health.lateClocks);
+            entry["timeouts"] = static_cast<double>(health.timeouts);
+            entry["bpm"] = health.bpm;
+            entry["jitterNs"] = health.jitterNs;
+            entry["phaseOffsetNs"] = health.phaseOffsetNs;
+            sources.append(entry);
+        }
+        QJsonObject clockSources;
+        clockSources["failover"] = m_engine->clockFailoverEnabled();
+        clockSources["active"] = arbiterStats.activeSource >= 0 ? m_engine->clockSourceName(arbiterStats.activeSource)
+                               : arbiterStats.activeSource == ClockArbiter::INTERNAL_SOURCE ? "internal" : QString();
+        clockSources["failovers"] = static_cast<double>(arbiterStats.failovers);
+        clockSources["failbacks"] = static_cast<double>(arbiterStats.failbacks);
+        clockSources["holdoverClocks"] = static_cast<double>(arbiterStats.holdoverClocks);
+        clockSources["sources"] = sources;
+        
+        QJsonObject engine;
+        engine["input"] = input;
+        engine["latency"] = latency;
+        engine["outputs"] = outputs;
+        engine["clockSources"] = clockSources;
+        if (const RtpMidiSession *session = m_engine->networkInput()) {
+            const RtpMidiSession::Stats networkStats = session->stats();
+            QJsonObject network;
+            network["port"] = session->controlPort();
+            network["connected"] = networkStats.connected;
+            network["peer"] = session->peerName();
+            network["packets"] = static_cast<double>(networkStats.buffer.packets);
+            network["events"] = static_cast<double>(networkStats.buffer.events);
+            network["lateEvents"] = static_cast<double>(networkStats.buffer.lateEvents);
+            network["reordered"] = static_cast<double>(networkStats.buffer.reordered);
+            network["lost"] = static_cast<double>(networkStats.buffer.lost);
+            network["duplicates"] = static_cast<double>(networkStats.buffer.duplicates);
+            network["overflows"] = static_cast<double>(networkStats.buffer.overflows);
+            network["bufferDepthMs"] = networkStats.buffer.depthNs / 1.0e6;
+            network["maxBufferDepthMs"] = networkStats.buffer.maxDepthNs / 1.0e6;
+            network["jitterMs"] = networkStats.buffer.jitterNs / 1.0e6;
+            network["buffered"] = networkStats.buffer.buffered;
+            network["roundTripMs"] = networkStats.roundTripNs / 1.0e6;
+            engine["network"] = network;
+        }
+        const UmpStreamDecoder::Stats umpStats = m_engine->umpInputStats();
+        if (umpStats.packets > 0) {
+            QJsonObject ump;
+            ump["packets"] = static_cast<double>(umpStats.packets);
+            ump["jrTimestamped"] = static_cast<double>(umpStats.jrTimestamped);
+            ump["untranslated"] = static_cast<double>(umpStats.untranslated);
+            ump["jrJitterMs"] = umpStats.jrJitterNs / 1.0e6;
+            engine["ump"] = ump;
+        }
+        const MidiCaptureRecorder &recorder = m_engine->capture();
+        if (recorder.isCapturing()) {
+            const MidiCaptureRecorder::Stats captureStats = recorder.stats();
+            QJsonObject capture;
+            capture["path"] = recorder.path();
+            capture["records"] = static_cast<double>(captureStats.records);
+            capture["dropped"] = static_cast<double>(captureStats.dropped);
+            engine["capture"] = capture;
+        }
+        json["engine"] = engine;
+    }
+    
+    if (RealtimeScheduling::profile().isEnabled()) {
+        const RealtimeScheduling::ProcessReport process = RealtimeScheduling::processReport();
+        QJsonObject realtime;
+        realtime["memoryLock"] = RealtimeScheduling::grantName(process.memoryLock);
+        realtime["prefaultedBytes"] = static_cast<double>(process.prefaultedBytes);
+        QJsonObject threads;
+        for (int role = 0; role < static_cast<int>(RealtimeThreadRole::Count); ++role) {
+            const RealtimeThreadRole threadRole = static_cast<RealtimeThreadRole>(role);
+            const RealtimeScheduling::ThreadReport report = RealtimeScheduling::threadReport(threadRole);
+            if (report.started) {
+                QJsonObject thread;
+                thread["policy"] = RealtimeScheduling::grantName(report.policy);
+                thread["affinity"] = RealtimeScheduling::grantName(report.affinity);
+                thread["cpu"] = report.cpu;
+                threads[RealtimeScheduling::roleName(threadRole)] = thread;
+            }
+        }
+        realtime["threads"] = threads;
+        json["realtime"] = realtime;
+    }
+    
+    if (m_syncController) {
+        const TransportState state = m_syncController->transportState();
+        QJsonObject sync;
+        sync["running"] = state.running;
+        sync["bpm"] = state.bpm;
+        sync["incomingClocks"] = state.incomingClockCount;
+        sync["clockGaps"] = static_cast<double>(m_syncController->clockGapCount());
+        sync["tempoJitterNs"] = state.tempoJitterNs;
+        sync["clockLookaheadTicks"] = m_syncController->clockLookaheadTicks();
+        sync["patternSwitches"] = static_cast<double>(m_syncController->patternSwitchCount());
+        
+        QJsonObject latency;
+        latency["clockEntry"] = histogramToJson(
+            m_syncController->latencyHistogram(SyncLatencyStage::ClockEntry));
+        latency["downbeatFire"] = histogramToJson(
+            m_syncController->latencyHistogram(SyncLatencyStage::DownbeatFire));
+        latency["clockJitter"] = histogramToJson(
+            m_syncController->latencyHistogram(SyncLatencyStage::ClockJitter));
+        sync["latency"] = latency;
+        
+        const BoundaryScheduler::Stats timing = m_syncController->boundaryTimingStats();
+        QJsonObject downbeats;
+        downbeats["fired"] = static_cast<double>(timing.fired);
+        downbeats["rescheduled"] = static_cast<double>(timing.rescheduled);
+        downbeats["cancelled"] = static_cast<double>(timing.cancelled);
+        downbeats["maxLateNs"] = static_cast<double>(timing.maxLateNs);
+        downbeats["maxEarlyNs"] = static_cast<double>(timing.maxEarlyNs);
+        QJsonObject error;
+        for (int bucket = 0; bucket < BoundaryScheduler::HISTOGRAM_BUCKETS; ++bucket) {
+            error[BoundaryScheduler::bucketLabel(bucket)] = static_cast<double>(timing.histogram[bucket]);
+        }
+        downbeats["error"] = error;
+        sync["downbeats"] = downbeats;
+        
+        const MtcChaseState chase = m_syncController->timeCodeState();
+        QJsonObject timeCode;
+        timeCode["locked"] = chase.locked;
+        timeCode["position"] = chase.locked ? MidiTimeCode::toString(m_syncController->timeCodePosition()) : QString();
+        timeCode["speed"] = chase.speed;
+        timeCode["relocations"] = static_cast<double>(m_syncController->timeCodeRelocateCount());
+        timeCode["output"] = m_syncController->timeCodeOutputEnabled();
+        sync["timeCode"] = timeCode;
+        
+        const LinkMode linkMode = m_syncController->linkMode();
+        if (linkMode != LinkMode::Off) {
+            const LinkTimeline timeline = m_syncController->linkTimeline();
+            const qint64 nowNs = MidiTime::nowNanoseconds();
+            QJsonObject link;
+            link["mode"] = linkMode == LinkMode::Follow ? "follow" : "publish";
+            link["peers"] = timeline.peers;
+            link["bpm"] = timeline.bpm;
+            link["playing"] = timeline.playing;
+            link["phase"] = timeline.bpm > 0.0 ? timeline.phaseAtTime(nowNs, LinkTimebase::QUANTUM) : 0.0;
+            sync["link"] = link;
+        }
+        json["sync"] = sync;
+    }
+    
+    if (!m_zoneControllers.isEmpty()) {
+        QJsonArray zones;
+        for (const SyncController *controller : m_zoneControllers) {
+            const TransportState state = controller->transportState();
+            QJsonObject zone;
+            zone["zone"] = controller->outputZone();
+            zone["running"] = state.running;
+            zone["bpm"] = state.bpm;
+            zone["incomingClocks"] = state.incomingClockCount;
+            zone["clockGaps"] = static_cast<double>(controller->clockGapCount());
+            zones.append(zone);
+        }
+        json["zones"] = zones;
+    }
+    
+    return json;
+}
+
+bool StatsReporter::writeSnapshot() {
+    if (m_path.isEmpty()) {
+        return false;
+    }
+    
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write stats to" << m_path << ":" << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(snapshot()).toJson(QJsonDocument::Indented));
+    if (!file.commit()) {
+        qWarning() << "Cannot write stats to" << m_path << ":" << file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef STATSREPORTER_H
+#define STATSREPORTER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+class LatencyHistogram;
+class MidiEngine;
+class SyncController;
+
+// Periodic JSON dump of the engine and sync instrumentation
+// Every interval the latency histograms, counters and output stats are
+// read (lock-free, nothing on the timing path is touched) and the file is
+// replaced atomically, so an external tool can poll it at any time.
+class StatsReporter : public QObject {
+    Q_OBJECT
+
+public:
+    // Either pointer may be null
+    StatsReporter(MidiEngine *engine, SyncController *syncController, QObject *parent = nullptr);
+
+    // The session's other tempo zones, summarized under "zones"
+    void setZoneControllers(const QVector<SyncController *> &controllers) { m_zoneControllers = controllers; }
+
+    void start(const QString &path, int intervalMs = 1000);
+    void stop();
+
+    QJsonObject snapshot() const;
+    // Writes one snapshot now; false (with a warning) if the file can't be written
+    bool writeSnapshot();
+
+    // Percentiles, extremes and the non-empty buckets as [upper bound ns, count]
+    static QJsonObject histogramToJson(const LatencyHistogram &histogram);
+
+private:
+    MidiEngine *m_engine;
+    SyncController *m_syncController;
+    QVector<SyncController *> m_zoneControllers;
+    QString m_path;
+    QTimer m_timer;
+};
+
+#endif // STATSREPORTER_H
@@ -1,111 +1,386 @@
 #include "SyncController.h"
 #include "MidiEngine.h"
+#include "SyncTrace.h"
 #include <drumstick/rtmidioutput.h>
-#include <QDateTime>
 #include <QtMath>
-#include <QMutexLocker>
+#include <cmath>
+#include <mutex>
 
-// Initialize static members for high-resolution timing
-SyncController::TimePoint SyncController::s_lastClockTime = SyncController::Clock::now();
-int SyncController::s_clockWindow = 0;
+namespace {
+
+// Transport reset shared by construction and stop()
+void resetTransport(TransportState &state) {
+    state.clockCount = 0;
+    state.running = false;
+    state.positionBeats = 0;
+    state.positionQuarterNotes = 0.0;
+    state.lastEmittedWholeNote = -1;
+    state.predictedNextBoundaryQuarterNotes = -1.0;
+    state.clocksSinceLastBoundary = 0;
+}
+
+} // namespace
 
 SyncController::SyncController(MidiEngine *engine, QObject *parent)
     : QObject(parent)
     , m_engine(engine)
-    , m_syncTimer(nullptr)
-    , m_isRunning(false)
-    , m_currentBPM(120.0)
-    , m_clockCount(0)
-    , m_incomingClockCount(0)
+    , m_outputZone(-1)
+    , m_outputZones(MidiOutputZone::All)
+    , m_clockGenerator(nullptr)
+    , m_boundaryScheduler(nullptr)
+    , m_clockSource(SystemClockSource::instance())
     , m_bpmUpdateBlocked(false)
     , m_transportSyncBlocked(false)
-    , m_currentPositionBeats(0)
-    , m_currentPositionQuarterNotes(0.0)
-    , m_lastEmittedWholeNote(-1)
+    , m_tempoEstimator(new KalmanTempoEstimator())
+    , m_clockGeneratorBPM(120.0)
+    , m_pendingBoundaryClock(-1)
+    , m_pendingBoundaryToken(0)
+    , m_traceCounter(0)
     , m_midiChannel(0)
     , m_midiNote(60)
     , m_midiVelocity(100)
-    , m_noteOn(false)
-    , m_lastClockMessageTime(Clock::now())
-    , m_predictedNextBoundaryQuarterNotes(-1.0)
-    , m_boundaryPending(false)
-    , m_clocksSinceLastBoundary(0)
-    , m_startTime(Clock::now())
+    , m_lastClockMessageTime(now())
+    , m_lastClockPeriodNs(0.0)
+    , m_clockGapCount(0)
+    , m_timeCodeSnapshot(m_timeCodeDecoder.state())
+    , m_timeCodeRelocateCount(0)
+    , m_timeCodeOutput(false)
+    , m_timeCodeOutputRate(MtcFrameRate::Fps25)
+    , m_clockLookaheadTicks(0)
+    , m_nextPattern(nullptr)
+    , m_retiredPattern(nullptr)
+    , m_pattern(nullptr)
+    , m_patternCursor(-1)
+    , m_patternSwitchCount(0)
+    , m_linkTimebase(nullptr)
+    , m_linkMode(LinkMode::Off)
+    , m_linkBeatOrigin(0.0)
+    , m_linkStartPending(false)
+    , m_linkSnapshot(LinkTimeline{})
+    , m_startTime(now())
 {
-    // Reset static clock timing
-    s_lastClockTime = Clock::now();
-    s_clockWindow = 0;
+    resetTransport(m_state);
+    m_state.noteOn = false;
+    m_state.incomingClockCount = 0;
+    m_state.bpm = 120.0;
+    m_state.tempoPhaseErrorNs = 0.0;
+    m_state.tempoJitterNs = 0.0;
+    publishState();
+    
+    // Nothing to fire without an engine (unit tests drive the logic only)
+    if (m_engine) {
+        m_boundaryScheduler = new BoundaryScheduler(this);
+        m_boundaryScheduler->setFireCallback([this](qint64 boundaryTimeNs) {
+            fireBoundaryNote(boundaryTimeNs);
+        });
+        m_boundaryScheduler->setLatenessHistogram(&histogram(SyncLatencyStage::DownbeatFire));
+        m_boundaryScheduler->startScheduler();
+    }
 }
 
 SyncController::~SyncController() {
     stop(false);
+    // Join before members go away: the fire callback uses them
+    if (m_boundaryScheduler) {
+        m_boundaryScheduler->stopScheduler();
+    }
+    delete m_pattern;
+    delete m_nextPattern.load();
+    delete m_retiredPattern.load();
+}
+
+void SyncController::midiStart(qint64 timestamp) {
+    if (followsInput()) {
+        handleDAWStart(timestamp);
+    }
+}
+
+void SyncController::midiStop(qint64 timestamp) {
+    Q_UNUSED(timestamp);
+    if (followsInput()) {
+        handleDAWStop();
+    }
+}
+
+void SyncController::midiContinue(qint64 timestamp) {
+    if (followsInput()) {
+        handleDAWContinue(timestamp);
+    }
+}
+
+void SyncController::midiClock(qint64 timestamp) {
+    if (followsInput()) {
+        handleMIDIClock(timestamp);
+    }
+}
+
+void SyncController::midiSongPositionPointer(int positionBeats, double positionQuarterNotes) {
+    // Position 0 arrives alongside Start/Stop, which already reset the
+    // position, so only real positions are applied
+    if (followsInput() && (positionBeats > 0 || positionQuarterNotes > 0.0)) {
+        handleSongPositionPointer(positionBeats, positionQuarterNotes);
+    }
+}
+
+void SyncController::midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) {
+    handleTimeCodeQuarterFrame(data, timestamp);
+}
+
+SyncController::TimePoint SyncController::now() const {
+    return MidiTime::fromNanoseconds(m_clockSource->nowNanoseconds());
+}
+
+SyncController::TimePoint SyncController::eventTime(qint64 timestamp) const {
+    return timestamp > 0 ? MidiTime::fromNanoseconds(timestamp) : now();
+}
+
+bool SyncController::usesSystemClock() const {
+    return m_clockSource == SystemClockSource::instance();
+}
+
+void SyncController::setClockSource(const ClockSource *clock) {
+    m_clockSource = clock ? clock : SystemClockSource::instance();
+    if (m_boundaryScheduler) {
+        m_boundaryScheduler->stopScheduler();
+        m_boundaryScheduler->setClockSource(m_clockSource);
+        if (usesSystemClock()) {
+            m_boundaryScheduler->startScheduler();
+        }
+    }
+}
+
+const LatencyHistogram &SyncController::latencyHistogram(SyncLatencyStage stage) const {
+    return m_latencyHistograms[static_cast<int>(stage)];
+}
+
+quint64 SyncController::clockGapCount() const {
+    return m_clockGapCount.load(std::memory_order_relaxed);
+}
+
+void SyncController::resetInstrumentation() {
+    for (LatencyHistogram &latency : m_latencyHistograms) {
+        latency.reset();
+    }
+    m_clockGapCount.store(0, std::memory_order_relaxed);
+}
+
+qint64 SyncController::pendingBoundaryDeadline() const {
+    return m_boundaryScheduler ? m_boundaryScheduler->pendingDeadline() : 0;
+}
+
+bool SyncController::fireDueBoundary() {
+    return m_boundaryScheduler && m_boundaryScheduler->fireDue();
+}
+
+void SyncController::publishState() {
+    // Caller holds m_writeLock (or is the constructor)
+    m_snapshot.store(m_state);
+}
+
+TransportState SyncController::transportState() const {
+    return m_snapshot.load();
+}
+
+void SyncController::handleTimeCodeQuarterFrame(quint8 data, qint64 timestamp) {
+    const qint64 arrivalNs = MidiTime::toNanoseconds(eventTime(timestamp));
+    std::lock_guard<WriterLock> guard(m_timeCodeLock);
+    m_timeCodeDecoder.quarterFrame(data, arrivalNs);
+    m_timeCodeSnapshot.store(m_timeCodeDecoder.state());
+    m_timeCodeRelocateCount.store(m_timeCodeDecoder.relocateCount(), std::memory_order_relaxed);
+}
+
+MtcChaseState SyncController::timeCodeState() const {
+    return m_timeCodeSnapshot.load();
+}
+
+qint64 SyncController::timeCodePositionNs(qint64 nowNs) const {
+    return MtcDecoder::positionAt(m_timeCodeSnapshot.load(),
+                                  nowNs > 0 ? nowNs : m_clockSource->nowNanoseconds());
+}
+
+MtcTime SyncController::timeCodePosition(qint64 nowNs) const {
+    const MtcChaseState state = m_timeCodeSnapshot.load();
+    const qint64 positionNs = MtcDecoder::positionAt(state, nowNs > 0 ? nowNs : m_clockSource->nowNanoseconds());
+    return MidiTimeCode::timeForFrameCount(MidiTimeCode::frameCountForNs(positionNs, state.rate), state.rate);
+}
+
+quint64 SyncController::timeCodeRelocateCount() const {
+    return m_timeCodeRelocateCount.load(std::memory_order_relaxed);
+}
+
+void SyncController::setTimeCodeOutput(bool enabled, MtcFrameRate rate) {
+    m_timeCodeOutput = enabled;
+    m_timeCodeOutputRate = rate;
+}
+
+void SyncController::setClockLookaheadTicks(int ticks) {
+    m_clockLookaheadTicks = qMax(0, ticks);
+}
+
+void SyncController::setOutputZone(int zone) {
+    m_outputZone = zone >= 0 && zone < MidiOutputZone::MAX_ZONES ? zone : -1;
+    m_outputZones.store(m_outputZone >= 0 ? MidiOutputZone::forZone(m_outputZone) : quint8(MidiOutputZone::All),
+                        std::memory_order_relaxed);
+}
+
+bool SyncController::setPattern(const MidiPattern &pattern, QString *error) {
+    std::unique_ptr<CompiledPattern> compiled = CompiledPattern::compile(pattern, error);
+    if (!compiled) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_patternOwnerLock);
+    // The tick path is done with a retired pattern; one published but not
+    // taken yet is replaced (it only ever takes it by exchange)
+    delete m_retiredPattern.exchange(nullptr, std::memory_order_acq_rel);
+    delete m_nextPattern.exchange(compiled.release(), std::memory_order_acq_rel);
+    return true;
+}
+
+void SyncController::setLinkTimebase(LinkTimebase *timebase, LinkMode mode) {
+    m_linkTimebase = timebase;
+    m_linkMode.store(timebase ? mode : LinkMode::Off, std::memory_order_release);
+}
+
+LinkTimeline SyncController::linkTimeline() const {
+    if (!m_linkTimebase) {
+        return LinkTimeline{};
+    }
+    // While following, the generator thread is the one capturing
+    if (linkMode() == LinkMode::Follow && isRunning()) {
+        return m_linkSnapshot.load();
+    }
+    return m_linkTimebase->capture();
+}
+
+qint64 SyncController::nextLinkTickNs(qint64 previousDeadlineNs) const {
+    const LinkTimeline timeline = m_linkTimebase->capture();
+    if (previousDeadlineNs <= 0) {
+        const double tick = std::ceil(timeline.beatAtTime(m_clockSource->nowNanoseconds()) * CLOCKS_PER_QUARTER_NOTE);
+        return timeline.timeAtBeat(tick / CLOCKS_PER_QUARTER_NOTE);
+    }
+    // Where the previous tick sits on the grid now (the session may have
+    // moved it), then the next grid tick; never sooner than half a period,
+    // so a phase jump back doesn't bunch clocks
+    const double tick = std::floor(timeline.beatAtTime(previousDeadlineNs) * CLOCKS_PER_QUARTER_NOTE + 0.5) + 1.0;
+    const qint64 deadlineNs = timeline.timeAtBeat(tick / CLOCKS_PER_QUARTER_NOTE);
+    return qMax(deadlineNs, previousDeadlineNs + static_cast<qint64>(std::llround(0.5 * ClockSchedule::periodNsForBPM(timeline.bpm))));
 }
 
 bool SyncController::isRunning() const {
-    QMutexLocker locker(&m_stateMutex);
-    return m_isRunning;
+    return m_snapshot.load().running;
 }
 
 double SyncController::currentBPM() const {
-    QMutexLocker locker(&m_stateMutex);
-    return m_currentBPM;
+    return m_snapshot.load().bpm;
 }
 
 int SyncController::getIncomingClockCount() const {
-    QMutexLocker locker(&m_stateMutex);
-    return m_incomingClockCount;
+    return m_snapshot.load().incomingClockCount;
 }
 
 int SyncController::getCurrentPositionBeats() const {
-    QMutexLocker locker(&m_stateMutex);
-    return m_currentPositionBeats;
+    return m_snapshot.load().positionBeats;
 }
 
 double SyncController::getCurrentPositionQuarterNotes() const {
-    QMutexLocker locker(&m_stateMutex);
-    return m_currentPositionQuarterNotes;
+    return m_snapshot.load().positionQuarterNotes;
 }
 
 void SyncController::blockBPMUpdates(bool block) {
-    QMutexLocker locker(&m_stateMutex);
-    m_bpmUpdateBlocked = block;
+    m_bpmUpdateBlocked.store(block);
+}
+
+void SyncController::setTempoEstimator(std::unique_ptr<TempoEstimator> estimator) {
+    if (!estimator) return;
+    std::lock_guard<WriterLock> guard(m_writeLock);
+    m_tempoEstimator = std::move(estimator);
 }
 
 void SyncController::blockTransportSync(bool block) {
-    QMutexLocker locker(&m_stateMutex);
-    m_transportSyncBlocked = block;
+    m_transportSyncBlocked.store(block);
 }
 
 void SyncController::setBPM(double bpm) {
     if (bpm >= 20 && bpm <= 300) {
         {
-            QMutexLocker locker(&m_stateMutex);
-            m_currentBPM = bpm;
-        }
-        if (m_syncTimer) {
-            updateSyncTimer();
+            std::lock_guard<WriterLock> guard(m_writeLock);
+            m_state.bpm = bpm;
+            m_clockGeneratorBPM = bpm;
+            publishState();
         }
+        updateClockGenerator(bpm);
         emit bpmChanged(bpm);
     }
 }
 
 void SyncController::start(bool sendStartCommand) {
+    double bpm = 120.0;
+    bool following = false;
     {
-        QMutexLocker locker(&m_stateMutex);
-        if (m_syncTimer == nullptr) {
-            m_syncTimer = new QTimer(this);
-            connect(m_syncTimer, &QTimer::timeout, this, &SyncController::onSyncTick);
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        if (m_clockGenerator == nullptr) {
+            m_clockGenerator = new MidiClockGenerator(this);
+            m_clockGenerator->setTickCallback([this](qint64 deadlineNs) {
+                onSyncTick(deadlineNs);
+            });
         }
         
-        m_isRunning = true;
-        m_startTime = Clock::now(); // Reset start time when starting playback
+        // MTC rides on the generator's deadline loop, from the first clock
+        if (m_timeCodeOutput) {
+            m_timeCodeGenerator.start({0, 0, 0, 0, m_timeCodeOutputRate});
+            m_clockGenerator->setAuxSchedule(MidiTimeCode::quarterFrameNs(m_timeCodeOutputRate),
+                                             [this](qint64 deadlineNs) {
+                onTimeCodeTick(deadlineNs);
+            });
+        } else {
+            m_clockGenerator->setAuxSchedule(0.0, nullptr);
+        }
+        
+        // Following Link: ticks on the session grid from its next bar line
+        // (a quantized start, so the downbeats line up with every peer)
+        following = linkMode() == LinkMode::Follow;
+        if (following) {
+            const LinkTimeline timeline = m_linkTimebase->capture();
+            m_linkBeatOrigin = std::ceil(timeline.beatAtTime(m_clockSource->nowNanoseconds()) / LinkTimebase::QUANTUM)
+                * LinkTimebase::QUANTUM;
+            m_linkStartPending = sendStartCommand;
+            m_linkSnapshot.store(timeline);
+            m_state.bpm = timeline.bpm;
+            m_clockGenerator->setDeadlineCallback([this](qint64 previousDeadlineNs) {
+                return nextLinkTickNs(previousDeadlineNs);
+            });
+        } else {
+            m_clockGenerator->setDeadlineCallback(nullptr);
+        }
+        m_clockGenerator->setLookaheadTicks(m_clockLookaheadTicks);
+        
+        // Nothing sounds yet, so a published pattern needn't wait for a boundary
+        MidiOutputBatch released;
+        switchPattern(released);
+        m_patternCursor = -1;
+        
+        m_state.running = true;
+        m_startTime = now(); // Reset start time when starting playback
+        bpm = m_state.bpm;
+        m_clockGeneratorBPM = bpm;
+        publishState();
     }
     
-    updateSyncTimer();
-    m_syncTimer->start();
+    updateClockGenerator(bpm);
+    
+    // START goes out before the generator's first clock
+    if (sendStartCommand && m_engine && !following) {
+        m_engine->sendSystemMessage(drumstick::rt::MIDI_REALTIME_START, outputZones());
+    }
+    if (linkMode() == LinkMode::Publish) {
+        m_linkTimebase->commitStart(0.0, m_clockSource->nowNanoseconds());
+    }
     
-    if (sendStartCommand && m_engine) {
-        m_engine->sendSystemMessage(drumstick::rt::MIDI_REALTIME_START);
+    // Without an engine there is nothing to clock out, and virtual time
+    // can't pace a thread (unit tests drive handleMIDIClock directly), so
+    // only run the generator thread with an engine on the system clock
+    if (m_engine && usesSystemClock()) {
+        m_clockGenerator->startClock();
     }
     
     emit runningChanged(true);
@@ -113,286 +388,352 @@ void SyncController::start(bool sendStartCommand) {
 
 void SyncController::stop(bool sendStopCommand) {
     bool noteWasOn = false;
+    bool boundaryNoteArmed = false;
+    const CompiledPattern *pattern = nullptr;
+    
+    // Join the generator thread first so it is no longer writing state
+    if (m_clockGenerator) {
+        m_clockGenerator->stopClock();
+    }
+    // A downbeat not yet fired must not sound after the stop (and one
+    // firing now has been handed to the outputs once this returns)
+    if (m_boundaryScheduler) {
+        boundaryNoteArmed = m_boundaryScheduler->cancel();
+    }
     
     {
-        QMutexLocker locker(&m_stateMutex);
-        if (m_syncTimer) {
-            m_syncTimer->stop();
-        }
-        
-        noteWasOn = m_noteOn;
-        m_clockCount = 0;
-        m_isRunning = false;
-        m_currentPositionBeats = 0;
-        m_currentPositionQuarterNotes = 0.0;
-        m_lastEmittedWholeNote = -1;
-        m_predictedNextBoundaryQuarterNotes = -1.0;
-        m_boundaryPending = false;
-        m_clocksSinceLastBoundary = 0;
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        noteWasOn = m_state.noteOn;
+        // Only the tick path retires it, and it has stopped ticking
+        pattern = patternPlaying() ? m_pattern : nullptr;
+        m_patternCursor = -1;
+        m_pendingBoundaryClock = -1;
+        m_linkStartPending = false;
+        resetTransport(m_state);
+        m_state.noteOn = false;
+        publishState();
+    }
+    if (linkMode() == LinkMode::Publish) {
+        m_linkTimebase->commitStop(m_clockSource->nowNanoseconds());
     }
     
     if (m_engine) {
+        MidiOutputBatch batch;
+        // Each output holds the downbeat until its own offset before the
+        // boundary (pattern rows and lookahead ticks too): drop whatever is
+        // still held, so none of it follows the Note Off below
+        m_engine->cancelScheduledOutput(outputZones());
+        // Running ahead, the note may be sounding whatever the state says
+        // (its scheduled Note Off cancelled with the rest)
+        if (m_clockLookaheadTicks > 0 || boundaryNoteArmed) {
+            noteWasOn = true;
+        }
         // Send note off if note is still on
         if (noteWasOn) {
-            m_engine->sendNoteOff(m_midiChannel, m_midiNote, 0);
-            {
-                QMutexLocker locker(&m_stateMutex);
-                m_noteOn = false;
+            batch.noteOff(m_midiChannel, m_midiNote, 0);
+        }
+        // Release whatever the pattern plays
+        if (pattern) {
+            int next = 0;
+            while (next < pattern->noteCount()) {
+                MidiOutputBatch release;
+                next = pattern->appendAllNoteOffs(release, next);
+                m_engine->sendBatch(release, outputZones());
             }
         }
         
         if (sendStopCommand) {
-            m_engine->sendSystemMessage(drumstick::rt::MIDI_REALTIME_STOP);
+            batch.systemMessage(drumstick::rt::MIDI_REALTIME_STOP);
         }
+        m_engine->sendBatch(batch, outputZones());
     }
     
     emit runningChanged(false);
     emit positionChanged(0, 0.0);
 }
 
-void SyncController::handleDAWStart() {
-    QMutexLocker locker(&m_stateMutex);
-    if (!m_transportSyncBlocked && !m_isRunning) {
-        m_transportSyncBlocked = true;
-        m_clockCount = 0;
-        m_currentPositionBeats = 0;
-        m_currentPositionQuarterNotes = 0.0;
-        m_lastEmittedWholeNote = -1; // Reset to allow first whole note to emit
-        m_predictedNextBoundaryQuarterNotes = 0.0; // First boundary is at 0
-        m_boundaryPending = false;
-        m_clocksSinceLastBoundary = 0;
-        // Reset static clock timing for fresh BPM calculation
-        s_lastClockTime = Clock::now();
-        s_clockWindow = 0;
-        m_lastClockMessageTime = Clock::now();
-        m_startTime = Clock::now(); // Reset start time
-        
-        qDebug() << "DAW START - m_lastEmittedWholeNote initialized to -1";
+void SyncController::handleDAWStart(qint64 timestamp) {
+    const TimePoint startTime = eventTime(timestamp);
+    if (m_transportSyncBlocked.load()) {
+        return;
+    }
+    
+    {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        if (m_state.running) {
+            return;
+        }
+        m_transportSyncBlocked.store(true);
+        m_state.clockCount = 0;
+        m_state.positionBeats = 0;
+        m_state.positionQuarterNotes = 0.0;
+        m_state.lastEmittedWholeNote = -1; // Reset to allow first whole note to emit
+        m_state.predictedNextBoundaryQuarterNotes = 0.0; // First boundary is at 0
+        m_state.clocksSinceLastBoundary = 0;
+        // Fresh tempo tracking from the first clock after Start
+        m_tempoEstimator->reset();
+        m_lastClockMessageTime = startTime;
+        m_lastClockPeriodNs = 0.0;
+        m_startTime = startTime; // Reset start time
         
         // When syncing to DAW, just set running state but DON'T start internal timer
         // The DAW will provide clock ticks via handleMIDIClock()
-        m_isRunning = true;
-        locker.unlock();
-        
-        // Don't send START command back, and don't start internal timer (we're in slave mode)
-        emit runningChanged(true);
-        
-        locker.relock();
-        m_transportSyncBlocked = false;
+        m_state.running = true;
+        MidiOutputBatch released;
+        switchPattern(released);
+        m_patternCursor = -1;
+        publishState();
+    }
+    
+    SYNC_TRACE(TraceEvent::DawStart);
+    if (linkMode() == LinkMode::Publish) {
+        m_linkTimebase->commitStart(0.0, MidiTime::toNanoseconds(startTime));
     }
+    
+    // Don't send START command back, and don't start internal timer (we're in slave mode)
+    emit runningChanged(true);
+    
+    m_transportSyncBlocked.store(false);
 }
 
 void SyncController::handleDAWStop() {
-    QMutexLocker locker(&m_stateMutex);
-    if (!m_transportSyncBlocked && m_isRunning) {
-        m_transportSyncBlocked = true;
-        locker.unlock();
+    if (!m_transportSyncBlocked.load() && isRunning()) {
+        m_transportSyncBlocked.store(true);
         stop(false); // Don't send STOP command back
-        locker.relock();
-        m_transportSyncBlocked = false;
+        m_transportSyncBlocked.store(false);
     }
 }
 
-void SyncController::handleDAWContinue() {
-    QMutexLocker locker(&m_stateMutex);
-    if (!m_transportSyncBlocked && !m_isRunning) {
-        m_transportSyncBlocked = true;
+void SyncController::handleDAWContinue(qint64 timestamp) {
+    const TimePoint continueTime = eventTime(timestamp);
+    if (m_transportSyncBlocked.load()) {
+        return;
+    }
+    
+    {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        if (m_state.running) {
+            return;
+        }
+        m_transportSyncBlocked.store(true);
         // Reset last emitted whole note based on current position
         // This ensures we don't re-emit for the current whole note
-        int currentWholeNote = static_cast<int>(m_currentPositionQuarterNotes / 4.0);
-        m_lastEmittedWholeNote = currentWholeNote - 1; // Set to previous so next emits correctly
-        m_predictedNextBoundaryQuarterNotes = currentWholeNote * 4.0;
-        m_boundaryPending = false;
+        int currentWholeNote = static_cast<int>(m_state.positionQuarterNotes / 4.0);
+        m_state.lastEmittedWholeNote = currentWholeNote - 1; // Set to previous so next emits correctly
+        m_state.predictedNextBoundaryQuarterNotes = currentWholeNote * 4.0;
         
         // Calculate clocks since the last boundary based on current position
-        double positionInCurrentBoundary = m_currentPositionQuarterNotes - (currentWholeNote * 4.0);
-        m_clocksSinceLastBoundary = static_cast<int>(positionInCurrentBoundary * CLOCKS_PER_QUARTER_NOTE);
+        double positionInCurrentBoundary = m_state.positionQuarterNotes - (currentWholeNote * 4.0);
+        m_state.clocksSinceLastBoundary = static_cast<int>(positionInCurrentBoundary * CLOCKS_PER_QUARTER_NOTE);
         
-        // Reset static clock timing for fresh BPM calculation
-        s_lastClockTime = Clock::now();
-        s_clockWindow = 0;
-        m_lastClockMessageTime = Clock::now();
-        m_startTime = Clock::now(); // Reset start time
+        // Fresh tempo tracking from the first clock after Continue
+        m_tempoEstimator->reset();
+        m_lastClockMessageTime = continueTime;
+        m_lastClockPeriodNs = 0.0;
+        m_startTime = continueTime; // Reset start time
         
         // When syncing to DAW, just set running state but DON'T start internal timer
         // The DAW will provide clock ticks via handleMIDIClock()
-        m_isRunning = true;
-        locker.unlock();
-        
-        // Don't send CONTINUE command back, and don't start internal timer (we're in slave mode)
-        emit runningChanged(true);
-        
-        locker.relock();
-        m_transportSyncBlocked = false;
+        m_state.running = true;
+        publishState();
+    }
+    
+    if (linkMode() == LinkMode::Publish) {
+        m_linkTimebase->commitStart(getCurrentPositionQuarterNotes(), MidiTime::toNanoseconds(continueTime));
     }
+    
+    // Don't send CONTINUE command back, and don't start internal timer (we're in slave mode)
+    emit runningChanged(true);
+    
+    m_transportSyncBlocked.store(false);
 }
 
 void SyncController::handleSongPositionPointer(int positionBeats, double positionQuarterNotes) {
-    bool shouldEmitNote = false;
-    bool isRunning = false;
-    double previousPosition = 0.0;
+    if (positionBeats < 0) {
+        emit positionChanged(positionBeats, positionQuarterNotes);
+        return;
+    }
+    
+    BoundaryAction action = {};
     
     {
-        QMutexLocker locker(&m_stateMutex);
-        if (positionBeats >= 0) {
-            previousPosition = m_currentPositionQuarterNotes;
-            m_currentPositionBeats = positionBeats;
-            m_currentPositionQuarterNotes = positionQuarterNotes;
-            
-            // Update clock count based on position (position is in 16th notes, convert to clock ticks)
-            // Each beat = 24 clock ticks, positionBeats is in 16th notes (6 per quarter note)
-            // So: clockCount = (positionBeats / 6) * 24 = positionBeats * 4
-            m_clockCount = positionBeats * 4;
-            
-            // CRITICAL FIX: Only update m_lastEmittedWholeNote if we're NOT running
-            // or if we're seeking BACKWARDS. During normal playback, let the clock-based
-            // boundary detection handle emission - don't let SPP messages interfere!
-            bool isSeekingBackwards = (positionQuarterNotes < previousPosition - 0.5);
-            
-            // Also check if we're at the very start (position near 0) - this handles both
-            // initial start and loop backs
-            bool isAtStart = (positionQuarterNotes < 0.5);
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        double previousPosition = m_state.positionQuarterNotes;
+        m_state.positionBeats = positionBeats;
+        m_state.positionQuarterNotes = positionQuarterNotes;
+        
+        // Update clock count based on position (position is in 16th notes, convert to clock ticks)
+        // Each beat = 24 clock ticks, positionBeats is in 16th notes (6 per quarter note)
+        // So: clockCount = (positionBeats / 6) * 24 = positionBeats * 4
+        m_state.clockCount = positionBeats * 4;
+        
+        // CRITICAL FIX: Only update lastEmittedWholeNote if we're NOT running
+        // or if we're seeking BACKWARDS. During normal playback, let the clock-based
+        // boundary detection handle emission - don't let SPP messages interfere!
+        bool isSeekingBackwards = (positionQuarterNotes < previousPosition - 0.5);
+        
+        if (!m_state.running || isSeekingBackwards) {
+            // Recalculate last emitted whole note to prevent duplicate emissions
+            // This only runs when:
+            // 1. Not running (stopped) - safe to update positioning
+            // 2. Seeking backwards (rewind/loop) - prevent duplicate emissions
+            // NOTE: We DON'T update during normal playback - let clock-based detection handle it
+            int currentWholeNote = static_cast<int>(positionQuarterNotes / 4.0);
+            double fractionIntoBoundary = positionQuarterNotes - (currentWholeNote * 4.0);
             
-            if (!m_isRunning || isSeekingBackwards) {
-                // Recalculate last emitted whole note to prevent duplicate emissions
-                // This only runs when:
-                // 1. Not running (stopped) - safe to update positioning
-                // 2. Seeking backwards (rewind/loop) - prevent duplicate emissions
-                // NOTE: We DON'T update during normal playback - let clock-based detection handle it
-                int currentWholeNote = static_cast<int>(positionQuarterNotes / 4.0);
-                double fractionIntoBoundary = positionQuarterNotes - (currentWholeNote * 4.0);
-                
-                // If we're in the first half of a boundary, consider it not yet emitted
-                if (fractionIntoBoundary < 2.0) {
-                    m_lastEmittedWholeNote = currentWholeNote - 1;
-                } else {
-                    // We're more than halfway through the boundary, so mark it as already emitted
-                    m_lastEmittedWholeNote = currentWholeNote;
-                }
-                
-                qDebug() << "SPP UPDATE - m_lastEmittedWholeNote set to:" << m_lastEmittedWholeNote 
-                         << "| Position QN:" << QString::number(positionQuarterNotes, 'f', 2)
-                         << "| ClockCount:" << m_clockCount
-                         << "| Running:" << m_isRunning
-                         << "| SeekingBack:" << isSeekingBackwards;
-                
-                m_predictedNextBoundaryQuarterNotes = (m_lastEmittedWholeNote + 1) * 4.0;
+            // If we're in the first half of a boundary, consider it not yet emitted
+            if (fractionIntoBoundary < 2.0) {
+                m_state.lastEmittedWholeNote = currentWholeNote - 1;
+            } else {
+                // We're more than halfway through the boundary, so mark it as already emitted
+                m_state.lastEmittedWholeNote = currentWholeNote;
             }
             
-            // Recalculate clocks since boundary based on DAW's position
-            // This corrects any accumulated drift
-            int currentWholeNote = static_cast<int>(positionQuarterNotes / 4.0);
-            double fractionIntoBoundary = positionQuarterNotes - (currentWholeNote * 4.0);
-            m_clocksSinceLastBoundary = static_cast<int>(fractionIntoBoundary * CLOCKS_PER_QUARTER_NOTE);
+            m_state.predictedNextBoundaryQuarterNotes = (m_state.lastEmittedWholeNote + 1) * 4.0;
             
-            isRunning = m_isRunning;
+            SYNC_TRACE(TraceEvent::SppUpdate, m_state.lastEmittedWholeNote, m_state.clockCount,
+                       m_state.running, isSeekingBackwards, positionQuarterNotes);
         }
+        
+        // Recalculate clocks since boundary based on DAW's position
+        // This corrects any accumulated drift
+        int currentWholeNote = static_cast<int>(positionQuarterNotes / 4.0);
+        double fractionIntoBoundary = positionQuarterNotes - (currentWholeNote * 4.0);
+        m_state.clocksSinceLastBoundary = static_cast<int>(fractionIntoBoundary * CLOCKS_PER_QUARTER_NOTE);
+        
+        // Check for whole note boundary in the same write section
+        if (m_state.running && positionQuarterNotes >= 0) {
+            action = evaluateWholeNote(positionQuarterNotes, now());
+        }
+        publishState();
     }
     
-    // Check for whole note boundary and emit immediately if crossed
-    // This happens OUTSIDE the mutex for minimal latency
-    if (isRunning && positionQuarterNotes >= 0) {
-        checkAndEmitWholeNote(positionQuarterNotes);
-    }
+    // Emit immediately if a boundary was crossed (outside the writer lock)
+    MidiOutputBatch batch;
+    performBoundaryAction(action, batch);
     
     emit positionChanged(positionBeats, positionQuarterNotes);
 }
 
-void SyncController::handleMIDIClock() {
-    static int clockHandlerCount = 0;
-    ++clockHandlerCount;
-    
-    TimePoint currentTime = Clock::now();
-    bool isRunning = false;
-    double positionQuarterNotes = 0.0;
+void SyncController::handleMIDIClock(qint64 timestamp) {
+    // Use the driver arrival time, not the time this handler got to run:
+    // both BPM estimation and emission timing are measured from arrival
+    TimePoint currentTime = eventTime(timestamp);
+    if (timestamp > 0) {
+        histogram(SyncLatencyStage::ClockEntry).record(m_clockSource->nowNanoseconds() - timestamp);
+    }
+    BoundaryAction action = {};
+    double newBPM = 0.0;
+    qint64 refinedBoundaryNs = 0;
     
-    // CRITICAL PATH: Update position from clock with minimal mutex hold
+    // CRITICAL PATH: one write section per tick; readers never block it
     {
-        QMutexLocker locker(&m_stateMutex);
-        m_incomingClockCount++;
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        m_state.incomingClockCount++;
+        if (m_lastClockPeriodNs > 0.0 &&
+            MidiTime::toNanoseconds(currentTime) - MidiTime::toNanoseconds(m_lastClockMessageTime) >
+                CLOCK_GAP_FACTOR * m_lastClockPeriodNs) {
+            m_clockGapCount.fetch_add(1, std::memory_order_relaxed);
+        }
         m_lastClockMessageTime = currentTime;
-        isRunning = m_isRunning;
+        
+        // Track tempo and phase from every clock; once locked, the filtered
+        // tick time replaces the jittery arrival for boundary prediction
+        const TempoEstimate tempo = m_tempoEstimator->update(MidiTime::toNanoseconds(currentTime));
+        TimePoint tickTime = currentTime;
+        if (tempo.valid) {
+            tickTime = MidiTime::fromNanoseconds(tempo.tickTimeNs);
+            m_state.tempoPhaseErrorNs = tempo.phaseErrorNs;
+            m_state.tempoJitterNs = tempo.jitterNs;
+            histogram(SyncLatencyStage::ClockJitter).record(llround(qAbs(tempo.phaseErrorNs)));
+            m_lastClockPeriodNs = tempo.periodNs;
+            if (tempo.bpm >= 20.0 && tempo.bpm <= 300.0 && !m_bpmUpdateBlocked.load()) {
+                m_state.bpm = tempo.bpm;
+                if (qAbs(tempo.bpm - m_clockGeneratorBPM) > CLOCK_GENERATOR_BPM_STEP) {
+                    m_clockGeneratorBPM = tempo.bpm;
+                    newBPM = tempo.bpm;
+                }
+            }
+        }
         
         // Update clock count and position based on incoming clock (when running)
         // Position is calculated from clock count: each clock tick = 1/24 quarter note
-        if (isRunning) {
-            m_clockCount++;
-            m_clocksSinceLastBoundary++; // Track clocks for drift detection
+        if (m_state.running) {
+            m_state.clockCount++;
+            m_state.clocksSinceLastBoundary++; // Track clocks for drift detection
+            
+            // Re-project the armed downbeat from the latest tempo and phase
+            if (m_pendingBoundaryClock > m_state.clockCount && tempo.valid) {
+                refinedBoundaryNs = tempo.tickTimeNs +
+                    llround((m_pendingBoundaryClock - m_state.clockCount) * tempo.periodNs);
+            }
             
             // Update position from clock count (24 ticks per quarter note)
-            positionQuarterNotes = static_cast<double>(m_clockCount) / CLOCKS_PER_QUARTER_NOTE;
-            m_currentPositionQuarterNotes = positionQuarterNotes;
+            double positionQuarterNotes = static_cast<double>(m_state.clockCount) / CLOCKS_PER_QUARTER_NOTE;
+            m_state.positionQuarterNotes = positionQuarterNotes;
             // Convert quarter notes to beats (4 beats per quarter note)
-            m_currentPositionBeats = static_cast<int>(positionQuarterNotes * 4);
+            m_state.positionBeats = static_cast<int>(positionQuarterNotes * 4);
+            
+            // Check for whole note boundary using ACTUAL position (no look-ahead)
+            // Look-ahead is applied inside evaluateWholeNote for emission timing only
+            // This prevents cumulative drift from early boundary detection
+            if (m_engine) {
+                action = evaluateWholeNote(positionQuarterNotes, tickTime);
+                evaluatePattern(MidiTime::toNanoseconds(tickTime), tempo.valid ? tempo.periodNs : 0.0, action);
+            }
         }
-    } // Release mutex ASAP - critical timing work is done
+        
+        publishState();
+    }
     
-    // Check for whole note boundary using ACTUAL position (no look-ahead)
-    // Look-ahead will be applied INSIDE checkAndEmitWholeNote for emission timing only
-    // This prevents cumulative drift from early boundary detection
-    if (isRunning && m_engine) {
-        checkAndEmitWholeNote(positionQuarterNotes);
+    if (refinedBoundaryNs > 0 && m_boundaryScheduler) {
+        m_boundaryScheduler->reschedule(m_pendingBoundaryToken.load(std::memory_order_relaxed),
+                                        refinedBoundaryNs - llround(emissionAdvanceMs() * 1000000.0),
+                                        refinedBoundaryNs);
     }
     
-    // NON-CRITICAL PATH: BPM calculation (deferred - happens after note emission)
-    // Only track timing, actual calculation happens after critical path
-    bool needsBPMCalc = false;
-    TimePoint lastClockTimeForBPM;
+    // Send notes outside the write section
+    MidiOutputBatch batch;
+    performBoundaryAction(action, batch);
     
-    {
-        // Minimal mutex hold for BPM window tracking
-        QMutexLocker locker(&m_stateMutex);
-        if (s_clockWindow == 0) {
-            s_lastClockTime = currentTime;
-            s_clockWindow = CLOCKS_PER_QUARTER_NOTE;
-        }
-        s_clockWindow--;
-        if (s_clockWindow == 0) {
-            needsBPMCalc = true;
-            lastClockTimeForBPM = s_lastClockTime;
-        }
+    if (newBPM > 0.0) {
+        updateClockGenerator(newBPM);
     }
-    
-    // Do BPM calculation AFTER note emission (non-blocking)
-    if (needsBPMCalc) {
-        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
-            currentTime - lastClockTimeForBPM);
-        double elapsedSeconds = elapsed.count() / 1000000.0;
-        
-        if (elapsedSeconds > 0.2 && elapsedSeconds < 3.0) {
-            double calculatedBPM = 60.0 / elapsedSeconds;
-            {
-                QMutexLocker locker(&m_stateMutex);
-                if (calculatedBPM >= 20 && calculatedBPM <= 300 && 
-                    qAbs(calculatedBPM - m_currentBPM) > 0.5 && !m_bpmUpdateBlocked) {
-                    m_currentBPM = calculatedBPM;
-                    if (m_syncTimer) {
-                        updateSyncTimer();
-                    }
-                }
-                s_lastClockTime = currentTime;
-                s_clockWindow = CLOCKS_PER_QUARTER_NOTE;
-            }
-        } else {
-            QMutexLocker locker(&m_stateMutex);
-            s_lastClockTime = currentTime;
-            s_clockWindow = CLOCKS_PER_QUARTER_NOTE;
-        }
+}
+
+void SyncController::checkAndEmitWholeNote(double positionQuarterNotes, TimePoint clockTime) {
+    BoundaryAction action;
+    {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        action = evaluateWholeNote(positionQuarterNotes, clockTime);
+        publishState();
     }
-    
-    emit clockTick();
+    MidiOutputBatch batch;
+    performBoundaryAction(action, batch);
+}
+
+double SyncController::emissionAdvanceMs() const {
+    return m_engine ? m_engine->maxOutputLatencyOffsetMs(outputZones()) : MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS;
 }
 
-void SyncController::checkAndEmitWholeNote(double positionQuarterNotes) {
+SyncController::BoundaryAction SyncController::evaluateWholeNote(double positionQuarterNotes, TimePoint clockTime) {
     // CRITICAL: Simplified, drift-free boundary detection with predictive emission
     // Strategy: Emit when we're within a BPM-adjusted advance time of a boundary (BEFORE crossing it)
+    // Caller holds m_writeLock; no I/O happens here (tracing only records)
+    BoundaryAction action = {};
+    
+    // The armed downbeat's boundary has been reached but it has not fired
+    // (scheduler late, or ticks faster than real time): send it now
+    if (m_pendingBoundaryClock >= 0 && m_state.clockCount >= m_pendingBoundaryClock) {
+        action.flushBoundaryToken = m_pendingBoundaryToken.load(std::memory_order_relaxed);
+        m_pendingBoundaryClock = -1;
+    }
     
     // Which whole note period are we currently in?
     int currentBoundary = static_cast<int>(qFloor(positionQuarterNotes / 4.0));
     
     // Calculate position relative to current boundary
     double positionInBoundary = positionQuarterNotes - (currentBoundary * 4.0);
-    double ticksIntoBoundary = positionInBoundary * CLOCKS_PER_QUARTER_NOTE;
     
     // Calculate how many ticks until the NEXT boundary
     double ticksToNextBoundary = (4.0 - positionInBoundary) * CLOCKS_PER_QUARTER_NOTE;
@@ -400,146 +741,247 @@ void SyncController::checkAndEmitWholeNote(double positionQuarterNotes) {
     // The next boundary we'll cross
     int nextBoundary = currentBoundary + 1;
     
-    bool shouldEmit = false;
-    bool noteWasOn = false;
-    int quarterNoteCount = 0;
-    int positionBeats = 0;
-    double currentPositionQuarterNotes = 0.0;
-    int lastEmitted = 0;
-    double bpm = 120.0;
+    // EMIT STRATEGY: Emit BEFORE crossing into next boundary
+    // Calculate BPM-adjusted advance time to maintain consistent millisecond offset
+    // At 120 BPM: 1 tick = 20.83ms, so 50ms = ~2.4 ticks
+    // At 60 BPM: 1 tick = 41.67ms, so 50ms = ~1.2 ticks
+    // At 240 BPM: 1 tick = 10.42ms, so 50ms = ~4.8 ticks
+    double bpm = m_state.bpm;
     
-    {
-        QMutexLocker locker(&m_stateMutex);
-        
-        // EMIT STRATEGY: Emit BEFORE crossing into next boundary
-        // Calculate BPM-adjusted advance time to maintain consistent millisecond offset
-        // At 120 BPM: 1 tick = 20.83ms, so 50ms = ~2.4 ticks
-        // At 60 BPM: 1 tick = 41.67ms, so 50ms = ~1.2 ticks
-        // At 240 BPM: 1 tick = 10.42ms, so 50ms = ~4.8 ticks
-        
-        bpm = m_currentBPM;
+    // Safety check: ensure BPM is valid
+    if (bpm < 20.0 || bpm > 300.0) {
+        bpm = 120.0;
+    }
+    
+    double msPerTick = (60000.0 / bpm) / CLOCKS_PER_QUARTER_NOTE; // milliseconds per tick
+    
+    // Time already spent between the clock's arrival and now (queueing,
+    // thread wakeup) eats into the advance, so widen the window by it
+    double processingLagMs = std::chrono::duration<double, std::milli>(now() - clockTime).count();
+    if (processingLagMs < 0.0) {
+        processingLagMs = 0.0;
+    }
+    double emissionAdvanceTicks = (emissionAdvanceMs() + processingLagMs) / msPerTick // convert ms to ticks
+        + LOOKAHEAD_MARGIN_TICKS;
+    
+    // Ensure minimum advance window to handle timing jitter
+    if (emissionAdvanceTicks < 1.5) {
+        emissionAdvanceTicks = 1.5;
+    }
+    
+    int lastEmitted = m_state.lastEmittedWholeNote;
+    bool noteWasOn = m_state.noteOn;
+    
+    // Special case: Emit boundary 0 (absolute first beat) immediately at tick 1
+    // This gives the first downbeat of the song
+    bool isFirstDownbeat = (currentBoundary == 0 && lastEmitted < 0 && positionQuarterNotes < 1.0);
+    
+    // Check: Should we emit for the NEXT boundary?
+    // Emit when we're within BPM-adjusted advance time of next boundary
+    // OR if this is the first downbeat (boundary 0)
+    if (isFirstDownbeat || 
+        (nextBoundary > lastEmitted && ticksToNextBoundary <= emissionAdvanceTicks)) {
+        // A pattern plays in the note's place: the boundary is still
+        // tracked (position, signals), the note isn't started
+        action.boundaryReached = true;
+        action.sendNoteOn = !patternPlaying();
         
-        // Safety check: ensure BPM is valid
-        if (bpm < 20.0 || bpm > 300.0) {
-            bpm = 120.0;
-        }
+        // Mark the boundary we're emitting for
+        int boundaryToEmit = isFirstDownbeat ? currentBoundary : nextBoundary;
+        m_state.lastEmittedWholeNote = boundaryToEmit;
+        action.quarterNoteCount = boundaryToEmit * 4;
+        action.positionBeats = m_state.positionBeats;
+        action.positionQuarterNotes = m_state.positionQuarterNotes;
         
-        double msPerTick = (60000.0 / bpm) / CLOCKS_PER_QUARTER_NOTE; // milliseconds per tick
-        double emissionAdvanceTicks = EMISSION_ADVANCE_MS / msPerTick; // convert ms to ticks
+        // Project the boundary onto the clock's own timeline; the first
+        // downbeat is already here
+        action.boundaryTimeNs = isFirstDownbeat ? 0
+            : MidiTime::toNanoseconds(clockTime) + llround(ticksToNextBoundary * msPerTick * 1000000.0);
         
-        // Ensure minimum advance window to handle timing jitter
-        if (emissionAdvanceTicks < 1.5) {
-            emissionAdvanceTicks = 1.5;
+        // Only one downbeat is held at a time
+        if (m_pendingBoundaryClock >= 0) {
+            action.flushBoundaryToken = m_pendingBoundaryToken.load(std::memory_order_relaxed);
         }
+        m_pendingBoundaryClock = isFirstDownbeat || !action.sendNoteOn ? -1 : boundaryToEmit * CLOCKS_PER_WHOLE_NOTE;
         
-        lastEmitted = m_lastEmittedWholeNote;
-        
-        // Special case: Emit boundary 0 (absolute first beat) immediately at tick 1
-        // This gives the first downbeat of the song
-        bool isFirstDownbeat = (currentBoundary == 0 && m_lastEmittedWholeNote < 0 && positionQuarterNotes < 1.0);
-        
-        // Check: Should we emit for the NEXT boundary?
-        // Emit when we're within BPM-adjusted advance time of next boundary
-        // OR if this is the first downbeat (boundary 0)
-        if (isFirstDownbeat || 
-            (nextBoundary > m_lastEmittedWholeNote && ticksToNextBoundary <= emissionAdvanceTicks)) {
-            shouldEmit = true;
-            
-            // Mark the boundary we're emitting for
-            int boundaryToEmit = isFirstDownbeat ? currentBoundary : nextBoundary;
-            m_lastEmittedWholeNote = boundaryToEmit;
-            noteWasOn = m_noteOn;
-            quarterNoteCount = boundaryToEmit * 4;
-            positionBeats = m_currentPositionBeats;
-            currentPositionQuarterNotes = m_currentPositionQuarterNotes;
-            
-            // Store the predicted next boundary (whole note = 4 quarter notes)
-            m_predictedNextBoundaryQuarterNotes = (boundaryToEmit + 1) * 4.0;
-            
-            // DRIFT CORRECTION: Reset clock counter
-            m_clocksSinceLastBoundary = 0;
-        }
+        // Store the predicted next boundary (whole note = 4 quarter notes)
+        m_state.predictedNextBoundaryQuarterNotes = (boundaryToEmit + 1) * 4.0;
         
+        // DRIFT CORRECTION: Reset clock counter
+        m_state.clocksSinceLastBoundary = 0;
     }
     
     // Check if we need to send NOTE OFF when crossing into a boundary
     // Send NOTE OFF when we CROSS the boundary (not early) so notes sustain full whole note duration
-    // This happens OUTSIDE the mutex after all emission checks
-    bool noteShouldBeOff = false;
-    int currentTickForNoteOff = 0;
-    {
-        QMutexLocker locker(&m_stateMutex);
-        // Check if we've crossed into a new boundary and a note is still on
-        // We check if we're just past a whole note boundary (position >= boundary * 4.0)
-        // and within the first 10% of that boundary to catch it exactly at the boundary
-        double positionInCurrentBoundary = positionQuarterNotes - (currentBoundary * 4.0);
-        if (m_noteOn && positionInCurrentBoundary > 0.0 && positionInCurrentBoundary < 0.4) {
-            // We've just crossed into a boundary - turn off the previous note
-            noteShouldBeOff = true;
-            currentTickForNoteOff = m_clockCount;
-            m_noteOn = false;
-        }
+    // We check if we're just past a whole note boundary (position >= boundary * 4.0)
+    // and within the first 10% of that boundary to catch it exactly at the boundary
+    if (noteWasOn && positionInBoundary > 0.0 && positionInBoundary < 0.4) {
+        // We've just crossed into a boundary - turn off the previous note
+        action.sendNoteOff = true;
     }
     
-    if (noteShouldBeOff && m_engine) {
-        m_engine->sendNoteOff(m_midiChannel, m_midiNote, 0);
-        qDebug() << "NOTE OFF - Tick:" << currentTickForNoteOff 
-                 << "| QN:" << QString::number(positionQuarterNotes, 'f', 2) 
-                 << "| Boundary:" << currentBoundary;
+    // Note state after this tick's traffic goes out (off first, then on)
+    if (action.sendNoteOff) {
+        m_state.noteOn = false;
+    }
+    if (action.sendNoteOn) {
+        m_state.noteOn = true;
     }
     
-    // Debug logging every 24 clocks (once per quarter note) around boundaries
-    static int debugCounter = 0;
-    debugCounter++;
-    if (debugCounter % 24 == 0 || ticksToNextBoundary <= 10.0) {
-        int currentTick = 0;
-        double msPerTick = (60000.0 / bpm) / CLOCKS_PER_QUARTER_NOTE;
-        double emissionAdvanceTicks = EMISSION_ADVANCE_MS / msPerTick;
-        {
-            QMutexLocker locker(&m_stateMutex);
-            currentTick = m_clockCount;
+#if MIDIMASTER2_TRACE
+    // Trace every 24 clocks (once per quarter note) and around boundaries
+    // Recording is a few stores into the trace ring; formatting is off-thread
+    if (SyncTrace::isEnabled()) {
+        if (action.sendNoteOff) {
+            SyncTrace::record(TraceEvent::NoteOff, m_state.clockCount, currentBoundary);
+        }
+        if (++m_traceCounter % 24 == 0 || ticksToNextBoundary <= 10.0) {
+            SyncTrace::record(TraceEvent::BoundaryCheck, m_state.clockCount, currentBoundary, lastEmitted,
+                              action.sendNoteOn, ticksToNextBoundary, emissionAdvanceTicks, bpm);
         }
-        qDebug() << "BOUNDARY CHECK - Tick:" << currentTick 
-                 << "| QN:" << QString::number(positionQuarterNotes, 'f', 2)
-                 << "| CurrentBoundary:" << currentBoundary 
-                 << "| NextBoundary:" << nextBoundary
-                 << "| LastEmitted:" << lastEmitted
-                 << "| TicksToNext:" << QString::number(ticksToNextBoundary, 'f', 3)
-                 << "| AdvTicks:" << QString::number(emissionAdvanceTicks, 'f', 1)
-                 << "| BPM:" << QString::number(bpm, 'f', 0)
-                 << "| ShouldEmit:" << (shouldEmit ? "YES" : "NO");
-    }
-    
-    // Emit note immediately
-    // This happens OUTSIDE the mutex for minimal latency
-    if (shouldEmit && m_engine) {
-        // Send note ON for whole note boundary - will arrive at output just as boundary occurs
+        if (action.sendNoteOn) {
+            SyncTrace::record(TraceEvent::NoteEmitted, m_state.clockCount, 0, 0, 0,
+                              std::chrono::duration<double>(now() - m_startTime).count(), bpm);
+        }
+    }
+#endif
+    
+    return action;
+}
+
+void SyncController::performBoundaryAction(const BoundaryAction &action, MidiOutputBatch &batch, qint64 sendAtNs) {
+    if (!m_engine) {
+        return;
+    }
+    
+    if (action.flushBoundaryToken != 0) {
+        m_boundaryScheduler->fireNow(action.flushBoundaryToken);
+    }
+    
+    // Everything else this tick produces (clock already queued by the
+    // caller, Note Off) goes out as one flush
+    if (action.sendNoteOff) {
+        batch.noteOff(m_midiChannel, m_midiNote, 0);
+    }
+    
+    if (sendAtNs > 0) {
+        m_engine->sendBatchAt(batch, sendAtNs, outputZones());
+    } else {
+        m_engine->sendBatch(batch, outputZones());
+    }
+    
+    // Each output holds a pattern row until its own offset before the
+    // row's tick, like the downbeat
+    for (int i = 0; i < action.patternRowCount; ++i) {
+        MidiOutputBatch row = action.patternRows[i].batch;
+        m_engine->scheduleBatch(row, action.patternRows[i].presentationTimeNs, outputZones());
+    }
+    
+    if (action.sendNoteOn) {
+        // Send note ON for whole note boundary - the scheduler fires it at
+        // "boundary minus the largest output advance" (between clocks), and
+        // each output then holds it until its own offset, so it arrives just as the boundary occurs
         // The note will sustain until the next boundary
         // Note: We don't send note-off here - it will be sent at the exact next boundary
         // to ensure full whole note duration
-        m_engine->sendNoteOn(m_midiChannel, m_midiNote, m_midiVelocity);
-        
-        // Calculate time elapsed and log note emission
-        int currentTick = 0;
-        double bpm = 0.0;
-        double elapsedSeconds = 0.0;
-        {
-            QMutexLocker locker(&m_stateMutex);
-            m_noteOn = true;
-            currentTick = m_clockCount;
-            bpm = m_currentBPM;
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-                Clock::now() - m_startTime);
-            elapsedSeconds = elapsed.count() / 1000.0;
+        // Running ahead, the boundary is still a lookahead away: scheduled
+        // straight to the outputs, with no scheduler wakeup
+        if (sendAtNs > 0 && action.boundaryTimeNs > 0) {
+            m_pendingBoundaryToken.store(0, std::memory_order_relaxed);
+            fireBoundaryNote(action.boundaryTimeNs);
+        } else if (action.boundaryTimeNs > 0) {
+            m_pendingBoundaryToken.store(m_boundaryScheduler->arm(
+                action.boundaryTimeNs - llround(emissionAdvanceMs() * 1000000.0), action.boundaryTimeNs),
+                std::memory_order_relaxed);
+        } else {
+            fireBoundaryNote(0);
+        }
+    }
+    
+    if (action.boundaryReached) {
+        emit beatSent(action.quarterNoteCount);
+        emit positionChanged(action.positionBeats, action.positionQuarterNotes);
+    }
+}
+
+void SyncController::evaluatePattern(qint64 tickTimeNs, double tickPeriodNs, BoundaryAction &action) {
+    // Caller holds m_writeLock. Runs with the downbeat note too (no rows),
+    // so a published pattern is taken at a whole note boundary.
+    const qint64 clockCount = m_state.clockCount;
+    const double bpm = m_state.bpm >= 20.0 && m_state.bpm <= 300.0 ? m_state.bpm : 120.0;
+    const double periodNs = tickPeriodNs > 0.0 ? tickPeriodNs : ClockSchedule::periodNsForBPM(bpm);
+    // Rows are decided one emission advance ahead of their tick, as the
+    // downbeat is
+    const qint64 horizon = clockCount +
+        static_cast<qint64>(std::floor(emissionAdvanceMs() * 1000000.0 / periodNs + LOOKAHEAD_MARGIN_TICKS));
+    // A relocation (song position, a Link phase jump) restarts from here
+    if (m_patternCursor < clockCount - 2 || m_patternCursor > horizon) {
+        m_patternCursor = clockCount - 1;
+    }
+    
+    int rows = 0;
+    while (m_patternCursor < horizon && rows < MAX_PATTERN_ROWS_PER_TICK - 1) {
+        const qint64 tick = m_patternCursor + 1;
+        const qint64 presentationTimeNs = tickTimeNs + std::llround((tick - clockCount) * periodNs);
+        const int boundaryTicks = m_pattern && m_pattern->eventCount() > 0 ? m_pattern->lengthTicks()
+                                                                            : CLOCKS_PER_WHOLE_NOTE;
+        if (tick % boundaryTicks == 0 && m_nextPattern.load(std::memory_order_relaxed)) {
+            PatternRow &release = action.patternRows[rows];
+            if (switchPattern(release.batch) && !release.batch.isEmpty()) {
+                release.presentationTimeNs = presentationTimeNs;
+                ++rows;
+            }
+        }
+        m_patternCursor = tick;
+        if (patternPlaying() && m_pattern->rowSize(tick) > 0) {
+            PatternRow &row = action.patternRows[rows++];
+            m_pattern->appendTick(tick, row.batch);
+            row.presentationTimeNs = presentationTimeNs;
         }
-        
-        // Log note emission with current tick, time elapsed, and BPM
-        qDebug() << "NOTE EMITTED - Tick:" << currentTick 
-                 << "| Elapsed:" << QString::number(elapsedSeconds, 'f', 3) << "s"
-                 << "| BPM:" << QString::number(bpm, 'f', 2);
-        
-        emit beatSent(quarterNoteCount);
-        emit positionChanged(positionBeats, currentPositionQuarterNotes);
+    }
+    action.patternRowCount = rows;
+}
+
+bool SyncController::switchPattern(MidiOutputBatch &releaseBatch) {
+    // Until setPattern() has freed the last one retired, the next waits
+    if (m_retiredPattern.load(std::memory_order_acquire) != nullptr) {
+        return false;
+    }
+    CompiledPattern *next = m_nextPattern.exchange(nullptr, std::memory_order_acq_rel);
+    if (!next) {
+        return false;
+    }
+    if (patternPlaying()) {
+        m_pattern->appendTailNoteOffs(releaseBatch);
+    }
+    CompiledPattern *previous = m_pattern;
+    m_pattern = next;
+    if (previous) {
+        m_retiredPattern.store(previous, std::memory_order_release);
+    }
+    m_patternSwitchCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void SyncController::fireBoundaryNote(qint64 boundaryTimeNs) {
+    // Scheduler thread (or the clock thread when flushing a late fire)
+    MidiOutputBatch noteBatch;
+    noteBatch.noteOn(m_midiChannel, m_midiNote, m_midiVelocity);
+    m_engine->scheduleBatch(noteBatch, boundaryTimeNs, outputZones());
+    emit downbeatFired(boundaryTimeNs);
+}
+
+BoundaryScheduler::Stats SyncController::boundaryTimingStats() const {
+    if (m_boundaryScheduler) {
+        return m_boundaryScheduler->stats();
+    }
+    BoundaryScheduler::Stats stats = {};
+    return stats;
+}
+
+void SyncController::resetBoundaryTimingStats() {
+    if (m_boundaryScheduler) {
+        m_boundaryScheduler->resetStats();
     }
 }
 
@@ -547,17 +989,17 @@ void SyncController::updateBPMFromDAW(double bpm) {
     if (bpm >= 20 && bpm <= 300) {
         bool shouldUpdate = false;
         {
-            QMutexLocker locker(&m_stateMutex);
-            if (!m_bpmUpdateBlocked && qAbs(bpm - m_currentBPM) > 0.1) {
-                m_currentBPM = bpm;
+            std::lock_guard<WriterLock> guard(m_writeLock);
+            if (!m_bpmUpdateBlocked.load() && qAbs(bpm - m_state.bpm) > 0.1) {
+                m_state.bpm = bpm;
+                m_clockGeneratorBPM = bpm;
                 shouldUpdate = true;
+                publishState();
             }
         }
         
         if (shouldUpdate) {
-            if (m_syncTimer) {
-                updateSyncTimer();
-            }
+            updateClockGenerator(bpm);
             emit bpmChanged(bpm);
         }
     }
@@ -567,41 +1009,118 @@ void SyncController::syncBPMToDAW(int bpm) {
     emit bpmChanged(bpm);
 }
 
-void SyncController::updateSyncTimer() {
-    if (!m_syncTimer) return;
+void SyncController::updateClockGenerator(double bpm) {
+    // Publishing: every tempo the generator takes, tracked or set
+    if (linkMode() == LinkMode::Publish) {
+        m_linkTimebase->commitTempo(bpm, m_clockSource->nowNanoseconds());
+    }
+    if (!m_clockGenerator) return;
     
-    // MIDI Clock: 24 ticks per quarter note
-    // Interval in ms = (60 / BPM / 24) * 1000
-    double intervalMs = (60.0 / m_currentBPM / 24.0) * 1000.0;
-    m_syncTimer->setInterval(static_cast<int>(intervalMs));
+    // The generator keeps the exact fractional tick period (60 / BPM / 24)
+    // and schedules against absolute deadlines; setBPM is thread-safe
+    m_clockGenerator->setBPM(bpm);
 }
 
-void SyncController::onSyncTick() {
-    bool isRunning = false;
-    double positionQuarterNotes = 0.0;
+void SyncController::onSyncTick(qint64 deadlineNs) {
+    if (linkMode() == LinkMode::Follow) {
+        handleLinkTick(deadlineNs);
+        return;
+    }
+    BoundaryAction action = {};
     
     {
-        QMutexLocker locker(&m_stateMutex);
-        isRunning = m_isRunning;
-        if (isRunning) {
-            m_clockCount++;
-            // Update position from clock count (24 ticks per quarter note)
-            positionQuarterNotes = static_cast<double>(m_clockCount) / CLOCKS_PER_QUARTER_NOTE;
-            m_currentPositionQuarterNotes = positionQuarterNotes;
-            // Convert quarter notes to beats (4 beats per quarter note)
-            m_currentPositionBeats = static_cast<int>(positionQuarterNotes * 4);
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        if (!m_state.running) {
+            return;
         }
+        m_state.clockCount++;
+        // Update position from clock count (24 ticks per quarter note)
+        double positionQuarterNotes = static_cast<double>(m_state.clockCount) / CLOCKS_PER_QUARTER_NOTE;
+        m_state.positionQuarterNotes = positionQuarterNotes;
+        // Convert quarter notes to beats (4 beats per quarter note)
+        m_state.positionBeats = static_cast<int>(positionQuarterNotes * 4);
+        
+        // Check for whole note boundary in the same write section
+        // Uses same position-based approach as handleMIDIClock for consistency
+        action = evaluateWholeNote(positionQuarterNotes, MidiTime::fromNanoseconds(deadlineNs));
+        evaluatePattern(deadlineNs, 0.0, action);
+        publishState();
     }
     
-    if (!isRunning || !m_engine) return;
+    if (!m_engine) return;
     
     // Send MIDI clock when running from internal timer (master mode)
     // When syncing to DAW, clock comes from incoming messages
-    m_engine->sendSystemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+    MidiOutputBatch batch;
+    batch.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
     
-    // Check for whole note boundary and emit immediately if crossed
-    // Uses same position-based approach as handleMIDIClock for consistency
-    checkAndEmitWholeNote(positionQuarterNotes);
+    performBoundaryAction(action, batch, m_clockLookaheadTicks > 0 ? deadlineNs : 0);
 }
 
+void SyncController::handleLinkTick(qint64 deadlineNs) {
+    // Position straight from the session timeline: no tick counting, so
+    // a peer's tempo or phase change moves the downbeat at once
+    const LinkTimeline timeline = m_linkTimebase->capture();
+    BoundaryAction action = {};
+    bool sendStart = false;
+    qint64 refinedBoundaryNs = 0;
+    
+    {
+        std::lock_guard<WriterLock> guard(m_writeLock);
+        m_linkSnapshot.store(timeline);
+        const double positionQuarterNotes = timeline.beatAtTime(deadlineNs) - m_linkBeatOrigin;
+        const int clockCount = static_cast<int>(std::llround(positionQuarterNotes * CLOCKS_PER_QUARTER_NOTE));
+        // Silent until the bar line the start waits for
+        if (!m_state.running || clockCount < 0) {
+            return;
+        }
+        sendStart = m_linkStartPending;
+        m_linkStartPending = false;
+        m_state.clockCount = clockCount;
+        m_state.positionQuarterNotes = positionQuarterNotes;
+        m_state.positionBeats = static_cast<int>(positionQuarterNotes * 4);
+        if (timeline.bpm >= 20.0 && timeline.bpm <= 300.0) {
+            m_state.bpm = timeline.bpm;
+        }
+        
+        // The armed downbeat follows the session's latest tempo and phase
+        if (m_pendingBoundaryClock > m_state.clockCount) {
+            refinedBoundaryNs = timeline.timeAtBeat(m_linkBeatOrigin +
+                static_cast<double>(m_pendingBoundaryClock) / CLOCKS_PER_QUARTER_NOTE);
+        }
+        
+        action = evaluateWholeNote(positionQuarterNotes, MidiTime::fromNanoseconds(deadlineNs));
+        if (action.sendNoteOn && action.boundaryTimeNs > 0) {
+            // The session's bar line itself, not a projection from ticks
+            action.boundaryTimeNs = timeline.timeAtBeat(m_linkBeatOrigin + action.quarterNoteCount);
+        }
+        evaluatePattern(deadlineNs, 0.0, action);
+        publishState();
+    }
+    
+    if (!m_engine) return;
+    
+    if (refinedBoundaryNs > 0) {
+        m_boundaryScheduler->reschedule(m_pendingBoundaryToken.load(std::memory_order_relaxed),
+                                        refinedBoundaryNs - llround(emissionAdvanceMs() * 1000000.0),
+                                        refinedBoundaryNs);
+    }
+    
+    // The origin tick carries START (position 0); clocks from the next one
+    MidiOutputBatch batch;
+    batch.systemMessage(sendStart ? drumstick::rt::MIDI_REALTIME_START : drumstick::rt::MIDI_REALTIME_CLOCK);
+    performBoundaryAction(action, batch, m_clockLookaheadTicks > 0 ? deadlineNs : 0);
+}
 
+void SyncController::onTimeCodeTick(qint64 deadlineNs) {
+    if (!m_engine) return;
+    
+    // One byte out of the precomputed cycle
+    MidiOutputBatch batch;
+    batch.timeCodeQuarterFrame(m_timeCodeGenerator.nextQuarterFrame());
+    if (m_clockLookaheadTicks > 0) {
+        m_engine->sendBatchAt(batch, deadlineNs, outputZones());
+    } else {
+        m_engine->sendBatch(batch, outputZones());
+    }
+}
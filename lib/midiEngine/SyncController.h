@@ -2,19 +2,72 @@
 #define SYNCCONTROLLER_H
 
 #include <QObject>
-#include <QTimer>
-#include <QMutex>
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include "MidiTime.h"
+#include "BoundaryScheduler.h"
+#include "ClockSource.h"
+#include "LinkTimebase.h"
+#include "MidiClockGenerator.h"
+#include "MidiOutputBatch.h"
+#include "MidiPattern.h"
+#include "MidiTimeCode.h"
+#include "MidiTransportSink.h"
+#include "SeqLock.h"
+#include "TempoEstimator.h"
 
 class MidiEngine;
 
-class SyncController : public QObject {
+// Transport state published by the tick path
+// Written by one thread at a time (the thread delivering clocks), read by
+// anyone through SyncController::transportState() without locking.
+struct TransportState {
+    bool running;
+    bool noteOn;
+    int clockCount;
+    int incomingClockCount;
+    int positionBeats;
+    double positionQuarterNotes;
+    double bpm;
+    double tempoPhaseErrorNs; // Incoming clock vs the tempo tracker's prediction
+    double tempoJitterNs;     // RMS arrival jitter of the incoming clock
+    int lastEmittedWholeNote; // Last whole note position that triggered a note
+    int clocksSinceLastBoundary;
+    double predictedNextBoundaryQuarterNotes;
+};
+
+// Stages of the clock path probed by SyncController
+enum class SyncLatencyStage {
+    ClockEntry,   // Driver arrival to handleMIDIClock running
+    DownbeatFire, // How late the boundary scheduler fired (early = 0)
+    ClockJitter   // |incoming clock - tempo tracker prediction|
+};
+
+// Install as the engine's transport sink (MidiEngine::setTransportSink, or
+// addTransportSink for a further tempo zone following the same input)
+// to receive clock and transport on the input thread without signal hops.
+// The UI should poll transportState() at display rate rather than connect
+// to the per-event signals.
+class SyncController : public QObject, public MidiTransportSink {
     Q_OBJECT
 
 public:
     explicit SyncController(MidiEngine *engine, QObject *parent = nullptr);
     ~SyncController();
 
+    // Consistent snapshot of the whole transport state (lock-free)
+    TransportState transportState() const;
+    
+    // MidiTransportSink
+    void midiStart(qint64 timestamp) override;
+    void midiStop(qint64 timestamp) override;
+    void midiContinue(qint64 timestamp) override;
+    void midiClock(qint64 timestamp) override;
+    void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) override;
+    void midiTimeCodeQuarterFrame(quint8 data, qint64 timestamp) override;
+
     bool isRunning() const;
     double currentBPM() const;
     
@@ -24,81 +77,271 @@ public:
     
     void setBPM(double bpm);
     void blockBPMUpdates(bool block);
+    
+    // Tempo tracking for incoming clock (KalmanTempoEstimator by default);
+    // the estimator is fed every clock on the thread delivering them
+    void setTempoEstimator(std::unique_ptr<TempoEstimator> estimator);
+    
+    // How precisely downbeats left at their computed time (signed error
+    // histogram); all zero without an engine
+    BoundaryScheduler::Stats boundaryTimingStats() const;
+    void resetBoundaryTimingStats();
+    
+    // Live instrumentation (lock-free, any thread). A clock gap is an
+    // incoming interval longer than 1.5 tracked periods (a lost clock or
+    // a stalled sender).
+    const LatencyHistogram &latencyHistogram(SyncLatencyStage stage) const;
+    quint64 clockGapCount() const;
+    void resetInstrumentation();
+    
+    // Source of "now" for untimestamped events, processing lag and downbeat
+    // deadlines (system clock by default; nullptr restores it). Set while
+    // stopped. With any other source nothing runs on real time: the clock
+    // generator and boundary scheduler threads stay idle, and the caller
+    // advances the clock, delivers clocks with timestamps and calls
+    // fireDueBoundary() when pendingBoundaryDeadline() has been reached.
+    void setClockSource(const ClockSource *clock);
+    qint64 pendingBoundaryDeadline() const;
+    bool fireDueBoundary();
     void blockTransportSync(bool block);
+    
+    // MIDI Time Code chase (incoming quarter frames, lock-free to read).
+    // The position is interpolated between quarter frames at the measured
+    // speed; nowNs 0 = the clock source's now.
+    MtcChaseState timeCodeState() const;
+    qint64 timeCodePositionNs(qint64 nowNs = 0) const;
+    MtcTime timeCodePosition(qint64 nowNs = 0) const;
+    quint64 timeCodeRelocateCount() const;
+    
+    // Master mode: send MTC quarter frames from the clock generator's
+    // thread alongside the clock, starting at 00:00:00:00 on start(). Set
+    // while stopped.
+    void setTimeCodeOutput(bool enabled, MtcFrameRate rate = MtcFrameRate::Fps25);
+    bool timeCodeOutputEnabled() const { return m_timeCodeOutput; }
+    MtcFrameRate timeCodeOutputRate() const { return m_timeCodeOutputRate; }
+    
+    // Master mode clock lookahead: the generator runs this many ticks
+    // ahead of real time, and each clock (with its Note Off, MTC quarter
+    // frame and downbeat Note On) goes out scheduled for its own time, so
+    // outputs with timestamped delivery (MidiEngine::setTimestampedOutput)
+    // send it from the OS scheduler. Position, state and signals run that
+    // far ahead, and a tempo change is heard one lookahead later. 0 (the
+    // default) sends each tick at its deadline. Set while stopped.
+    void setClockLookaheadTicks(int ticks);
+    int clockLookaheadTicks() const { return m_clockLookaheadTicks; }
+    
+    // Pattern played against the clock in place of the downbeat note
+    // (MidiPattern; an empty one restores the note). Compiled here, then
+    // handed to the tick path without locking: it switches at the next
+    // boundary of what is playing (a whole note for the downbeat note),
+    // or at the next start. Each tick plays one precompiled row per tick
+    // of emission advance, scheduled to land on its own tick. false with
+    // a message if the pattern doesn't compile.
+    bool setPattern(const MidiPattern &pattern, QString *error = nullptr);
+    // Switches that have taken effect
+    quint64 patternSwitchCount() const { return m_patternSwitchCount.load(std::memory_order_relaxed); }
+    
+    // Tempo zone: the outputs this controller drives, when several share
+    // one engine (MidiEngine::setOutputPortZones). 0 to
+    // MidiOutputZone::MAX_ZONES - 1, or -1 (the default) for every
+    // output; the emission advance follows the zone's own outputs. A
+    // zone following the input is added with MidiEngine::addTransportSink.
+    // Set while stopped.
+    void setOutputZone(int zone);
+    int outputZone() const { return m_outputZone; }
+    
+    // Ableton Link, or any shared session (not owned; nullptr = Off). Set
+    // while stopped.
+    // Following: start() waits for the session's next bar line, then the
+    // clock generator ticks on the session's beat grid, and position and
+    // downbeats are read from the timeline rather than counted, so a
+    // peer's tempo or phase change is followed within a tick. Incoming
+    // MIDI clock and transport are ignored.
+    // Publishing: tempo changes, start and stop (master or following MIDI
+    // clock) are committed to the session.
+    void setLinkTimebase(LinkTimebase *timebase, LinkMode mode);
+    LinkMode linkMode() const { return m_linkMode.load(std::memory_order_acquire); }
+    // The session as seen by the last Link tick while following, else
+    // captured now (zero without a timebase)
+    LinkTimeline linkTimeline() const;
+    // Following: the deadline of the tick after previousDeadlineNs on the
+    // session grid (24 per beat; 0 = the first one from now)
+    qint64 nextLinkTickNs(qint64 previousDeadlineNs) const;
 
 public slots:
     void start(bool sendStartCommand = true);
     void stop(bool sendStopCommand = true);
-    void handleDAWStart();
+    // Timestamps are arrival times in MidiTime nanoseconds (0 = now)
+    void handleDAWStart(qint64 timestamp = 0);
     void handleDAWStop();
-    void handleDAWContinue();
-    void handleMIDIClock();
+    void handleDAWContinue(qint64 timestamp = 0);
+    void handleMIDIClock(qint64 timestamp = 0);
     void handleSongPositionPointer(int positionBeats, double positionQuarterNotes);
+    // Quarter frame data byte; timestamp as above
+    void handleTimeCodeQuarterFrame(quint8 data, qint64 timestamp = 0);
+    // Following Link: the tick due at deadlineNs (the clock generator's
+    // thread; on virtual time, call it at each nextLinkTickNs())
+    void handleLinkTick(qint64 deadlineNs);
 
 signals:
     void runningChanged(bool running);
     void bpmChanged(double bpm);
-    void clockTick();
     void beatSent(int quarterNote);
     void positionChanged(int beats, double quarterNotes);
+    // A downbeat Note On was handed to the outputs (on the thread that
+    // fired it); boundaryTimeNs is the time it is scheduled to land (0 =
+    // sent at once, the first downbeat)
+    void downbeatFired(qint64 boundaryTimeNs);
 
 private:
-    void updateSyncTimer();
-    void checkAndEmitWholeNote(double positionQuarterNotes);
+    // A pattern row scheduled for its tick's time
+    struct PatternRow {
+        MidiOutputBatch batch;
+        qint64 presentationTimeNs;
+    };
+    // Enough to catch up from a start at 300 BPM with the default offset
+    static constexpr int MAX_PATTERN_ROWS_PER_TICK = 12;
+    
+    // Note traffic decided while holding the writer lock, sent after releasing it
+    struct BoundaryAction {
+        bool sendNoteOff;
+        bool sendNoteOn;
+        bool boundaryReached; // Emitted for a boundary (with a pattern playing, no note)
+        int quarterNoteCount;
+        int positionBeats;
+        double positionQuarterNotes;
+        qint64 boundaryTimeNs; // When the emitted boundary lands (0 = now)
+        quint32 flushBoundaryToken; // Previous downbeat still held: send it first (0 = none)
+        int patternRowCount;
+        PatternRow patternRows[MAX_PATTERN_ROWS_PER_TICK];
+    };
+
+    void updateClockGenerator(double bpm);
+    void checkAndEmitWholeNote(double positionQuarterNotes, MidiTime::TimePoint clockTime);
+    BoundaryAction evaluateWholeNote(double positionQuarterNotes, MidiTime::TimePoint clockTime);
+    // sendAtNs > 0: the tick is ahead of real time (lookahead) and its
+    // traffic is scheduled rather than sent
+    void performBoundaryAction(const BoundaryAction &action, MidiOutputBatch &batch, qint64 sendAtNs = 0);
+    void fireBoundaryNote(qint64 boundaryTimeNs);
+    // Writer side: the pattern rows from the cursor up to the emission
+    // advance past this tick (tickPeriodNs 0 = from the tempo)
+    void evaluatePattern(qint64 tickTimeNs, double tickPeriodNs, BoundaryAction &action);
+    // Writer side: takes the published pattern if there is one (and the
+    // last one retired has been reclaimed); Note Offs the old one still
+    // owes go into releaseBatch
+    bool switchPattern(MidiOutputBatch &releaseBatch);
+    bool patternPlaying() const { return m_pattern && m_pattern->eventCount() > 0; }
+    void publishState();
+    quint8 outputZones() const { return m_outputZones.load(std::memory_order_relaxed); }
+
+    // Master mode: called on the clock generator thread for every tick
+    void onSyncTick(qint64 deadlineNs);
+    // Master mode: called on the clock generator thread for every MTC quarter frame
+    void onTimeCodeTick(qint64 deadlineNs);
 
 private slots:
-    void onSyncTick();
     void syncBPMToDAW(int bpm);
     void updateBPMFromDAW(double bpm);
 
 private:
     MidiEngine *m_engine;
-    QTimer *m_syncTimer;
-    
-    // Thread-safe state
-    mutable QMutex m_stateMutex;
-    bool m_isRunning;
-    double m_currentBPM;
-    int m_clockCount;
-    int m_incomingClockCount;
-    bool m_bpmUpdateBlocked;
-    bool m_transportSyncBlocked;
-    
-    // Position tracking
-    int m_currentPositionBeats;
-    double m_currentPositionQuarterNotes;
-    int m_lastEmittedWholeNote; // Track last whole note position that triggered a note
+    int m_outputZone;
+    std::atomic<quint8> m_outputZones; // Port zone mask every send carries
+    MidiClockGenerator *m_clockGenerator; // Master clock (replaces the integer-ms QTimer)
+    BoundaryScheduler *m_boundaryScheduler; // Fires downbeat Note Ons between clocks
+    const ClockSource *m_clockSource;
+    
+    // Transport state: m_state is the writer's working copy (guarded by
+    // m_writeLock), m_snapshot is what readers see. Readers never block
+    // the tick path.
+    TransportState m_state;
+    SeqLock<TransportState> m_snapshot;
+    WriterLock m_writeLock;
+    std::atomic<bool> m_bpmUpdateBlocked;
+    std::atomic<bool> m_transportSyncBlocked;
+    
+    // Writer side only (guarded by m_writeLock)
+    std::unique_ptr<TempoEstimator> m_tempoEstimator;
+    double m_clockGeneratorBPM; // Last tempo handed to the clock generator
+    int m_pendingBoundaryClock;  // Clock count of the armed downbeat (-1 = none)
+    // Written after the write section when the downbeat is armed, so
+    // shared with stop()/start() and the reschedule outside the lock
+    std::atomic<quint32> m_pendingBoundaryToken;
+    int m_traceCounter;
     
     // MIDI note parameters
     int m_midiChannel;
     int m_midiNote;
     int m_midiVelocity;
-    bool m_noteOn;
     
     // High-resolution BPM calculation from incoming clock
-    using Clock = std::chrono::high_resolution_clock;
-    using TimePoint = std::chrono::high_resolution_clock::time_point;
-    static TimePoint s_lastClockTime;
-    static int s_clockWindow;
+    // Monotonic clock shared with MidiEngine's arrival timestamps
+    using Clock = MidiTime::Clock;
+    using TimePoint = MidiTime::TimePoint;
+    TimePoint now() const;
+    TimePoint eventTime(qint64 timestamp) const;
+    bool usesSystemClock() const;
     static const int CLOCKS_PER_QUARTER_NOTE = 24;
     static const int CLOCKS_PER_WHOLE_NOTE = 96; // 4 quarter notes = 1 bar
     
-    // Predictive emission: emit this many milliseconds before boundary to compensate for latency
-    // This maintains consistent timing compensation regardless of BPM
-    static constexpr double EMISSION_ADVANCE_MS = 70.0; // 70ms advance time
+    // Predictive emission: the Note On is decided this many ticks before
+    // the largest output latency offset, then each output holds it until
+    // its own offset before the boundary (MidiEngine::scheduleBatch)
+    static constexpr double LOOKAHEAD_MARGIN_TICKS = 1.0;
+    // Tracked tempo changes smaller than this don't retune the clock generator
+    static constexpr double CLOCK_GENERATOR_BPM_STEP = 0.5;
+    double emissionAdvanceMs() const;
     
-    // Timing tracking for position sync
+    // Timing tracking for position sync (writer side only)
     TimePoint m_lastClockMessageTime;
-    double m_predictedNextBoundaryQuarterNotes;
-    bool m_boundaryPending;
+    double m_lastClockPeriodNs; // Tracked period at the previous clock (0 = none yet)
+    static constexpr double CLOCK_GAP_FACTOR = 1.5;
     
-    // Drift correction: track how many clocks we've seen in each whole note
-    // This resets at each boundary to prevent cumulative timing errors
-    int m_clocksSinceLastBoundary;
+    // Instrumentation (indexed by SyncLatencyStage)
+    static const int SYNC_LATENCY_STAGE_COUNT = 3;
+    LatencyHistogram m_latencyHistograms[SYNC_LATENCY_STAGE_COUNT];
+    std::atomic<quint64> m_clockGapCount;
+    LatencyHistogram &histogram(SyncLatencyStage stage) {
+        return m_latencyHistograms[static_cast<int>(stage)];
+    }
+    
+    // MTC chase: the decoder is written by whichever thread delivers
+    // quarter frames (guarded by m_timeCodeLock), readers use the snapshot
+    MtcDecoder m_timeCodeDecoder;
+    SeqLock<MtcChaseState> m_timeCodeSnapshot;
+    WriterLock m_timeCodeLock;
+    std::atomic<quint64> m_timeCodeRelocateCount;
+    
+    // MTC generation (clock generator thread only while running)
+    MtcGenerator m_timeCodeGenerator;
+    bool m_timeCodeOutput;
+    MtcFrameRate m_timeCodeOutputRate;
+    int m_clockLookaheadTicks;
+    
+    // Patterns: setPattern() publishes through m_nextPattern and frees
+    // what the tick path left in m_retiredPattern (serialized by
+    // m_patternOwnerLock); the tick path swaps m_pattern at a boundary
+    // and never frees, so it neither locks nor allocates
+    std::atomic<CompiledPattern *> m_nextPattern;
+    std::atomic<CompiledPattern *> m_retiredPattern;
+    std::mutex m_patternOwnerLock;
+    CompiledPattern *m_pattern;  // Playing (writer side; nullptr = the downbeat note)
+    qint64 m_patternCursor;      // Last pattern tick emitted (writer side)
+    std::atomic<quint64> m_patternSwitchCount;
+    
+    // Link (m_linkTimebase and the mode are set while stopped; the rest
+    // is writer side)
+    LinkTimebase *m_linkTimebase;
+    std::atomic<LinkMode> m_linkMode;
+    double m_linkBeatOrigin;    // Session beat of position 0: a bar line
+    bool m_linkStartPending;    // START goes out at the origin
+    SeqLock<LinkTimeline> m_linkSnapshot;
+    bool followsInput() const { return linkMode() != LinkMode::Follow; }
     
     // Start time tracking for elapsed time calculation
     TimePoint m_startTime;
+    
+    friend class MidiEngineBench;
 };
 
 #endif // SYNCCONTROLLER_H
-
@@ -1,7 +1,318 @@
 #include "SyncControllerTest.h"
+#include "ClockArbiter.h"
+#include "MidiCapture.h"
+#include "MidiEventQueue.h"
+#include "MidiClockGenerator.h"
+#include "MidiEngine.h"
+#include "MidiOutputBackend.h"
+#include "MidiSession.h"
+#include "MidiStreamParser.h"
+#include "MidiTimeCode.h"
+#include "RealtimeScheduling.h"
+#include "RtpMidiSession.h"
+#include "SeqLock.h"
+#include "StatsReporter.h"
+#include "SyncTrace.h"
+#include "TempoEstimator.h"
+#include <drumstick/rtmidioutput.h>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
 #include <QSignalSpy>
 #include <QDebug>
 #include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <thread>
+
+// Counting allocator: every operator new in the test binary goes through
+// here, and is counted while the calling thread has counting armed
+namespace {
+thread_local bool t_countAllocations = false;
+thread_local int t_allocationCount = 0;
+
+void *countedAllocate(std::size_t size) {
+    if (t_countAllocations) {
+        ++t_allocationCount;
+    }
+    void *pointer = std::malloc(size ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+// Records outgoing messages into fixed storage (never allocates)
+class RecordingOutputBackend : public MidiOutputBackend {
+public:
+    static const int MAX_MESSAGES = 4096;
+
+    RecordingOutputBackend() : count(0), noteOnCount(0) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        if (size == 3 && (data[0] & 0xF0) == 0x90) {
+            ++noteOnCount;
+        }
+        if (count < MAX_MESSAGES) {
+            statuses[count++] = data[0];
+        }
+    }
+
+    unsigned char statuses[MAX_MESSAGES];
+    int count;
+    int noteOnCount;
+};
+
+// Copies each SysEx view into fixed storage (never allocates)
+class RecordingSysExSink : public MidiSysExSink {
+public:
+    static const int MAX_BYTES = 4096;
+
+    RecordingSysExSink() : count(0), size(0) {}
+
+    void midiSysEx(const SysExMessage &message) override {
+        ++count;
+        size = qMin(message.size, int(MAX_BYTES));
+        std::memcpy(bytes, message.data, size);
+    }
+
+    quint8 bytes[MAX_BYTES];
+    int count;
+    int size;
+};
+
+// Thread-safe counting backend for fan-out ports (called on port workers)
+class CountingOutputBackend : public MidiOutputBackend {
+public:
+    CountingOutputBackend(std::atomic<int> *clocks, std::atomic<int> *notes, int sendDelayUs)
+        : m_clocks(clocks), m_notes(notes), m_sendDelayUs(sendDelayUs) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        Q_UNUSED(size);
+        if (m_sendDelayUs > 0) {
+            QThread::usleep(m_sendDelayUs);
+        }
+        if (data[0] == 0xF8) {
+            m_clocks->fetch_add(1);
+        } else if ((data[0] & 0xF0) == 0x90) {
+            m_notes->fetch_add(1);
+        }
+    }
+
+private:
+    std::atomic<int> *m_clocks;
+    std::atomic<int> *m_notes;
+    int m_sendDelayUs;
+};
+
+// Records when the first Note On went out
+class TimestampingOutputBackend : public MidiOutputBackend {
+public:
+    explicit TimestampingOutputBackend(std::atomic<qint64> *noteOnAt)
+        : m_noteOnAt(noteOnAt) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        Q_UNUSED(size);
+        qint64 expected = 0;
+        if ((data[0] & 0xF0) == 0x90) {
+            m_noteOnAt->compare_exchange_strong(expected, MidiTime::nowNanoseconds());
+        }
+    }
+
+private:
+    std::atomic<qint64> *m_noteOnAt;
+};
+
+// Stands in for an OS scheduler: records every batch handed over, with
+// the time it is to be delivered (0 = sent now), and each cancel
+class SchedulingOutputBackend : public MidiOutputBackend {
+public:
+    static const int MAX_EVENTS = 1024;
+
+    struct Event {
+        unsigned char status; // 0 = cancelScheduled()
+        qint64 calledAt;
+        qint64 deliverAt;
+    };
+
+    SchedulingOutputBackend() : count(0) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        Q_UNUSED(size);
+        record(data[0], 0);
+    }
+
+    bool schedulesDelivery() const override { return true; }
+
+    void scheduleBatch(const MidiOutputBatch &batch, qint64 deliverAtNs) override {
+        for (int i = 0; i < batch.count(); ++i) {
+            if (!batch.at(i).dropped) {
+                record(batch.at(i).bytes[0], deliverAtNs);
+            }
+        }
+    }
+
+    void cancelScheduled() override { record(0, 0); }
+
+    Event events[MAX_EVENTS];
+    std::atomic<int> count; // Single writer (the port's worker)
+
+private:
+    void record(unsigned char status, qint64 deliverAt) {
+        const int index = count.load(std::memory_order_relaxed);
+        if (index < MAX_EVENTS) {
+            events[index] = {status, MidiTime::nowNanoseconds(), deliverAt};
+            count.store(index + 1, std::memory_order_release);
+        }
+    }
+};
+
+// Records the value byte of each message sent, in order (called on the
+// port's worker)
+class OrderingOutputBackend : public MidiOutputBackend {
+public:
+    static const int MAX_SENDS = 256;
+
+    OrderingOutputBackend() : count(0) {}
+
+    void sendMessage(const unsigned char *data, size_t size) override {
+        const int index = count.load(std::memory_order_relaxed);
+        if (size == 3 && index < MAX_SENDS) {
+            values[index] = data[2];
+            count.store(index + 1, std::memory_order_release);
+        }
+    }
+
+    quint8 values[MAX_SENDS];
+    std::atomic<int> count; // Single writer
+};
+
+// Feeds a controller incoming clock in simulated time
+// Tick n's true time follows a linear tempo ramp and each arrival is that
+// time plus uniform jitter. Virtual time steps straight to the next
+// arrival or the armed downbeat deadline, whichever comes first, so
+// thousands of bars run in milliseconds with every timestamp exact.
+class VirtualClockDriver {
+public:
+    VirtualClockDriver(SyncController *controller, VirtualClockSource *clock)
+        : m_controller(controller)
+        , m_clock(clock)
+        , m_startBPM(120.0)
+        , m_endBPM(120.0)
+        , m_rampClocks(0)
+        , m_jitterNs(0)
+        , m_clocks(0)
+        , m_idealNs(0.0)
+    {
+    }
+
+    // Tempo moves linearly from startBPM to endBPM over rampClocks, then holds
+    void setTempo(double startBPM, double endBPM, int rampClocks) {
+        m_startBPM = startBPM;
+        m_endBPM = endBPM;
+        m_rampClocks = rampClocks;
+    }
+
+    // Arrivals land uniformly within +-jitterNs of the true tick
+    void setJitter(qint64 jitterNs, unsigned seed) {
+        m_jitterNs = jitterNs;
+        srand(seed);
+    }
+
+    // DAW Start at the current virtual time (the true time of clock 0)
+    void start() {
+        m_clocks = 0;
+        m_idealNs = static_cast<double>(m_clock->nowNanoseconds());
+        m_tickTimes.clear();
+        m_tickTimes.append(m_clock->nowNanoseconds());
+        m_controller->handleDAWStart(m_clock->nowNanoseconds());
+    }
+
+    void run(int clocks) {
+        for (int i = 0; i < clocks; ++i) {
+            m_idealNs += ClockSchedule::periodNsForBPM(bpmAt(m_clocks));
+            ++m_clocks;
+            m_tickTimes.append(llround(m_idealNs));
+            
+            qint64 arrivalNs = llround(m_idealNs);
+            if (m_jitterNs > 0) {
+                arrivalNs += rand() % (2 * m_jitterNs + 1) - m_jitterNs;
+            }
+            
+            // Any downbeat due before this arrival fires at its deadline
+            const qint64 deadline = m_controller->pendingBoundaryDeadline();
+            if (deadline != 0 && deadline <= arrivalNs) {
+                m_clock->setNanoseconds(qMax(deadline, m_clock->nowNanoseconds()));
+                m_controller->fireDueBoundary();
+            }
+            m_clock->setNanoseconds(qMax(arrivalNs, m_clock->nowNanoseconds()));
+            m_controller->handleMIDIClock(arrivalNs);
+        }
+    }
+
+    // True time of the given bar line (clock 96 * bar)
+    qint64 barTimeNs(int bar) const {
+        return m_tickTimes.value(bar * 96, 0);
+    }
+
+    double bpmAt(int clock) const {
+        if (clock >= m_rampClocks) {
+            return m_endBPM;
+        }
+        return m_startBPM + (m_endBPM - m_startBPM) * clock / m_rampClocks;
+    }
+
+    int clocks() const { return m_clocks; }
+
+private:
+    SyncController *m_controller;
+    VirtualClockSource *m_clock;
+    double m_startBPM;
+    double m_endBPM;
+    int m_rampClocks;
+    qint64 m_jitterNs;
+    int m_clocks;
+    double m_idealNs;
+    QVector<qint64> m_tickTimes;
+};
+
+// Downbeats as handed to the outputs: when (virtual time) and for when
+struct DownbeatFire {
+    qint64 firedAtNs;
+    qint64 boundaryTimeNs;
+};
+
+// Records the merged clock stream a ClockArbiter passes on
+class RecordingTransportSink : public MidiTransportSink {
+public:
+    RecordingTransportSink() : starts(0), stops(0) {}
+
+    void midiStart(qint64 timestamp) override { Q_UNUSED(timestamp); ++starts; }
+    void midiStop(qint64 timestamp) override { Q_UNUSED(timestamp); ++stops; }
+    void midiContinue(qint64 timestamp) override { Q_UNUSED(timestamp); }
+    void midiClock(qint64 timestamp) override { clocks.append(timestamp); }
+    void midiSongPositionPointer(int positionBeats, double positionQuarterNotes) override {
+        Q_UNUSED(positionBeats);
+        Q_UNUSED(positionQuarterNotes);
+    }
+
+    QVector<qint64> clocks;
+    int starts;
+    int stops;
+};
+} // namespace
+
+void *operator new(std::size_t size) { return countedAllocate(size); }
+void *operator new[](std::size_t size) { return countedAllocate(size); }
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { std::free(pointer); }
 
 void SyncControllerTest::initTestCase() {
     // Setup before all tests
@@ -12,9 +323,13 @@ void SyncControllerTest::cleanupTestCase() {
 }
 
 void SyncControllerTest::init() {
-    // Pass nullptr for MidiEngine - SyncController checks for nullptr before using it
-    // This allows us to test the logic without needing a real MIDI engine
-    m_syncController = new SyncController(nullptr, this);
+    // A real engine with no output ports: the whole emission path runs,
+    // nothing leaves the process. Virtual time keeps every timestamp exact
+    // and no thread runs on the wall clock.
+    m_engine = new MidiEngine(this);
+    m_clock = new VirtualClockSource();
+    m_syncController = new SyncController(m_engine, this);
+    m_syncController->setClockSource(m_clock);
 }
 
 void SyncControllerTest::cleanup() {
@@ -23,6 +338,10 @@ void SyncControllerTest::cleanup() {
         delete m_syncController;
         m_syncController = nullptr;
     }
+    delete m_engine;
+    m_engine = nullptr;
+    delete m_clock;
+    m_clock = nullptr;
 }
 
 void SyncControllerTest::simulateClockTicks(int count, double bpm) {
@@ -32,10 +351,11 @@ void SyncControllerTest::simulateClockTicks(int count, double bpm) {
         m_syncController->start(false);
     }
     
+    // Clocks arrive exactly one period apart in virtual time
+    const double periodNs = ClockSchedule::periodNsForBPM(bpm);
     for (int i = 0; i < count; ++i) {
-        m_syncController->handleMIDIClock();
-        // Small delay to simulate real timing (optional, can be removed for faster tests)
-        QTest::qWait(1);
+        m_clock->setNanoseconds(m_clock->nowNanoseconds() + llround(periodNs));
+        m_syncController->handleMIDIClock(m_clock->nowNanoseconds());
     }
 }
 
@@ -56,8 +376,10 @@ void SyncControllerTest::simulateClockTicksToPosition(double targetQuarterNotes,
     
     int targetTicks = static_cast<int>(remainingQuarterNotes * 24.0);
     
+    const double periodNs = ClockSchedule::periodNsForBPM(bpm);
     for (int i = 0; i < targetTicks; ++i) {
-        m_syncController->handleMIDIClock();
+        m_clock->setNanoseconds(m_clock->nowNanoseconds() + llround(periodNs));
+        m_syncController->handleMIDIClock(m_clock->nowNanoseconds());
     }
 }
 
@@ -270,6 +592,2108 @@ void SyncControllerTest::testNoDelaysAfterBar10() {
     QCOMPARE(firstAfterBar10, 44); // Should be exactly at next boundary (bar 11), no delay
 }
 
+void SyncControllerTest::testInputQueueOverflowIsCounted() {
+    // The RtMidi callback must never block: a full ring drops and counts
+    SpscRingBuffer<MidiEvent, 8> queue;
+    MidiEvent clock = {{0xF8, 0, 0, 0}, 1, 0.0};
+    
+    for (int i = 0; i < 8; ++i) {
+        QVERIFY(queue.push(clock));
+    }
+    QVERIFY(!queue.push(clock));
+    QCOMPARE(queue.overflowCount(), quint64(1));
+    QCOMPARE(queue.size(), 8);
+    
+    // Drain and refill across the wrap-around point
+    MidiEvent event;
+    for (int i = 0; i < 5; ++i) {
+        QVERIFY(queue.pop(event));
+        QCOMPARE(event.status(), quint8(0xF8));
+    }
+    for (int i = 0; i < 5; ++i) {
+        MidiEvent spp = {{0xF2, quint8(i), 0, 0}, 3, 0.0};
+        QVERIFY(queue.push(spp));
+    }
+    QCOMPARE(queue.size(), 8);
+    
+    int sppCount = 0;
+    while (queue.pop(event)) {
+        if (event.status() == 0xF2) {
+            QCOMPARE(int(event.bytes[1]), sppCount);
+            ++sppCount;
+        }
+    }
+    QCOMPARE(sppCount, 5);
+    QVERIFY(queue.isEmpty());
+    QCOMPARE(queue.overflowCount(), quint64(1));
+}
+
+void SyncControllerTest::testMasterClockScheduleHasNoDrift() {
+    // 1000 bars at tempos whose tick period isn't a whole number of ms
+    // must end exactly where the ideal timeline says (integer-ms timers
+    // drifted ~4% fast at 120 BPM)
+    const QList<double> tempos = {20.0, 97.3, 120.0, 233.3, 300.0};
+    const int bars = 1000;
+    const qint64 anchor = 1000000;
+    
+    for (double bpm : tempos) {
+        ClockSchedule schedule;
+        schedule.start(anchor, bpm);
+        // start() points at tick 1; advance to tick 96 * bars
+        for (int tick = 1; tick < 96 * bars; ++tick) {
+            schedule.advance();
+        }
+        qint64 ideal = anchor + qint64(std::llround(bars * 4 * 60.0e9 / bpm));
+        QVERIFY(qAbs(schedule.nextDeadline() - ideal) <= 1);
+    }
+    
+    // A tempo change keeps the pending deadline (phase continuous) and
+    // spaces following ticks at the new period
+    ClockSchedule schedule;
+    schedule.start(anchor, 120.0);
+    schedule.advance();
+    qint64 pending = schedule.nextDeadline();
+    schedule.setBPM(60.0);
+    QCOMPARE(schedule.nextDeadline(), pending);
+    schedule.advance();
+    QVERIFY(qAbs(schedule.nextDeadline() - pending - qint64(std::llround(60.0e9 / 60.0 / 24.0))) <= 1);
+}
+
+void SyncControllerTest::testTransportSnapshotIsConsistent() {
+    // A reader racing the writer must never see a half-written state:
+    // every field of the snapshot belongs to the same store()
+    SeqLock<TransportState> snapshot;
+    std::atomic<bool> done(false);
+    
+    std::thread writer([&snapshot, &done]() {
+        TransportState state = {};
+        for (int i = 1; i <= 200000; ++i) {
+            state.clockCount = i;
+            state.incomingClockCount = i;
+            state.positionBeats = i * 4;
+            state.positionQuarterNotes = static_cast<double>(i) / 24.0;
+            snapshot.store(state);
+        }
+        done.store(true);
+    });
+    
+    int torn = 0;
+    int lastSeen = 0;
+    bool wentBackwards = false;
+    while (!done.load()) {
+        TransportState state = snapshot.load();
+        if (state.incomingClockCount != state.clockCount ||
+            state.positionBeats != state.clockCount * 4 ||
+            state.positionQuarterNotes != static_cast<double>(state.clockCount) / 24.0) {
+            ++torn;
+        }
+        if (state.clockCount < lastSeen) {
+            wentBackwards = true;
+        }
+        lastSeen = state.clockCount;
+    }
+    writer.join();
+    
+    QCOMPARE(torn, 0);
+    QVERIFY(!wentBackwards);
+    QCOMPARE(snapshot.load().clockCount, 200000);
+    
+    // The controller publishes through the same snapshot
+    m_syncController->handleDAWStart();
+    simulateClockTicks(30);
+    TransportState state = m_syncController->transportState();
+    QVERIFY(state.running);
+    QCOMPARE(state.clockCount, 30);
+    QCOMPARE(state.incomingClockCount, 30);
+    QCOMPARE(m_syncController->getCurrentPositionQuarterNotes(), 30.0 / 24.0);
+}
+
+void SyncControllerTest::testTraceRecordsWithoutFormatting() {
+#if MIDIMASTER2_TRACE
+    auto discard = [](const TraceRecord &) {};
+    SyncTrace::drain(discard);
+    
+    // Disabled at runtime: nothing reaches the ring
+    SyncTrace::setEnabled(false);
+    m_syncController->handleSongPositionPointer(16, 4.0);
+    QCOMPARE(SyncTrace::drain(discard), 0);
+    
+    // Enabled: fixed-size records carry the values, formatting is deferred
+    SyncTrace::setEnabled(true);
+    m_syncController->handleSongPositionPointer(40, 10.0);
+    m_syncController->handleDAWStart();
+    QList<TraceRecord> records;
+    SyncTrace::drain([&records](const TraceRecord &record) { records.append(record); });
+    SyncTrace::setEnabled(false);
+    
+    QCOMPARE(records.size(), 2);
+    QVERIFY(records.at(0).event == TraceEvent::SppUpdate);
+    QCOMPARE(records.at(0).ints[0], 2);   // 10 QN is halfway through boundary 2: counts as emitted
+    QCOMPARE(records.at(0).ints[1], 160); // clockCount = beats * 4
+    QCOMPARE(records.at(0).values[0], 10.0);
+    QVERIFY(records.at(1).event == TraceEvent::DawStart);
+    QVERIFY(records.at(1).timestamp >= records.at(0).timestamp);
+    QVERIFY(SyncTrace::format(records.at(0)).startsWith("SPP UPDATE"));
+#else
+    QSKIP("Built with MIDIMASTER2_ENABLE_TRACE=OFF");
+#endif
+}
+
+void SyncControllerTest::testOutputPathDoesNotAllocate() {
+    // Drive ticks through a controller wired to a real MidiEngine: clock
+    // byte, boundary evaluation, Note Off/On and SPP must reach the output
+    // backend without a single heap allocation
+    MidiEngine engine;
+    RecordingOutputBackend backend;
+    engine.setOutputBackend(&backend);
+    SyncController controller(&engine);
+    controller.handleDAWStart();
+    
+    // Warm up (first-use statics) before counting
+    controller.handleMIDIClock();
+    engine.sendSystemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+    
+    const int ticks = 96 * 8; // 8 bars
+    t_allocationCount = 0;
+    t_countAllocations = true;
+    for (int i = 0; i < ticks; ++i) {
+        engine.sendSystemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+        controller.handleMIDIClock();
+    }
+    engine.sendSongPositionPointer(128);
+    t_countAllocations = false;
+    
+    QCOMPARE(t_allocationCount, 0);
+    QVERIFY(backend.noteOnCount >= 8);
+    QVERIFY(backend.count > ticks);
+    
+    engine.setOutputBackend(nullptr);
+    controller.stop(false);
+}
+
+void SyncControllerTest::testOutputBatchCoalescing() {
+    MidiEngine engine;
+    RecordingOutputBackend backend;
+    engine.setOutputBackend(&backend);
+    
+    // Boundary tick: clock + re-trigger of the same note, one flush
+    MidiOutputBatch batch;
+    batch.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+    batch.noteOff(0, 60, 0);
+    batch.noteOn(0, 60, 100);
+    engine.sendBatch(batch);
+    QCOMPARE(backend.count, 3);
+    
+    MidiEngine::OutputStats stats = engine.outputStats();
+    QCOMPARE(stats.flushes, quint64(1));
+    QCOMPARE(stats.messages, quint64(3));
+    QCOMPARE(stats.flushSizeCounts[3], quint64(1));
+    
+    // With coalescing the Off/On pair is tied; unrelated notes survive
+    engine.setCoalescingPolicy(MidiEngine::CoalescingPolicy::DropCancellingNotePairs);
+    batch.clear();
+    batch.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+    batch.noteOff(0, 60, 0);
+    batch.noteOn(0, 60, 100);
+    batch.noteOn(0, 64, 100);
+    batch.noteOn(1, 60, 100);
+    engine.sendBatch(batch);
+    QCOMPARE(backend.count, 3 + 3);
+    QCOMPARE(backend.statuses[3], static_cast<unsigned char>(0xF8));
+    QCOMPARE(backend.statuses[4], static_cast<unsigned char>(0x90));
+    QCOMPARE(backend.statuses[5], static_cast<unsigned char>(0x91));
+    
+    // Zero-length note (On then Off, velocity-0 Note On counts as Off)
+    batch.clear();
+    batch.noteOn(0, 62, 100);
+    batch.noteOn(0, 62, 0);
+    engine.sendBatch(batch);
+    QCOMPARE(backend.count, 6);
+    
+    stats = engine.outputStats();
+    QCOMPARE(stats.flushes, quint64(2));
+    QCOMPARE(stats.messages, quint64(6));
+    QCOMPARE(stats.coalesced, quint64(4));
+    
+    engine.setOutputBackend(nullptr);
+}
+
+void SyncControllerTest::testOutputFanOutIsolatesSlowPorts() {
+    // One fast port gets everything; a slow port (20ms per send) only gets
+    // clock. The producer must never wait for the slow port.
+    MidiEngine engine;
+    std::atomic<int> fastClocks(0), fastNotes(0), slowClocks(0), slowNotes(0);
+    QVERIFY(engine.addOutputPort("fast",
+        std::unique_ptr<MidiOutputBackend>(new CountingOutputBackend(&fastClocks, &fastNotes, 0))));
+    QVERIFY(engine.addOutputPort("slow",
+        std::unique_ptr<MidiOutputBackend>(new CountingOutputBackend(&slowClocks, &slowNotes, 20000)),
+        MidiOutputRoute::Clock));
+    QCOMPARE(engine.openOutputPorts().size(), 2);
+    
+    const int ticks = 10;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < ticks; ++i) {
+        MidiOutputBatch batch;
+        batch.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+        batch.noteOn(0, 60, 100);
+        engine.sendBatch(batch);
+    }
+    // Serialized behind the slow port this would take 10 x 20ms
+    QVERIFY(timer.elapsed() < 100);
+    
+    QTRY_COMPARE_WITH_TIMEOUT(fastClocks.load(), ticks, 1000);
+    QCOMPARE(fastNotes.load(), ticks);
+    QTRY_COMPARE_WITH_TIMEOUT(slowClocks.load(), ticks, 2000);
+    QCOMPARE(slowNotes.load(), 0); // Notes masked off
+    
+    QList<OutputPortStats> stats = engine.outputPortStats();
+    QCOMPARE(stats.size(), 2);
+    QCOMPARE(stats.at(0).name, QString("fast"));
+    QCOMPARE(stats.at(0).messages, quint64(2 * ticks));
+    QCOMPARE(stats.at(1).messages, quint64(ticks));
+    QVERIFY(stats.at(1).maxLatencyUs > stats.at(0).averageLatencyUs);
+    
+    engine.removeOutputPort("slow");
+    QCOMPARE(engine.openOutputPorts(), QStringList() << "fast");
+}
+
+void SyncControllerTest::testScheduledOutputHonorsPortLatency() {
+    // A note scheduled 80ms ahead must leave each port its own offset
+    // early: never before that, and the slower device first
+    MidiEngine engine;
+    std::atomic<qint64> nearSentAt(0), farSentAt(0);
+    QVERIFY(engine.addOutputPort("near",
+        std::unique_ptr<MidiOutputBackend>(new TimestampingOutputBackend(&nearSentAt))));
+    QVERIFY(engine.addOutputPort("far",
+        std::unique_ptr<MidiOutputBackend>(new TimestampingOutputBackend(&farSentAt))));
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(), MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS);
+    QVERIFY(engine.setOutputLatencyOffset("near", 10.0));
+    QVERIFY(engine.setOutputLatencyOffset("far", 40.0));
+    QCOMPARE(engine.outputLatencyOffset("far"), 40.0);
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(), 40.0);
+    
+    const qint64 presentation = MidiTime::nowNanoseconds() + 80000000;
+    MidiOutputBatch batch;
+    batch.noteOn(0, 60, 100);
+    engine.scheduleBatch(batch, presentation);
+    
+    QTRY_VERIFY_WITH_TIMEOUT(nearSentAt.load() != 0 && farSentAt.load() != 0, 1000);
+    QVERIFY(farSentAt.load() >= presentation - 40000000);
+    QVERIFY(nearSentAt.load() >= presentation - 10000000);
+    QVERIFY(farSentAt.load() < nearSentAt.load());
+    // Loose upper bound: scheduler wakeups on a loaded test machine
+    QVERIFY(nearSentAt.load() - (presentation - 10000000) < 20000000);
+    
+    engine.removeOutputPort("far");
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(), 10.0);
+}
+
+void SyncControllerTest::testTransportSinkDrivesController() {
+    // The engine's direct path: clock and transport reach the controller
+    // through the sink interface with no signal connections at all
+    MidiEngine engine;
+    QVERIFY(engine.transportSink() == nullptr);
+    engine.setTransportSink(m_syncController);
+    MidiTransportSink *sink = engine.transportSink();
+    QVERIFY(sink != nullptr);
+    
+    // Two bars' worth of arrival times at 120 BPM, all in the past
+    const qint64 tickNs = 20833333;
+    const qint64 start = MidiTime::nowNanoseconds() - 200 * tickNs;
+    sink->midiStart(start);
+    QVERIFY(m_syncController->isRunning());
+    for (int i = 1; i <= 48; ++i) {
+        sink->midiClock(start + i * tickNs);
+    }
+    QVERIFY(qAbs(m_syncController->getCurrentPositionQuarterNotes() - 2.0) < 0.01);
+    
+    // SPP 0 is left to Start/Stop; real positions are applied
+    sink->midiSongPositionPointer(0, 0.0);
+    QVERIFY(qAbs(m_syncController->getCurrentPositionQuarterNotes() - 2.0) < 0.01);
+    sink->midiSongPositionPointer(16, 4.0);
+    QCOMPARE(m_syncController->getCurrentPositionQuarterNotes(), 4.0);
+    
+    sink->midiStop(start + 49 * tickNs);
+    QVERIFY(!m_syncController->isRunning());
+    
+    engine.setTransportSink(nullptr);
+}
+
+void SyncControllerTest::testTempoEstimatorsFollowRamps() {
+    // 4 bars at 120 BPM, an 8 bar ramp to 140, 4 bars at 140, with up to
+    // 1ms of arrival jitter. Both filters must track within a fraction of
+    // a BPM on every clock, not a beat late in 0.5 BPM steps.
+    PllTempoEstimator pll;
+    KalmanTempoEstimator kalman;
+    TempoEstimator *estimators[] = {&pll, &kalman};
+    
+    for (TempoEstimator *estimator : estimators) {
+        srand(7);
+        double bpm = 120.0;
+        double idealNs = 1.0e12;
+        double maxErrorBpm = 0.0;
+        double maxTickErrorNs = 0.0;
+        for (int i = 0; i < 96 * 16; ++i) {
+            if (i >= 96 * 4 && i < 96 * 12) {
+                bpm += 20.0 / (96 * 8);
+            }
+            idealNs += ClockSchedule::periodNsForBPM(bpm);
+            const double jitterNs = (rand() / static_cast<double>(RAND_MAX) - 0.5) * 2000000.0;
+            TempoEstimate estimate = estimator->update(static_cast<qint64>(idealNs + jitterNs));
+            if (i >= 96) {
+                QVERIFY(estimate.valid);
+                maxErrorBpm = qMax(maxErrorBpm, qAbs(estimate.bpm - bpm));
+                maxTickErrorNs = qMax(maxTickErrorNs, qAbs(estimate.tickTimeNs - idealNs));
+            }
+        }
+        QVERIFY(maxErrorBpm < 1.0);
+        QVERIFY(maxTickErrorNs < 1500000.0); // Better than the raw +-1ms jitter plus margin
+        TempoEstimate settled = estimator->estimate();
+        QVERIFY(settled.jitterNs > 200000.0 && settled.jitterNs < 1000000.0);
+        QCOMPARE(estimator->resyncCount(), quint64(0));
+        
+        // A clock that stops and restarts re-anchors instead of dragging
+        // the tempo through the gap
+        estimator->update(static_cast<qint64>(idealNs) + 2000000000LL);
+        QCOMPARE(estimator->resyncCount(), quint64(1));
+        
+        // Sub-millisecond intervals are not a running clock
+        estimator->reset();
+        for (int i = 0; i < 48; ++i) {
+            estimator->update(1000000LL * i);
+        }
+        QVERIFY(!estimator->estimate().valid);
+    }
+}
+
+void SyncControllerTest::testTempoTrackingIsPerController() {
+    // Two controllers slaved to different clocks must not share any tempo
+    // state
+    SyncController other(nullptr);
+    const qint64 start = MidiTime::nowNanoseconds() - 1000000000LL;
+    m_syncController->handleDAWStart(start);
+    other.handleDAWStart(start);
+    
+    const double periodA = ClockSchedule::periodNsForBPM(100.0);
+    const double periodB = ClockSchedule::periodNsForBPM(150.0);
+    for (int i = 1; i <= 48; ++i) {
+        m_syncController->handleMIDIClock(start + llround(i * periodA));
+        other.handleMIDIClock(start + llround(i * periodB));
+    }
+    QVERIFY(qAbs(m_syncController->currentBPM() - 100.0) < 0.1);
+    QVERIFY(qAbs(other.currentBPM() - 150.0) < 0.1);
+    
+    TransportState state = m_syncController->transportState();
+    QVERIFY(qAbs(state.tempoPhaseErrorNs) < 1000.0);
+    QVERIFY(state.tempoJitterNs < 1000.0);
+    other.stop(false);
+}
+
+void SyncControllerTest::testBoundarySchedulerFiresBetweenClocks() {
+    // The downbeat is decided a couple of clocks early but must leave at
+    // "boundary minus the output offset", not on the deciding clock
+    MidiEngine engine;
+    std::atomic<qint64> noteOnAt(0);
+    QVERIFY(engine.addOutputPort("out",
+        std::unique_ptr<MidiOutputBackend>(new TimestampingOutputBackend(&noteOnAt))));
+    QVERIFY(engine.setOutputLatencyOffset("out", 10.0));
+    SyncController controller(&engine);
+    
+    // 300 BPM grid whose first bar line is 100ms from now
+    const double periodNs = ClockSchedule::periodNsForBPM(300.0);
+    const qint64 boundaryNs = MidiTime::nowNanoseconds() + 100000000;
+    const qint64 start = boundaryNs - llround(96 * periodNs);
+    controller.handleDAWStart(start);
+    controller.handleMIDIClock(start + llround(periodNs));
+    QTRY_VERIFY_WITH_TIMEOUT(noteOnAt.load() != 0, 1000); // First downbeat, sent at once
+    noteOnAt.store(0);
+    
+    for (int i = 2; i < 96; ++i) {
+        controller.handleMIDIClock(start + llround(i * periodNs));
+    }
+    // Armed, not sent: the last clock before the bar line has been handled
+    QCOMPARE(noteOnAt.load(), qint64(0));
+    
+    QTRY_VERIFY_WITH_TIMEOUT(noteOnAt.load() != 0, 1000);
+    QVERIFY(noteOnAt.load() >= boundaryNs - 10000000);
+    // Loose upper bound: scheduler wakeups on a loaded test machine
+    QVERIFY(noteOnAt.load() - (boundaryNs - 10000000) < 20000000);
+    
+    BoundaryScheduler::Stats stats = controller.boundaryTimingStats();
+    QCOMPARE(stats.fired, quint64(1));
+    quint64 histogramTotal = 0;
+    for (int i = 0; i < BoundaryScheduler::HISTOGRAM_BUCKETS; ++i) {
+        histogramTotal += stats.histogram[i];
+    }
+    QCOMPARE(histogramTotal, stats.fired);
+    QVERIFY(stats.maxEarlyNs >= 0); // Never fires ahead of its deadline
+    controller.stop(false);
+}
+
+void SyncControllerTest::testVirtualTimeEmissionAtFixedTempos() {
+    // Exact clocks across the supported range: every bar line fires once,
+    // between clocks, exactly the output advance before a boundary that is
+    // projected to the nanosecond
+    QVector<DownbeatFire> fires;
+    connect(m_syncController, &SyncController::downbeatFired, this, [&](qint64 boundaryTimeNs) {
+        DownbeatFire fire = {m_clock->nowNanoseconds(), boundaryTimeNs};
+        fires.append(fire);
+    });
+    const qint64 advanceNs = llround(m_engine->maxOutputLatencyOffsetMs() * 1000000.0);
+    const int bars = 500;
+    
+    const double tempos[] = {30.0, 60.0, 97.0, 120.0, 174.0, 240.0, 300.0};
+    for (double bpm : tempos) {
+        fires.clear();
+        m_syncController->resetBoundaryTimingStats();
+        QSignalSpy beatSentSpy(m_syncController, &SyncController::beatSent);
+        VirtualClockDriver driver(m_syncController, m_clock);
+        driver.setTempo(bpm, bpm, 0);
+        driver.start();
+        driver.run(bars * 96);
+        
+        QCOMPARE(beatSentSpy.count(), bars + 1);
+        QCOMPARE(fires.size(), bars + 1);
+        QCOMPARE(fires[0].boundaryTimeNs, qint64(0)); // First downbeat goes at once
+        for (int bar = 1; bar <= bars; ++bar) {
+            const DownbeatFire &fire = fires[bar];
+            QVERIFY(qAbs(fire.boundaryTimeNs - driver.barTimeNs(bar)) < 1000);
+            QVERIFY(qAbs(fire.boundaryTimeNs - advanceNs - fire.firedAtNs) < 1000);
+        }
+        QVERIFY(qAbs(m_syncController->currentBPM() - bpm) < 0.001);
+        
+        BoundaryScheduler::Stats stats = m_syncController->boundaryTimingStats();
+        QCOMPARE(stats.fired, quint64(bars));
+        QCOMPARE(stats.histogram[BoundaryScheduler::ON_TIME_BUCKET], stats.fired); // All within +-10us of the deadline
+        QCOMPARE(QString(BoundaryScheduler::bucketLabel(BoundaryScheduler::ON_TIME_BUCKET)), QString("+-10us"));
+        m_syncController->stop(false);
+    }
+}
+
+void SyncControllerTest::testVirtualTimeEmissionWithJitterAndRamps() {
+    // +-1ms arrival jitter on steady tempo and on ramps in both directions:
+    // the tempo tracker must keep every projected bar line close to the
+    // true one, with no bar missed or sent twice
+    QVector<DownbeatFire> fires;
+    connect(m_syncController, &SyncController::downbeatFired, this, [&](qint64 boundaryTimeNs) {
+        DownbeatFire fire = {m_clock->nowNanoseconds(), boundaryTimeNs};
+        fires.append(fire);
+    });
+    
+    struct Scenario {
+        double startBPM;
+        double endBPM;
+        int rampBars;
+        qint64 maxErrorNs;
+    };
+    const Scenario scenarios[] = {
+        {120.0, 120.0, 0, 1500000},
+        {90.0, 180.0, 64, 2500000},
+        {200.0, 70.0, 64, 2500000},
+    };
+    const int bars = 1000;
+    for (const Scenario &scenario : scenarios) {
+        fires.clear();
+        VirtualClockDriver driver(m_syncController, m_clock);
+        driver.setTempo(scenario.startBPM, scenario.endBPM, scenario.rampBars * 96);
+        driver.setJitter(1000000, 11);
+        driver.start();
+        driver.run(bars * 96);
+        
+        QCOMPARE(fires.size(), bars + 1);
+        qint64 maxErrorNs = 0;
+        for (int bar = 1; bar <= bars; ++bar) {
+            maxErrorNs = qMax(maxErrorNs, qAbs(fires[bar].boundaryTimeNs - driver.barTimeNs(bar)));
+        }
+        QVERIFY2(maxErrorNs < scenario.maxErrorNs, qPrintable(QString("max error %1 ns").arg(maxErrorNs)));
+        QVERIFY(qAbs(m_syncController->currentBPM() - scenario.endBPM) < 0.3);
+        m_syncController->stop(false);
+    }
+}
+
+void SyncControllerTest::testLatencyHistogramPercentiles() {
+    LatencyHistogram histogram;
+    QCOMPARE(histogram.summary().count, quint64(0));
+    QCOMPARE(histogram.valueAtPercentile(99.0), qint64(0));
+    
+    // 1 us .. 1 ms in 1 us steps
+    for (int i = 1; i <= 1000; ++i) {
+        histogram.record(i * 1000LL);
+    }
+    const LatencySummary summary = histogram.summary();
+    QCOMPARE(summary.count, quint64(1000));
+    QCOMPARE(summary.minNs, qint64(1000));
+    QCOMPARE(summary.maxNs, qint64(1000000));
+    QCOMPARE(summary.meanNs, 500500.0);
+    
+    // Log-linear buckets: within ~3% of the exact percentile
+    QVERIFY2(qAbs(summary.p50Ns - 500000) <= 500000 * 0.035, qPrintable(QString::number(summary.p50Ns)));
+    QVERIFY2(qAbs(summary.p90Ns - 900000) <= 900000 * 0.035, qPrintable(QString::number(summary.p90Ns)));
+    QVERIFY2(qAbs(summary.p99Ns - 990000) <= 990000 * 0.035, qPrintable(QString::number(summary.p99Ns)));
+    QVERIFY(summary.p999Ns <= summary.maxNs);
+    
+    // Every value lands in a bucket whose bounds contain it
+    const qint64 samples[] = {0, 1, 31, 32, 33, 1000, 65535, 65536, 123456789, 1LL << 40};
+    for (qint64 ns : samples) {
+        const int bucket = LatencyHistogram::bucketFor(static_cast<quint64>(ns));
+        QVERIFY(bucket >= 0 && bucket < LatencyHistogram::BUCKETS);
+        QVERIFY(LatencyHistogram::bucketLowerBound(bucket) <= ns);
+        QVERIFY(LatencyHistogram::bucketUpperBound(bucket) >= ns);
+    }
+    
+    histogram.record(-5); // Counted as zero
+    QCOMPARE(histogram.summary().minNs, qint64(0));
+    
+    histogram.reset();
+    QCOMPARE(histogram.count(), quint64(0));
+    QCOMPARE(histogram.summary().maxNs, qint64(0));
+}
+
+void SyncControllerTest::testInstrumentationCountsClockGaps() {
+    m_syncController->resetInstrumentation();
+    simulateClockTicks(48, 120.0);
+    QCOMPARE(m_syncController->clockGapCount(), quint64(0));
+    
+    // One clock lost on the wire
+    const double periodNs = ClockSchedule::periodNsForBPM(120.0);
+    m_clock->advance(llround(periodNs));
+    simulateClockTicks(24, 120.0);
+    QCOMPARE(m_syncController->clockGapCount(), quint64(1));
+    
+    // Every timestamped clock is probed; virtual time means zero entry latency
+    const LatencyHistogram &entry = m_syncController->latencyHistogram(SyncLatencyStage::ClockEntry);
+    QCOMPARE(entry.count(), quint64(72));
+    QCOMPARE(entry.summary().maxNs, qint64(0));
+    QVERIFY(m_syncController->latencyHistogram(SyncLatencyStage::ClockJitter).count() > 0);
+    
+    // The JSON dump carries the same counters
+    StatsReporter reporter(m_engine, m_syncController);
+    const QJsonObject snapshot = reporter.snapshot();
+    const QJsonObject sync = snapshot["sync"].toObject();
+    QCOMPARE(sync["clockGaps"].toDouble(), 1.0);
+    QCOMPARE(sync["latency"].toObject()["clockEntry"].toObject()["count"].toDouble(), 72.0);
+    const QJsonObject input = snapshot["engine"].toObject()["input"].toObject();
+    QCOMPARE(input["queueCapacity"].toInt(), MidiEventQueue::capacity());
+    
+    m_syncController->resetInstrumentation();
+    QCOMPARE(m_syncController->clockGapCount(), quint64(0));
+    QCOMPARE(entry.count(), quint64(0));
+}
+
+void SyncControllerTest::testStreamParserRunningStatusAndRealtime() {
+    const quint8 stream[] = {
+        0x90, 0x3C, 0x64,             // Note On
+        0x3E, 0x64,                   // Note On by running status
+        0xF8,                         // Clock between messages
+        0x40, 0xF8, 0x64,             // Clock inside a running-status message
+        0xF0, 0x7E, 0xF8, 0x7F, 0xF7, // Clock inside a SysEx
+        0x40,                         // SysEx cancelled running status: dropped
+        0xF2, 0x10, 0x00,             // Song Position Pointer
+        0xB0, 0x07, 0x7F,             // CC
+        0xC0, 0x05, 0x06              // Program Change twice (running status)
+    };
+    const QList<QByteArray> expected = {
+        QByteArray("\x90\x3C\x64", 3), QByteArray("\x90\x3E\x64", 3), QByteArray("\xF8", 1),
+        QByteArray("\xF8", 1), QByteArray("\x90\x40\x64", 3), QByteArray("\xF8", 1),
+        QByteArray("\xF2\x10\x00", 3), QByteArray("\xB0\x07\x7F", 3),
+        QByteArray("\xC0\x05", 2), QByteArray("\xC0\x06", 2)
+    };
+    
+    // Whole buffer at once, then split at every byte: same messages
+    for (int chunk : {int(sizeof(stream)), 1}) {
+        MidiStreamParser parser;
+        QList<QByteArray> messages;
+        auto collect = [&messages](const MidiMessage &message) {
+            messages.append(QByteArray(reinterpret_cast<const char *>(message.bytes), message.size));
+        };
+        for (int offset = 0; offset < int(sizeof(stream)); offset += chunk) {
+            parser.parse(stream + offset, qMin(chunk, int(sizeof(stream)) - offset), 1, collect);
+        }
+        QCOMPARE(messages, expected);
+        QCOMPARE(parser.droppedBytes(), quint64(1));
+        QCOMPARE(parser.runningStatus(), quint8(0xC0));
+    }
+    
+    // A status byte cuts a partial message short
+    MidiStreamParser parser;
+    int count = 0;
+    const quint8 cut[] = {0x90, 0x3C, 0xF6};
+    parser.parse(cut, 3, 1, [&count](const MidiMessage &message) {
+        QCOMPARE(message.status(), quint8(0xF6));
+        ++count;
+    });
+    QCOMPARE(count, 1);
+    QCOMPARE(parser.interruptedMessages(), quint64(1));
+}
+
+void SyncControllerTest::testRawByteStreamDrivesController() {
+    // A raw transport: Start, then a bar of clocks with a running-status
+    // note stream woven through it, delivered in awkward chunks
+    MidiEngine engine;
+    engine.setTransportSink(m_syncController);
+    QSignalSpy channelSpy(&engine, &MidiEngine::channelMessageReceived);
+    
+    const qint64 tickNs = llround(ClockSchedule::periodNsForBPM(120.0));
+    const quint8 start = 0xFA;
+    engine.handleRawMIDIBytes(&start, 1, m_clock->nowNanoseconds());
+    QVERIFY(m_syncController->isRunning());
+    
+    const quint8 noteOn[] = {0x91, 0x30};
+    const quint8 velocityAndClock[] = {0xF8, 0x50, 0x31};
+    const quint8 clock = 0xF8;
+    engine.handleRawMIDIBytes(noteOn, 2, m_clock->nowNanoseconds());
+    for (int i = 0; i < 96; ++i) {
+        m_clock->advance(tickNs);
+        if (i % 2 == 0) {
+            // Clock lands between a note's key and velocity
+            engine.handleRawMIDIBytes(velocityAndClock, 3, m_clock->nowNanoseconds());
+        } else {
+            const quint8 velocity = 0x50;
+            engine.handleRawMIDIBytes(&clock, 1, m_clock->nowNanoseconds());
+            engine.handleRawMIDIBytes(&velocity, 1, m_clock->nowNanoseconds());
+            // Key of the next running-status note
+            const quint8 key = 0x30;
+            engine.handleRawMIDIBytes(&key, 1, m_clock->nowNanoseconds());
+        }
+    }
+    
+    QCOMPARE(m_syncController->getIncomingClockCount(), 96);
+    QCOMPARE(m_syncController->getCurrentPositionQuarterNotes(), 4.0);
+    QCOMPARE(channelSpy.count(), 96);
+    QCOMPARE(channelSpy.first().at(0).toInt(), 0x91);
+    QCOMPARE(channelSpy.first().at(2).toInt(), 0x50);
+    
+    engine.setTransportSink(nullptr);
+}
+
+void SyncControllerTest::testSysExReassemblyIsPooledAndBounded() {
+    MidiEngine engine;
+    QVERIFY(engine.setSysExLimits(1024, 2));
+    RecordingSysExSink sysExSink;
+    engine.setSysExSink(&sysExSink);
+    engine.setTransportSink(m_syncController);
+    
+    const quint8 start = 0xFA;
+    engine.handleRawMIDIBytes(&start, 1, m_clock->nowNanoseconds());
+    
+    // A 600 byte dump with a clock every 100 bytes, in 37 byte chunks
+    quint8 stream[700];
+    int length = 0;
+    stream[length++] = 0xF0;
+    for (int i = 0; i < 600; ++i) {
+        if (i % 100 == 50) {
+            stream[length++] = 0xF8;
+        }
+        stream[length++] = quint8(i & 0x7F);
+    }
+    stream[length++] = 0xF7;
+    
+    t_allocationCount = 0;
+    t_countAllocations = true;
+    for (int offset = 0; offset < length; offset += 37) {
+        m_clock->advance(1000000);
+        engine.handleRawMIDIBytes(stream + offset, qMin(37, length - offset), m_clock->nowNanoseconds());
+    }
+    t_countAllocations = false;
+    QCOMPARE(t_allocationCount, 0);
+    
+    // Clocks went through as they came; the dump arrived whole, in place
+    QCOMPARE(m_syncController->getIncomingClockCount(), 6);
+    QCOMPARE(sysExSink.count, 1);
+    QCOMPARE(sysExSink.size, 602);
+    QCOMPARE(sysExSink.bytes[0], quint8(0xF0));
+    QCOMPARE(sysExSink.bytes[601], quint8(0xF7));
+    bool payloadIntact = true;
+    for (int i = 0; i < 600; ++i) {
+        payloadIntact = payloadIntact && sysExSink.bytes[1 + i] == quint8(i & 0x7F);
+    }
+    QVERIFY(payloadIntact);
+    
+    // Over the size limit: dropped, the stream carries on
+    const quint8 begin = 0xF0;
+    const quint8 end = 0xF7;
+    const quint8 filler[256] = {};
+    engine.handleRawMIDIBytes(&begin, 1);
+    for (int i = 0; i < 8; ++i) {
+        engine.handleRawMIDIBytes(filler, sizeof(filler));
+    }
+    engine.handleRawMIDIBytes(&end, 1);
+    QCOMPARE(sysExSink.count, 1);
+    
+    // Cut short by a channel message, which still arrives
+    QSignalSpy channelSpy(&engine, &MidiEngine::channelMessageReceived);
+    const quint8 cut[] = {0xF0, 0x43, 0x10, 0x90, 0x3C, 0x64};
+    engine.handleRawMIDIBytes(cut, sizeof(cut));
+    QCOMPARE(channelSpy.count(), 1);
+    
+    const SysExBufferPool::Stats stats = engine.sysExStats();
+    QCOMPARE(stats.completed, quint64(1));
+    QCOMPARE(stats.truncated, quint64(1));
+    QCOMPARE(stats.interrupted, quint64(1));
+    QCOMPARE(stats.bufferSize, 1024);
+    
+    // Every buffer is back; an exhausted pool refuses instead of allocating
+    SysExBufferPool pool(2, 64);
+    const quint16 first = pool.acquire();
+    const quint16 second = pool.acquire();
+    QVERIFY(first != 0 && second != 0 && first != second);
+    QCOMPARE(pool.acquire(), quint16(0));
+    pool.release(first);
+    QCOMPARE(pool.acquire(), first);
+    
+    engine.setTransportSink(nullptr);
+    engine.setSysExSink(nullptr);
+}
+
+void SyncControllerTest::testTimeCodeDropFrameRoundTrip() {
+    // 29.97 drop-frame skips ;00 and ;01 at each minute but every tenth
+    const MtcTime lastOfMinute = {0, 0, 59, 29, MtcFrameRate::Fps2997Drop};
+    const qint64 frames = MidiTimeCode::frameCount(lastOfMinute);
+    QCOMPARE(frames, qint64(1799));
+    const MtcTime next = MidiTimeCode::timeForFrameCount(frames + 1, MtcFrameRate::Fps2997Drop);
+    QCOMPARE(next.minutes, 1);
+    QCOMPARE(next.seconds, 0);
+    QCOMPARE(next.frames, 2);
+    
+    const MtcTime tenMinutes = MidiTimeCode::timeForFrameCount(17982, MtcFrameRate::Fps2997Drop);
+    QCOMPARE(MidiTimeCode::toString(tenMinutes), QString("00:10:00;00"));
+    
+    // Every frame count over the first eleven minutes maps to a label and back
+    bool roundTrips = true;
+    for (qint64 count = 0; count < 11 * 60 * 30; ++count) {
+        const MtcTime time = MidiTimeCode::timeForFrameCount(count, MtcFrameRate::Fps2997Drop);
+        const bool dropped = time.seconds == 0 && time.frames < 2 && time.minutes % 10 != 0;
+        roundTrips = roundTrips && !dropped && MidiTimeCode::frameCount(time) == count;
+    }
+    QVERIFY(roundTrips);
+    
+    // The generator's bytes are the table entries, piece numbers included
+    MtcGenerator generator;
+    generator.start({1, 2, 3, 4, MtcFrameRate::Fps25});
+    const quint8 expected[8] = {0x04, 0x10, 0x23, 0x30, 0x42, 0x50, 0x61, 0x72};
+    bool bytesMatch = true;
+    for (quint8 byte : expected) {
+        bytesMatch = bytesMatch && generator.nextQuarterFrame() == byte;
+    }
+    QVERIFY(bytesMatch);
+    QCOMPARE(generator.nextQuarterFrame(), quint8(0x06)); // Next cycle: frame 6
+}
+
+void SyncControllerTest::testTimeCodeChaseInterpolatesAndRelocates() {
+    m_engine->setTransportSink(m_syncController);
+    
+    MtcGenerator generator;
+    generator.start({1, 2, 3, 4, MtcFrameRate::Fps25});
+    const MtcTime startTime = {1, 2, 3, 4, MtcFrameRate::Fps25};
+    const double startNs = MidiTimeCode::frameCount(startTime) * MidiTimeCode::frameNs(MtcFrameRate::Fps25);
+    const qint64 quarterFrameNs = 10000000; // 25 fps
+    
+    // 100 quarter frames through the engine, each up to 300 us off its grid
+    qint64 lastGridNs = 0;
+    const qint64 baseNs = m_clock->nowNanoseconds();
+    for (int k = 0; k < 100; ++k) {
+        lastGridNs = baseNs + k * quarterFrameNs;
+        const qint64 jitterNs = ((k * 7919) % 601 - 300) * 1000;
+        const quint8 message[2] = {0xF1, generator.nextQuarterFrame()};
+        m_engine->handleRawMIDIBytes(message, 2, lastGridNs + jitterNs);
+    }
+    
+    const MtcChaseState state = m_syncController->timeCodeState();
+    QVERIFY(state.locked);
+    QCOMPARE(state.rate, MtcFrameRate::Fps25);
+    QVERIFY(qAbs(state.speed - 1.0) < 0.01);
+    QCOMPARE(m_syncController->timeCodeRelocateCount(), quint64(0));
+    
+    // Between quarter frames the position keeps moving instead of stepping
+    const qint64 nowNs = lastGridNs + 5000000;
+    const double expectedNs = startNs + 99 * quarterFrameNs + 5000000;
+    QVERIFY(qAbs(m_syncController->timeCodePositionNs(nowNs) - expectedNs) < 1000000.0);
+    QCOMPARE(MidiTimeCode::toString(m_syncController->timeCodePosition(nowNs)), QString("01:02:04:03"));
+    
+    // A jump in the sender's time code relocates at the next full cycle
+    generator.start({2, 0, 0, 0, MtcFrameRate::Fps25});
+    for (int k = 100; k < 108; ++k) {
+        lastGridNs = baseNs + k * quarterFrameNs;
+        const quint8 message[2] = {0xF1, generator.nextQuarterFrame()};
+        m_engine->handleRawMIDIBytes(message, 2, lastGridNs);
+    }
+    QCOMPARE(m_syncController->timeCodeRelocateCount(), quint64(1));
+    QCOMPARE(MidiTimeCode::toString(m_syncController->timeCodePosition(lastGridNs)), QString("02:00:00:01"));
+    
+    m_engine->setTransportSink(nullptr);
+}
+
+void SyncControllerTest::testPortTableStableIdsAndRefresh() {
+    // Ports sharing a name get numbered IDs; lookups are by ID or name
+    const MidiPortTable outputs = MidiPortTable::fromNames({"IAC Driver Bus 1", "USB MIDI", "USB MIDI"});
+    QCOMPARE(outputs.ids(), QStringList({"IAC Driver Bus 1", "USB MIDI", "USB MIDI#2"}));
+    QVERIFY(outputs.findById("USB MIDI#2") != nullptr);
+    QCOMPARE(outputs.findById("USB MIDI#2")->index, 2);
+    QCOMPARE(outputs.findByName("USB MIDI")->index, 1);
+    QVERIFY(outputs.findById("Network Session 1") == nullptr);
+    
+    QSignalSpy outputSpy(m_engine, &MidiEngine::outputPortsRefreshed);
+    QSignalSpy inputSpy(m_engine, &MidiEngine::inputPortsRefreshed);
+    
+    MidiPortSnapshot snapshot;
+    snapshot.outputs = outputs;
+    snapshot.inputs = MidiPortTable::fromNames({"IAC Driver Bus 1"});
+    snapshot.cached = false;
+    m_engine->setPortSnapshot(snapshot);
+    QCOMPARE(outputSpy.count(), 1);
+    QCOMPARE(inputSpy.count(), 1);
+    QCOMPARE(m_engine->getOutputPorts(), outputs.names());
+    
+    // A custom-backend output is not a device port: a refresh leaves it open
+    QVERIFY(m_engine->addOutputPort("Recorder", std::unique_ptr<MidiOutputBackend>(new RecordingOutputBackend())));
+    
+    // The same ports again: nothing to announce
+    m_engine->setPortSnapshot(snapshot);
+    QCOMPARE(outputSpy.count(), 1);
+    QCOMPARE(inputSpy.count(), 1);
+    
+    // A device plugged in ahead of the others: indexes move, IDs stay
+    snapshot.outputs = MidiPortTable::fromNames({"Keystation", "IAC Driver Bus 1", "USB MIDI", "USB MIDI"});
+    m_engine->setPortSnapshot(snapshot);
+    QCOMPARE(outputSpy.count(), 2);
+    QCOMPARE(inputSpy.count(), 1);
+    QCOMPARE(m_engine->outputPortTable().findById("USB MIDI#2")->index, 3);
+    QVERIFY(m_engine->openOutputPorts().contains("Recorder"));
+    
+    m_engine->removeOutputPort("Recorder");
+}
+
+void SyncControllerTest::testSessionConfigFromJson() {
+    // Nothing given: auto-selected ports and a running clock at 120
+    MidiSessionConfig config;
+    QString error;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &config, &error));
+    QVERIFY(config.outputPort.isEmpty());
+    QVERIFY(config.startClock);
+    QCOMPARE(config.bpm, 120.0);
+    
+    QJsonObject offsets;
+    offsets["IAC Driver Bus 1"] = 12.5;
+    QJsonObject timeCode;
+    timeCode["enabled"] = true;
+    timeCode["rate"] = "29.97df";
+    QJsonObject stats;
+    stats["path"] = "/tmp/midimaster2.json";
+    stats["intervalMs"] = 250;
+    QJsonObject json;
+    json["output"] = "IAC Driver Bus 1";
+    json["input"] = "coremidi:-1234";
+    json["bpm"] = 98.5;
+    json["start"] = false;
+    json["latencyOffsetsMs"] = offsets;
+    json["timeCode"] = timeCode;
+    json["stats"] = stats;
+    QVERIFY(MidiSessionConfig::fromJson(json, &config, &error));
+    QCOMPARE(config.outputPort, QString("IAC Driver Bus 1"));
+    QCOMPARE(config.inputPort, QString("coremidi:-1234"));
+    QCOMPARE(config.bpm, 98.5);
+    QVERIFY(!config.startClock);
+    QCOMPARE(config.latencyOffsetsMs.value("IAC Driver Bus 1"), 12.5);
+    QVERIFY(config.timeCodeOutput);
+    QVERIFY(config.timeCodeRate == MtcFrameRate::Fps2997Drop);
+    QCOMPARE(config.statsPath, QString("/tmp/midimaster2.json"));
+    QCOMPARE(config.statsIntervalMs, 250);
+    
+    // Wrong types and ranges are refused with a message
+    QJsonObject badTempo;
+    badTempo["bpm"] = "fast";
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(badTempo, &rejected, &error));
+    QVERIFY(error.contains("bpm"));
+    badTempo["bpm"] = 900;
+    QVERIFY(!MidiSessionConfig::fromJson(badTempo, &rejected, &error));
+    
+    QJsonObject badRate;
+    timeCode["rate"] = "60";
+    badRate["timeCode"] = timeCode;
+    error.clear();
+    QVERIFY(!MidiSessionConfig::fromJson(badRate, &rejected, &error));
+    QVERIFY(error.contains("timeCode.rate"));
+    // A quoted boolean is refused rather than read as off
+    timeCode["rate"] = "25";
+    timeCode["enabled"] = "true";
+    badRate["timeCode"] = timeCode;
+    QVERIFY(!MidiSessionConfig::fromJson(badRate, &rejected, &error));
+    QVERIFY(error.contains("timeCode.enabled"));
+    
+    // The session's port fallback is unchanged from the window's
+    QCOMPARE(MidiSession::findAutoSelectPort({"Network Session 1", "USB MIDI", "IAC Driver Bus 1"}),
+             QString("IAC Driver Bus 1"));
+    QCOMPARE(MidiSession::findAutoSelectPort({"Network Session 1", "rtpMIDI"}), QString());
+}
+
+void SyncControllerTest::testSessionConfigClockFailover() {
+    QString error;
+    QJsonObject failover;
+    failover["enabled"] = true;
+    failover["backups"] = QJsonArray{"USB MIDI", "coremidi:-99"};
+    QJsonObject withFailover;
+    withFailover["clockFailover"] = failover;
+    MidiSessionConfig redundant;
+    QVERIFY(MidiSessionConfig::fromJson(withFailover, &redundant, &error));
+    QVERIFY(redundant.clockFailover);
+    QCOMPARE(redundant.backupInputs, QStringList({"USB MIDI", "coremidi:-99"}));
+    QCOMPARE(redundant.clockTimeoutPeriods, ClockArbiter::DEFAULT_TIMEOUT_PERIODS);
+    failover["timeoutPeriods"] = 1;
+    withFailover["clockFailover"] = failover;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withFailover, &rejected, &error));
+    QVERIFY(error.contains("clockFailover.timeoutPeriods"));
+    failover["timeoutPeriods"] = 3;
+    failover["enabled"] = "yes";
+    withFailover["clockFailover"] = failover;
+    QVERIFY(!MidiSessionConfig::fromJson(withFailover, &rejected, &error));
+    QVERIFY(error.contains("clockFailover.enabled"));
+}
+
+void SyncControllerTest::testSessionConfigLink() {
+    QString error;
+    QJsonObject linkMode;
+    linkMode["mode"] = "publish";
+    QJsonObject withLink;
+    withLink["link"] = linkMode;
+    MidiSessionConfig linked;
+    QVERIFY(MidiSessionConfig::fromJson(withLink, &linked, &error));
+    QVERIFY(linked.linkMode == LinkMode::Publish);
+    linkMode["mode"] = "lead";
+    withLink["link"] = linkMode;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withLink, &rejected, &error));
+    QVERIFY(error.contains("link.mode"));
+}
+
+void SyncControllerTest::testSessionConfigNetwork() {
+    QString error;
+    QJsonObject network;
+    network["enabled"] = true;
+    network["port"] = 5006;
+    QJsonObject withNetwork;
+    withNetwork["network"] = network;
+    MidiSessionConfig networked;
+    QVERIFY(MidiSessionConfig::fromJson(withNetwork, &networked, &error));
+    QVERIFY(networked.networkInput);
+    QCOMPARE(networked.networkPort, quint16(5006));
+    QCOMPARE(networked.networkName, QString("MidiMaster2"));
+    network["port"] = 65535; // Its data port would not fit
+    withNetwork["network"] = network;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withNetwork, &rejected, &error));
+    QVERIFY(error.contains("network.port"));
+    network["port"] = 5006;
+    network["enabled"] = "true";
+    withNetwork["network"] = network;
+    QVERIFY(!MidiSessionConfig::fromJson(withNetwork, &rejected, &error));
+    QVERIFY(error.contains("network.enabled"));
+}
+
+void SyncControllerTest::testSessionConfigCapture() {
+    QString error;
+    MidiSessionConfig defaults;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &defaults, &error));
+    QVERIFY(defaults.capture);
+    QVERIFY(defaults.capturePath.isEmpty());
+    QJsonObject capture;
+    capture["enabled"] = false;
+    QJsonObject withCapture;
+    withCapture["capture"] = capture;
+    MidiSessionConfig uncaptured;
+    QVERIFY(MidiSessionConfig::fromJson(withCapture, &uncaptured, &error));
+    QVERIFY(!uncaptured.capture);
+    capture["path"] = 7;
+    withCapture["capture"] = capture;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withCapture, &rejected, &error));
+    QVERIFY(error.contains("capture.path"));
+}
+
+void SyncControllerTest::testSessionConfigRealtime() {
+    QString error;
+    MidiSessionConfig defaults;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &defaults, &error));
+    QVERIFY(!defaults.realtime.isEnabled());
+    QJsonObject realtime;
+    realtime["enabled"] = true;
+    realtime["priority"] = 70;
+    realtime["cpus"] = QJsonArray{2, 3};
+    realtime["lockMemory"] = true;
+    QJsonObject withRealtime;
+    withRealtime["realtime"] = realtime;
+    MidiSessionConfig pinned;
+    QVERIFY(MidiSessionConfig::fromJson(withRealtime, &pinned, &error));
+    QVERIFY(pinned.realtime.schedulingPolicy);
+    QCOMPARE(pinned.realtime.priority, 70);
+    QCOMPARE(pinned.realtime.cpus, QVector<int>({2, 3}));
+    QVERIFY(pinned.realtime.lockMemory);
+    QVERIFY(!pinned.realtime.prefault);
+    realtime["priority"] = 100;
+    withRealtime["realtime"] = realtime;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withRealtime, &rejected, &error));
+    QVERIFY(error.contains("realtime.priority"));
+}
+
+void SyncControllerTest::testSessionConfigScheduledOutput() {
+    QString error;
+    MidiSessionConfig defaults;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &defaults, &error));
+    QVERIFY(!defaults.timestampedOutput);
+    QCOMPARE(defaults.clockLookaheadTicks, 24);
+    QJsonObject scheduled;
+    scheduled["enabled"] = true;
+    scheduled["lookaheadTicks"] = 48;
+    QJsonObject withScheduled;
+    withScheduled["scheduledOutput"] = scheduled;
+    MidiSessionConfig timestamped;
+    QVERIFY(MidiSessionConfig::fromJson(withScheduled, &timestamped, &error));
+    QVERIFY(timestamped.timestampedOutput);
+    QCOMPARE(timestamped.clockLookaheadTicks, 48);
+    scheduled["lookaheadTicks"] = 0;
+    withScheduled["scheduledOutput"] = scheduled;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withScheduled, &rejected, &error));
+    QVERIFY(error.contains("scheduledOutput.lookaheadTicks"));
+}
+
+void SyncControllerTest::testSessionConfigPattern() {
+    QString error;
+    MidiSessionConfig defaults;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &defaults, &error));
+    QVERIFY(!defaults.hasPattern);
+    QJsonObject hat;
+    hat["every"] = 24;
+    hat["note"] = 42;
+    hat["channel"] = 9;
+    QJsonObject sweep;
+    sweep["every"] = 48;
+    sweep["cc"] = 74;
+    sweep["values"] = QJsonArray({0, 64});
+    QJsonObject patternJson;
+    patternJson["bars"] = 1;
+    patternJson["events"] = QJsonArray({hat, sweep});
+    QJsonObject halved;
+    halved["divide"] = 2;
+    QJsonObject rates;
+    rates["Volca"] = halved;
+    QJsonObject withPattern;
+    withPattern["pattern"] = patternJson;
+    withPattern["clockRates"] = rates;
+    MidiSessionConfig patterned;
+    QVERIFY(MidiSessionConfig::fromJson(withPattern, &patterned, &error));
+    QVERIFY(patterned.hasPattern);
+    QCOMPARE(patterned.pattern.lengthTicks, 96);
+    QCOMPARE(patterned.pattern.events.size(), 6); // Four hats, two sweep steps
+    QCOMPARE(int(patterned.pattern.events.at(4).bytes[2]), 0);
+    QCOMPARE(int(patterned.pattern.events.at(5).bytes[2]), 64);
+    QCOMPARE(patterned.clockRates.value("Volca").multiplier, 1);
+    QCOMPARE(patterned.clockRates.value("Volca").divider, 2);
+    // Seventeen messages on one tick can't go out in a tick's batch
+    hat["every"] = 96;
+    QJsonArray crowded;
+    for (int i = 0; i < MidiOutputBatch::MAX_MESSAGES + 1; ++i) {
+        hat["note"] = 36 + i;
+        crowded.append(hat);
+    }
+    patternJson["events"] = crowded;
+    withPattern["pattern"] = patternJson;
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withPattern, &rejected, &error));
+    QVERIFY(error.contains("pattern"));
+}
+
+void SyncControllerTest::testSessionConfigZones() {
+    QString error;
+    MidiSessionConfig defaults;
+    QVERIFY(MidiSessionConfig::fromJson(QJsonObject(), &defaults, &error));
+    QVERIFY(defaults.zones.isEmpty());
+    QJsonObject stageZone;
+    stageZone["outputs"] = QJsonArray({"Stage 2"});
+    stageZone["bpm"] = 60;
+    QJsonObject mirrorZone;
+    mirrorZone["outputs"] = QJsonArray({"Monitor", "coremidi:-7"});
+    mirrorZone["follow"] = true;
+    QJsonObject withZones;
+    withZones["zones"] = QJsonArray({stageZone, mirrorZone});
+    MidiSessionConfig zoned;
+    QVERIFY(MidiSessionConfig::fromJson(withZones, &zoned, &error));
+    QCOMPARE(zoned.zones.size(), 2);
+    QCOMPARE(zoned.zones.at(0).outputs, QStringList({"Stage 2"}));
+    QCOMPARE(zoned.zones.at(0).bpm, 60.0);
+    QVERIFY(!zoned.zones.at(0).followInput);
+    QVERIFY(zoned.zones.at(0).startClock);
+    QVERIFY(zoned.zones.at(1).followInput);
+    QCOMPARE(zoned.zones.at(1).outputs.size(), 2);
+    mirrorZone["outputs"] = QJsonArray();
+    withZones["zones"] = QJsonArray({stageZone, mirrorZone});
+    MidiSessionConfig rejected;
+    QVERIFY(!MidiSessionConfig::fromJson(withZones, &rejected, &error));
+    QVERIFY(error.contains("zones[1].outputs"));
+}
+
+void SyncControllerTest::testClockArbiterFailsOverWithoutGap() {
+    // Two inputs with the same 120 BPM clock, the backup 20% of a period
+    // late; virtual time steps 1 ms at a time with the arbiter polled
+    // between clocks, as its thread would be woken
+    const qint64 periodNs = 20833333;
+    const qint64 backupLagNs = periodNs / 5;
+    const qint64 stepNs = 1000000;
+    VirtualClockSource clock;
+    RecordingTransportSink downstream;
+    ClockArbiter arbiter;
+    arbiter.setClockSource(&clock);
+    arbiter.setSink(&downstream);
+    MidiTransportSink *primary = arbiter.sourceSink(0);
+    MidiTransportSink *backup = arbiter.sourceSink(1);
+    
+    const qint64 startNs = clock.nowNanoseconds();
+    primary->midiStart(startNs);
+    backup->midiStart(startNs);
+    QCOMPARE(downstream.starts, 1);
+    QCOMPARE(arbiter.activeSource(), 0);
+    
+    // Ticks 0-99 on the primary, which drops out for ticks 100-199; the
+    // backup drops out for good at 250, and both are silent after that
+    auto primaryClocks = [](int tick) { return tick < 100 || (tick >= 200 && tick < 400); };
+    auto backupClocks = [](int tick) { return tick < 250; };
+    int failoverTick = -1;
+    int failbackTick = -1;
+    int internalTick = -1;
+    int primaryTick = 0;
+    int backupTick = 0;
+    while (primaryTick < 500) {
+        const qint64 nextNs = qMin(startNs + primaryTick * periodNs,
+                                   startNs + backupTick * periodNs + backupLagNs);
+        if (clock.nowNanoseconds() < nextNs) {
+            clock.setNanoseconds(qMin(nextNs, clock.nowNanoseconds() + stepNs));
+            arbiter.fireDue();
+            continue;
+        }
+        if (nextNs == startNs + primaryTick * periodNs) {
+            if (primaryClocks(primaryTick)) {
+                primary->midiClock(nextNs);
+            }
+            ++primaryTick;
+        } else {
+            if (backupClocks(backupTick)) {
+                backup->midiClock(nextNs);
+            }
+            ++backupTick;
+        }
+        
+        const int active = arbiter.activeSource();
+        if (active == 1 && failoverTick < 0) {
+            failoverTick = primaryTick;
+        } else if (active == 0 && failoverTick >= 0 && failbackTick < 0) {
+            failbackTick = primaryTick;
+        } else if (active == ClockArbiter::INTERNAL_SOURCE && internalTick < 0) {
+            internalTick = primaryTick;
+        }
+    }
+    
+    // Failover once the timeout (3 periods) ran out, failback after a
+    // quarter note of clean primary clocks, the internal grid last
+    QVERIFY(failoverTick > 100 && failoverTick <= 100 + 4);
+    QVERIFY(failbackTick >= 200 + ClockArbiter::RECOVERY_CLOCKS &&
+            failbackTick <= 200 + ClockArbiter::RECOVERY_CLOCKS + 1);
+    QVERIFY(internalTick > 400 && internalTick <= 400 + 4);
+    const ClockArbiter::Stats stats = arbiter.stats();
+    QCOMPARE(stats.activeSource, ClockArbiter::INTERNAL_SOURCE);
+    QCOMPARE(stats.failovers, quint64(2));
+    QCOMPARE(stats.failbacks, quint64(1));
+    QVERIFY(stats.holdoverClocks > 90);
+    
+    // Downstream: one tick per period throughout, never a gap and never
+    // more than the phase step between neighbours
+    QVERIFY(downstream.clocks.size() >= 495);
+    for (int i = 1; i < downstream.clocks.size(); ++i) {
+        const qint64 intervalNs = downstream.clocks[i] - downstream.clocks[i - 1];
+        QVERIFY2(qAbs(intervalNs - periodNs) <= periodNs * (ClockArbiter::MAX_PHASE_STEP + ClockArbiter::MAX_PERIOD_STEP),
+                 qPrintable(QString("Tick %1 came %2 ns after the previous").arg(i).arg(intervalNs)));
+    }
+    
+    const ClockArbiter::SourceHealth primaryHealth = arbiter.sourceHealth(0);
+    QCOMPARE(primaryHealth.state, ClockArbiter::SourceState::TimedOut);
+    QCOMPARE(primaryHealth.timeouts, quint64(2));
+    QCOMPARE(primaryHealth.clocks, quint64(300));
+    QVERIFY(!primaryHealth.active);
+    QVERIFY(qAbs(primaryHealth.bpm - 120.0) < 0.1);
+    const ClockArbiter::SourceHealth backupHealth = arbiter.sourceHealth(1);
+    QCOMPARE(backupHealth.clocks, quint64(250));
+    QCOMPARE(backupHealth.timeouts, quint64(1));
+    QVERIFY(backupHealth.mergedClocks > 90);
+    
+    // The followed source's Stop stops downstream; resetting a source
+    // forgets it
+    primary->midiStop(clock.nowNanoseconds());
+    QCOMPARE(downstream.stops, 1);
+    arbiter.resetSource(1);
+    QCOMPARE(arbiter.sourceHealth(1).state, ClockArbiter::SourceState::Idle);
+    QCOMPARE(arbiter.sourceHealth(1).clocks, quint64(0));
+}
+
+void SyncControllerTest::testLinkFollowLocksDownbeatsToSessionPhase() {
+    // A one-peer session at 120 BPM, joined 1.3 beats into its first bar
+    LocalLinkTimebase link(120.0, m_clock->nowNanoseconds());
+    m_clock->advance(llround(1.3 * 60.0e9 / 120.0));
+    m_syncController->setLinkTimebase(&link, LinkMode::Follow);
+    
+    // Every downbeat is handed over on a session bar line
+    QVector<DownbeatFire> fires;
+    connect(m_syncController, &SyncController::downbeatFired, this, [&](qint64 boundaryTimeNs) {
+        DownbeatFire fire = {m_clock->nowNanoseconds(), boundaryTimeNs};
+        fires.append(fire);
+        const double phase = link.capture().phaseAtTime(boundaryTimeNs > 0 ? boundaryTimeNs : fire.firedAtNs,
+                                                        LinkTimebase::QUANTUM);
+        QVERIFY2(qMin(phase, LinkTimebase::QUANTUM - phase) < 1.0e-5,
+                 qPrintable(QString("Downbeat %1 at session phase %2").arg(fires.size()).arg(phase)));
+    });
+    
+    m_syncController->start(true);
+    QCOMPARE(m_syncController->linkTimeline().bpm, 120.0);
+    
+    // The generator's loop on virtual time: due downbeats fire at their
+    // deadlines, then the tick at its own
+    qint64 previousNs = 0;
+    QVector<qint64> ticks;
+    auto runTicks = [&](int count) {
+        for (int i = 0; i < count; ++i) {
+            const qint64 deadlineNs = m_syncController->nextLinkTickNs(previousNs);
+            const qint64 boundaryNs = m_syncController->pendingBoundaryDeadline();
+            if (boundaryNs > 0 && boundaryNs <= deadlineNs) {
+                m_clock->setNanoseconds(qMax(boundaryNs, m_clock->nowNanoseconds()));
+                m_syncController->fireDueBoundary();
+            }
+            m_clock->setNanoseconds(deadlineNs);
+            m_syncController->handleLinkTick(deadlineNs);
+            ticks.append(deadlineNs);
+            previousNs = deadlineNs;
+        }
+    };
+    
+    // Quantized start: nothing until the session's next bar line (beat 4),
+    // which carries the first downbeat
+    runTicks(2 * 24);
+    QCOMPARE(fires.size(), 0);
+    QCOMPARE(m_syncController->getCurrentPositionQuarterNotes(), 0.0);
+    runTicks(24);
+    QCOMPARE(fires.size(), 1);
+    QCOMPARE(fires[0].boundaryTimeNs, qint64(0));
+    QVERIFY(qAbs(fires[0].firedAtNs - link.capture().timeAtBeat(4.0)) < 1000);
+    
+    // Incoming MIDI clock is not followed meanwhile
+    const int incoming = m_syncController->getIncomingClockCount();
+    m_syncController->midiClock(m_clock->nowNanoseconds());
+    QCOMPARE(m_syncController->getIncomingClockCount(), incoming);
+    
+    // Two bars, then a peer slows the session to 100 BPM mid-bar, then
+    // nudges its phase 0.1 beats on: both are followed within a tick and
+    // the downbeats stay on the session's bar lines
+    runTicks(2 * 96);
+    link.commitTempo(100.0, m_clock->nowNanoseconds() + 1);
+    runTicks(96 + 30);
+    QCOMPARE(m_syncController->currentBPM(), 100.0);
+    const LinkTimeline before = link.capture();
+    link.commitStart(before.beatAtTime(m_clock->nowNanoseconds() + 1) + 0.1, m_clock->nowNanoseconds() + 1);
+    runTicks(3 * 96);
+    QCOMPARE(fires.size(), 1 + 2 + 1 + 3);
+    for (int i = 1; i < fires.size(); ++i) {
+        QVERIFY(fires[i].boundaryTimeNs > fires[i].firedAtNs);
+    }
+    
+    // Clocks out never bunch: at least half a period apart through the
+    // tempo change and the phase nudge
+    for (int i = 1; i < ticks.size(); ++i) {
+        QVERIFY(ticks[i] - ticks[i - 1] >= llround(0.5 * ClockSchedule::periodNsForBPM(120.0)) - 1);
+    }
+    m_syncController->stop(false);
+    
+    // Publishing: the session takes this controller's tempo and transport
+    m_syncController->setLinkTimebase(&link, LinkMode::Publish);
+    m_syncController->setBPM(133.0);
+    QCOMPARE(link.capture().bpm, 133.0);
+    m_syncController->start(false);
+    const LinkTimeline published = link.capture();
+    QVERIFY(published.playing);
+    QVERIFY(qAbs(published.beatAtTime(m_clock->nowNanoseconds())) < 1.0e-9);
+    m_syncController->stop(false);
+    QVERIFY(!link.capture().playing);
+    m_syncController->setLinkTimebase(nullptr, LinkMode::Follow);
+    QCOMPARE(m_syncController->linkMode(), LinkMode::Off);
+}
+
+void SyncControllerTest::testNetworkInputPlaysOutOnSenderTimes() {
+    // An RTP-MIDI packet: header, then a command list with running status
+    // and delta times (a clock, two notes, a clock 128 ticks on)
+    const quint8 packet[] = {0x80, 0x61, 0x01, 0x02, 0x00, 0x00, 0x03, 0xE8, 0x12, 0x34, 0x56, 0x78,
+                             0x0B, 0xF8, 0x0A, 0x90, 0x3C, 0x64, 0x05, 0x3E, 0x64, 0x81, 0x00, 0xF8};
+    QVector<QVector<int>> parsed;
+    const int sequence = RtpMidiSession::parseMidiPacket(packet, sizeof(packet),
+        [&parsed](const quint8 *bytes, int size, quint32 ticks) {
+            QVector<int> event = {static_cast<int>(ticks)};
+            for (int i = 0; i < size; ++i) {
+                event.append(bytes[i]);
+            }
+            parsed.append(event);
+        });
+    QCOMPARE(sequence, 0x0102);
+    QCOMPARE(parsed.size(), 4);
+    QCOMPARE(parsed[0], QVector<int>({1000, 0xF8}));
+    QCOMPARE(parsed[1], QVector<int>({1010, 0x90, 0x3C, 0x64}));
+    QCOMPARE(parsed[2], QVector<int>({1015, 0x90, 0x3E, 0x64}));
+    QCOMPARE(parsed[3], QVector<int>({1143, 0xF8}));
+    QCOMPARE(RtpMidiSession::parseMidiPacket(packet, 8, [](const quint8 *, int, quint32) {}), -1);
+    
+    // Start and four bars of clock at 120 BPM, one packet each, over a
+    // link adding 3 ms plus up to 30 ms of jitter; packet 40 is overtaken
+    // by 41, packet 60 arrives twice and packet 70 never does
+    MidiEngine engine;
+    engine.setTransportSink(m_syncController);
+    JitterBuffer buffer;
+    const qint64 tickNs = llround(ClockSchedule::periodNsForBPM(120.0));
+    const qint64 originNs = m_clock->nowNanoseconds();
+    struct Arrival {
+        qint64 arrivalNs;
+        int packet;
+    };
+    QVector<Arrival> arrivals;
+    for (int i = 0; i <= 96; ++i) {
+        if (i == 70) {
+            continue;
+        }
+        const qint64 jitterNs = i == 40 ? 30000000 : i == 41 ? 0 : ((i * 37) % 13) * 2500000;
+        const qint64 arrivalNs = originNs + i * tickNs + 3000000 + jitterNs;
+        arrivals.append({arrivalNs, i});
+        if (i == 60) {
+            arrivals.append({arrivalNs + 1000000, i});
+        }
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+                     [](const Arrival &a, const Arrival &b) { return a.arrivalNs < b.arrivalNs; });
+    
+    QVector<qint64> released;
+    auto releaseUntil = [&](qint64 untilNs) {
+        while (buffer.nextPlayoutNs() > 0 && buffer.nextPlayoutNs() <= untilNs) {
+            m_clock->setNanoseconds(buffer.nextPlayoutNs());
+            buffer.releaseDue(m_clock->nowNanoseconds(), [&](const quint8 *bytes, int size, qint64 playoutNs) {
+                if (bytes[0] == 0xF8) {
+                    released.append(playoutNs);
+                }
+                engine.handleRawMIDIBytes(bytes, size, playoutNs);
+            });
+        }
+    };
+    for (const Arrival &arrival : arrivals) {
+        releaseUntil(arrival.arrivalNs);
+        m_clock->setNanoseconds(arrival.arrivalNs);
+        
+        // Sender time in RTP ticks, as the session thread sees it
+        const quint32 ticks = static_cast<quint32>((originNs + arrival.packet * tickNs) / RtpMidiSession::NS_PER_TICK);
+        quint8 data[14] = {0x80, 0x61, 0, static_cast<quint8>(arrival.packet), static_cast<quint8>(ticks >> 24),
+                           static_cast<quint8>(ticks >> 16), static_cast<quint8>(ticks >> 8),
+                           static_cast<quint8>(ticks), 0, 0, 0, 1, 0x01,
+                           static_cast<quint8>(arrival.packet == 0 ? 0xFA : 0xF8)};
+        if (!buffer.packetArrived(static_cast<quint16>(arrival.packet), qint64(ticks) * RtpMidiSession::NS_PER_TICK,
+                                  arrival.arrivalNs)) {
+            continue;
+        }
+        RtpMidiSession::parseMidiPacket(data, sizeof(data), [&](const quint8 *bytes, int size, quint32 eventTicks) {
+            buffer.push(bytes, size, qint64(eventTicks) * RtpMidiSession::NS_PER_TICK, arrival.arrivalNs);
+        });
+    }
+    releaseUntil(std::numeric_limits<qint64>::max());
+    
+    // The controller hears the sender's intervals (to the 100 µs RTP
+    // resolution) once the buffer has seen the worst jitter, not the
+    // link's; nothing was late, and the lost clock is just missing
+    const JitterBuffer::Stats stats = buffer.stats();
+    QCOMPARE(stats.packets, quint64(96));
+    QCOMPARE(stats.reordered, quint64(1));
+    QCOMPARE(stats.duplicates, quint64(1));
+    QCOMPARE(stats.lost, quint64(1));
+    QCOMPARE(stats.lateEvents, quint64(0));
+    QVERIFY(qAbs(stats.jitterNs - 30000000) <= RtpMidiSession::NS_PER_TICK);
+    QVERIFY(qAbs(stats.depthNs - (stats.jitterNs + JitterBuffer::DEPTH_MARGIN_NS)) <= RtpMidiSession::NS_PER_TICK);
+    QCOMPARE(stats.buffered, 0);
+    QCOMPARE(released.size(), 95);
+    for (int i = 8; i < released.size(); ++i) {
+        const qint64 expectedNs = (i == 69 ? 2 : 1) * tickNs; // Across the gap packet 70 left
+        QVERIFY2(qAbs(released[i] - released[i - 1] - expectedNs) <= RtpMidiSession::NS_PER_TICK,
+                 qPrintable(QString("Clock %1 interval %2 ns").arg(i).arg(released[i] - released[i - 1])));
+    }
+    QVERIFY(m_syncController->isRunning());
+    QCOMPARE(m_syncController->getIncomingClockCount(), 95);
+    
+    // A packet held up past the playout delay goes out at once, counted
+    const qint64 lateSenderNs = originNs + 97 * tickNs;
+    const qint64 lateArrivalNs = lateSenderNs + 3000000 + 50000000;
+    m_clock->setNanoseconds(lateArrivalNs);
+    QVERIFY(buffer.packetArrived(97, lateSenderNs, lateArrivalNs));
+    const quint8 clock = 0xF8;
+    QVERIFY(buffer.push(&clock, 1, lateSenderNs, lateArrivalNs));
+    QCOMPARE(buffer.stats().lateEvents, quint64(1));
+    QCOMPARE(buffer.nextPlayoutNs(), lateArrivalNs);
+    releaseUntil(lateArrivalNs);
+    QCOMPARE(m_syncController->getIncomingClockCount(), 96);
+    
+    engine.setTransportSink(nullptr);
+}
+
 QTEST_MAIN(SyncControllerTest)
+void SyncControllerTest::testCaptureRecordsAndReplaysTraffic() {
+    // Record: Start, half a bar of clock and a note in, one message out
+    const QString path = QDir::tempPath() + "/midimaster2-test.mm2cap";
+    const qint64 tickNs = llround(ClockSchedule::periodNsForBPM(120.0));
+    const qint64 startNs = 1000000000;
+    {
+        MidiEngine engine;
+        RecordingOutputBackend backend;
+        engine.setOutputBackend(&backend);
+        QVERIFY(engine.startCapture(path));
+        QVERIFY(engine.capture().isCapturing());
+        
+        const quint8 start = 0xFA;
+        const quint8 clock = 0xF8;
+        const quint8 noteOn[] = {0x92, 0x40, 0x64};
+        engine.handleRawMIDIBytes(&start, 1, startNs);
+        for (int i = 1; i <= 24; ++i) {
+            engine.handleRawMIDIBytes(&clock, 1, startNs + i * tickNs);
+        }
+        engine.handleRawMIDIBytes(noteOn, 3, startNs + 24 * tickNs);
+        const unsigned char stop = 0xFC;
+        engine.sendMessage(&stop, 1);
+        
+        engine.stopCapture();
+        QVERIFY(!engine.capture().isCapturing());
+        QCOMPARE(engine.capture().stats().records, quint64(27));
+        QCOMPARE(engine.capture().stats().dropped, quint64(0));
+        QCOMPARE(backend.count, 1);
+    }
+    
+    QString error;
+    std::unique_ptr<MidiCaptureFile> capture = MidiCaptureFile::open(path, &error);
+    QVERIFY2(capture, qPrintable(error));
+    QCOMPARE(capture->count(), quint64(27));
+    QCOMPARE(int(capture->at(0).kind), int(MidiCaptureRecord::Input));
+    QCOMPARE(int(capture->at(0).bytes[0]), 0xFA);
+    QCOMPARE(capture->at(0).timestampNs, startNs);
+    QCOMPARE(capture->at(24).timestampNs, startNs + 24 * tickNs);
+    const MidiCaptureRecord &note = capture->at(25);
+    QCOMPARE(int(note.size), 3);
+    QCOMPARE(int(note.bytes[0]), 0x92);
+    QCOMPARE(int(note.bytes[2]), 0x64);
+    QCOMPARE(int(capture->at(26).kind), int(MidiCaptureRecord::Output));
+    QCOMPARE(int(capture->at(26).bytes[0]), 0xFC);
+    QVERIFY(capture->at(26).timestampNs > capture->header().startNs);
+    capture.reset();
+    
+    // Replay at 64x through the input pipeline: the same stream,
+    // compressed, with the replay times as its timestamps
+    {
+        MidiEngine engine;
+        RecordingTransportSink sink;
+        engine.setTransportSink(&sink);
+        engine.setProcessingMode(MidiEngine::ProcessingMode::RealtimeThread);
+        QVERIFY(engine.startCaptureReplay(path, 64.0, &error));
+        QVERIFY(engine.isReplayingCapture());
+        QElapsedTimer timeout;
+        timeout.start();
+        while (engine.isReplayingCapture() && timeout.elapsed() < 5000) {
+            QThread::msleep(5);
+        }
+        QVERIFY(!engine.isReplayingCapture());
+        QThread::msleep(20);
+        engine.stopCaptureReplay();
+        engine.setTransportSink(nullptr);
+        
+        QCOMPARE(sink.starts, 1);
+        QCOMPARE(sink.clocks.size(), 24);
+        const qint64 firstNs = llround(tickNs / 64.0);
+        for (int i = 0; i < sink.clocks.size(); ++i) {
+            const qint64 expectedNs = llround((i + 1) * tickNs / 64.0) - firstNs;
+            QVERIFY(qAbs(sink.clocks.at(i) - sink.clocks.first() - expectedNs) <= 1);
+        }
+    }
+    QVERIFY(QFile::remove(path));
+}
+
+void SyncControllerTest::testRealtimeProfileReportsEachSetting() {
+    // Whether the policy is granted depends on the machine (privileges,
+    // RLIMIT_RTPRIO); that each setting is tried and reported does not
+    RealtimeProfile profile;
+    profile.schedulingPolicy = true;
+    profile.cpus = {0};
+    profile.prefault = true;
+    const RealtimeScheduling::ProcessReport process = RealtimeScheduling::setProfile(profile);
+    QVERIFY(process.memoryLock == RealtimeScheduling::Grant::NotRequested);
+    
+    const RealtimeScheduling::ThreadReport probed = RealtimeScheduling::probe(RealtimeThreadRole::Clock);
+    QVERIFY(probed.started);
+    QVERIFY(probed.policy != RealtimeScheduling::Grant::NotRequested);
+    QVERIFY(probed.affinity != RealtimeScheduling::Grant::NotRequested);
+    QVERIFY(probed.affinity != RealtimeScheduling::Grant::Granted || probed.cpu == 0);
+    const QString line = RealtimeScheduling::describe(RealtimeThreadRole::Clock, probed);
+    QVERIFY(line.startsWith("clock thread: "));
+    QVERIFY(line.contains("CPU 0"));
+    // A probe is not the thread itself
+    QVERIFY(!RealtimeScheduling::threadReport(RealtimeThreadRole::Clock).started);
+    
+    // The clock thread applies it as it starts, and prefaults its stack
+    const quint64 prefaultedBefore = RealtimeScheduling::processReport().prefaultedBytes;
+    MidiClockGenerator generator;
+    generator.setTickCallback([](qint64) {});
+    generator.startClock();
+    generator.stopClock();
+    const RealtimeScheduling::ThreadReport applied = RealtimeScheduling::threadReport(RealtimeThreadRole::Clock);
+    QVERIFY(applied.started);
+    QVERIFY(applied.policy == probed.policy);
+    QVERIFY(applied.affinity == probed.affinity);
+    QCOMPARE(RealtimeScheduling::processReport().prefaultedBytes,
+             prefaultedBefore + RealtimeScheduling::STACK_PREFAULT_BYTES);
+    
+    // Prefaulting leaves the memory as it was
+    quint8 buffer[3 * 4096 + 100];
+    for (std::size_t i = 0; i < sizeof(buffer); ++i) {
+        buffer[i] = static_cast<quint8>(i * 7);
+    }
+    QCOMPARE(RealtimeScheduling::prefault(buffer + 1, sizeof(buffer) - 1), quint64(sizeof(buffer) - 1));
+    for (std::size_t i = 0; i < sizeof(buffer); ++i) {
+        QCOMPARE(buffer[i], static_cast<quint8>(i * 7));
+    }
+    
+    RealtimeScheduling::setProfile(RealtimeProfile());
+}
+
+void SyncControllerTest::testLookaheadClockIsScheduledAhead() {
+    // A scheduling port gets scheduled batches as soon as they are queued:
+    // presentation time minus the offset, or the send time itself, and
+    // the cancel in order with the traffic around it
+    MidiEngine engine;
+    SchedulingOutputBackend *backend = new SchedulingOutputBackend();
+    QVERIFY(engine.addOutputPort("scheduled", std::unique_ptr<MidiOutputBackend>(backend)));
+    QVERIFY(engine.setOutputLatencyOffset("scheduled", 10.0));
+    const qint64 presentAt = MidiTime::nowNanoseconds() + 1000000000;
+    MidiOutputBatch note;
+    note.noteOn(0, 60, 100);
+    engine.scheduleBatch(note, presentAt);
+    MidiOutputBatch clock;
+    clock.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+    engine.sendBatchAt(clock, presentAt);
+    engine.cancelScheduledOutput();
+    engine.sendSystemMessage(drumstick::rt::MIDI_REALTIME_STOP);
+    QTRY_COMPARE_WITH_TIMEOUT(backend->count.load(std::memory_order_acquire), 4, 1000);
+    QCOMPARE(int(backend->events[0].status), 0x90);
+    QCOMPARE(backend->events[0].deliverAt, presentAt - 10000000);
+    QCOMPARE(int(backend->events[1].status), 0xF8);
+    QCOMPARE(backend->events[1].deliverAt, presentAt);
+    QVERIFY(backend->events[1].calledAt < presentAt - 500000000); // Not held until due
+    QCOMPARE(int(backend->events[2].status), 0);
+    QCOMPARE(int(backend->events[3].status), 0xFC);
+    QCOMPARE(backend->events[3].deliverAt, qint64(0));
+    QVERIFY(engine.outputPortStats().at(0).timestamped);
+    
+    // The controller a beat ahead at 240 BPM: each clock handed over up
+    // to a lookahead early for its own deadline, one period apart
+    backend->count.store(0);
+    SyncController controller(&engine);
+    controller.setClockLookaheadTicks(24);
+    controller.setBPM(240.0);
+    controller.start(true);
+    QThread::msleep(200); // The first burst, and the one half a lookahead before it runs out
+    controller.stop(true);
+    const qint64 stoppedAt = MidiTime::nowNanoseconds();
+    QTRY_VERIFY_WITH_TIMEOUT(backend->count.load(std::memory_order_acquire) > 0 &&
+        backend->events[backend->count.load(std::memory_order_acquire) - 1].status == 0xFC, 1000);
+    
+    const int events = backend->count.load(std::memory_order_acquire);
+    const double periodNs = ClockSchedule::periodNsForBPM(240.0);
+    const qint64 lookaheadNs = llround(24 * periodNs);
+    QCOMPARE(int(backend->events[0].status), 0xFA); // Start, at once
+    int clocks = 0;
+    int cancelAt = -1;
+    qint64 previousDeliverAt = 0;
+    bool scheduledPastStop = false;
+    for (int i = 1; i < events; ++i) {
+        const SchedulingOutputBackend::Event &event = backend->events[i];
+        if (event.status == 0xF8) {
+            QVERIFY(cancelAt < 0);
+            QVERIFY(event.deliverAt > event.calledAt);
+            QVERIFY(event.deliverAt - event.calledAt <= lookaheadNs + 2000000);
+            if (previousDeliverAt > 0) {
+                QVERIFY(qAbs(event.deliverAt - previousDeliverAt - periodNs) < 1000.0);
+            }
+            previousDeliverAt = event.deliverAt;
+            scheduledPastStop = scheduledPastStop || event.deliverAt > stoppedAt;
+            ++clocks;
+        } else if (event.status == 0) {
+            cancelAt = i;
+        }
+    }
+    QVERIFY(clocks > 24);
+    QVERIFY(scheduledPastStop);
+    // Stopping: what is still scheduled is dropped, then Note Off and Stop
+    QCOMPARE(cancelAt, events - 3);
+    QCOMPARE(int(backend->events[events - 2].status), 0x80);
+    QCOMPARE(backend->events[events - 1].deliverAt, qint64(0));
+}
+
+void SyncControllerTest::testPatternPlaysPrecompiledTicks() {
+    // Compiling: one row per tick, Note Offs first, swing resolved to
+    // whole ticks (0.66 over 16ths moves the off 16th 2 ticks later)
+    MidiPattern pattern;
+    pattern.lengthTicks = 24;
+    pattern.swing = 0.66;
+    pattern.addNote(0, 24, 9, 36, 110);    // Whole pattern: released as it retriggers
+    pattern.addNote(6, 3, 9, 42, 80);      // Swung to tick 8
+    pattern.addControlChange(12, 0, 74, 100);
+    pattern.addProgramChange(0, 1, 5);
+    QString error;
+    std::unique_ptr<CompiledPattern> compiled = CompiledPattern::compile(pattern, &error);
+    QVERIFY2(compiled, qPrintable(error));
+    QCOMPARE(compiled->lengthTicks(), 24);
+    MidiOutputBatch row;
+    QCOMPARE(compiled->appendTick(24 * 5, row), 3); // Indexed by clock count mod length
+    QCOMPARE(int(row.at(0).bytes[0]), 0x89);
+    QCOMPARE(int(row.at(1).bytes[0]), 0x99);
+    QCOMPARE(int(row.at(2).bytes[0]), 0xC1);
+    QCOMPARE(compiled->rowSize(6), 0);
+    QCOMPARE(compiled->rowSize(8), 1);
+    QCOMPARE(compiled->rowSize(11), 1);           // Its Note Off
+    QCOMPARE(compiled->rowSize(12), 1);
+    MidiOutputBatch release;
+    compiled->appendTailNoteOffs(release);
+    QCOMPARE(release.count(), 1);                 // The long note wraps
+    QCOMPARE(compiled->noteCount(), 2);
+    pattern.lengthTicks = 0;
+    QVERIFY(!CompiledPattern::compile(pattern, &error));
+    
+    // Playing: the controller at 240 BPM with a one-beat pattern in place
+    // of the downbeat note, each row scheduled for its own tick
+    MidiEngine engine;
+    SchedulingOutputBackend *backend = new SchedulingOutputBackend();
+    QVERIFY(engine.addOutputPort("pattern", std::unique_ptr<MidiOutputBackend>(backend)));
+    QVERIFY(engine.setOutputLatencyOffset("pattern", 10.0));
+    MidiPattern click;
+    click.lengthTicks = 24;
+    click.addNote(0, 6, 9, 37, 100);
+    click.addControlChange(12, 0, 1, 64);
+    SyncController controller(&engine);
+    QVERIFY(controller.setPattern(click, &error));
+    controller.setBPM(240.0);
+    controller.start(true);
+    QThread::msleep(600);
+    // A new pattern waits for the beat
+    MidiPattern accent;
+    accent.lengthTicks = 24;
+    accent.addProgramChange(0, 0, 7);
+    QVERIFY(controller.setPattern(accent, &error));
+    QThread::msleep(400);
+    controller.stop(true);
+    QTRY_VERIFY_WITH_TIMEOUT(backend->count.load(std::memory_order_acquire) > 0 &&
+        backend->events[backend->count.load(std::memory_order_acquire) - 1].status == 0xFC, 1000);
+    QCOMPARE(controller.patternSwitchCount(), quint64(2));
+    
+    const int events = backend->count.load(std::memory_order_acquire);
+    const double beatNs = 24 * ClockSchedule::periodNsForBPM(240.0);
+    qint64 firstNoteAt = 0;
+    qint64 previousNoteAt = 0;
+    qint64 programAt = 0;
+    int notes = 0;
+    int controls = 0;
+    int cancelAt = -1;
+    for (int i = 0; i < events; ++i) {
+        const SchedulingOutputBackend::Event &event = backend->events[i];
+        if (event.status == 0x99) {
+            QVERIFY(programAt == 0);
+            if (previousNoteAt > 0) {
+                QVERIFY(qAbs(event.deliverAt - previousNoteAt - beatNs) < 5000.0);
+            } else {
+                firstNoteAt = event.deliverAt;
+            }
+            previousNoteAt = event.deliverAt;
+            ++notes;
+        } else if (event.status == 0xB0) {
+            QVERIFY(qAbs(event.deliverAt - previousNoteAt - beatNs / 2) < 5000.0);
+            ++controls;
+        } else if (event.status == 0xC0 && programAt == 0) {
+            programAt = event.deliverAt;
+        } else if (event.status == 0) {
+            cancelAt = i;
+        }
+        QVERIFY(event.status != 0x90); // No downbeat note
+    }
+    QVERIFY(notes >= 2);
+    QVERIFY(controls >= 2);
+    // The switch landed on a beat of the old pattern
+    QVERIFY(programAt > 0);
+    const double beats = (programAt - firstNoteAt) / beatNs;
+    QVERIFY(qAbs(beats - std::round(beats)) < 0.001);
+    // Stopping drops the rows still held, then Stop
+    QVERIFY(cancelAt > 0);
+    QCOMPARE(int(backend->events[events - 1].status), 0xFC);
+    
+    // Clock rates per device: halved passes every other clock, doubled
+    // adds one halfway to the next (spaced as the last interval)
+    MidiEngine rates;
+    SchedulingOutputBackend *halved = new SchedulingOutputBackend();
+    SchedulingOutputBackend *doubled = new SchedulingOutputBackend();
+    QVERIFY(rates.addOutputPort("halved", std::unique_ptr<MidiOutputBackend>(halved)));
+    QVERIFY(rates.addOutputPort("doubled", std::unique_ptr<MidiOutputBackend>(doubled)));
+    QVERIFY(rates.setOutputClockRate("halved", 1, 2));
+    QVERIFY(rates.setOutputClockRate("doubled", 2, 1));
+    rates.sendSystemMessage(drumstick::rt::MIDI_REALTIME_START);
+    const qint64 baseNs = MidiTime::nowNanoseconds() + 1000000000;
+    const qint64 intervalNs = 20000000;
+    for (int i = 0; i < 4; ++i) {
+        MidiOutputBatch clock;
+        clock.systemMessage(drumstick::rt::MIDI_REALTIME_CLOCK);
+        rates.sendBatchAt(clock, baseNs + i * intervalNs);
+    }
+    rates.sendSystemMessage(drumstick::rt::MIDI_REALTIME_STOP);
+    QTRY_COMPARE_WITH_TIMEOUT(halved->count.load(std::memory_order_acquire), 4, 1000);
+    QTRY_COMPARE_WITH_TIMEOUT(doubled->count.load(std::memory_order_acquire), 10, 1000);
+    QCOMPARE(halved->events[1].deliverAt, baseNs);
+    QCOMPARE(halved->events[2].deliverAt, baseNs + 2 * intervalNs);
+    QCOMPARE(int(halved->events[3].status), 0xFC);
+    for (int i = 1; i <= 7; ++i) {
+        QCOMPARE(int(doubled->events[i].status), 0xF8);
+        QCOMPARE(doubled->events[i].deliverAt, baseNs + (i == 1 ? 0 : (i - 1) * intervalNs / 2 + intervalNs / 2));
+    }
+    QCOMPARE(int(doubled->events[8].status), 0);    // Extra clocks held past the Stop dropped
+    QCOMPARE(int(doubled->events[9].status), 0xFC);
+    QCOMPARE(rates.outputPortStats().at(1).clockMultiplier, 2);
+}
+
+void SyncControllerTest::testTempoZonesShareOneEngine() {
+    // Two zones follow the input from one parse, a third masters its own
+    // tempo, and each drives only the port in its zone
+    MidiEngine engine;
+    std::atomic<int> mainClocks(0), mainNotes(0), stageClocks(0), stageNotes(0), standbyClocks(0), standbyNotes(0);
+    QVERIFY(engine.addOutputPort("main", std::unique_ptr<MidiOutputBackend>(
+        new CountingOutputBackend(&mainClocks, &mainNotes, 0))));
+    QVERIFY(engine.addOutputPort("stage", std::unique_ptr<MidiOutputBackend>(
+        new CountingOutputBackend(&stageClocks, &stageNotes, 0))));
+    QVERIFY(engine.addOutputPort("standby", std::unique_ptr<MidiOutputBackend>(
+        new CountingOutputBackend(&standbyClocks, &standbyNotes, 0))));
+    QVERIFY(engine.setOutputPortZones("main", MidiOutputZone::forZone(0)));
+    QVERIFY(engine.setOutputPortZones("stage", MidiOutputZone::forZone(1)));
+    QVERIFY(engine.setOutputPortZones("standby", MidiOutputZone::forZone(2)));
+    QVERIFY(!engine.setOutputPortZones("missing", MidiOutputZone::All));
+    
+    // Each zone's emission advance is its own ports' largest offset
+    QVERIFY(engine.setOutputLatencyOffset("main", 5.0));
+    QVERIFY(engine.setOutputLatencyOffset("stage", 20.0));
+    QVERIFY(engine.setOutputLatencyOffset("standby", 10.0));
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(MidiOutputZone::forZone(0)), 5.0);
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(MidiOutputZone::forZone(1)), 20.0);
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(), 20.0);
+    QCOMPARE(engine.maxOutputLatencyOffsetMs(MidiOutputZone::forZone(5)), MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS);
+    
+    SyncController follower(&engine);
+    SyncController stage(&engine);
+    SyncController standby(&engine);
+    follower.setOutputZone(0);
+    stage.setOutputZone(1);
+    standby.setOutputZone(2);
+    QCOMPARE(stage.outputZone(), 1);
+    engine.setTransportSink(&follower);
+    QVERIFY(engine.addTransportSink(&stage));
+    QVERIFY(!engine.addTransportSink(&stage));
+    QCOMPARE(engine.transportSinkCount(), 2);
+    QVERIFY(engine.transportSink() == &follower);
+    
+    // One parse of the DAW's start and clock reaches both followers
+    const double periodNs = ClockSchedule::periodNsForBPM(100.0);
+    const qint64 start = MidiTime::nowNanoseconds() - 1000000000LL;
+    const quint8 startByte = 0xFA;
+    const quint8 clockByte = 0xF8;
+    engine.handleRawMIDIBytes(&startByte, 1, start);
+    for (int i = 1; i <= 48; ++i) {
+        engine.handleRawMIDIBytes(&clockByte, 1, start + llround(i * periodNs));
+    }
+    QCOMPARE(follower.getIncomingClockCount(), 48);
+    QCOMPARE(stage.getIncomingClockCount(), 48);
+    QCOMPARE(standby.getIncomingClockCount(), 0);
+    QVERIFY(qAbs(follower.currentBPM() - 100.0) < 0.1);
+    QVERIFY(qAbs(stage.currentBPM() - 100.0) < 0.1);
+    
+    // Each follower's first downbeat goes to its own port only
+    QTRY_COMPARE_WITH_TIMEOUT(mainNotes.load(), 1, 1000);
+    QTRY_COMPARE_WITH_TIMEOUT(stageNotes.load(), 1, 1000);
+    
+    // The master zone keeps its own tempo and clock, on its port alone
+    standby.setBPM(180.0);
+    standby.start(true);
+    QTRY_VERIFY_WITH_TIMEOUT(standbyClocks.load() >= 4, 1000);
+    QVERIFY(qAbs(standby.currentBPM() - 180.0) < 0.1);
+    QVERIFY(qAbs(follower.currentBPM() - 100.0) < 0.1);
+    standby.stop(false);
+    QCOMPARE(mainClocks.load(), 0);
+    QCOMPARE(stageClocks.load(), 0);
+    QCOMPARE(mainNotes.load(), 1);
+    QCOMPARE(stageNotes.load(), 1);
+    
+    // A zone taken off the input hears nothing more
+    engine.removeTransportSink(&stage);
+    QCOMPARE(engine.transportSinkCount(), 1);
+    engine.handleRawMIDIBytes(&clockByte, 1, start + llround(49 * periodNs));
+    QCOMPARE(follower.getIncomingClockCount(), 49);
+    QCOMPARE(stage.getIncomingClockCount(), 48);
+    
+    engine.setTransportSink(nullptr);
+    QCOMPARE(engine.transportSinkCount(), 0);
+    follower.stop(false);
+    stage.stop(false);
+}
+
+void SyncControllerTest::testUmpInputTimesClockByJrTimestamps() {
+    // MIDI 2.0 channel voice scales down to MIDI 1.0 and back, both ends
+    // and the center exact
+    QCOMPARE(Ump::scaleUp(127, 7, 16), quint32(0xFFFF));
+    QCOMPARE(Ump::scaleUp(64, 7, 16), quint32(0x8000));
+    QCOMPARE(Ump::scaleUp(0x2000, 14, 32), quint32(0x80000000));
+    const quint8 noteOn[3] = {0x91, 60, 100};
+    UmpPacket packet;
+    QVERIFY(Ump::fromMidi1(noteOn, 3, 0, Ump::Protocol::Midi2, &packet));
+    QCOMPARE(packet.wordCount, quint8(2));
+    QCOMPARE(packet.words[0], quint32(0x40913C00));
+    MidiMessage messages[Ump::MAX_MIDI1_MESSAGES];
+    QCOMPARE(Ump::toMidi1(packet, messages), 1);
+    QVERIFY(messages[0].size == 3 && messages[0].bytes[0] == 0x91 && messages[0].bytes[1] == 60
+            && messages[0].bytes[2] == 100);
+    const quint8 released[3] = {0x91, 60, 0};
+    QVERIFY(Ump::fromMidi1(released, 3, 0, Ump::Protocol::Midi2, &packet));
+    QCOMPARE((packet.words[0] >> 20) & 0x0F, quint32(0x8)); // Note Off
+
+    // Words split anywhere; SysEx7 reassembled; no MIDI 1.0 form counted
+    struct Collector {
+        QVector<MidiMessage> *messages;
+        QByteArray *sysEx;
+        void operator()(const MidiMessage &message) { messages->append(message); }
+        void operator()(const SysExMessage &message) {
+            *sysEx = QByteArray(reinterpret_cast<const char *>(message.data), message.size);
+        }
+    };
+    QVector<MidiMessage> decoded;
+    QByteArray sysEx;
+    SysExBufferPool pool(4, 64);
+    UmpStreamDecoder decoder;
+    decoder.setSysExPool(&pool);
+    decoder.decode(packet.words, 1, 1000, Collector{&decoded, &sysEx});
+    QVERIFY(decoded.isEmpty());
+    decoder.decode(packet.words + 1, 1, 1000, Collector{&decoded, &sysEx});
+    QCOMPARE(decoded.size(), 1);
+    QCOMPARE(decoded[0].bytes[0], quint8(0x81));
+    const quint32 stream[] = {
+        0x30167E7F, 0x06010203, // SysEx7 start, 6 bytes
+        0x30320405, 0x00000000, // End, 2 bytes
+        0xF0000000, 0, 0, 0     // Stream message: no MIDI 1.0 form
+    };
+    decoder.decode(stream, 8, 2000, Collector{&decoded, &sysEx});
+    QCOMPARE(sysEx, QByteArray("\xF0\x7E\x7F\x06\x01\x02\x03\x04\x05\xF7", 10));
+    QCOMPARE(decoder.stats().untranslated, quint64(1));
+    QCOMPARE(pool.stats().completed, quint64(1));
+
+    // Clock behind JR Timestamps: the tracker hears the sender's intervals
+    // (to the 32 us JR resolution), not the transport's up to 1 ms delays
+    m_engine->setTransportSink(m_syncController);
+    const double periodNs = ClockSchedule::periodNsForBPM(120.0);
+    const qint64 baseNs = m_clock->nowNanoseconds();
+    const qint64 senderBaseNs = 5000000000LL;
+    auto arrivalNs = [&](int i) {
+        return baseNs + llround(i * periodNs) + ((i * 7919) % 1001) * 1000;
+    };
+    for (int i = 0; i <= 48; ++i) {
+        const quint16 ticks = Ump::jrTicks(senderBaseNs + llround(i * periodNs));
+        const quint32 words[2] = {Ump::utility(Ump::JrTimestamp, ticks).words[0], i == 0 ? 0x10FA0000u : 0x10F80000u};
+        m_engine->handleUmpWords(words, 2, arrivalNs(i));
+    }
+    QVERIFY(qAbs(m_syncController->currentBPM() - 120.0) < 0.1);
+    QVERIFY(m_syncController->transportState().tempoJitterNs < 100000.0);
+    QCOMPARE(m_engine->umpInputStats().jrTimestamped, quint64(49));
+    QVERIFY(m_engine->umpInputStats().jrJitterNs > 900000);
+
+    // The same arrivals without the stamps keep the transport's jitter
+    SyncController unstamped(nullptr);
+    m_engine->setTransportSink(&unstamped);
+    for (int i = 0; i <= 48; ++i) {
+        const quint32 word = i == 0 ? 0x10FA0000u : 0x10F80000u;
+        m_engine->handleUmpWords(&word, 1, arrivalNs(i) + 1000000000LL);
+    }
+    QVERIFY(unstamped.transportState().tempoJitterNs > 200000.0);
+    m_engine->setTransportSink(nullptr);
+    unstamped.stop(false);
+
+    // A UMP port gets a JR Clock, then a JR Timestamp before each message
+    struct RecordingUmpBackend : UmpOutputBackend {
+        explicit RecordingUmpBackend(Ump::Protocol protocol) : UmpOutputBackend(protocol) {}
+        void sendPackets(const UmpPacket *packets, int count, qint64 deliverAtNs) override {
+            Q_UNUSED(deliverAtNs);
+            sent.clear();
+            for (int i = 0; i < count; ++i) {
+                sent.append(packets[i]);
+            }
+        }
+        QVector<UmpPacket> sent;
+    };
+    RecordingUmpBackend midi1(Ump::Protocol::Midi1);
+    const unsigned char clock = 0xF8;
+    midi1.sendMessage(&clock, 1);
+    QCOMPARE(midi1.sent.size(), 3);
+    QCOMPARE(midi1.sent[0].words[0] >> 20, quint32(Ump::JrClock));
+    QCOMPARE(midi1.sent[1].words[0] >> 20, quint32(Ump::JrTimestamp));
+    QCOMPARE(midi1.sent[2].words[0], quint32(0x10F80000));
+    midi1.sendMessage(&clock, 1); // Within the JR Clock interval
+    QCOMPARE(midi1.sent.size(), 2);
+    RecordingUmpBackend midi2(Ump::Protocol::Midi2);
+    midi2.sendMessage(noteOn, 3);
+    QCOMPARE(midi2.sent.last().messageType(), quint8(Ump::Midi2ChannelVoice));
+    QCOMPARE(midi2.sent.last().words[1], Ump::scaleUp(100, 7, 16) << 16);
+}
+
+void SyncControllerTest::testPatternSwingKeepsLastStepInPattern() {
+    // 0.75 over 16ths moves the last 16th 3 ticks: past the end, so it
+    // stays on the last tick instead of wrapping to the start of the bar
+    MidiPattern pattern;
+    pattern.lengthTicks = 24;
+    pattern.swing = 0.75;
+    pattern.addNote(0, 2, 9, 36, 110);
+    pattern.addNote(22, 2, 9, 42, 80);
+    QString error;
+    std::unique_ptr<CompiledPattern> compiled = CompiledPattern::compile(pattern, &error);
+    QVERIFY2(compiled, qPrintable(error));
+    MidiOutputBatch first;
+    QCOMPARE(compiled->appendTick(0, first), 1);
+    QCOMPARE(int(first.at(0).bytes[1]), 36);
+    MidiOutputBatch last;
+    QCOMPARE(compiled->appendTick(23, last), 1);
+    QCOMPARE(int(last.at(0).bytes[0]), 0x99);
+    QCOMPARE(int(last.at(0).bytes[1]), 42);
+    // Its Note Off carries into the next repeat, and out of a stop
+    MidiOutputBatch carried;
+    QCOMPARE(compiled->appendTick(1, carried), 1);
+    QCOMPARE(int(carried.at(0).bytes[0]), 0x89);
+    QCOMPARE(int(carried.at(0).bytes[1]), 42);
+    MidiOutputBatch release;
+    compiled->appendTailNoteOffs(release);
+    QCOMPARE(release.count(), 1);
+    QCOMPARE(int(release.at(0).bytes[1]), 42);
+}
+
+void SyncControllerTest::testFullPendingListKeepsDueOrder() {
+    OrderingOutputBackend *backend = new OrderingOutputBackend();
+    MidiOutputPort port("held", std::unique_ptr<MidiOutputBackend>(backend));
+    port.setLatencyOffsetMs(0.0);
+
+    // More held batches than the pending list takes, a millisecond apart:
+    // the earliest go early to make room, and nothing overtakes them
+    const int batches = 160;
+    const qint64 firstDueNs = MidiTime::nowNanoseconds() + 300000000LL;
+    for (int i = 0; i < batches; ++i) {
+        const quint8 controlChange[3] = {0xB0, 20, static_cast<quint8>(i % 128)};
+        MidiOutputBatch batch;
+        batch.append(controlChange, 3);
+        QVERIFY(port.enqueue(batch, MidiTime::nowNanoseconds(), firstDueNs + i * 1000000LL, false));
+    }
+    QTRY_COMPARE_WITH_TIMEOUT(backend->count.load(std::memory_order_acquire), batches, 2000);
+    bool inOrder = true;
+    for (int i = 0; i < batches; ++i) {
+        inOrder = inOrder && backend->values[i] == i % 128;
+    }
+    QVERIFY(inOrder);
+    QCOMPARE(port.stats().sentEarly, quint64(batches - 128));
+}
+
+void SyncControllerTest::testBoundaryCancelWaitsForRunningFire() {
+    // A fire already claimed can't be called back, but cancel() must not
+    // return while its callback is still emitting
+    BoundaryScheduler scheduler;
+    std::atomic<bool> entered(false);
+    std::atomic<bool> finished(false);
+    scheduler.setFireCallback([&](qint64) {
+        entered.store(true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        finished.store(true);
+    });
+    scheduler.startScheduler();
+    
+    scheduler.arm(MidiTime::nowNanoseconds(), 0);
+    QTRY_VERIFY_WITH_TIMEOUT(entered.load(), 1000);
+    QVERIFY(!scheduler.cancel()); // Nothing left pending
+    QVERIFY(finished.load());
+    
+    // Still pending: dropped, and reported as such
+    const quint32 token = scheduler.arm(MidiTime::nowNanoseconds() + 1000000000, 0);
+    QVERIFY(scheduler.cancel());
+    QVERIFY(!scheduler.fireNow(token));
+    QCOMPARE(scheduler.stats().fired, quint64(1));
+    QCOMPARE(scheduler.stats().cancelled, quint64(1));
+    scheduler.stopScheduler();
+}
+
+void SyncControllerTest::testStopReleasesHeldDownbeat() {
+    // The downbeat has fired for the slow port but the fast one holds it
+    // until the boundary: a stop in between must not let it out after
+    // the stop's Note Off
+    MidiEngine engine;
+    OrderingOutputBackend *held = new OrderingOutputBackend;
+    QVERIFY(engine.addOutputPort("held", std::unique_ptr<MidiOutputBackend>(held)));
+    QVERIFY(engine.addOutputPort("slow", std::unique_ptr<MidiOutputBackend>(new RecordingOutputBackend)));
+    QVERIFY(engine.setOutputLatencyOffset("held", 1.0));
+    QVERIFY(engine.setOutputLatencyOffset("slow", 100.0));
+    SyncController controller(&engine);
+    std::atomic<int> fired(0);
+    connect(&controller, &SyncController::downbeatFired, [&](qint64) {
+        fired.fetch_add(1); // Scheduler thread
+    });
+    
+    // 300 BPM grid whose first bar line is 250ms from now
+    const double periodNs = ClockSchedule::periodNsForBPM(300.0);
+    const qint64 boundaryNs = MidiTime::nowNanoseconds() + 250000000;
+    const qint64 start = boundaryNs - llround(96 * periodNs);
+    controller.handleDAWStart(start);
+    for (int i = 1; i < 96; ++i) {
+        controller.handleMIDIClock(start + llround(i * periodNs));
+    }
+    QTRY_VERIFY_WITH_TIMEOUT(fired.load() == 2, 1000); // First downbeat, then the bar line's
+    QVERIFY(MidiTime::nowNanoseconds() < boundaryNs - 10000000);
+    controller.stop(false);
+    
+    // Well past the boundary: nothing followed the stop's Note Off
+    QThread::msleep(qMax<qint64>(0, (boundaryNs - MidiTime::nowNanoseconds()) / 1000000) + 50);
+    const int count = held->count.load(std::memory_order_acquire);
+    // The first downbeat's Note On and its Note Off, then the stop's
+    QCOMPARE(count, 3);
+    QVERIFY(held->values[0] > 0);
+    QCOMPARE(held->values[1], quint8(0));
+    QCOMPARE(held->values[2], quint8(0));
+}
+
+void SyncControllerTest::testCloseInputsStopsDelivery() {
+    // Nothing feeds the sinks once the inputs are closed, the arbiter's
+    // holdover thread included; enabling failover again restarts it
+    MidiEngine engine;
+    SyncController controller(&engine);
+    engine.setTransportSink(&controller);
+    engine.setClockFailover(true);
+    QVERIFY(engine.clockArbiter().isRunning());
+    
+    engine.closeInputs();
+    QVERIFY(!engine.clockArbiter().isRunning());
+    QVERIFY(!engine.networkInputOpen());
+    QVERIFY(!engine.isReplayingCapture());
+    QVERIFY(engine.currentInputPort().isEmpty());
+    engine.setTransportSink(nullptr);
+    
+    engine.setClockFailover(true);
+    QVERIFY(engine.clockArbiter().isRunning());
+    engine.setClockFailover(false);
+    QVERIFY(!engine.clockArbiter().isRunning());
+}
+
 #include "SyncControllerTest.moc"
 
@@ -21,8 +21,56 @@ private slots:
     void testNoteEmissionAtBar20();
     void testBoundaryDetectionAccuracy();
     void testNoDelaysAfterBar10();
+    void testInputQueueOverflowIsCounted();
+    void testMasterClockScheduleHasNoDrift();
+    void testTransportSnapshotIsConsistent();
+    void testTraceRecordsWithoutFormatting();
+    void testOutputPathDoesNotAllocate();
+    void testOutputBatchCoalescing();
+    void testOutputFanOutIsolatesSlowPorts();
+    void testScheduledOutputHonorsPortLatency();
+    void testTransportSinkDrivesController();
+    void testTempoEstimatorsFollowRamps();
+    void testTempoTrackingIsPerController();
+    void testBoundarySchedulerFiresBetweenClocks();
+    void testVirtualTimeEmissionAtFixedTempos();
+    void testVirtualTimeEmissionWithJitterAndRamps();
+    void testLatencyHistogramPercentiles();
+    void testInstrumentationCountsClockGaps();
+    void testStreamParserRunningStatusAndRealtime();
+    void testRawByteStreamDrivesController();
+    void testSysExReassemblyIsPooledAndBounded();
+    void testTimeCodeDropFrameRoundTrip();
+    void testTimeCodeChaseInterpolatesAndRelocates();
+    void testPortTableStableIdsAndRefresh();
+    void testSessionConfigFromJson();
+    void testSessionConfigClockFailover();
+    void testSessionConfigLink();
+    void testSessionConfigNetwork();
+    void testSessionConfigCapture();
+    void testSessionConfigRealtime();
+    void testSessionConfigScheduledOutput();
+    void testSessionConfigPattern();
+    void testSessionConfigZones();
+    void testClockArbiterFailsOverWithoutGap();
+    void testLinkFollowLocksDownbeatsToSessionPhase();
+    void testNetworkInputPlaysOutOnSenderTimes();
+    void testCaptureRecordsAndReplaysTraffic();
+    void testRealtimeProfileReportsEachSetting();
+    void testLookaheadClockIsScheduledAhead();
+    void testPatternPlaysPrecompiledTicks();
+    void testTempoZonesShareOneEngine();
+    void testUmpInputTimesClockByJrTimestamps();
+    void testPatternSwingKeepsLastStepInPattern();
+    void testFullPendingListKeepsDueOrder();
+    void testBoundaryCancelWaitsForRunningFire();
+    void testStopReleasesHeldDownbeat();
+    void testCloseInputsStopsDelivery();
 
 private:
+    // The fixture's controller runs on virtual time with a port-less engine
+    MidiEngine *m_engine;
+    VirtualClockSource *m_clock;
     SyncController *m_syncController;
     
     // Helper methods
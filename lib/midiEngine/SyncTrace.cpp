@@ -0,0 +1,177 @@
+#include "SyncTrace.h"
+#include <QDebug>
+#include <QThread>
+#include <memory>
+
+std::atomic<bool> SyncTrace::s_enabled(false);
+
+namespace {
+
+// Bounded multi-producer ring (per-slot sequence numbers)
+// Producers claim a slot with one CAS on the head; the single consumer
+// walks the tail. A full ring drops the new record instead of waiting.
+class TraceRing {
+public:
+    static const quint32 CAPACITY = 4096;
+
+    TraceRing()
+        : m_head(0)
+        , m_tail(0)
+        , m_dropped(0)
+    {
+        for (quint32 i = 0; i < CAPACITY; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    void push(const TraceRecord &record) {
+        quint32 head = m_head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = m_slots[head & MASK];
+            const quint32 sequence = slot.sequence.load(std::memory_order_acquire);
+            const qint32 diff = static_cast<qint32>(sequence - head);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                    slot.record = record;
+                    slot.sequence.store(head + 1, std::memory_order_release);
+                    return;
+                }
+            } else if (diff < 0) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                head = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(TraceRecord &record) {
+        const quint32 tail = m_tail.load(std::memory_order_relaxed);
+        Slot &slot = m_slots[tail & MASK];
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+        record = slot.record;
+        slot.sequence.store(tail + CAPACITY, std::memory_order_release);
+        m_tail.store(tail + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    quint64 dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const quint32 MASK = CAPACITY - 1;
+
+    struct Slot {
+        std::atomic<quint32> sequence;
+        TraceRecord record;
+    };
+
+    alignas(64) std::atomic<quint32> m_head;
+    alignas(64) std::atomic<quint32> m_tail;
+    alignas(64) std::atomic<quint64> m_dropped;
+    Slot m_slots[CAPACITY];
+};
+
+TraceRing &ring() {
+    static TraceRing s_ring;
+    return s_ring;
+}
+
+// Background formatter: wakes every few milliseconds and prints whatever
+// accumulated, so qDebug() never runs on a real-time thread
+std::unique_ptr<QThread> s_loggingThread;
+std::atomic<bool> s_loggingStopRequested(false);
+const int LOGGING_INTERVAL_MS = 20;
+
+} // namespace
+
+void SyncTrace::setEnabled(bool enabled) {
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void SyncTrace::record(TraceEvent event,
+                       qint32 i0, qint32 i1, qint32 i2, qint32 i3,
+                       double v0, double v1, double v2) {
+    TraceRecord record;
+    record.timestamp = MidiTime::nowNanoseconds();
+    record.event = event;
+    record.ints[0] = i0;
+    record.ints[1] = i1;
+    record.ints[2] = i2;
+    record.ints[3] = i3;
+    record.values[0] = v0;
+    record.values[1] = v1;
+    record.values[2] = v2;
+    ring().push(record);
+}
+
+void SyncTrace::startLogging() {
+    if (s_loggingThread) {
+        return;
+    }
+    s_loggingStopRequested.store(false);
+    s_loggingThread.reset(QThread::create([]() {
+        auto print = [](const TraceRecord &record) {
+            qDebug().noquote() << format(record);
+        };
+        while (!s_loggingStopRequested.load()) {
+            drain(print);
+            QThread::msleep(LOGGING_INTERVAL_MS);
+        }
+        drain(print);
+    }));
+    s_loggingThread->setObjectName("SyncTraceLogger");
+    s_loggingThread->start(QThread::LowPriority);
+}
+
+void SyncTrace::stopLogging() {
+    if (!s_loggingThread) {
+        return;
+    }
+    s_loggingStopRequested.store(true);
+    s_loggingThread->wait();
+    s_loggingThread.reset();
+}
+
+int SyncTrace::drain(const std::function<void(const TraceRecord &)> &consumer) {
+    int count = 0;
+    TraceRecord record;
+    while (ring().pop(record)) {
+        consumer(record);
+        ++count;
+    }
+    return count;
+}
+
+quint64 SyncTrace::droppedCount() {
+    return ring().dropped();
+}
+
+QString SyncTrace::format(const TraceRecord &record) {
+    const qint32 *i = record.ints;
+    const double *v = record.values;
+    switch (record.event) {
+    case TraceEvent::DawStart:
+        return QString("DAW START - m_lastEmittedWholeNote initialized to -1");
+    case TraceEvent::SppUpdate:
+        return QString("SPP UPDATE - m_lastEmittedWholeNote set to: %1 | Position QN: %2 | ClockCount: %3"
+                       " | Running: %4 | SeekingBack: %5")
+            .arg(i[0]).arg(v[0], 0, 'f', 2).arg(i[1])
+            .arg(i[2] ? "true" : "false").arg(i[3] ? "true" : "false");
+    case TraceEvent::NoteOff:
+        return QString("NOTE OFF - Tick: %1 | Boundary: %2").arg(i[0]).arg(i[1]);
+    case TraceEvent::BoundaryCheck:
+        return QString("BOUNDARY CHECK - Tick: %1 | CurrentBoundary: %2 | NextBoundary: %3"
+                       " | LastEmitted: %4 | TicksToNext: %5 | AdvTicks: %6 | BPM: %7 | ShouldEmit: %8")
+            .arg(i[0]).arg(i[1]).arg(i[1] + 1).arg(i[2])
+            .arg(v[0], 0, 'f', 3).arg(v[1], 0, 'f', 1).arg(v[2], 0, 'f', 0)
+            .arg(i[3] ? "YES" : "NO");
+    case TraceEvent::NoteEmitted:
+        return QString("NOTE EMITTED - Tick: %1 | Elapsed: %2 s | BPM: %3")
+            .arg(i[0]).arg(v[0], 0, 'f', 3).arg(v[1], 0, 'f', 2);
+    }
+    return QString();
+}
@@ -0,0 +1,77 @@
+#ifndef SYNCTRACE_H
+#define SYNCTRACE_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <functional>
+#include "MidiTime.h"
+
+// Build-time switch (CMake option MIDIMASTER2_ENABLE_TRACE). With it off
+// every SYNC_TRACE() site compiles to nothing, arguments included.
+#ifndef MIDIMASTER2_TRACE
+#define MIDIMASTER2_TRACE 0
+#endif
+
+// Kinds of trace record emitted by SyncController
+enum class TraceEvent : quint8 {
+    DawStart,
+    SppUpdate,     // ints: lastEmitted, clockCount, running, seekingBack; values: positionQN
+    NoteOff,       // ints: clockCount, boundary
+    BoundaryCheck, // ints: clockCount, boundary, lastEmitted, shouldEmit; values: ticksToNext, advTicks, bpm
+    NoteEmitted    // ints: clockCount; values: elapsedSeconds, bpm
+};
+
+// Fixed-size binary trace record
+// Filling one in is a handful of stores; no strings are built on the
+// tick path. Formatting happens later on the trace thread.
+struct TraceRecord {
+    qint64 timestamp; // MidiTime nanoseconds
+    TraceEvent event;
+    qint32 ints[4];
+    double values[3];
+};
+
+// Process-wide trace ring for the sync hot path
+// record() is lock-free and safe from any thread (clock generator, input
+// thread, GUI); when the ring is full the record is dropped and counted.
+// Nothing is recorded unless tracing has been enabled at runtime.
+class SyncTrace {
+public:
+    static void setEnabled(bool enabled);
+    static bool isEnabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static void record(TraceEvent event,
+                       qint32 i0 = 0, qint32 i1 = 0, qint32 i2 = 0, qint32 i3 = 0,
+                       double v0 = 0.0, double v1 = 0.0, double v2 = 0.0);
+
+    // Start/stop the background thread that formats records to qDebug()
+    static void startLogging();
+    static void stopLogging();
+
+    // Consume everything currently in the ring (single consumer: don't
+    // call while logging is running). Returns the number of records.
+    static int drain(const std::function<void(const TraceRecord &)> &consumer);
+
+    static quint64 droppedCount();
+
+    static QString format(const TraceRecord &record);
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+#if MIDIMASTER2_TRACE
+#define SYNC_TRACE(...) \
+    do { \
+        if (SyncTrace::isEnabled()) { \
+            SyncTrace::record(__VA_ARGS__); \
+        } \
+    } while (0)
+#else
+#define SYNC_TRACE(...) do { } while (0)
+#endif
+
+#endif // SYNCTRACE_H
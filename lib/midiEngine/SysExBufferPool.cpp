@@ -0,0 +1,138 @@
+#include "SysExBufferPool.h"
+#include <cstring>
+
+SysExBufferPool::SysExBufferPool(int bufferCount, int bufferSize)
+    : m_bufferCount(qBound(1, bufferCount, static_cast<int>(MAX_BUFFER_COUNT)))
+    , m_bufferSize(qMax(bufferSize, 16))
+    , m_storage(new quint8[static_cast<std::size_t>(m_bufferCount) * m_bufferSize])
+    , m_next(new std::atomic<quint16>[m_bufferCount])
+    , m_freeHead(0)
+    , m_completed(0)
+    , m_dropped(0)
+    , m_truncated(0)
+    , m_interrupted(0)
+{
+    // Chain every buffer: 1 -> 2 -> ... -> n -> none
+    for (int i = 0; i < m_bufferCount; ++i) {
+        m_next[i].store(i + 1 < m_bufferCount ? static_cast<quint16>(i + 2) : 0, std::memory_order_relaxed);
+    }
+    m_freeHead.store(1, std::memory_order_release);
+}
+
+quint16 SysExBufferPool::acquire() {
+    quint64 head = m_freeHead.load(std::memory_order_acquire);
+    for (;;) {
+        const quint16 handle = static_cast<quint16>(head & 0xFFFF);
+        if (handle == 0) {
+            return 0;
+        }
+        const quint64 next = m_next[handle - 1].load(std::memory_order_relaxed);
+        const quint64 newHead = (((head >> 16) + 1) << 16) | next;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+            return handle;
+        }
+    }
+}
+
+void SysExBufferPool::release(quint16 handle) {
+    if (handle == 0 || handle > m_bufferCount) {
+        return;
+    }
+    quint64 head = m_freeHead.load(std::memory_order_acquire);
+    for (;;) {
+        m_next[handle - 1].store(static_cast<quint16>(head & 0xFFFF), std::memory_order_relaxed);
+        const quint64 newHead = (((head >> 16) + 1) << 16) | handle;
+        if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+SysExBufferPool::Stats SysExBufferPool::stats() const {
+    Stats stats;
+    stats.completed = m_completed.load(std::memory_order_relaxed);
+    stats.dropped = m_dropped.load(std::memory_order_relaxed);
+    stats.truncated = m_truncated.load(std::memory_order_relaxed);
+    stats.interrupted = m_interrupted.load(std::memory_order_relaxed);
+    stats.bufferCount = m_bufferCount;
+    stats.bufferSize = m_bufferSize;
+    return stats;
+}
+
+SysExAssembler::SysExAssembler(SysExBufferPool *pool)
+    : m_pool(pool)
+    , m_handle(0)
+    , m_size(0)
+    , m_timestamp(0)
+    , m_active(false)
+{
+}
+
+void SysExAssembler::setPool(SysExBufferPool *pool) {
+    abort();
+    m_pool = pool;
+}
+
+void SysExAssembler::begin(qint64 timestamp) {
+    abort();
+    m_active = true;
+    m_size = 0;
+    m_timestamp = timestamp;
+    if (m_pool) {
+        m_handle = m_pool->acquire();
+        if (m_handle == 0) {
+            m_pool->countDropped();
+        }
+    }
+}
+
+bool SysExAssembler::append(const quint8 *data, int size) {
+    if (!m_active) {
+        return false;
+    }
+    const quint8 *end = static_cast<const quint8 *>(std::memchr(data, 0xF7, size));
+    const int length = end ? static_cast<int>(end - data) + 1 : size;
+
+    if (m_handle != 0) {
+        if (m_size + length > m_pool->bufferSize()) {
+            // Over the limit: let the rest of it go by
+            m_pool->release(m_handle);
+            m_handle = 0;
+            m_pool->countTruncated();
+        } else {
+            std::memcpy(m_pool->data(m_handle) + m_size, data, length);
+            m_size += length;
+        }
+    }
+    return end != nullptr;
+}
+
+quint16 SysExAssembler::take(SysExMessage *message) {
+    const quint16 handle = m_handle;
+    if (handle != 0) {
+        m_pool->countCompleted();
+        message->data = m_pool->data(handle);
+        message->size = m_size;
+        message->timestamp = m_timestamp;
+    }
+    m_handle = 0;
+    m_active = false;
+    return handle;
+}
+
+void SysExAssembler::interrupt() {
+    if (m_active && m_pool) {
+        m_pool->countInterrupted();
+    }
+    abort();
+}
+
+void SysExAssembler::abort() {
+    if (m_handle != 0) {
+        m_pool->release(m_handle);
+        m_handle = 0;
+    }
+    m_active = false;
+}
@@ -0,0 +1,106 @@
+#ifndef SYSEXBUFFERPOOL_H
+#define SYSEXBUFFERPOOL_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+
+// A reassembled SysEx message (F0 ... F7), viewed in place in its pool
+// buffer. Only valid during the call it is handed to: copy what you keep.
+struct SysExMessage {
+    const quint8 *data;
+    int size;
+    qint64 timestamp; // Arrival of the F0, MidiTime nanoseconds
+};
+
+// Fixed set of SysEx buffers allocated up front
+// Buffers are handed out by small integer handles (0 = none) from a
+// lock-free free list, so the RtMidi callback, the input processor and a
+// raw transport can all acquire and release without locks or allocation.
+// The buffer size is the SysEx size limit; when every buffer is in use a
+// new SysEx is dropped, never waited for.
+class SysExBufferPool {
+public:
+    static const int DEFAULT_BUFFER_COUNT = 4;
+    static const int DEFAULT_BUFFER_SIZE = 512 * 1024; // Covers full patch dumps
+    static const int MAX_BUFFER_COUNT = 0xFFFF;
+
+    struct Stats {
+        quint64 completed;
+        quint64 dropped;     // No free buffer
+        quint64 truncated;   // Larger than the buffer size
+        quint64 interrupted; // Cut short by another status byte
+        int bufferCount;
+        int bufferSize;
+    };
+
+    SysExBufferPool(int bufferCount = DEFAULT_BUFFER_COUNT, int bufferSize = DEFAULT_BUFFER_SIZE);
+
+    SysExBufferPool(const SysExBufferPool &) = delete;
+    SysExBufferPool &operator=(const SysExBufferPool &) = delete;
+
+    // Any thread; 0 when all buffers are in use
+    quint16 acquire();
+    void release(quint16 handle);
+
+    quint8 *data(quint16 handle) {
+        return m_storage.get() + static_cast<std::size_t>(handle - 1) * m_bufferSize;
+    }
+    int bufferSize() const { return m_bufferSize; }
+    int bufferCount() const { return m_bufferCount; }
+
+    Stats stats() const;
+
+    // Recorded by SysExAssembler
+    void countCompleted() { m_completed.fetch_add(1, std::memory_order_relaxed); }
+    void countDropped() { m_dropped.fetch_add(1, std::memory_order_relaxed); }
+    void countTruncated() { m_truncated.fetch_add(1, std::memory_order_relaxed); }
+    void countInterrupted() { m_interrupted.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    int m_bufferCount;
+    int m_bufferSize;
+    std::unique_ptr<quint8[]> m_storage;
+    std::unique_ptr<std::atomic<quint16>[]> m_next; // Free list links, by handle - 1
+    // Free list head: handle in the low 16 bits, ABA tag above
+    std::atomic<quint64> m_freeHead;
+
+    std::atomic<quint64> m_completed;
+    std::atomic<quint64> m_dropped;
+    std::atomic<quint64> m_truncated;
+    std::atomic<quint64> m_interrupted;
+};
+
+// Collects one SysEx at a time into a pool buffer, in chunks of any size
+// (a whole RtMidi message, byte by byte from a parser). Used by one thread.
+class SysExAssembler {
+public:
+    explicit SysExAssembler(SysExBufferPool *pool = nullptr);
+
+    // Drops any SysEx in progress
+    void setPool(SysExBufferPool *pool);
+    SysExBufferPool *pool() const { return m_pool; }
+
+    // Starts a SysEx (the F0 still has to be appended)
+    void begin(qint64 timestamp);
+    // Copies bytes up to and including an F7; true if one ended the
+    // message (take() it). Bytes past the F7 are not consumed.
+    bool append(const quint8 *data, int size);
+    // Hands over the completed message's buffer (0 if it was dropped or
+    // truncated); release it to pool() when done
+    quint16 take(SysExMessage *message);
+    // Another status byte cut the SysEx short
+    void interrupt();
+    void abort();
+
+    bool active() const { return m_active; }
+
+private:
+    SysExBufferPool *m_pool;
+    quint16 m_handle;
+    int m_size;
+    qint64 m_timestamp;
+    bool m_active;
+};
+
+#endif // SYSEXBUFFERPOOL_H
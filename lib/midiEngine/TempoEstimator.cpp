@@ -0,0 +1,146 @@
+#include "TempoEstimator.h"
+#include <cmath>
+
+TempoEstimator::TempoEstimator()
+    : m_tickNs(0.0)
+    , m_periodNs(0.0)
+    , m_originNs(0)
+    , m_lastArrivalNs(0)
+    , m_arrivals(0)
+    , m_consistentClocks(0)
+    , m_phaseErrorNs(0.0)
+    , m_jitterVariance(0.0)
+    , m_resyncCount(0)
+{
+}
+
+void TempoEstimator::reset() {
+    m_tickNs = 0.0;
+    m_periodNs = 0.0;
+    m_originNs = 0;
+    m_lastArrivalNs = 0;
+    m_arrivals = 0;
+    m_consistentClocks = 0;
+    m_phaseErrorNs = 0.0;
+    m_jitterVariance = 0.0;
+}
+
+void TempoEstimator::anchor(qint64 arrivalNs) {
+    m_originNs = arrivalNs;
+    m_tickNs = 0.0;
+    m_arrivals = 1;
+    m_consistentClocks = 0;
+}
+
+TempoEstimate TempoEstimator::update(qint64 arrivalNs) {
+    const qint64 intervalNs = arrivalNs - m_lastArrivalNs;
+    const bool intervalInRange = intervalNs >= MIN_PERIOD_NS && intervalNs <= MAX_PERIOD_NS;
+
+    if (m_arrivals == 0) {
+        anchor(arrivalNs);
+    } else if (m_arrivals == 1 || m_periodNs <= 0.0) {
+        // Second clock: the first interval seeds the period
+        if (intervalInRange) {
+            resetFilter(static_cast<double>(intervalNs));
+            anchor(arrivalNs);
+            m_arrivals = 2;
+        } else {
+            anchor(arrivalNs);
+        }
+    } else {
+        const double arrival = static_cast<double>(arrivalNs - m_originNs);
+        const double phaseErrorNs = arrival - (m_tickNs + m_periodNs);
+
+        if (std::fabs(phaseErrorNs) > MAX_PHASE_ERROR_PERIODS * m_periodNs) {
+            // Dropped clocks, a paused clock or a tempo jump: start over
+            // from the latest interval instead of chasing it slowly
+            ++m_resyncCount;
+            anchor(arrivalNs);
+            if (intervalInRange) {
+                resetFilter(static_cast<double>(intervalNs));
+                m_arrivals = 2;
+            }
+        } else {
+            correct(phaseErrorNs);
+            if (m_periodNs < MIN_PERIOD_NS) m_periodNs = MIN_PERIOD_NS;
+            if (m_periodNs > MAX_PERIOD_NS) m_periodNs = MAX_PERIOD_NS;
+            m_phaseErrorNs = phaseErrorNs;
+            m_jitterVariance += JITTER_SMOOTHING * (phaseErrorNs * phaseErrorNs - m_jitterVariance);
+            ++m_arrivals;
+            ++m_consistentClocks;
+
+            // Keep the relative times small so doubles stay exact to the ns
+            if (m_tickNs > 1.0e12) {
+                const qint64 shift = static_cast<qint64>(m_tickNs);
+                m_originNs += shift;
+                m_tickNs -= static_cast<double>(shift);
+            }
+        }
+    }
+
+    m_lastArrivalNs = arrivalNs;
+    return estimate();
+}
+
+TempoEstimate TempoEstimator::estimate() const {
+    TempoEstimate estimate;
+    estimate.valid = m_consistentClocks >= MIN_CONSISTENT_CLOCKS;
+    estimate.periodNs = m_periodNs;
+    estimate.bpm = m_periodNs > 0.0 ? 60.0e9 / (m_periodNs * 24.0) : 0.0;
+    estimate.tickTimeNs = m_originNs + static_cast<qint64>(std::llround(m_tickNs));
+    estimate.phaseErrorNs = m_phaseErrorNs;
+    estimate.jitterNs = std::sqrt(m_jitterVariance);
+    return estimate;
+}
+
+PllTempoEstimator::PllTempoEstimator(double alpha)
+    : m_alpha(alpha)
+    , m_beta(alpha * alpha / (2.0 - alpha))
+{
+}
+
+void PllTempoEstimator::resetFilter(double periodNs) {
+    m_periodNs = periodNs;
+}
+
+void PllTempoEstimator::correct(double phaseErrorNs) {
+    m_tickNs += m_periodNs + m_alpha * phaseErrorNs;
+    m_periodNs += m_beta * phaseErrorNs;
+}
+
+KalmanTempoEstimator::KalmanTempoEstimator(double measurementNoiseNs, double periodDriftNs)
+    : m_measurementVariance(measurementNoiseNs * measurementNoiseNs)
+    , m_periodDriftVariance(periodDriftNs * periodDriftNs)
+    , m_p00(0.0)
+    , m_p01(0.0)
+    , m_p11(0.0)
+{
+}
+
+void KalmanTempoEstimator::resetFilter(double periodNs) {
+    m_periodNs = periodNs;
+    // One arrival pins the tick time to the measurement noise; the period
+    // came from the difference of two arrivals
+    m_p00 = m_measurementVariance;
+    m_p01 = 0.0;
+    m_p11 = 2.0 * m_measurementVariance;
+}
+
+void KalmanTempoEstimator::correct(double phaseErrorNs) {
+    // Predict: tick += period (constant tempo), period drifts
+    m_tickNs += m_periodNs;
+    m_p00 += 2.0 * m_p01 + m_p11;
+    m_p01 += m_p11;
+    m_p11 += m_periodDriftVariance;
+
+    // Update with the arrival (only the tick time is observed)
+    const double innovationVariance = m_p00 + m_measurementVariance;
+    const double tickGain = m_p00 / innovationVariance;
+    const double periodGain = m_p01 / innovationVariance;
+    m_tickNs += tickGain * phaseErrorNs;
+    m_periodNs += periodGain * phaseErrorNs;
+
+    m_p11 -= periodGain * m_p01;
+    m_p01 *= 1.0 - tickGain;
+    m_p00 *= 1.0 - tickGain;
+}
@@ -0,0 +1,108 @@
+#ifndef TEMPOESTIMATOR_H
+#define TEMPOESTIMATOR_H
+
+#include <QtGlobal>
+
+// Tempo and phase recovered from incoming MIDI clock arrival times
+struct TempoEstimate {
+    bool valid;          // Enough consistent clocks to trust the figures
+    double bpm;
+    double periodNs;     // Estimated clock tick period
+    qint64 tickTimeNs;   // Filtered time of the latest tick (arrival jitter removed)
+    double phaseErrorNs; // Latest arrival minus its prediction (positive = late)
+    double jitterNs;     // RMS of the phase error
+};
+
+// Tracks tempo from every incoming clock
+// The base class handles anchoring, dropped clocks and range checks; a
+// subclass supplies the loop filter that turns each phase error into
+// corrections of the tick time and period. update() runs on the clock
+// path for every tick, so it must not allocate or block.
+class TempoEstimator {
+public:
+    TempoEstimator();
+    virtual ~TempoEstimator() {}
+
+    // Forget all history (transport start, continue, a clock restart)
+    void reset();
+
+    // Feed one clock arrival (MidiTime nanoseconds)
+    TempoEstimate update(qint64 arrivalNs);
+    TempoEstimate estimate() const;
+
+    // Number of times tracking was lost and re-anchored (dropped clocks,
+    // tempo jumps too large to follow)
+    quint64 resyncCount() const { return m_resyncCount; }
+
+    // Accepted tick period range: a bit wider than the 20-300 BPM the
+    // application supports, anything else is not a running clock
+    static const qint64 MIN_PERIOD_NS = 6250000;   // 400 BPM
+    static const qint64 MAX_PERIOD_NS = 166666667; // 15 BPM
+
+protected:
+    // Start the filter from a measured first period
+    virtual void resetFilter(double periodNs) = 0;
+    // Predict the next tick and correct it by the phase error of its
+    // arrival; updates m_tickNs and m_periodNs
+    virtual void correct(double phaseErrorNs) = 0;
+
+    double m_tickNs;   // Filtered latest tick, relative to m_originNs
+    double m_periodNs;
+
+private:
+    void anchor(qint64 arrivalNs);
+
+    static const int MIN_CONSISTENT_CLOCKS = 6;
+    static constexpr double MAX_PHASE_ERROR_PERIODS = 0.4; // Beyond this, re-anchor
+    static constexpr double JITTER_SMOOTHING = 0.05;
+
+    qint64 m_originNs;
+    qint64 m_lastArrivalNs;
+    int m_arrivals;        // Since the last anchor
+    int m_consistentClocks;
+    double m_phaseErrorNs;
+    double m_jitterVariance;
+    quint64 m_resyncCount;
+};
+
+// Second-order phase-locked loop (alpha-beta filter on tick times)
+// Fixed gains: alpha corrects the phase, beta the period. The default
+// settles in about a quarter note and follows tempo ramps with a small
+// constant lag.
+class PllTempoEstimator : public TempoEstimator {
+public:
+    explicit PllTempoEstimator(double alpha = 0.15);
+
+protected:
+    void resetFilter(double periodNs) override;
+    void correct(double phaseErrorNs) override;
+
+private:
+    double m_alpha;
+    double m_beta; // Benedict-Bordner: alpha^2 / (2 - alpha)
+};
+
+// Kalman filter over [tick time, period]
+// Gains adapt to the configured arrival jitter and tempo drift, so it
+// converges quickly after a start and then rejects jitter harder than the
+// fixed-gain PLL.
+class KalmanTempoEstimator : public TempoEstimator {
+public:
+    // measurementNoiseNs: expected arrival jitter (standard deviation)
+    // periodDriftNs: expected period change per tick during tempo ramps
+    explicit KalmanTempoEstimator(double measurementNoiseNs = 1000000.0, double periodDriftNs = 20000.0);
+
+protected:
+    void resetFilter(double periodNs) override;
+    void correct(double phaseErrorNs) override;
+
+private:
+    double m_measurementVariance;
+    double m_periodDriftVariance;
+    // Covariance of [tick time, period]
+    double m_p00;
+    double m_p01;
+    double m_p11;
+};
+
+#endif // TEMPOESTIMATOR_H
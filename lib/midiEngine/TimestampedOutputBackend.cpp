@@ -0,0 +1,245 @@
+#include "TimestampedOutputBackend.h"
+#include "MidiTime.h"
+#include <QByteArray>
+#if defined(__APPLE__)
+#include <CoreMIDI/CoreMIDI.h>
+#include <mach/mach_time.h>
+#elif MIDIMASTER2_ALSA_SEQ
+#include <alsa/asoundlib.h>
+#endif
+
+namespace {
+
+#if defined(__APPLE__)
+// One CoreMIDI client per process (each port is an output port on it)
+MIDIClientRef sharedClient() {
+    static MIDIClientRef client = 0;
+    static const OSStatus status = MIDIClientCreate(CFSTR("MidiMaster2"), nullptr, nullptr, &client);
+    return status == noErr ? client : 0;
+}
+
+// A batch is at most MidiOutputBatch::MAX_MESSAGES short messages
+const int PACKET_LIST_BYTES = 1024;
+#endif
+
+} // namespace
+
+struct TimestampedOutputBackend::Platform {
+#if defined(__APPLE__)
+    MIDIPortRef port = 0;
+    MIDIEndpointRef destination = 0;
+    mach_timebase_info_data_t timebase = {};
+#elif MIDIMASTER2_ALSA_SEQ
+    snd_seq_t *sequencer = nullptr;
+    snd_midi_event_t *encoder = nullptr;
+    int port = -1;
+    int queue = -1;
+#endif
+    bool open = false;
+};
+
+TimestampedOutputBackend::TimestampedOutputBackend()
+    : m_platform(std::make_unique<Platform>())
+    , m_failed(0)
+{
+}
+
+TimestampedOutputBackend::~TimestampedOutputBackend() {
+    close();
+}
+
+bool TimestampedOutputBackend::isAvailable() {
+#if defined(__APPLE__) || MIDIMASTER2_ALSA_SEQ
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool TimestampedOutputBackend::open(const QString &portName, unsigned int portIndex, QString *error) {
+    close();
+    auto fail = [this, error](const QString &message) {
+        if (error) {
+            *error = message;
+        }
+        close();
+        return false;
+    };
+    Platform &platform = *m_platform;
+
+#if defined(__APPLE__)
+    Q_UNUSED(portName);
+    if (portIndex >= MIDIGetNumberOfDestinations()) {
+        return fail("no such CoreMIDI destination");
+    }
+    platform.destination = MIDIGetDestination(portIndex);
+    const MIDIClientRef client = sharedClient();
+    if (!client || platform.destination == 0 ||
+        MIDIOutputPortCreate(client, CFSTR("MidiMaster2 Scheduled Out"), &platform.port) != noErr) {
+        return fail("cannot create a CoreMIDI output port");
+    }
+    mach_timebase_info(&platform.timebase);
+#elif MIDIMASTER2_ALSA_SEQ
+    Q_UNUSED(portIndex);
+    // RtMidi names ALSA ports "client:port name client:port"
+    const QByteArray address = portName.section(' ', -1).toUtf8();
+    if (snd_seq_open(&platform.sequencer, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) {
+        platform.sequencer = nullptr;
+        return fail("cannot open the ALSA sequencer");
+    }
+    snd_seq_set_client_name(platform.sequencer, "MidiMaster2");
+    snd_seq_addr_t destination;
+    if (snd_seq_parse_address(platform.sequencer, &destination, address.constData()) < 0) {
+        return fail("no ALSA address in " + portName);
+    }
+    platform.port = snd_seq_create_simple_port(platform.sequencer, "MidiMaster2 Scheduled Out",
+                                               SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                               SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    platform.queue = snd_seq_alloc_named_queue(platform.sequencer, "MidiMaster2");
+    if (platform.port < 0 || platform.queue < 0 ||
+        snd_seq_connect_to(platform.sequencer, platform.port, destination.client, destination.port) < 0 ||
+        snd_midi_event_new(16, &platform.encoder) < 0) {
+        platform.encoder = nullptr;
+        return fail("cannot connect to ALSA port " + QString::fromUtf8(address));
+    }
+    // Events are stamped relative to the queue's current time, so only
+    // its running matters, not its tempo
+    snd_seq_start_queue(platform.sequencer, platform.queue, nullptr);
+    snd_seq_drain_output(platform.sequencer);
+#else
+    Q_UNUSED(platform);
+    Q_UNUSED(portName);
+    Q_UNUSED(portIndex);
+    return fail("built without an OS MIDI scheduler");
+#endif
+
+    platform.open = true;
+    m_failed.store(0);
+    return true;
+}
+
+void TimestampedOutputBackend::close() {
+    Platform &platform = *m_platform;
+#if defined(__APPLE__)
+    if (platform.port) {
+        if (platform.destination) {
+            MIDIFlushOutput(platform.destination);
+        }
+        MIDIPortDispose(platform.port);
+    }
+    platform.port = 0;
+    platform.destination = 0;
+#elif MIDIMASTER2_ALSA_SEQ
+    if (platform.encoder) {
+        snd_midi_event_free(platform.encoder);
+        platform.encoder = nullptr;
+    }
+    if (platform.sequencer) {
+        // Closing the client drops whatever its queue still holds
+        snd_seq_close(platform.sequencer);
+        platform.sequencer = nullptr;
+    }
+    platform.port = -1;
+    platform.queue = -1;
+#endif
+    platform.open = false;
+}
+
+bool TimestampedOutputBackend::isOpen() const {
+    return m_platform->open;
+}
+
+void TimestampedOutputBackend::sendMessage(const unsigned char *data, size_t size) {
+    MidiOutputBatch batch;
+    batch.append(data, size);
+    deliver(batch, 0);
+}
+
+void TimestampedOutputBackend::sendBatch(const MidiOutputBatch &batch) {
+    deliver(batch, 0);
+}
+
+void TimestampedOutputBackend::scheduleBatch(const MidiOutputBatch &batch, qint64 deliverAtNs) {
+    deliver(batch, deliverAtNs);
+}
+
+void TimestampedOutputBackend::deliver(const MidiOutputBatch &batch, qint64 deliverAtNs) {
+    if (!isOpen() || batch.isEmpty()) {
+        return;
+    }
+    Platform &platform = *m_platform;
+    // Both schedulers take a delay from now (a timestamp already past
+    // goes out immediately)
+    const qint64 delayNs = deliverAtNs > 0 ? qMax<qint64>(0, deliverAtNs - MidiTime::nowNanoseconds()) : 0;
+
+#if defined(__APPLE__)
+    // The whole batch is one packet list with one timestamp; 0 = now
+    const MIDITimeStamp timestamp = delayNs > 0
+        ? mach_absolute_time() + static_cast<MIDITimeStamp>(delayNs) * platform.timebase.denom / platform.timebase.numer
+        : 0;
+    Byte buffer[PACKET_LIST_BYTES];
+    MIDIPacketList *list = reinterpret_cast<MIDIPacketList *>(buffer);
+    MIDIPacket *packet = MIDIPacketListInit(list);
+    for (int i = 0; i < batch.count() && packet; ++i) {
+        const MidiOutputBatch::Message &message = batch.at(i);
+        if (!message.dropped) {
+            packet = MIDIPacketListAdd(list, sizeof(buffer), packet, timestamp, message.size, message.bytes);
+        }
+    }
+    if (!packet || MIDISend(platform.port, platform.destination, list) != noErr) {
+        m_failed.fetch_add(batch.liveCount(), std::memory_order_relaxed);
+    }
+#elif MIDIMASTER2_ALSA_SEQ
+    snd_seq_real_time_t delay;
+    delay.tv_sec = static_cast<unsigned int>(delayNs / 1000000000);
+    delay.tv_nsec = static_cast<unsigned int>(delayNs % 1000000000);
+    for (int i = 0; i < batch.count(); ++i) {
+        const MidiOutputBatch::Message &message = batch.at(i);
+        if (message.dropped) {
+            continue;
+        }
+        snd_seq_event_t event;
+        snd_seq_ev_clear(&event);
+        snd_midi_event_reset_encode(platform.encoder);
+        if (snd_midi_event_encode(platform.encoder, message.bytes, message.size, &event) != message.size ||
+            event.type == SND_SEQ_EVENT_NONE) {
+            m_failed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        snd_seq_ev_set_source(&event, platform.port);
+        snd_seq_ev_set_subs(&event);
+        if (delayNs > 0) {
+            snd_seq_ev_schedule_real(&event, platform.queue, 1, &delay);
+        } else {
+            snd_seq_ev_set_direct(&event);
+        }
+        if (snd_seq_event_output(platform.sequencer, &event) < 0) {
+            m_failed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    snd_seq_drain_output(platform.sequencer);
+#else
+    Q_UNUSED(platform);
+    Q_UNUSED(delayNs);
+#endif
+}
+
+void TimestampedOutputBackend::cancelScheduled() {
+    if (!isOpen()) {
+        return;
+    }
+    Platform &platform = *m_platform;
+#if defined(__APPLE__)
+    MIDIFlushOutput(platform.destination);
+#elif MIDIMASTER2_ALSA_SEQ
+    // Both what is still in our output buffer and what the kernel holds
+    snd_seq_drop_output(platform.sequencer);
+    snd_seq_remove_events_t *remove;
+    snd_seq_remove_events_alloca(&remove);
+    snd_seq_remove_events_set_queue(remove, platform.queue);
+    snd_seq_remove_events_set_condition(remove, SND_SEQ_REMOVE_OUTPUT);
+    snd_seq_remove_events(platform.sequencer, remove);
+#else
+    Q_UNUSED(platform);
+#endif
+}
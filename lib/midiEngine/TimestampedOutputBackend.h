@@ -0,0 +1,57 @@
+#ifndef TIMESTAMPEDOUTPUTBACKEND_H
+#define TIMESTAMPEDOUTPUTBACKEND_H
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+#include "MidiOutputBackend.h"
+
+// ALSA sequencer support (set by the build when ALSA is found)
+#ifndef MIDIMASTER2_ALSA_SEQ
+#define MIDIMASTER2_ALSA_SEQ 0
+#endif
+
+// Output port that hands scheduled batches to the OS MIDI scheduler with
+// their delivery time: CoreMIDI packet timestamps on macOS, an ALSA
+// sequencer queue on Linux (built with MIDIMASTER2_ALSA_SEQ). The driver
+// sends each message at its time, so no thread of ours has to wake up
+// (let alone spin) for it, and the scheduler's own wakeup jitter is the
+// only jitter left. Immediate messages go out directly, as with RtMidi.
+class TimestampedOutputBackend : public MidiOutputBackend {
+public:
+    TimestampedOutputBackend();
+    ~TimestampedOutputBackend();
+
+    // Built with an OS scheduler (otherwise open() always fails)
+    static bool isAvailable();
+
+    // The destination RtMidi lists as portName at portIndex: CoreMIDI
+    // destinations are in the same order; ALSA ports are connected by the
+    // "client:port" address RtMidi appends to the name. False with a
+    // message on failure.
+    bool open(const QString &portName, unsigned int portIndex, QString *error = nullptr);
+    void close();
+    bool isOpen() const;
+
+    void sendMessage(const unsigned char *data, size_t size) override;
+    void sendBatch(const MidiOutputBatch &batch) override;
+
+    bool schedulesDelivery() const override { return isOpen(); }
+    void scheduleBatch(const MidiOutputBatch &batch, qint64 deliverAtNs) override;
+    void cancelScheduled() override;
+
+    // Messages the OS refused (its queue full, the destination gone)
+    quint64 failedCount() const { return m_failed.load(std::memory_order_relaxed); }
+
+private:
+    struct Platform;
+
+    // deliverAtNs 0 = now
+    void deliver(const MidiOutputBatch &batch, qint64 deliverAtNs);
+
+    std::unique_ptr<Platform> m_platform;
+    std::atomic<quint64> m_failed;
+};
+
+#endif // TIMESTAMPEDOUTPUTBACKEND_H
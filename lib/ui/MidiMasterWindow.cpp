@@ -3,27 +3,26 @@
 #include <QMessageBox>
 #include <QCoreApplication>
 #include <QTimer>
+#include <QtMath>
 
 MidiMasterWindow::MidiMasterWindow(QWidget *parent)
     : QWidget(parent)
+    , m_session(nullptr)
     , m_engine(nullptr)
     , m_syncController(nullptr)
-    , m_noteOn(false)
-    , m_midiChannel(0)
-    , m_midiNote(60)
-    , m_midiVelocity(100)
+    , m_outputStatsTimer(nullptr)
+    , m_transportTimer(nullptr)
+    , m_shownRunning(false)
+    , m_shownBPM(120)
+    , m_shownQuarterNote(-1)
+    , m_localStopPending(false)
 {
     setupUI();
     initializeMIDI();
 }
 
 MidiMasterWindow::~MidiMasterWindow() {
-    if (m_syncController) {
-        delete m_syncController;
-    }
-    if (m_engine) {
-        delete m_engine;
-    }
+    delete m_session;
 }
 
 void MidiMasterWindow::setupUI() {
@@ -51,6 +50,54 @@ void MidiMasterWindow::setupUI() {
     connect(portCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MidiMasterWindow::onPortChanged);
     portGroupLayout->addLayout(outputPortLayout);
     
+    // Additional outputs: every checked port gets the same clock and
+    // downbeat, each through its own send queue
+    QHBoxLayout *fanOutLayout = new QHBoxLayout();
+    fanOutLayout->addWidget(new QLabel("Outputs:", this));
+    outputList = new QListWidget(this);
+    outputList->setMaximumHeight(100);
+    outputList->setToolTip("Check every output that should receive clock and downbeat notes. Select a port to choose what it receives.");
+    connect(outputList, &QListWidget::itemChanged, this, &MidiMasterWindow::onOutputListItemChanged);
+    connect(outputList, &QListWidget::currentItemChanged, this, &MidiMasterWindow::onOutputListCurrentChanged);
+    fanOutLayout->addWidget(outputList);
+    
+    QVBoxLayout *routeLayout = new QVBoxLayout();
+    clockRouteCheck = new QCheckBox("Clock", this);
+    transportRouteCheck = new QCheckBox("Transport", this);
+    sppRouteCheck = new QCheckBox("SPP", this);
+    notesRouteCheck = new QCheckBox("Notes", this);
+    mtcRouteCheck = new QCheckBox("MTC", this);
+    for (QCheckBox *check : {clockRouteCheck, transportRouteCheck, sppRouteCheck, notesRouteCheck, mtcRouteCheck}) {
+        check->setChecked(true);
+        check->setEnabled(false);
+        connect(check, &QCheckBox::toggled, this, &MidiMasterWindow::onOutputRoutesToggled);
+        routeLayout->addWidget(check);
+    }
+    
+    // Latency compensation for the selected output: downbeat notes leave
+    // this port early by its offset
+    QHBoxLayout *latencyLayout = new QHBoxLayout();
+    latencySpin = new QSpinBox(this);
+    latencySpin->setRange(0, 500);
+    latencySpin->setSuffix(" ms");
+    latencySpin->setValue(static_cast<int>(MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS));
+    latencySpin->setEnabled(false);
+    latencySpin->setToolTip("How early downbeat notes leave this output to compensate for its latency");
+    connect(latencySpin, QOverload<int>::of(&QSpinBox::valueChanged), this, &MidiMasterWindow::onOutputLatencyChanged);
+    latencyLayout->addWidget(latencySpin);
+    calibrateBtn = new QPushButton("Calibrate", this);
+    calibrateBtn->setEnabled(false);
+    calibrateBtn->setToolTip("Measure the latency: route this output back into the selected input first (cable or IAC bus)");
+    connect(calibrateBtn, &QPushButton::clicked, this, &MidiMasterWindow::onCalibrateLatency);
+    latencyLayout->addWidget(calibrateBtn);
+    routeLayout->addLayout(latencyLayout);
+    fanOutLayout->addLayout(routeLayout);
+    portGroupLayout->addLayout(fanOutLayout);
+    
+    outputStatsLabel = new QLabel("", this);
+    outputStatsLabel->setWordWrap(true);
+    portGroupLayout->addWidget(outputStatsLabel);
+    
     // Input Port Selection
     QHBoxLayout *inputPortLayout = new QHBoxLayout();
     inputPortLayout->addWidget(new QLabel("Input (DAW Sync):", this));
@@ -62,10 +109,26 @@ void MidiMasterWindow::setupUI() {
     QPushButton *refreshInputBtn = new QPushButton("Refresh", this);
     connect(refreshInputBtn, &QPushButton::clicked, this, &MidiMasterWindow::onRefreshInput);
     inputPortLayout->addWidget(refreshInputBtn);
+    networkInputCheck = new QCheckBox("RTP-MIDI session", this);
+    networkInputCheck->setToolTip(QString("Receive over the network instead: join this machine from the other side's Network Session (UDP port %1), timing is rebuilt from the sender's timestamps").arg(RtpMidiSession::DEFAULT_PORT));
+    connect(networkInputCheck, &QCheckBox::toggled, this, &MidiMasterWindow::onNetworkInputToggled);
+    inputPortLayout->addWidget(networkInputCheck);
     inputPortLayout->addStretch();
     connect(inputPortCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MidiMasterWindow::onInputPortChanged);
     portGroupLayout->addLayout(inputPortLayout);
     
+    // Clock redundancy: a second input carrying the same clock
+    QHBoxLayout *backupInputLayout = new QHBoxLayout();
+    backupInputLayout->addWidget(new QLabel("Backup clock input:", this));
+    backupInputCombo = new QComboBox(this);
+    backupInputCombo->setMinimumWidth(300);
+    backupInputCombo->addItem("None");
+    backupInputCombo->setToolTip("Takes over without a gap if the input's clock drops out; with none, the clock carries on at the last tempo");
+    connect(backupInputCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MidiMasterWindow::onBackupInputChanged);
+    backupInputLayout->addWidget(backupInputCombo);
+    backupInputLayout->addStretch();
+    portGroupLayout->addLayout(backupInputLayout);
+    
     mainLayout->addWidget(portGroup);
     
     // Sync Settings Group
@@ -80,9 +143,42 @@ void MidiMasterWindow::setupUI() {
     bpmSpin->setSuffix(" BPM");
     connect(bpmSpin, QOverload<int>::of(&QSpinBox::valueChanged), this, &MidiMasterWindow::onBPMValueChanged);
     bpmLayout->addWidget(bpmSpin);
+    positionLabel = new QLabel("Bar 1 | Beat 1", this);
+    bpmLayout->addWidget(positionLabel);
     bpmLayout->addStretch();
     syncLayout->addLayout(bpmLayout);
     
+    QHBoxLayout *timeCodeLayout = new QHBoxLayout();
+    mtcOutputCheck = new QCheckBox("Send MTC", this);
+    mtcOutputCheck->setToolTip("Send MIDI Time Code quarter frames with the clock when running as master");
+    timeCodeLayout->addWidget(mtcOutputCheck);
+    mtcRateCombo = new QComboBox(this);
+    mtcRateCombo->addItem("24 fps", static_cast<int>(MtcFrameRate::Fps24));
+    mtcRateCombo->addItem("25 fps", static_cast<int>(MtcFrameRate::Fps25));
+    mtcRateCombo->addItem("29.97 drop", static_cast<int>(MtcFrameRate::Fps2997Drop));
+    mtcRateCombo->addItem("30 fps", static_cast<int>(MtcFrameRate::Fps30));
+    mtcRateCombo->setCurrentIndex(1);
+    timeCodeLayout->addWidget(mtcRateCombo);
+    timeCodeLabel = new QLabel("MTC in: --", this);
+    timeCodeLayout->addWidget(timeCodeLabel);
+    timeCodeLayout->addStretch();
+    syncLayout->addLayout(timeCodeLayout);
+    
+    QHBoxLayout *linkLayout = new QHBoxLayout();
+    linkLayout->addWidget(new QLabel("Ableton Link:", this));
+    linkModeCombo = new QComboBox(this);
+    linkModeCombo->addItem("Off", static_cast<int>(LinkMode::Off));
+    linkModeCombo->addItem("Follow session", static_cast<int>(LinkMode::Follow));
+    linkModeCombo->addItem("Publish to session", static_cast<int>(LinkMode::Publish));
+    linkModeCombo->setEnabled(MidiSession::linkAvailable());
+    linkModeCombo->setToolTip(MidiSession::linkAvailable()
+        ? "Follow: clock and downbeats locked to the Link session's beat and bar (starts on its next bar line). Publish: the session follows this tempo and transport."
+        : "Built without Ableton Link support (MIDIMASTER2_ENABLE_LINK)");
+    connect(linkModeCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MidiMasterWindow::onLinkModeChanged);
+    linkLayout->addWidget(linkModeCombo);
+    linkLayout->addStretch();
+    syncLayout->addLayout(linkLayout);
+    
     mainLayout->addWidget(syncGroup);
     
     // Control Buttons
@@ -107,7 +203,11 @@ void MidiMasterWindow::setupUI() {
 }
 
 void MidiMasterWindow::initializeMIDI() {
-    m_engine = new MidiEngine(this);
+    // The engine (on its real-time input thread) and the sync controller,
+    // wired as the headless daemon runs them; the window only watches
+    m_session = new MidiSession(this);
+    m_engine = m_session->engine();
+    m_syncController = m_session->controller();
     
     // Connect MIDI engine signals
     connect(m_engine, &MidiEngine::outputPortChanged, this, &MidiMasterWindow::onEngineOutputPortChanged);
@@ -116,99 +216,44 @@ void MidiMasterWindow::initializeMIDI() {
     connect(m_engine, &MidiEngine::inputPortsRefreshed, this, &MidiMasterWindow::onInputPortsRefreshed);
     connect(m_engine, &MidiEngine::error, this, &MidiMasterWindow::onMidiError);
     
-    // Create sync controller
-    m_syncController = new SyncController(m_engine, this);
-    
-    // Connect sync controller signals
-    connect(m_syncController, &SyncController::runningChanged, this, [this](bool running) {
-        startStopBtn->setText(running ? "Stop" : "Start");
-        if (statusLabel) {
-            statusLabel->setText(running ? "Sync running" : "Ready");
-        }
-    });
-    
-    connect(m_syncController, &SyncController::bpmChanged, this, &MidiMasterWindow::onBPMChanged);
-    connect(m_syncController, &SyncController::clockTick, this, &MidiMasterWindow::onSyncControllerClockTick);
-    connect(m_syncController, &SyncController::beatSent, this, &MidiMasterWindow::onSyncControllerBeatSent);
-    
-    // Connect MIDI input signals
-    connect(m_engine, &MidiEngine::midiStartReceived, this, &MidiMasterWindow::onSyncControllerStartReceived);
-    connect(m_engine, &MidiEngine::midiStopReceived, this, &MidiMasterWindow::onSyncControllerStopReceived);
-    connect(m_engine, &MidiEngine::midiContinueReceived, this, &MidiMasterWindow::onSyncControllerContinueReceived);
-    connect(m_engine, &MidiEngine::midiClockReceived, this, &MidiMasterWindow::onSyncControllerClockReceived);
-    
-    // Initialize engine
-    if (m_engine->initialize()) {
-        // Process events to ensure signals are delivered
-        QCoreApplication::processEvents();
+    // The window only polls the controller's state snapshot at ~30 Hz, so
+    // a busy or minimized window costs the timing path nothing
+    m_transportTimer = new QTimer(this);
+    m_transportTimer->setInterval(33);
+    connect(m_transportTimer, &QTimer::timeout, this, &MidiMasterWindow::onUpdateTransportState);
+    m_transportTimer->start();
+    
+    // Initialize engine: the port lists it shows at once are last
+    // session's (the refreshed handlers fill the combos); the scan that
+    // follows updates them in the background
+    if (m_session->initialize()) {
+        restorePortSelection();
         
-        // Get available ports (signals should have been emitted during initialization)
-        m_availableOutputPorts = m_engine->getOutputPorts();
-        m_availableInputPorts = m_engine->getInputPorts();
+        // Always-on record of the session's MIDI traffic, for replay
+        m_session->startCapture();
         
-        // Populate combo boxes directly (signal handlers should also update them, but this ensures immediate display)
-        portCombo->clear();
-        for (const QString &port : m_availableOutputPorts) {
-            portCombo->addItem(port);
-        }
-        
-        inputPortCombo->clear();
-        for (const QString &port : m_availableInputPorts) {
-            inputPortCombo->addItem(port);
-        }
-        
-        // If ports are still empty, try refreshing explicitly
-        if (m_availableOutputPorts.isEmpty() || m_availableInputPorts.isEmpty()) {
-            m_engine->refreshPorts();
-            QCoreApplication::processEvents();
-            
-            // Update again after refresh
-            m_availableOutputPorts = m_engine->getOutputPorts();
-            m_availableInputPorts = m_engine->getInputPorts();
-            
-            portCombo->clear();
-            for (const QString &port : m_availableOutputPorts) {
-                portCombo->addItem(port);
-            }
-            
-            inputPortCombo->clear();
-            for (const QString &port : m_availableInputPorts) {
-                inputPortCombo->addItem(port);
-            }
-        }
+        // Per-output send latency, refreshed twice a second
+        m_outputStatsTimer = new QTimer(this);
+        m_outputStatsTimer->setInterval(500);
+        connect(m_outputStatsTimer, &QTimer::timeout, this, &MidiMasterWindow::onUpdateOutputStats);
+        m_outputStatsTimer->start();
         
-        // Auto-select loopback port
-        QString autoPort = findAutoSelectPort(m_availableOutputPorts);
-        if (!autoPort.isEmpty()) {
-            int index = m_availableOutputPorts.indexOf(autoPort);
-            if (index >= 0) {
-                portCombo->setCurrentIndex(index);
-            }
-        }
-        
-        QString autoInputPort = findAutoSelectPort(m_availableInputPorts);
-        if (!autoInputPort.isEmpty()) {
-            int index = m_availableInputPorts.indexOf(autoInputPort);
-            if (index >= 0) {
-                inputPortCombo->setCurrentIndex(index);
-            }
-        }
-        
-        // Additional DAW sync signal handling
-        connect(m_engine, &MidiEngine::midiSongPositionPointerReceived, this, &MidiMasterWindow::onSyncControllerSongPositionPointer);
-        connect(m_engine, &MidiEngine::unknownMessageReceived, this, &MidiMasterWindow::onSyncControllerUnknownMessage);
-        
-        // Connect position tracking
-        connect(m_syncController, &SyncController::positionChanged, this, &MidiMasterWindow::onSyncControllerPositionChanged);
+        connect(m_engine, &MidiEngine::latencyCalibrationFinished, this, &MidiMasterWindow::onLatencyCalibrationFinished);
     }
 }
 
+void MidiMasterWindow::startStatsExport(const QString &path, int intervalMs) {
+    m_session->startStatsExport(path, intervalMs);
+}
+
 void MidiMasterWindow::onPortChanged(int index) {
     if (!m_engine) return;
     
     if (index >= 0 && index < m_availableOutputPorts.size()) {
         QString portName = m_availableOutputPorts[index];
-        m_engine->openOutputPort(portName);
+        if (m_engine->openOutputPort(portName)) {
+            m_session->rememberOutputPort(portName);
+        }
     }
 }
 
@@ -230,6 +275,7 @@ void MidiMasterWindow::onInputPortChanged(int index) {
     
     QString portName = m_availableInputPorts[index];
     if (m_engine->openInputPort(portName)) {
+        m_session->rememberInputPort(portName);
         if (statusLabel && statusLabel->text().contains("No valid")) {
             statusLabel->setText("Ready");
             statusLabel->setStyleSheet("QLabel { background-color: #e0e0e0; padding: 5px; }");
@@ -237,23 +283,71 @@ void MidiMasterWindow::onInputPortChanged(int index) {
     }
 }
 
+void MidiMasterWindow::onBackupInputChanged(int index) {
+    if (!m_engine) {
+        return;
+    }
+    
+    for (const QString &backup : m_engine->backupInputs()) {
+        m_engine->removeBackupInput(backup);
+    }
+    // Item 0 is "None": failover only runs with a backup chosen
+    const bool failover = index > 0 && m_engine->addBackupInput(backupInputCombo->itemText(index));
+    m_engine->setClockFailover(failover);
+}
+
+void MidiMasterWindow::onNetworkInputToggled(bool enabled) {
+    if (!m_engine) {
+        return;
+    }
+    
+    if (!enabled) {
+        // Back to the selected input port
+        m_engine->closeNetworkInput();
+        inputPortCombo->setEnabled(!m_availableInputPorts.isEmpty());
+        onInputPortChanged(inputPortCombo->currentIndex());
+        return;
+    }
+    if (m_engine->openNetworkInput()) {
+        inputPortCombo->setEnabled(false);
+    } else {
+        networkInputCheck->blockSignals(true);
+        networkInputCheck->setChecked(false);
+        networkInputCheck->blockSignals(false);
+        statusLabel->setText(QString("⚠️ UDP ports %1-%2 are in use").arg(RtpMidiSession::DEFAULT_PORT)
+                             .arg(RtpMidiSession::DEFAULT_PORT + 1));
+        statusLabel->setStyleSheet("QLabel { background-color: #fff3cd; padding: 5px; color: #856404; }");
+    }
+}
+
+void MidiMasterWindow::onLinkModeChanged(int index) {
+    if (!m_session) {
+        return;
+    }
+    // Changing mode stops a running clock (it restarts on the new timebase)
+    m_session->setLinkMode(static_cast<LinkMode>(linkModeCombo->itemData(index).toInt()));
+}
+
 void MidiMasterWindow::onStartStop() {
     if (!m_engine || !m_syncController) {
         QMessageBox::warning(this, "Error", "MIDI engine or sync controller not initialized.");
         return;
     }
     
-    if (m_engine->currentOutputPort().isEmpty()) {
+    if (m_engine->openOutputPorts().isEmpty()) {
         QMessageBox::warning(this, "No Port", "Please select a MIDI output port first.");
         return;
     }
 
     if (m_syncController->isRunning()) {
+        m_localStopPending = true;
         m_syncController->stop(true);
         if (statusLabel) {
             statusLabel->setText("Stopping sync...");
         }
     } else {
+        m_syncController->setTimeCodeOutput(mtcOutputCheck->isChecked(),
+            static_cast<MtcFrameRate>(mtcRateCombo->currentData().toInt()));
         m_syncController->start(true);
         if (statusLabel) {
             statusLabel->setText("Starting sync...");
@@ -262,7 +356,7 @@ void MidiMasterWindow::onStartStop() {
 }
 
 void MidiMasterWindow::onTestNote() {
-    if (!m_engine || m_engine->currentOutputPort().isEmpty()) {
+    if (!m_engine || m_engine->openOutputPorts().isEmpty()) {
         QMessageBox::warning(this, "No Port", "Please select a MIDI output port first.");
         return;
     }
@@ -304,6 +398,213 @@ void MidiMasterWindow::onRefreshInput() {
 void MidiMasterWindow::onEngineOutputPortChanged(const QString &portName) {
     // Port opened successfully
     Q_UNUSED(portName);
+    syncOutputListChecks();
+}
+
+void MidiMasterWindow::populateOutputList() {
+    outputList->blockSignals(true);
+    outputList->clear();
+    for (const QString &port : m_availableOutputPorts) {
+        QListWidgetItem *item = new QListWidgetItem(port, outputList);
+        item->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled | Qt::ItemIsSelectable);
+        item->setCheckState(Qt::Unchecked);
+    }
+    outputList->blockSignals(false);
+    syncOutputListChecks();
+}
+
+void MidiMasterWindow::syncOutputListChecks() {
+    if (!m_engine) return;
+    
+    const QStringList openPorts = m_engine->openOutputPorts();
+    outputList->blockSignals(true);
+    for (int i = 0; i < outputList->count(); ++i) {
+        QListWidgetItem *item = outputList->item(i);
+        item->setCheckState(openPorts.contains(item->text()) ? Qt::Checked : Qt::Unchecked);
+    }
+    outputList->blockSignals(false);
+}
+
+void MidiMasterWindow::onOutputListItemChanged(QListWidgetItem *item) {
+    if (!m_engine || !item) return;
+    
+    if (item->checkState() == Qt::Checked) {
+        if (!m_engine->addOutputPort(item->text(), selectedRoutes())) {
+            outputList->blockSignals(true);
+            item->setCheckState(Qt::Unchecked);
+            outputList->blockSignals(false);
+        }
+    } else {
+        m_engine->removeOutputPort(item->text());
+    }
+    onOutputListCurrentChanged(outputList->currentItem(), nullptr);
+}
+
+void MidiMasterWindow::onOutputListCurrentChanged(QListWidgetItem *current, QListWidgetItem *previous) {
+    Q_UNUSED(previous);
+    
+    // Show the selected port's routes (editable only while it is open)
+    quint8 routes = MidiOutputRoute::All;
+    double latencyOffsetMs = MidiOutputPort::DEFAULT_LATENCY_OFFSET_MS;
+    bool open = false;
+    if (m_engine && current) {
+        for (const OutputPortStats &stats : m_engine->outputPortStats()) {
+            if (stats.name == current->text()) {
+                routes = stats.routes;
+                latencyOffsetMs = stats.latencyOffsetMs;
+                open = true;
+            }
+        }
+    }
+    
+    latencySpin->blockSignals(true);
+    latencySpin->setValue(qRound(latencyOffsetMs));
+    latencySpin->setEnabled(open);
+    latencySpin->blockSignals(false);
+    calibrateBtn->setEnabled(open && !m_engine->isCalibrating());
+    
+    const QList<QPair<QCheckBox *, quint8>> checks = {
+        {clockRouteCheck, MidiOutputRoute::Clock},
+        {transportRouteCheck, MidiOutputRoute::Transport},
+        {sppRouteCheck, MidiOutputRoute::SongPosition},
+        {notesRouteCheck, MidiOutputRoute::Notes},
+        {mtcRouteCheck, MidiOutputRoute::TimeCode}
+    };
+    for (const QPair<QCheckBox *, quint8> &check : checks) {
+        check.first->blockSignals(true);
+        check.first->setChecked(routes & check.second);
+        check.first->setEnabled(open);
+        check.first->blockSignals(false);
+    }
+}
+
+quint8 MidiMasterWindow::selectedRoutes() const {
+    quint8 routes = 0;
+    if (clockRouteCheck->isChecked()) routes |= MidiOutputRoute::Clock;
+    if (transportRouteCheck->isChecked()) routes |= MidiOutputRoute::Transport;
+    if (sppRouteCheck->isChecked()) routes |= MidiOutputRoute::SongPosition;
+    if (notesRouteCheck->isChecked()) routes |= MidiOutputRoute::Notes;
+    if (mtcRouteCheck->isChecked()) routes |= MidiOutputRoute::TimeCode;
+    return routes;
+}
+
+void MidiMasterWindow::onOutputRoutesToggled() {
+    QListWidgetItem *item = outputList->currentItem();
+    if (!m_engine || !item) return;
+    m_engine->setOutputPortRoutes(item->text(), selectedRoutes());
+}
+
+void MidiMasterWindow::onOutputLatencyChanged(int offsetMs) {
+    QListWidgetItem *item = outputList->currentItem();
+    if (!m_engine || !item) return;
+    m_engine->setOutputLatencyOffset(item->text(), offsetMs);
+}
+
+void MidiMasterWindow::onCalibrateLatency() {
+    QListWidgetItem *item = outputList->currentItem();
+    if (!m_engine || !item) return;
+    
+    if (!m_engine->startLatencyCalibration(item->text())) {
+        statusLabel->setText("Status: Calibration needs an open input and an output that routes Notes");
+        return;
+    }
+    calibrateBtn->setEnabled(false);
+    statusLabel->setText(QString("Status: Calibrating %1...").arg(item->text()));
+}
+
+void MidiMasterWindow::onLatencyCalibrationFinished(const QString &portName, double latencyMs, bool success) {
+    if (success) {
+        statusLabel->setText(QString("Status: %1 latency %2 ms").arg(portName).arg(latencyMs, 0, 'f', 1));
+    } else {
+        statusLabel->setText(QString("Status: No loopback echo from %1 - check the routing").arg(portName));
+    }
+    onOutputListCurrentChanged(outputList->currentItem(), nullptr);
+}
+
+void MidiMasterWindow::onUpdateOutputStats() {
+    if (!m_engine || !outputStatsLabel) return;
+    
+    QStringList lines;
+    const MidiEngine::InputCounters input = m_engine->inputCounters();
+    if (input.received > 0) {
+        lines.append(QString("Input: %1 received, %2 dropped, queue peak %3/%4, %5 µs p99 queue wait")
+                     .arg(input.received)
+                     .arg(input.dropped)
+                     .arg(input.queueHighWaterMark)
+                     .arg(input.queueCapacity)
+                     .arg(m_engine->latencyHistogram(MidiEngine::LatencyStage::QueueWait)
+                          .valueAtPercentile(99.0) / 1000.0, 0, 'f', 0));
+    }
+    for (const OutputPortStats &stats : m_engine->outputPortStats()) {
+        const QString clockRate = stats.clockMultiplier != 1 || stats.clockDivider != 1
+            ? QString(" (clock %1:%2)").arg(stats.clockMultiplier).arg(stats.clockDivider) : QString();
+        lines.append(QString("%1%2: %3 ms offset, %4 µs avg / %5 µs max send latency, %6 dropped")
+                     .arg(stats.name)
+                     .arg(QString(stats.timestamped ? " (timestamped)" : "") + clockRate)
+                     .arg(stats.latencyOffsetMs, 0, 'f', 0)
+                     .arg(stats.averageLatencyUs, 0, 'f', 0)
+                     .arg(stats.maxLatencyUs, 0, 'f', 0)
+                     .arg(stats.dropped));
+    }
+    if (const RtpMidiSession *network = m_engine->networkInput()) {
+        const RtpMidiSession::Stats networkStats = network->stats();
+        lines.append(networkStats.connected
+                     ? QString("Network: %1, %2 ms buffer (%3 ms jitter), %4 late, %5 lost")
+                       .arg(network->peerName())
+                       .arg(networkStats.buffer.depthNs / 1.0e6, 0, 'f', 1)
+                       .arg(networkStats.buffer.jitterNs / 1.0e6, 0, 'f', 1)
+                       .arg(networkStats.buffer.lateEvents)
+                       .arg(networkStats.buffer.lost)
+                     : QString("Network: waiting for a session on UDP port %1").arg(network->controlPort()));
+    }
+    if (m_engine->capture().isCapturing()) {
+        const MidiCaptureRecorder::Stats captureStats = m_engine->capture().stats();
+        lines.append(QString("Capture: %1 messages, %2 dropped")
+                     .arg(captureStats.records)
+                     .arg(captureStats.dropped));
+    }
+    if (m_engine->clockFailoverEnabled()) {
+        const ClockArbiter &arbiter = m_engine->clockArbiter();
+        const ClockArbiter::Stats clockStats = arbiter.stats();
+        QStringList sources;
+        for (int source = 0; source < ClockArbiter::MAX_SOURCES; ++source) {
+            const QString name = m_engine->clockSourceName(source);
+            if (!name.isEmpty()) {
+                const ClockArbiter::SourceHealth health = arbiter.sourceHealth(source);
+                sources.append(QString("%1%2 %3 (%4 timeouts)")
+                               .arg(health.active ? "▶ " : "")
+                               .arg(name)
+                               .arg(health.state == ClockArbiter::SourceState::Live ? "live"
+                                    : health.state == ClockArbiter::SourceState::TimedOut ? "timed out" : "idle")
+                               .arg(health.timeouts));
+            }
+        }
+        if (clockStats.activeSource == ClockArbiter::INTERNAL_SOURCE) {
+            sources.append("▶ internal");
+        }
+        lines.append(QString("Clock sources: %1; %2 failovers, %3 holdover ticks")
+                     .arg(sources.join(", "))
+                     .arg(clockStats.failovers)
+                     .arg(clockStats.holdoverClocks));
+    }
+    if (m_syncController && m_syncController->linkMode() != LinkMode::Off) {
+        const LinkTimeline link = m_syncController->linkTimeline();
+        lines.append(QString("Link: %1 peers, %2 BPM, beat %3 of 4")
+                     .arg(link.peers)
+                     .arg(link.bpm, 0, 'f', 1)
+                     .arg(link.bpm > 0.0 ? link.phaseAtTime(MidiTime::nowNanoseconds(), LinkTimebase::QUANTUM) + 1.0 : 0.0,
+                          0, 'f', 1));
+    }
+    if (m_syncController) {
+        BoundaryScheduler::Stats timing = m_syncController->boundaryTimingStats();
+        if (timing.fired > 0) {
+            lines.append(QString("Downbeats: %1 fired, %2% within ±10 µs, %3 µs max late")
+                         .arg(timing.fired)
+                         .arg(100.0 * timing.histogram[BoundaryScheduler::ON_TIME_BUCKET] / timing.fired, 0, 'f', 1)
+                         .arg(timing.maxLateNs / 1000.0, 0, 'f', 0));
+        }
+    }
+    outputStatsLabel->setText(lines.join("\n"));
 }
 
 void MidiMasterWindow::onEngineInputPortChanged(const QString &portName) {
@@ -325,7 +626,11 @@ void MidiMasterWindow::onOutputPortsRefreshed() {
     }
     
     m_availableOutputPorts = m_engine->getOutputPorts();
+    // Repopulating must not reopen anything (a hot-plug refresh can come
+    // in the middle of a session)
+    portCombo->blockSignals(true);
     portCombo->clear();
+    populateOutputList();
     
     if (m_availableOutputPorts.isEmpty()) {
         // No ports available - likely IAC Driver not configured
@@ -361,6 +666,11 @@ void MidiMasterWindow::onOutputPortsRefreshed() {
             statusLabel->setStyleSheet("QLabel { background-color: #e0e0e0; padding: 5px; }");
         }
     }
+    portCombo->blockSignals(false);
+    
+    if (currentPort.isEmpty()) {
+        restorePortSelection();
+    }
 }
 
 void MidiMasterWindow::onInputPortsRefreshed() {
@@ -373,6 +683,7 @@ void MidiMasterWindow::onInputPortsRefreshed() {
     
     m_availableInputPorts = m_engine->getInputPorts();
     
+    inputPortCombo->blockSignals(true);
     inputPortCombo->clear();
     
     if (m_availableInputPorts.isEmpty()) {
@@ -384,7 +695,7 @@ void MidiMasterWindow::onInputPortsRefreshed() {
             statusLabel->setStyleSheet("QLabel { background-color: #fff3cd; padding: 5px; color: #856404; }");
         }
     } else {
-        inputPortCombo->setEnabled(true);
+        inputPortCombo->setEnabled(!m_engine->networkInputOpen());
         for (int i = 0; i < m_availableInputPorts.size(); ++i) {
             const QString &port = m_availableInputPorts[i];
             inputPortCombo->addItem(port);
@@ -398,6 +709,20 @@ void MidiMasterWindow::onInputPortsRefreshed() {
             }
         }
     }
+    inputPortCombo->blockSignals(false);
+    
+    // The engine drops a backup whose port went away
+    const QStringList backups = m_engine->backupInputs();
+    backupInputCombo->blockSignals(true);
+    backupInputCombo->clear();
+    backupInputCombo->addItem("None");
+    backupInputCombo->addItems(m_availableInputPorts);
+    backupInputCombo->setCurrentIndex(backups.isEmpty() ? 0 : m_availableInputPorts.indexOf(backups.first()) + 1);
+    backupInputCombo->blockSignals(false);
+    
+    if (currentPort.isEmpty()) {
+        restorePortSelection();
+    }
 }
 
 void MidiMasterWindow::onMidiError(const QString &message) {
@@ -405,135 +730,78 @@ void MidiMasterWindow::onMidiError(const QString &message) {
     Q_UNUSED(message);
 }
 
-void MidiMasterWindow::onSyncControllerStartReceived() {
-    m_syncController->handleDAWStart();
-}
-
-void MidiMasterWindow::onSyncControllerStopReceived() {
-    // Handle DAW stop directly without going through onStartStop()
-    // onStartStop() checks for output port which can cause popup issues
-    // and is not needed when DAW sends stop command
-    if (m_syncController) {
-        m_syncController->handleDAWStop();
-        // Update UI state to reflect stop
-        if (startStopBtn) {
-            startStopBtn->setText("Start");
-        }
-        if (statusLabel) {
-            statusLabel->setText("DAW stopped");
+void MidiMasterWindow::onUpdateTransportState() {
+    if (!m_syncController) return;
+    
+    // One lock-free snapshot per frame; widgets are touched only on change
+    const TransportState state = m_syncController->transportState();
+    
+    if (state.running != m_shownRunning) {
+        m_shownRunning = state.running;
+        startStopBtn->setText(state.running ? "Stop" : "Start");
+        if (state.running) {
+            statusLabel->setText("Sync running");
+        } else {
+            statusLabel->setText(m_localStopPending ? "Ready" : "DAW stopped");
         }
+        m_localStopPending = false;
     }
-}
-
-void MidiMasterWindow::onSyncControllerContinueReceived() {
-    m_syncController->handleDAWContinue();
-}
-
-void MidiMasterWindow::onSyncControllerClockReceived() {
-    m_syncController->handleMIDIClock();
-}
-
-void MidiMasterWindow::onSyncControllerClockTick() {
-    // Clock tick handled by sync controller
-}
-
-void MidiMasterWindow::onSyncControllerBeatSent(int quarterNote) {
-}
-
-void MidiMasterWindow::onSyncControllerSongPositionPointer(int positionBeats, double positionQuarterNotes) {
-    if (positionBeats > 0 || positionQuarterNotes > 0.0) {
-        m_syncController->handleSongPositionPointer(positionBeats, positionQuarterNotes);
-    }
-}
-
-void MidiMasterWindow::onSyncControllerPositionChanged(int beats, double quarterNotes) {
-    // Position tracking handled within the sync controller
-    Q_UNUSED(beats);
-    Q_UNUSED(quarterNotes);
-}
-
-void MidiMasterWindow::onSyncControllerUnknownMessage(int status) {
-    // Unknown messages are ignored
-    Q_UNUSED(status);
-}
-
-void MidiMasterWindow::onBPMValueChanged(int value) {
-    if (m_syncController) {
-        m_syncController->setBPM(value);
-    }
-}
-
-void MidiMasterWindow::onBPMChanged(double bpm) {
+    
     // Update BPM spin box when BPM changes (e.g., from DAW sync)
-    if (bpmSpin) {
+    const int bpm = static_cast<int>(qRound(state.bpm));
+    if (bpm != m_shownBPM) {
+        m_shownBPM = bpm;
         // Block signals temporarily to avoid recursive updates
         bpmSpin->blockSignals(true);
-        bpmSpin->setValue(static_cast<int>(qRound(bpm)));
+        bpmSpin->setValue(bpm);
         bpmSpin->blockSignals(false);
     }
-}
-
-QString MidiMasterWindow::findAutoSelectPort(const QStringList &ports) {
-    // Priority: IAC Driver > Virtual ports > Other CoreMIDI ports
-    // Network MIDI is excluded to avoid UDP buffering issues that cause timing problems
     
-    // First priority: IAC Driver (CoreMIDI-based, best for loopback and DAW communication)
-    // IAC drivers provide lowest latency and most reliable timing
-    for (const QString &port : ports) {
-        if (port.contains("IAC", Qt::CaseInsensitive)) {
-            qDebug() << "Auto-selected IAC Driver port:" << port;
-            return port;
-        }
+    const int quarterNote = static_cast<int>(qFloor(state.positionQuarterNotes));
+    if (quarterNote != m_shownQuarterNote) {
+        m_shownQuarterNote = quarterNote;
+        positionLabel->setText(QString("Bar %1 | Beat %2").arg(quarterNote / 4 + 1).arg(quarterNote % 4 + 1));
     }
     
-    // Second priority: Virtual MIDI ports (CoreMIDI-based, good alternative to IAC)
-    for (const QString &port : ports) {
-        if (port.contains("Virtual", Qt::CaseInsensitive)) {
-            qDebug() << "Auto-selected Virtual MIDI port:" << port;
-            return port;
-        }
+    const QString timeCode = m_syncController->timeCodeState().locked
+        ? "MTC in: " + MidiTimeCode::toString(m_syncController->timeCodePosition())
+        : QString("MTC in: --");
+    if (timeCode != m_shownTimeCode) {
+        m_shownTimeCode = timeCode;
+        timeCodeLabel->setText(timeCode);
     }
-    
-    // Third priority: Other CoreMIDI loopback ports (but exclude Network/rtpMIDI)
-    // Network MIDI uses UDP which has buffering and can cause rushed/dragged notes
-    for (const QString &port : ports) {
-        if (port.contains("Loopback", Qt::CaseInsensitive) &&
-            !port.contains("Network", Qt::CaseInsensitive) &&
-            !port.contains("rtpMIDI", Qt::CaseInsensitive) &&
-            !port.contains("rtp.MIDI", Qt::CaseInsensitive)) {
-            qDebug() << "Auto-selected Loopback port (non-Network):" << port;
-            return port;
-        }
+}
+
+void MidiMasterWindow::onBPMValueChanged(int value) {
+    if (m_syncController) {
+        m_syncController->setBPM(value);
     }
-    
-    // Final fallback: Any CoreMIDI port (excluding Network MIDI)
-    // Filter out Network MIDI ports to avoid timing issues
-    QStringList coreMIDIPorts;
-    for (const QString &port : ports) {
-        bool isNetworkPort = false;
-        bool ok;
-        int portNum = port.toInt(&ok);
-        if (ok && portNum >= 21928 && portNum <= 21948) {
-            isNetworkPort = true;
-        }
-        if (port.contains("Network", Qt::CaseInsensitive) ||
-            port.contains("rtpMIDI", Qt::CaseInsensitive) ||
-            port.contains("rtp.MIDI", Qt::CaseInsensitive)) {
-            isNetworkPort = true;
-        }
-        if (!isNetworkPort) {
-            coreMIDIPorts.append(port);
+}
+
+void MidiMasterWindow::restorePortSelection() {
+    // Last session's ports by ID (their names may have been reused), or
+    // the best loopback port; each side once, when it opens
+    if (m_engine->currentOutputPort().isEmpty() && !m_availableOutputPorts.isEmpty()) {
+        const int index = m_availableOutputPorts.indexOf(m_session->preferredOutputPort());
+        if (index >= 0) {
+            if (portCombo->currentIndex() == index) {
+                onPortChanged(index);
+            } else {
+                portCombo->setCurrentIndex(index);
+            }
         }
     }
     
-    // Return first CoreMIDI port if available, or empty string if none
-    if (!coreMIDIPorts.isEmpty()) {
-        qDebug() << "Auto-selected CoreMIDI port:" << coreMIDIPorts.first();
-        return coreMIDIPorts.first();
+    // None while an RTP-MIDI session stands in for the input port
+    if (m_engine->currentInputPort().isEmpty() && !m_engine->networkInputOpen() &&
+        !m_availableInputPorts.isEmpty()) {
+        const int index = m_availableInputPorts.indexOf(m_session->preferredInputPort());
+        if (index >= 0) {
+            if (inputPortCombo->currentIndex() == index) {
+                onInputPortChanged(index);
+            } else {
+                inputPortCombo->setCurrentIndex(index);
+            }
+        }
     }
-    
-    // Last resort: if all ports were filtered, return empty (user must configure manually)
-    qDebug() << "WARNING: No suitable CoreMIDI ports found. All ports may be Network MIDI.";
-    return QString();
 }
-
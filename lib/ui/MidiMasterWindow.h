@@ -9,8 +9,12 @@
 #include <QLabel>
 #include <QGroupBox>
 #include <QSpinBox>
+#include <QCheckBox>
+#include <QListWidget>
+#include <QTimer>
 #include "../midiEngine/MidiEngine.h"
 #include "../midiEngine/SyncController.h"
+#include "../midiEngine/MidiSession.h"
 
 class MidiMasterWindow : public QWidget {
     Q_OBJECT
@@ -18,15 +22,31 @@ class MidiMasterWindow : public QWidget {
 public:
     explicit MidiMasterWindow(QWidget *parent = nullptr);
     ~MidiMasterWindow();
+    
+    // Dump the live instrumentation as JSON to path every intervalMs
+    void startStatsExport(const QString &path, int intervalMs = 1000);
 
 private slots:
     void onPortChanged(int index);
     void onInputPortChanged(int index);
+    void onBackupInputChanged(int index);
+    void onNetworkInputToggled(bool enabled);
+    void onLinkModeChanged(int index);
     void onStartStop();
     void onTestNote();
     void onRefreshOutput();
     void onRefreshInput();
     
+    // Output fan-out
+    void onOutputListItemChanged(QListWidgetItem *item);
+    void onOutputListCurrentChanged(QListWidgetItem *current, QListWidgetItem *previous);
+    void onOutputRoutesToggled();
+    void onOutputLatencyChanged(int offsetMs);
+    void onCalibrateLatency();
+    void onLatencyCalibrationFinished(const QString &portName, double latencyMs, bool success);
+    void onUpdateOutputStats();
+    void onUpdateTransportState();
+    
     // MIDI engine signals
     void onEngineOutputPortChanged(const QString &portName);
     void onEngineInputPortChanged(const QString &portName);
@@ -34,42 +54,55 @@ private slots:
     void onInputPortsRefreshed();
     void onMidiError(const QString &message);
     
-    // Sync controller signals
-    void onSyncControllerStartReceived();
-    void onSyncControllerStopReceived();
-    void onSyncControllerContinueReceived();
-    void onSyncControllerClockReceived();
-    void onSyncControllerClockTick();
-    void onSyncControllerBeatSent(int quarterNote);
-    void onSyncControllerUnknownMessage(int status);
-    void onSyncControllerSongPositionPointer(int positionBeats, double positionQuarterNotes);
-    void onSyncControllerPositionChanged(int beats, double quarterNotes);
-    
     // BPM handling
     void onBPMValueChanged(int value);
-    void onBPMChanged(double bpm);
 
 private:
     void setupUI();
     void initializeMIDI();
     
-    QString findAutoSelectPort(const QStringList &ports);
+    void restorePortSelection();
+    void populateOutputList();
+    void syncOutputListChecks();
+    quint8 selectedRoutes() const;
     
-    MidiEngine *m_engine;
-    SyncController *m_syncController;
+    MidiSession *m_session;
+    MidiEngine *m_engine;               // Owned by m_session
+    SyncController *m_syncController;   // Owned by m_session
     
     QComboBox* portCombo;
     QComboBox* inputPortCombo;
+    QComboBox* backupInputCombo;
+    QCheckBox* networkInputCheck;
+    QListWidget* outputList;
+    QCheckBox* clockRouteCheck;
+    QCheckBox* transportRouteCheck;
+    QCheckBox* sppRouteCheck;
+    QCheckBox* notesRouteCheck;
+    QCheckBox* mtcRouteCheck;
+    QSpinBox* latencySpin;
+    QPushButton* calibrateBtn;
+    QLabel* outputStatsLabel;
+    QTimer* m_outputStatsTimer;
+    QTimer* m_transportTimer;
     QSpinBox* bpmSpin;
+    QLabel* positionLabel;
+    QCheckBox* mtcOutputCheck;
+    QComboBox* mtcRateCombo;
+    QLabel* timeCodeLabel;
+    QComboBox* linkModeCombo;
     QPushButton* startStopBtn;
     QLabel* statusLabel;
     
     QStringList m_availableOutputPorts;
     QStringList m_availableInputPorts;
-    bool m_noteOn;
-    int m_midiChannel;
-    int m_midiNote;
-    int m_midiVelocity;
+    
+    // Last transport state shown (polled at display rate)
+    bool m_shownRunning;
+    int m_shownBPM;
+    int m_shownQuarterNote;
+    QString m_shownTimeCode;
+    bool m_localStopPending; // The next stop came from the Stop button
 };
 
 #endif // MIDIMASTERWINDOW_H
@@ -1,13 +1,139 @@
 #include <QApplication>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <memory>
 #include "lib/ui/MidiMasterWindow.h"
+#include "lib/midiEngine/MidiSession.h"
+#include "lib/midiEngine/SyncTrace.h"
 
-int main(int argc, char *argv[]) {
-    QApplication app(argc, argv);
+namespace {
+
+std::atomic<bool> g_quitRequested(false);
+
+void requestQuit(int) {
+    g_quitRequested.store(true);
+}
+
+bool hasArgument(int argc, char *argv[], const char *argument) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], argument) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QString argumentValue(const QStringList &arguments, const QString &name) {
+    const int index = arguments.indexOf(name);
+    return index >= 0 && index + 1 < arguments.size() ? arguments.at(index + 1) : QString();
+}
+
+// No window: the session opens the configured ports and starts the clock,
+// then runs until SIGINT/SIGTERM
+int runHeadless(QCoreApplication &app) {
+    QElapsedTimer launch;
+    launch.start();
     
-    MidiMasterWindow window;
-    window.show();
+    MidiSessionConfig config;
+    QString configPath = qEnvironmentVariable("MIDIMASTER2_CONFIG");
+    if (app.arguments().contains("--config")) {
+        configPath = argumentValue(app.arguments(), "--config");
+    }
+    if (!configPath.isEmpty()) {
+        QString error;
+        if (!MidiSessionConfig::load(configPath, &config, &error)) {
+            qCritical() << "Cannot load config" << error;
+            return 1;
+        }
+    }
+    if (config.statsPath.isEmpty()) {
+        config.statsPath = qEnvironmentVariable("MIDIMASTER2_STATS_JSON");
+    }
+    if (app.arguments().contains("--stats-json")) {
+        config.statsPath = argumentValue(app.arguments(), "--stats-json");
+    }
+    // --replay <capture> [--replay-speed <factor>]: the capture's input
+    // instead of the input port
+    if (app.arguments().contains("--replay")) {
+        config.replayPath = argumentValue(app.arguments(), "--replay");
+        if (app.arguments().contains("--replay-speed")) {
+            config.replaySpeed = argumentValue(app.arguments(), "--replay-speed").toDouble();
+        }
+    }
     
-    window.showFullScreen();
+    MidiSession session;
+    QObject::connect(&session, &MidiSession::clockStarted, [&launch]() {
+        qDebug() << "Clock started" << launch.elapsed() << "ms after launch";
+    });
+    if (!session.initialize()) {
+        qCritical() << "Cannot initialize MIDI";
+        return 1;
+    }
+    session.applyConfig(config);
+    
+    // Signal handlers only set the flag; stopping (and sending MIDI Stop)
+    // happens here on the event loop
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+    QTimer quitPoll;
+    quitPoll.setInterval(50);
+    QObject::connect(&quitPoll, &QTimer::timeout, [&app, &session]() {
+        if (g_quitRequested.load()) {
+            if (session.controller()->isRunning()) {
+                session.controller()->stop(true);
+            }
+            app.quit();
+        }
+    });
+    quitPoll.start();
     
     return app.exec();
 }
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    // --headless: no display needed, so no QApplication either
+    const bool headless = hasArgument(argc, argv, "--headless");
+    std::unique_ptr<QCoreApplication> app(headless ? new QCoreApplication(argc, argv)
+                                                   : new QApplication(argc, argv));
+    
+    // Hot-path tracing is off unless asked for (--trace or MIDIMASTER2_TRACE=1)
+    bool traceRequested = app->arguments().contains("--trace") ||
+                          qEnvironmentVariableIntValue("MIDIMASTER2_TRACE") != 0;
+    if (MIDIMASTER2_TRACE && traceRequested) {
+        SyncTrace::setEnabled(true);
+        SyncTrace::startLogging();
+    }
+    
+    int result = 0;
+    if (headless) {
+        result = runHeadless(*app);
+    } else {
+        MidiMasterWindow window;
+        window.show();
+        
+        // Periodic instrumentation dump (--stats-json <path> or MIDIMASTER2_STATS_JSON=<path>)
+        QString statsPath = qEnvironmentVariable("MIDIMASTER2_STATS_JSON");
+        if (app->arguments().contains("--stats-json")) {
+            statsPath = argumentValue(app->arguments(), "--stats-json");
+        }
+        if (!statsPath.isEmpty()) {
+            window.startStatsExport(statsPath);
+        }
+        
+        window.showFullScreen();
+        
+        result = app->exec();
+    }
+    
+    SyncTrace::setEnabled(false);
+    SyncTrace::stopLogging();
+    
+    return result;
+}